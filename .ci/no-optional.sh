@@ -1,4 +1,4 @@
-sudo apt-get remove -y zlib1g-dev libssl-dev
+sudo apt-get remove -y zlib1g-dev libzstd-dev libssl-dev
 
 .ci/install-libuv.sh
 autoreconf -fi
@@ -0,0 +1,195 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "config.h"
+#include "bench/bench.h"
+#include <uv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+static void bench_usage(const char *program)
+{
+  fprintf(stderr, "Usage: %s [-r repeats] [-s scale] [-l latency ms] [filter]\n", program);
+}
+
+bool bench_parse_options(int argc, char *argv[], bench_options_st *options)
+{
+  int option;
+
+  options->repeats= 5;
+  options->scale= 1.0;
+  options->latency= 0;
+  options->filter= NULL;
+  while ((option= getopt(argc, argv, "r:s:l:h")) != -1)
+  {
+    switch (option)
+    {
+      case 'r':
+        options->repeats= (uint32_t)strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        options->scale= strtod(optarg, NULL);
+        break;
+      case 'l':
+        options->latency= (uint32_t)strtoul(optarg, NULL, 10);
+        break;
+      default:
+        bench_usage(argv[0]);
+        return false;
+    }
+  }
+  if ((options->repeats == 0) or (options->scale <= 0))
+  {
+    bench_usage(argv[0]);
+    return false;
+  }
+  if (optind < argc)
+  {
+    options->filter= argv[optind];
+  }
+  return true;
+}
+
+uint64_t bench_now(void)
+{
+  return uv_hrtime();
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+  uint64_t first= ((const bench_run_st*)a)->nanoseconds;
+  uint64_t second= ((const bench_run_st*)b)->nanoseconds;
+  return (first > second) - (first < second);
+}
+
+void bench_run(const bench_options_st *options, const char *suite, const char *name, uint64_t iterations, bench_fn *function, void *context)
+{
+  bench_run_st warm_up;
+  bench_run_st *runs;
+  uint64_t start;
+
+  if ((options->filter != NULL) and (strstr(name, options->filter) == NULL))
+  {
+    return;
+  }
+  iterations= (uint64_t)(iterations * options->scale);
+  if (iterations == 0)
+  {
+    iterations= 1;
+  }
+
+  memset(&warm_up, 0, sizeof(warm_up));
+  function(context, (iterations / 10) + 1, &warm_up);
+  runs= (bench_run_st*)calloc(options->repeats, sizeof(bench_run_st));
+  for (uint32_t repeat= 0; repeat < options->repeats; repeat++)
+  {
+    start= bench_now();
+    function(context, iterations, &runs[repeat]);
+    if (runs[repeat].nanoseconds == 0)
+    {
+      runs[repeat].nanoseconds= bench_now() - start;
+    }
+    if (warm_up.failed or runs[repeat].failed)
+    {
+      printf("{\"suite\":\"%s\",\"name\":\"%s\",\"failed\":true}\n", suite, name);
+      fflush(stdout);
+      free(runs);
+      return;
+    }
+  }
+
+  qsort(runs, options->repeats, sizeof(bench_run_st), bench_compare);
+  bench_run_st *median= &runs[options->repeats / 2];
+  double seconds= (double)median->nanoseconds / 1e9;
+  printf("{\"suite\":\"%s\",\"name\":\"%s\",\"iterations\":%" PRIu64 ",\"repeats\":%u", suite, name, iterations, options->repeats);
+  printf(",\"ns_per_op\":%.1f", (double)median->nanoseconds / iterations);
+  printf(",\"min_ns_per_op\":%.1f", (double)runs[0].nanoseconds / iterations);
+  printf(",\"ops_per_sec\":%.0f", iterations / seconds);
+  if (median->bytes > 0)
+  {
+    printf(",\"mb_per_sec\":%.1f", (median->bytes / seconds) / (1024 * 1024));
+  }
+  if (median->p99 > 0)
+  {
+    printf(",\"p50_us\":%" PRIu64 ",\"p99_us\":%" PRIu64, median->p50, median->p99);
+  }
+  if (median->ratio > 0)
+  {
+    printf(",\"ratio\":%.2f", median->ratio);
+  }
+  printf("}\n");
+  fflush(stdout);
+  free(runs);
+}
+
+void bench_fill(char *data, size_t length, const char *alphabet, uint32_t seed)
+{
+  size_t alphabet_length= strlen(alphabet);
+  uint32_t state= seed;
+
+  for (size_t pos= 0; pos < length; pos++)
+  {
+    state= (state * 1103515245) + 12345;
+    data[pos]= alphabet[(state >> 16) % alphabet_length];
+  }
+}
+
+int64_t bench_query(attachsql_connect_t *con, const char *query)
+{
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  int64_t rows= 0;
+
+  attachsql_query(con, strlen(query), query, 0, NULL, &error);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+    if (aret == ATTACHSQL_RETURN_ROW_READY)
+    {
+      attachsql_query_row_get(con, &error);
+      rows++;
+      attachsql_query_row_next(con);
+    }
+  }
+  attachsql_query_close(con);
+  if (error != NULL)
+  {
+    fprintf(stderr, "Query error %d: %s\n", attachsql_error_code(error), attachsql_error_message(error));
+    attachsql_error_free(error);
+    return -1;
+  }
+  return rows;
+}
+
+void bench_histogram_percentiles(const attachsql_histogram_st *before, const attachsql_histogram_st *after, bench_run_st *run)
+{
+  attachsql_histogram_st difference;
+
+  memset(&difference, 0, sizeof(difference));
+  difference.count= after->count - before->count;
+  difference.total= after->total - before->total;
+  difference.max= after->max;
+  for (size_t bucket= 0; bucket < ATTACHSQL_HISTOGRAM_BUCKETS; bucket++)
+  {
+    difference.buckets[bucket]= after->buckets[bucket] - before->buckets[bucket];
+  }
+  run->p50= attachsql_histogram_percentile(&difference, 50.0);
+  run->p99= attachsql_histogram_percentile(&difference, 99.0);
+}
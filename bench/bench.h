@@ -0,0 +1,71 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/* Benchmark harness shared by the micro and macro benchmarks.  Every
+ * benchmark is run once to warm up and then a number of times, the run with
+ * the median time per operation is reported as one JSON object per line on
+ * stdout. */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <libattachsql2/attachsql.h>
+
+struct bench_options_st
+{
+  /* Timed runs of each benchmark */
+  uint32_t repeats;
+  /* Multiplier for the iteration count of every benchmark */
+  double scale;
+  /* Latency in milliseconds added by the mock server */
+  uint32_t latency;
+  /* Only run benchmarks whose name contains this */
+  const char *filter;
+};
+
+struct bench_run_st
+{
+  uint64_t nanoseconds;
+  /* Bytes processed, for MB/s */
+  uint64_t bytes;
+  /* Latency percentiles in microseconds, 0 if not measured */
+  uint64_t p50;
+  uint64_t p99;
+  /* Compression ratio, 0 if not measured */
+  double ratio;
+  bool failed;
+};
+
+/* Runs iterations operations and fills in run, nanoseconds is set by the
+ * harness if the function leaves it as 0 */
+typedef void (bench_fn)(void *context, uint64_t iterations, bench_run_st *run);
+
+bool bench_parse_options(int argc, char *argv[], bench_options_st *options);
+
+void bench_run(const bench_options_st *options, const char *suite, const char *name, uint64_t iterations, bench_fn *function, void *context);
+
+uint64_t bench_now(void);
+
+/* Fills data with reproducible pseudo-random bytes from the given alphabet */
+void bench_fill(char *data, size_t length, const char *alphabet, uint32_t seed);
+
+/* Runs a query to completion, returns the number of rows or -1 on error */
+int64_t bench_query(attachsql_connect_t *con, const char *query);
+
+/* Latency percentiles of the difference between two histograms */
+void bench_histogram_percentiles(const attachsql_histogram_st *before, const attachsql_histogram_st *after, bench_run_st *run);
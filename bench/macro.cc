@@ -0,0 +1,307 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/* Macro benchmarks of whole query paths against the mock server */
+
+#include "config.h"
+#include "bench/bench.h"
+#include "tests/mock_server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_SCAN_ROWS 100000
+#define BENCH_SCAN_QUERY "MOCK ROWS 100000 4 32"
+
+static in_port_t port;
+
+static attachsql_connect_t *bench_connect(attachsql_compression_algorithm_t algorithm, bool compress)
+{
+  attachsql_connect_t *con= attachsql_connect_create("127.0.0.1", port, "test", "test", "", NULL);
+  if (compress)
+  {
+    if (not attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_ALGORITHM, &algorithm)
+        or not attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESS, NULL))
+    {
+      attachsql_connect_destroy(con);
+      return NULL;
+    }
+  }
+  /* Connects so that the handshake isn't part of the timed runs */
+  if (bench_query(con, "SELECT 1") != 1)
+  {
+    attachsql_connect_destroy(con);
+    return NULL;
+  }
+  return con;
+}
+
+static void bench_point_select(void *context, uint64_t iterations, bench_run_st *run)
+{
+  attachsql_connect_t *con= (attachsql_connect_t*)context;
+  attachsql_connect_stats_st before;
+  attachsql_connect_stats_st after;
+
+  attachsql_connect_get_stats(con, &before);
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    if (bench_query(con, "SELECT 1") != 1)
+    {
+      run->failed= true;
+      return;
+    }
+  }
+  attachsql_connect_get_stats(con, &after);
+  bench_histogram_percentiles(&before.query_time, &after.query_time, run);
+}
+
+static void bench_large_scan(void *context, uint64_t iterations, bench_run_st *run)
+{
+  attachsql_connect_t *con= (attachsql_connect_t*)context;
+  attachsql_connect_stats_st before;
+  attachsql_connect_stats_st after;
+
+  attachsql_connect_get_stats(con, &before);
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    if (bench_query(con, BENCH_SCAN_QUERY) != BENCH_SCAN_ROWS)
+    {
+      run->failed= true;
+      return;
+    }
+  }
+  attachsql_connect_get_stats(con, &after);
+  /* Throughput of the result data, not the compressed bytes */
+  if (after.uncompressed_bytes_in > before.uncompressed_bytes_in)
+  {
+    run->bytes= after.uncompressed_bytes_in - before.uncompressed_bytes_in;
+    run->ratio= (double)run->bytes / (after.compressed_bytes_in - before.compressed_bytes_in);
+  }
+  else
+  {
+    run->bytes= after.bytes_in - before.bytes_in;
+  }
+  bench_histogram_percentiles(&before.query_time, &after.query_time, run);
+}
+
+static void bench_statement_execute(void *context, uint64_t iterations, bench_run_st *run)
+{
+  attachsql_connect_t *con= (attachsql_connect_t*)context;
+  attachsql_error_t *error= NULL;
+  attachsql_connect_stats_st before;
+  attachsql_connect_stats_st after;
+
+  attachsql_connect_get_stats(con, &before);
+  for (uint64_t iteration= 0; (iteration < iterations) and (error == NULL); iteration++)
+  {
+    attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+    attachsql_statement_set_int(con, 0, (int32_t)iteration, &error);
+    attachsql_statement_execute(con, &error);
+    while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+    {
+      aret= attachsql_connect_poll(con, &error);
+      if (aret == ATTACHSQL_RETURN_ROW_READY)
+      {
+        attachsql_statement_row_get(con, &error);
+        attachsql_statement_get_int(con, 0, &error);
+        attachsql_statement_row_next(con);
+      }
+    }
+  }
+  if (error != NULL)
+  {
+    fprintf(stderr, "Statement error %d: %s\n", attachsql_error_code(error), attachsql_error_message(error));
+    attachsql_error_free(error);
+    run->failed= true;
+    return;
+  }
+  attachsql_connect_get_stats(con, &after);
+  bench_histogram_percentiles(&before.query_time, &after.query_time, run);
+}
+
+static void run_statement_execute(const bench_options_st *options)
+{
+  attachsql_connect_t *con= bench_connect(ATTACHSQL_COMPRESSION_ALGORITHM_ZLIB, false);
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  const char *query= "SELECT ?";
+
+  if (con == NULL)
+  {
+    return;
+  }
+  attachsql_statement_prepare(con, strlen(query), query, &error);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+  }
+  if (error == NULL)
+  {
+    bench_run(options, "macro", "statement_execute", 20000, bench_statement_execute, con);
+  }
+  else
+  {
+    attachsql_error_free(error);
+  }
+  attachsql_statement_close(con);
+  attachsql_connect_destroy(con);
+}
+
+/* Many connections in a pool each running point selects */
+struct pool_context_st
+{
+  attachsql_pool_t *pool;
+  attachsql_connect_t **cons;
+  uint32_t count;
+  uint64_t remaining;
+  uint64_t completed;
+  bool failed;
+};
+
+static void pool_callback(attachsql_connect_t *con, uint32_t connection_id, attachsql_events_t events, void *context, attachsql_error_t *error)
+{
+  (void) connection_id;
+  pool_context_st *fan_out= (pool_context_st*)context;
+
+  switch (events)
+  {
+    case ATTACHSQL_EVENT_ROW_READY:
+      attachsql_query_row_get(con, NULL);
+      attachsql_query_row_next(con);
+      break;
+    case ATTACHSQL_EVENT_EOF:
+      attachsql_query_close(con);
+      fan_out->completed++;
+      if (fan_out->remaining > 0)
+      {
+        fan_out->remaining--;
+        attachsql_query(con, 8, "SELECT 1", 0, NULL, NULL);
+      }
+      break;
+    case ATTACHSQL_EVENT_ERROR:
+      fprintf(stderr, "Pool error %d: %s\n", attachsql_error_code(error), attachsql_error_message(error));
+      attachsql_error_free(error);
+      fan_out->failed= true;
+      break;
+    case ATTACHSQL_EVENT_CONNECTED:
+    case ATTACHSQL_EVENT_WARM_UP_COMPLETE:
+    case ATTACHSQL_EVENT_NONE:
+      break;
+  }
+}
+
+static bool pool_queries(pool_context_st *fan_out, uint64_t queries)
+{
+  fan_out->completed= 0;
+  fan_out->remaining= queries - fan_out->count;
+  for (uint32_t con= 0; con < fan_out->count; con++)
+  {
+    attachsql_query(fan_out->cons[con], 8, "SELECT 1", 0, NULL, NULL);
+  }
+  while ((fan_out->completed < queries) and not fan_out->failed)
+  {
+    attachsql_pool_run(fan_out->pool);
+  }
+  return not fan_out->failed;
+}
+
+static void bench_pool_fan_out(void *context, uint64_t iterations, bench_run_st *run)
+{
+  pool_context_st *fan_out= (pool_context_st*)context;
+  attachsql_connect_stats_st before;
+  attachsql_connect_stats_st after;
+
+  if (iterations < fan_out->count)
+  {
+    iterations= fan_out->count;
+  }
+  attachsql_pool_get_stats(fan_out->pool, &before);
+  uint64_t start= bench_now();
+  run->failed= not pool_queries(fan_out, iterations);
+  run->nanoseconds= bench_now() - start;
+  attachsql_pool_get_stats(fan_out->pool, &after);
+  bench_histogram_percentiles(&before.query_time, &after.query_time, run);
+}
+
+static void run_pool_fan_out(const bench_options_st *options, uint32_t count)
+{
+  pool_context_st fan_out;
+  char name[32];
+
+  memset(&fan_out, 0, sizeof(fan_out));
+  fan_out.count= count;
+  fan_out.pool= attachsql_pool_create(pool_callback, &fan_out, NULL);
+  fan_out.cons= (attachsql_connect_t**)calloc(count, sizeof(attachsql_connect_t*));
+  for (uint32_t con= 0; con < count; con++)
+  {
+    fan_out.cons[con]= attachsql_connect_create("127.0.0.1", port, "test", "test", "", NULL);
+    attachsql_pool_add_connection(fan_out.pool, fan_out.cons[con], NULL);
+  }
+  /* Connects every connection before the timed runs */
+  if (pool_queries(&fan_out, count))
+  {
+    snprintf(name, sizeof(name), "pool_fan_out_%u", count);
+    bench_run(options, "macro", name, 20000, bench_pool_fan_out, &fan_out);
+  }
+  attachsql_pool_destroy(fan_out.pool);
+  free(fan_out.cons);
+}
+
+int main(int argc, char *argv[])
+{
+  bench_options_st options;
+  attachsql_connect_t *con;
+
+  if (not bench_parse_options(argc, argv, &options))
+  {
+    return EXIT_FAILURE;
+  }
+  mock_server_st *server= mock_server_start(0);
+  if (server == NULL)
+  {
+    fprintf(stderr, "Could not start the mock server\n");
+    return EXIT_FAILURE;
+  }
+  port= mock_server_port(server);
+  mock_server_set_latency(server, options.latency);
+
+  con= bench_connect(ATTACHSQL_COMPRESSION_ALGORITHM_ZLIB, false);
+  if (con != NULL)
+  {
+    bench_run(&options, "macro", "point_select", 20000, bench_point_select, con);
+    bench_run(&options, "macro", "large_scan", 5, bench_large_scan, con);
+    attachsql_connect_destroy(con);
+  }
+  run_statement_execute(&options);
+  con= bench_connect(ATTACHSQL_COMPRESSION_ALGORITHM_ZLIB, true);
+  if (con != NULL)
+  {
+    bench_run(&options, "macro", "large_scan_zlib", 5, bench_large_scan, con);
+    attachsql_connect_destroy(con);
+  }
+  con= bench_connect(ATTACHSQL_COMPRESSION_ALGORITHM_ZSTD, true);
+  if (con != NULL)
+  {
+    bench_run(&options, "macro", "large_scan_zstd", 5, bench_large_scan, con);
+    attachsql_connect_destroy(con);
+  }
+  run_pool_fan_out(&options, 8);
+  run_pool_fan_out(&options, 64);
+
+  mock_server_stop(server);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,398 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/* Micro benchmarks of the library internals, this program is built from the
+ * library sources so that it can call internal functions directly. */
+
+#include "config.h"
+#include "bench/bench.h"
+#include "tests/mock_server.h"
+#include "src/query_internal.h"
+#include "src/pack.h"
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_ESCAPE_SIZE 4096
+#define BENCH_PACKET_SIZE 16384
+#define BENCH_PACKETS 16
+#define BENCH_SCAN_QUERY "MOCK ROWS 10000 4 16"
+
+struct escape_context_st
+{
+  char data[BENCH_ESCAPE_SIZE];
+  char buffer[BENCH_ESCAPE_SIZE * 2];
+};
+
+static void bench_escape(void *context, uint64_t iterations, bench_run_st *run)
+{
+  escape_context_st *escape= (escape_context_st*)context;
+  size_t total= 0;
+
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    total+= attachsql_query_escape_data(escape->buffer, escape->data, BENCH_ESCAPE_SIZE);
+  }
+  run->bytes= iterations * BENCH_ESCAPE_SIZE;
+  run->failed= (total < run->bytes);
+}
+
+static void bench_int_to_str(void *context, uint64_t iterations, bench_run_st *run)
+{
+  (void) context;
+  char buffer[32];
+  uint64_t value= 1;
+  size_t total= 0;
+
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    total+= attachsql_query_uint_to_str(buffer, value);
+    /* Covers every length from 1 to 20 digits */
+    value= (value < UINT64_MAX / 10) ? value * 10 + (iteration & 7) : 1;
+  }
+  run->failed= (total == 0);
+}
+
+static void bench_length_encoding(void *context, uint64_t iterations, bench_run_st *run)
+{
+  (void) context;
+  char buffer[16];
+  const uint64_t values[]= {0, 250, 251, 65535, 65536, 16777215, 16777216, UINT64_MAX};
+  uint64_t total= 0;
+  uint8_t bytes;
+  attachsql_pack_status_t status;
+
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    attachsql_pack_length(buffer, values[iteration & 7]);
+    total+= attachsql_unpack_length(buffer, &bytes, &status);
+    total+= bytes;
+  }
+  run->failed= (total == 0);
+}
+
+/* Compression of 16KB packets of typical text result rows, the streams are
+ * reused between packets the same way the connection does */
+struct compress_context_st
+{
+  char packets[BENCH_PACKETS][BENCH_PACKET_SIZE];
+  char compressed[BENCH_PACKETS][BENCH_PACKET_SIZE * 2];
+  size_t compressed_length[BENCH_PACKETS];
+  char output[BENCH_PACKET_SIZE];
+  int level;
+  z_stream deflate_stream;
+  z_stream inflate_stream;
+#ifdef HAVE_ZSTD
+  ZSTD_CCtx *cctx;
+  ZSTD_DCtx *dctx;
+#endif
+};
+
+static void fill_packets(compress_context_st *compress)
+{
+  const char *first_names[]= {"Alice", "Bob", "Carol", "Dave", "Erin", "Frank", "Grace", "Heidi"};
+  const char *last_names[]= {"Smith", "Jones", "Taylor", "Brown", "Wilson", "Evans", "Thomas", "Johnson"};
+
+  for (uint32_t packet= 0; packet < BENCH_PACKETS; packet++)
+  {
+    char *data= compress->packets[packet];
+    size_t pos= 0;
+    uint32_t row= packet * 1000;
+    while (pos + 64 < BENCH_PACKET_SIZE)
+    {
+      int written= snprintf(data + pos, 64, "%c%010u", 10, row);
+      pos+= (size_t)written;
+      written= snprintf(data + pos, 64, "%c%s %s", 20, first_names[(row * 7) % 8], last_names[(row * 13) % 8]);
+      data[pos]= (char)(written - 1);
+      pos+= (size_t)written;
+      written= snprintf(data + pos, 64, "%c2014-%02u-%02u 12:%02u:00", 19, (row % 12) + 1, (row % 28) + 1, row % 60);
+      pos+= (size_t)written;
+      row++;
+    }
+    memset(data + pos, 0, BENCH_PACKET_SIZE - pos);
+  }
+}
+
+static void bench_zlib_compress(void *context, uint64_t iterations, bench_run_st *run)
+{
+  compress_context_st *compress= (compress_context_st*)context;
+  uint64_t compressed= 0;
+
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    uint32_t packet= iteration % BENCH_PACKETS;
+    deflateReset(&compress->deflate_stream);
+    compress->deflate_stream.next_in= (Bytef*)compress->packets[packet];
+    compress->deflate_stream.avail_in= BENCH_PACKET_SIZE;
+    compress->deflate_stream.next_out= (Bytef*)compress->compressed[packet];
+    compress->deflate_stream.avail_out= BENCH_PACKET_SIZE * 2;
+    if (deflate(&compress->deflate_stream, Z_FINISH) != Z_STREAM_END)
+    {
+      run->failed= true;
+      return;
+    }
+    compress->compressed_length[packet]= compress->deflate_stream.total_out;
+    compressed+= compress->deflate_stream.total_out;
+  }
+  run->bytes= iterations * BENCH_PACKET_SIZE;
+  run->ratio= (double)run->bytes / compressed;
+}
+
+static void bench_zlib_decompress(void *context, uint64_t iterations, bench_run_st *run)
+{
+  compress_context_st *compress= (compress_context_st*)context;
+
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    uint32_t packet= iteration % BENCH_PACKETS;
+    inflateReset(&compress->inflate_stream);
+    compress->inflate_stream.next_in= (Bytef*)compress->compressed[packet];
+    compress->inflate_stream.avail_in= (uInt)compress->compressed_length[packet];
+    compress->inflate_stream.next_out= (Bytef*)compress->output;
+    compress->inflate_stream.avail_out= BENCH_PACKET_SIZE;
+    if (inflate(&compress->inflate_stream, Z_FINISH) != Z_STREAM_END)
+    {
+      run->failed= true;
+      return;
+    }
+  }
+  run->bytes= iterations * BENCH_PACKET_SIZE;
+}
+
+#ifdef HAVE_ZSTD
+static void bench_zstd_compress(void *context, uint64_t iterations, bench_run_st *run)
+{
+  compress_context_st *compress= (compress_context_st*)context;
+  uint64_t compressed= 0;
+
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    uint32_t packet= iteration % BENCH_PACKETS;
+    ZSTD_outBuffer output= { compress->compressed[packet], BENCH_PACKET_SIZE * 2, 0 };
+    ZSTD_inBuffer input= { compress->packets[packet], BENCH_PACKET_SIZE, 0 };
+    ZSTD_CCtx_reset(compress->cctx, ZSTD_reset_session_only);
+    ZSTD_CCtx_setPledgedSrcSize(compress->cctx, BENCH_PACKET_SIZE);
+    if (ZSTD_compressStream2(compress->cctx, &output, &input, ZSTD_e_end) != 0)
+    {
+      run->failed= true;
+      return;
+    }
+    compress->compressed_length[packet]= output.pos;
+    compressed+= output.pos;
+  }
+  run->bytes= iterations * BENCH_PACKET_SIZE;
+  run->ratio= (double)run->bytes / compressed;
+}
+
+static void bench_zstd_decompress(void *context, uint64_t iterations, bench_run_st *run)
+{
+  compress_context_st *compress= (compress_context_st*)context;
+
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    uint32_t packet= iteration % BENCH_PACKETS;
+    size_t result= ZSTD_decompressDCtx(compress->dctx, compress->output, BENCH_PACKET_SIZE, compress->compressed[packet], compress->compressed_length[packet]);
+    if (result != BENCH_PACKET_SIZE)
+    {
+      run->failed= true;
+      return;
+    }
+  }
+  run->bytes= iterations * BENCH_PACKET_SIZE;
+}
+#endif
+
+static void run_compression(const bench_options_st *options)
+{
+  compress_context_st *compress= new (std::nothrow) compress_context_st;
+  const int zlib_levels[]= {1, 6};
+  char name[32];
+
+  if (compress == NULL)
+  {
+    return;
+  }
+  memset(compress, 0, sizeof(compress_context_st));
+  fill_packets(compress);
+  inflateInit(&compress->inflate_stream);
+  for (size_t level= 0; level < 2; level++)
+  {
+    deflateInit(&compress->deflate_stream, zlib_levels[level]);
+    snprintf(name, sizeof(name), "zlib_%d_compress", zlib_levels[level]);
+    bench_run(options, "micro", name, 2000, bench_zlib_compress, compress);
+    snprintf(name, sizeof(name), "zlib_%d_decompress", zlib_levels[level]);
+    bench_run(options, "micro", name, 5000, bench_zlib_decompress, compress);
+    deflateEnd(&compress->deflate_stream);
+  }
+  inflateEnd(&compress->inflate_stream);
+#ifdef HAVE_ZSTD
+  compress->cctx= ZSTD_createCCtx();
+  compress->dctx= ZSTD_createDCtx();
+  ZSTD_CCtx_setParameter(compress->cctx, ZSTD_c_compressionLevel, 3);
+  bench_run(options, "micro", "zstd_3_compress", 5000, bench_zstd_compress, compress);
+  bench_run(options, "micro", "zstd_3_decompress", 20000, bench_zstd_decompress, compress);
+  ZSTD_freeCCtx(compress->cctx);
+  ZSTD_freeDCtx(compress->dctx);
+#endif
+  delete compress;
+}
+
+/* Text row parsing without a network, a captured result set is replayed */
+struct replay_context_st
+{
+  char filename[64];
+};
+
+static void bench_row_parse(void *context, uint64_t iterations, bench_run_st *run)
+{
+  replay_context_st *replay= (replay_context_st*)context;
+  attachsql_connect_stats_st stats;
+
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    attachsql_connect_t *con= attachsql_connect_create("localhost", 1, "test", "test", "", NULL);
+    if (not attachsql_connect_set_replay(con, replay->filename, NULL) or (bench_query(con, BENCH_SCAN_QUERY) != 10000))
+    {
+      attachsql_connect_destroy(con);
+      run->failed= true;
+      return;
+    }
+    attachsql_connect_get_stats(con, &stats);
+    run->bytes+= stats.bytes_in;
+    attachsql_connect_destroy(con);
+  }
+}
+
+static bool capture_scan(in_port_t port, replay_context_st *replay)
+{
+  strcpy(replay->filename, "/tmp/attachsql_bench_XXXXXX");
+  int fd= mkstemp(replay->filename);
+  if (fd < 0)
+  {
+    return false;
+  }
+  close(fd);
+  attachsql_connect_t *con= attachsql_connect_create("127.0.0.1", port, "test", "test", "", NULL);
+  bool captured= attachsql_connect_set_capture(con, replay->filename, NULL) and (bench_query(con, BENCH_SCAN_QUERY) == 10000);
+  attachsql_connect_destroy(con);
+  return captured;
+}
+
+/* Binary protocol decoding of a prepared statement row */
+static void bench_binary_decode(void *context, uint64_t iterations, bench_run_st *run)
+{
+  attachsql_connect_t *con= (attachsql_connect_t*)context;
+  uint64_t total= 0;
+  size_t length;
+
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    attachsql_statement_row_get(con, NULL);
+    total+= (uint64_t)attachsql_statement_get_int(con, 0, NULL);
+    total+= (uint64_t)attachsql_statement_get_bigint(con, 1, NULL);
+    total+= (uint64_t)attachsql_statement_get_double(con, 2, NULL);
+    attachsql_statement_get_char(con, 3, &length, NULL);
+    total+= length;
+    attachsql_statement_get_char(con, 4, &length, NULL);
+    total+= length;
+  }
+  run->failed= (total == 0);
+}
+
+static void run_binary_decode(const bench_options_st *options, in_port_t port)
+{
+  attachsql_connect_t *con= attachsql_connect_create("127.0.0.1", port, "test", "test", "", NULL);
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  const char *query= "SELECT ?, ?, ?, ?, ?";
+  bool done= false;
+
+  attachsql_statement_prepare(con, strlen(query), query, &error);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+  }
+  attachsql_statement_set_int(con, 0, 123456, &error);
+  attachsql_statement_set_bigint(con, 1, (int64_t)1234567 * 1000000, &error);
+  attachsql_statement_set_double(con, 2, 3.14159, &error);
+  attachsql_statement_set_string(con, 3, 24, "a string column value xx", &error);
+  attachsql_statement_set_datetime(con, 4, 2014, 11, 30, 16, 30, 19, 0, &error);
+  attachsql_statement_execute(con, &error);
+  aret= ATTACHSQL_RETURN_NONE;
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+    if ((aret == ATTACHSQL_RETURN_ROW_READY) and not done)
+    {
+      bench_run(options, "micro", "binary_decode", 2000000, bench_binary_decode, con);
+      done= true;
+      attachsql_statement_row_next(con);
+    }
+  }
+  if (error != NULL)
+  {
+    fprintf(stderr, "Statement error %d: %s\n", attachsql_error_code(error), attachsql_error_message(error));
+    attachsql_error_free(error);
+  }
+  attachsql_statement_close(con);
+  attachsql_connect_destroy(con);
+}
+
+int main(int argc, char *argv[])
+{
+  bench_options_st options;
+  escape_context_st escape;
+  replay_context_st replay;
+
+  if (not bench_parse_options(argc, argv, &options))
+  {
+    return EXIT_FAILURE;
+  }
+
+  bench_fill(escape.data, BENCH_ESCAPE_SIZE, "abcdefghijklmnopqrstuvwxyz0123456789 ", 1);
+  bench_run(&options, "micro", "escape_clean", 200000, bench_escape, &escape);
+  bench_fill(escape.data, BENCH_ESCAPE_SIZE, "abcdefghijklmnopqrstuvwxyz0123456789 '\"\\\n", 1);
+  bench_run(&options, "micro", "escape_mixed", 50000, bench_escape, &escape);
+  bench_run(&options, "micro", "int_to_str", 20000000, bench_int_to_str, NULL);
+  bench_run(&options, "micro", "length_encoding", 20000000, bench_length_encoding, NULL);
+  run_compression(&options);
+
+  mock_server_st *server= mock_server_start(0);
+  if (server == NULL)
+  {
+    fprintf(stderr, "Could not start the mock server\n");
+    return EXIT_FAILURE;
+  }
+  if (capture_scan(mock_server_port(server), &replay))
+  {
+    bench_run(&options, "micro", "row_parse", 50, bench_row_parse, &replay);
+  }
+  else
+  {
+    fprintf(stderr, "Could not capture a result set for row parsing\n");
+  }
+  unlink(replay.filename);
+  run_binary_decode(&options, mock_server_port(server));
+  mock_server_stop(server);
+  return EXIT_SUCCESS;
+}
@@ -52,6 +52,7 @@ static void callbk(attachsql_connect_t *current_con, uint32_t connection_id, att
       attachsql_query_row_next(current_con);
       printf("\n");
       break;
+    case ATTACHSQL_EVENT_WARM_UP_COMPLETE:
     case ATTACHSQL_EVENT_NONE:
       break;
   }
@@ -0,0 +1,826 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/* Fuzz and throughput harness for the packet parser.  An input is one byte
+ * choosing a scenario followed by the bytes the server sends.  The bytes are
+ * played back through a connection as an in-memory capture, so the whole
+ * read path runs without a network.
+ *
+ * Built with -DASQL_LIBFUZZER and -fsanitize=fuzzer this is a libFuzzer
+ * target.  Otherwise it is a driver which runs:
+ *
+ *   packet_parser [file...]      each file as an input, stdin without files
+ *                                (for AFL and reproducing crashes)
+ *   packet_parser -c dir         writes a seed corpus generated with the
+ *                                mock server to dir
+ *   packet_parser -f count [-S seed]
+ *                                mutates the seed corpus count times, the
+ *                                input of a crash is written to
+ *                                packet_parser-crash.bin
+ *   packet_parser -t [-r repeats] [-s scale] [filter]
+ *                                parse throughput of generated valid
+ *                                streams, as JSON lines like the benchmarks
+ */
+
+#include "config.h"
+#include "src/capture.h"
+#include "bench/bench.h"
+#include "tests/mock_server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FUZZ_MAGIC "ASQLCAP1"
+#define FUZZ_MAGIC_SIZE 8
+#define FUZZ_RECORD_READ 1
+#define FUZZ_RECORD_WRITE 2
+#define FUZZ_MAX_POLLS 1000000
+#define FUZZ_MAX_INPUT (1024 * 1024)
+
+enum fuzz_scenario_t
+{
+  /* The input is the whole stream including the handshake */
+  FUZZ_SCENARIO_HANDSHAKE,
+  /* The input is the response to a query */
+  FUZZ_SCENARIO_QUERY,
+  FUZZ_SCENARIO_QUERY_BUFFERED,
+  FUZZ_SCENARIO_MULTI_QUERY,
+  /* The input is the response to a prepare and then an execute */
+  FUZZ_SCENARIO_STATEMENT,
+  FUZZ_SCENARIO_COUNT
+};
+
+struct fuzz_buffer_st
+{
+  char *data;
+  size_t length;
+  size_t size;
+};
+
+/* Keeps the reads of row data from being optimized away */
+static volatile uint64_t fuzz_checksum;
+
+static void fuzz_append(fuzz_buffer_st *buffer, const void *data, size_t length)
+{
+  if (buffer->length + length > buffer->size)
+  {
+    size_t new_size= (buffer->size > 0) ? buffer->size : 1024;
+    while (new_size < buffer->length + length)
+    {
+      new_size*= 2;
+    }
+    char *new_data= (char*)realloc(buffer->data, new_size);
+    if (new_data == NULL)
+    {
+      abort();
+    }
+    buffer->data= new_data;
+    buffer->size= new_size;
+  }
+  if (length > 0)
+  {
+    memcpy(buffer->data + buffer->length, data, length);
+  }
+  buffer->length+= length;
+}
+
+static void fuzz_append_varint(fuzz_buffer_st *buffer, uint64_t value)
+{
+  unsigned char byte;
+
+  while (value >= 0x80)
+  {
+    byte= (unsigned char)(value | 0x80);
+    fuzz_append(buffer, &byte, 1);
+    value>>= 7;
+  }
+  byte= (unsigned char)value;
+  fuzz_append(buffer, &byte, 1);
+}
+
+static void fuzz_record(fuzz_buffer_st *capture, uint8_t type, const void *data, size_t length)
+{
+  fuzz_append(capture, &type, 1);
+  fuzz_append_varint(capture, 0);
+  fuzz_append_varint(capture, length);
+  fuzz_append(capture, data, length);
+}
+
+/* A server greeting for 5.5 without compression or SSL, then the OK for
+ * the login */
+static void fuzz_login(fuzz_buffer_st *capture)
+{
+  static const char greeting[]=
+    "\x4e\x00\x00\x00"
+    "\x0a" "5.5.0-fuzz\0"
+    "\x01\x00\x00\x00" "abcdefgh\0"
+    "\x0f\xa2" "\x21" "\x02\x00" "\x0b\x00"
+    "\x15" "\0\0\0\0\0\0\0\0\0\0"
+    "ijklmnopqrst\0"
+    "mysql_native_password";
+  static const char ok[]= "\x07\x00\x00\x02\x00\x00\x00\x02\x00\x00\x00";
+
+  /* The strings above include their terminating NUL */
+  fuzz_record(capture, FUZZ_RECORD_READ, greeting, sizeof(greeting));
+  fuzz_record(capture, FUZZ_RECORD_WRITE, NULL, 0);
+  fuzz_record(capture, FUZZ_RECORD_READ, ok, sizeof(ok) - 1);
+}
+
+/* The input being run when a mutation crashes */
+static const fuzz_buffer_st *fuzz_current;
+
+static void fuzz_write_crash(void)
+{
+  if (fuzz_current == NULL)
+  {
+    return;
+  }
+  int fd= open("packet_parser-crash.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0)
+  {
+    if (write(fd, fuzz_current->data, fuzz_current->length) < 0)
+    {
+      /* Nothing more can be done while crashing */
+    }
+    close(fd);
+  }
+}
+
+/* No valid stream needs FUZZ_MAX_POLLS polls so the parser is stuck */
+static void fuzz_stalled(void)
+{
+  fprintf(stderr, "Parser stalled\n");
+  fuzz_write_crash();
+  abort();
+}
+
+static void fuzz_touch_row(attachsql_query_row_st *row, uint16_t columns)
+{
+  uint64_t checksum= 0;
+
+  if (row == NULL)
+  {
+    return;
+  }
+  for (uint16_t column= 0; column < columns; column++)
+  {
+    checksum+= row[column].length;
+    if ((row[column].data != NULL) and (row[column].length > 0))
+    {
+      checksum+= (unsigned char)row[column].data[0] + (unsigned char)row[column].data[row[column].length - 1];
+    }
+  }
+  fuzz_checksum+= checksum;
+}
+
+/* Polls until the end of a result, counts rows and reads every column of
+ * them.  Returns false on an error. */
+static bool fuzz_query_result(attachsql_connect_t *con, bool buffered, uint64_t *rows)
+{
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  uint32_t polls= 0;
+
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    if (++polls > FUZZ_MAX_POLLS)
+    {
+      fuzz_stalled();
+    }
+    aret= attachsql_connect_poll(con, &error);
+    if ((aret == ATTACHSQL_RETURN_ROW_READY) and not buffered)
+    {
+      uint16_t columns= attachsql_query_column_count(con);
+      /* Column numbers start at 1 */
+      for (uint16_t column= 1; column <= columns; column++)
+      {
+        attachsql_query_column_st *meta= attachsql_query_column_get(con, column);
+        if (meta != NULL)
+        {
+          fuzz_checksum+= strlen(meta->column) + meta->length + meta->default_size;
+        }
+      }
+      fuzz_touch_row(attachsql_query_row_get(con, &error), columns);
+      (*rows)++;
+      attachsql_query_row_next(con);
+    }
+  }
+  if ((error == NULL) and buffered)
+  {
+    uint16_t columns= attachsql_query_column_count(con);
+    attachsql_query_row_st *row;
+    while ((row= attachsql_query_buffer_row_get(con)) != NULL)
+    {
+      fuzz_touch_row(row, columns);
+      (*rows)++;
+    }
+  }
+  attachsql_query_close(con);
+  if (error != NULL)
+  {
+    attachsql_error_free(error);
+    return false;
+  }
+  return true;
+}
+
+static bool fuzz_statement(attachsql_connect_t *con, uint64_t *rows)
+{
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  const char *query= "SELECT ?";
+  uint32_t polls= 0;
+
+  attachsql_statement_prepare(con, strlen(query), query, &error);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    if (++polls > FUZZ_MAX_POLLS)
+    {
+      fuzz_stalled();
+    }
+    aret= attachsql_connect_poll(con, &error);
+  }
+  if (error == NULL)
+  {
+    for (uint16_t param= 0; param < attachsql_statement_get_param_count(con); param++)
+    {
+      attachsql_statement_set_int(con, param, 1, NULL);
+    }
+    attachsql_statement_execute(con, &error);
+  }
+  aret= ATTACHSQL_RETURN_NONE;
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    if (++polls > FUZZ_MAX_POLLS)
+    {
+      fuzz_stalled();
+    }
+    aret= attachsql_connect_poll(con, &error);
+    if (aret == ATTACHSQL_RETURN_ROW_READY)
+    {
+      if (attachsql_statement_row_get(con, &error))
+      {
+        uint16_t columns= attachsql_statement_get_column_count(con);
+        for (uint16_t column= 0; column < columns; column++)
+        {
+          size_t length= 0;
+          attachsql_statement_get_char(con, column, &length, NULL);
+          fuzz_checksum+= length + attachsql_statement_get_column_type(con, column);
+        }
+      }
+      (*rows)++;
+      attachsql_statement_row_next(con);
+    }
+  }
+  attachsql_statement_close(con);
+  if (error != NULL)
+  {
+    attachsql_error_free(error);
+    return false;
+  }
+  return true;
+}
+
+/* Runs one input, returns the number of rows read */
+static uint64_t fuzz_one(const uint8_t *data, size_t size)
+{
+  fuzz_buffer_st capture= {NULL, 0, 0};
+  uint64_t rows= 0;
+
+  if (size == 0)
+  {
+    return 0;
+  }
+  fuzz_scenario_t scenario= (fuzz_scenario_t)(data[0] % FUZZ_SCENARIO_COUNT);
+  fuzz_append(&capture, FUZZ_MAGIC, FUZZ_MAGIC_SIZE);
+  if (scenario != FUZZ_SCENARIO_HANDSHAKE)
+  {
+    fuzz_login(&capture);
+    fuzz_record(&capture, FUZZ_RECORD_WRITE, NULL, 0);
+  }
+  fuzz_record(&capture, FUZZ_RECORD_READ, data + 1, size - 1);
+
+  attachsql_connect_t *con= attachsql_connect_create("localhost", 1, "fuzz", "fuzz", "", NULL);
+  if (scenario == FUZZ_SCENARIO_MULTI_QUERY)
+  {
+    attachsql_connect_set_option(con, ATTACHSQL_OPTION_MULTI_STATEMENTS, NULL);
+  }
+  if (not attachsql_replay_load(con, capture.data, capture.length, NULL))
+  {
+    attachsql_connect_destroy(con);
+    return 0;
+  }
+
+  if (scenario == FUZZ_SCENARIO_STATEMENT)
+  {
+    fuzz_statement(con, &rows);
+  }
+  else
+  {
+    bool buffered= (scenario == FUZZ_SCENARIO_QUERY_BUFFERED);
+    if (buffered)
+    {
+      attachsql_query_buffer_rows(con, true);
+    }
+    attachsql_query(con, 8, "SELECT 1", 0, NULL, NULL);
+    if (fuzz_query_result(con, buffered, &rows) and (scenario == FUZZ_SCENARIO_MULTI_QUERY))
+    {
+      uint32_t results= 0;
+      while ((attachsql_query_next_result(con) == ATTACHSQL_RETURN_PROCESSING) and (++results < FUZZ_MAX_POLLS))
+      {
+        if (not fuzz_query_result(con, false, &rows))
+        {
+          break;
+        }
+      }
+    }
+  }
+  attachsql_connect_destroy(con);
+  return rows;
+}
+
+#ifdef ASQL_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  fuzz_one(data, size);
+  return 0;
+}
+
+#else
+
+/* Seed corpus */
+
+struct fuzz_seed_st
+{
+  fuzz_scenario_t scenario;
+  const char *query;
+};
+
+static const fuzz_seed_st fuzz_seeds[]=
+{
+  { FUZZ_SCENARIO_HANDSHAKE, "MOCK ROWS 2 2 4" },
+  { FUZZ_SCENARIO_QUERY, "MOCK ROWS 3 3 8" },
+  { FUZZ_SCENARIO_QUERY, "MOCK ROWS 1 1 300" },
+  { FUZZ_SCENARIO_QUERY, "MOCK ERROR 1146" },
+  { FUZZ_SCENARIO_QUERY, "MOCK OK 3 7" },
+  { FUZZ_SCENARIO_QUERY_BUFFERED, "MOCK ROWS 4 2 4" },
+  { FUZZ_SCENARIO_MULTI_QUERY, "SELECT 1; MOCK ROWS 2 2 2; MOCK OK 1 1" },
+  { FUZZ_SCENARIO_STATEMENT, "SELECT ?" },
+  { FUZZ_SCENARIO_STATEMENT, "SELECT ?, ?" }
+};
+
+#define FUZZ_SEED_COUNT (sizeof(fuzz_seeds) / sizeof(fuzz_seed_st))
+
+/* Runs the seed's commands against the mock server with a capture and
+ * returns the server's side of it as an input */
+static bool fuzz_capture(in_port_t port, fuzz_scenario_t scenario, const char *query, fuzz_buffer_st *input)
+{
+  char filename[]= "/tmp/attachsql_fuzz_XXXXXX";
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  int fd= mkstemp(filename);
+
+  if (fd < 0)
+  {
+    return false;
+  }
+  close(fd);
+  attachsql_connect_t *con= attachsql_connect_create("127.0.0.1", port, "test", "test", "", NULL);
+  attachsql_connect_set_option(con, ATTACHSQL_OPTION_MULTI_STATEMENTS, NULL);
+  attachsql_connect_set_capture(con, filename, NULL);
+  if (scenario == FUZZ_SCENARIO_STATEMENT)
+  {
+    attachsql_statement_prepare(con, strlen(query), query, &error);
+    while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+    {
+      aret= attachsql_connect_poll(con, &error);
+    }
+    for (uint16_t param= 0; param < attachsql_statement_get_param_count(con); param++)
+    {
+      attachsql_statement_set_int(con, param, (int32_t)param + 1, NULL);
+    }
+    attachsql_statement_execute(con, &error);
+    aret= ATTACHSQL_RETURN_NONE;
+    while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+    {
+      aret= attachsql_connect_poll(con, &error);
+      if (aret == ATTACHSQL_RETURN_ROW_READY)
+      {
+        attachsql_statement_row_next(con);
+      }
+    }
+    attachsql_statement_close(con);
+  }
+  else
+  {
+    uint64_t rows= 0;
+    attachsql_query(con, strlen(query), query, 0, NULL, NULL);
+    if (fuzz_query_result(con, false, &rows))
+    {
+      while (attachsql_query_next_result(con) == ATTACHSQL_RETURN_PROCESSING)
+      {
+        fuzz_query_result(con, false, &rows);
+      }
+    }
+  }
+  if (error != NULL)
+  {
+    attachsql_error_free(error);
+  }
+  attachsql_connect_destroy(con);
+
+  /* The reads after the login and first command, or all of them for the
+   * handshake scenario */
+  FILE *file= fopen(filename, "rb");
+  unlink(filename);
+  if (file == NULL)
+  {
+    return false;
+  }
+  fuzz_buffer_st data= {NULL, 0, 0};
+  char chunk[4096];
+  size_t length;
+  while ((length= fread(chunk, 1, sizeof(chunk), file)) > 0)
+  {
+    fuzz_append(&data, chunk, length);
+  }
+  fclose(file);
+
+  uint8_t selector= (uint8_t)scenario;
+  uint32_t writes= 0;
+  size_t position= FUZZ_MAGIC_SIZE;
+  fuzz_append(input, &selector, 1);
+  while (position < data.length)
+  {
+    uint8_t type= (uint8_t)data.data[position++];
+    uint64_t values[2]= {0, 0};
+    for (uint8_t value= 0; value < 2; value++)
+    {
+      uint32_t shift= 0;
+      while ((position < data.length) and (data.data[position] & 0x80))
+      {
+        values[value]|= (uint64_t)(data.data[position++] & 0x7f) << shift;
+        shift+= 7;
+      }
+      if (position < data.length)
+      {
+        values[value]|= (uint64_t)data.data[position++] << shift;
+      }
+    }
+    if (position + values[1] > data.length)
+    {
+      break;
+    }
+    if (type == FUZZ_RECORD_WRITE)
+    {
+      writes++;
+    }
+    else if ((scenario == FUZZ_SCENARIO_HANDSHAKE) or (writes >= 2))
+    {
+      fuzz_append(input, data.data + position, (size_t)values[1]);
+    }
+    position+= (size_t)values[1];
+  }
+  free(data.data);
+  return (input->length > 1);
+}
+
+static uint32_t fuzz_random(uint64_t *state)
+{
+  /* xorshift64, the state must not be 0 */
+  *state^= *state << 13;
+  *state^= *state >> 7;
+  *state^= *state << 17;
+  return (uint32_t)(*state >> 32);
+}
+
+/* Values which are boundaries for length encoded integers, markers and
+ * column types */
+static const uint8_t fuzz_interesting[]= { 0x00, 0x01, 0x7f, 0x80, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+
+static void fuzz_mutate(fuzz_buffer_st *input, uint64_t *state)
+{
+  uint32_t mutations= 1 + (fuzz_random(state) % 4);
+
+  for (uint32_t mutation= 0; (mutation < mutations) and (input->length > 1); mutation++)
+  {
+    size_t position= 1 + (fuzz_random(state) % (input->length - 1));
+    switch (fuzz_random(state) % 5)
+    {
+      case 0:
+        input->data[position]^= (char)(1 << (fuzz_random(state) % 8));
+        break;
+      case 1:
+        input->data[position]= (char)fuzz_interesting[fuzz_random(state) % sizeof(fuzz_interesting)];
+        break;
+      case 2:
+        input->data[position]= (char)fuzz_random(state);
+        break;
+      case 3:
+        input->length= position;
+        break;
+      case 4:
+      {
+        /* Duplicates a chunk, which repeats packets */
+        size_t length= 1 + (fuzz_random(state) % 64);
+        if (position + length > input->length)
+        {
+          length= input->length - position;
+        }
+        if (input->length + length <= FUZZ_MAX_INPUT)
+        {
+          char *chunk= (char*)malloc(length);
+          memcpy(chunk, input->data + position, length);
+          fuzz_append(input, chunk, length);
+          memmove(input->data + position + length, input->data + position, input->length - position - length);
+          memcpy(input->data + position, chunk, length);
+          free(chunk);
+        }
+        break;
+      }
+    }
+  }
+}
+
+#ifdef __SANITIZE_ADDRESS__
+extern "C" void __sanitizer_set_death_callback(void (*callback)(void));
+#else
+static void fuzz_signal(int signal_number)
+{
+  fuzz_write_crash();
+  signal(signal_number, SIG_DFL);
+  raise(signal_number);
+}
+#endif
+
+static size_t fuzz_generate_seeds(fuzz_buffer_st *seeds)
+{
+  mock_server_st *server= mock_server_start(0);
+  size_t count= 0;
+
+  if (server == NULL)
+  {
+    fprintf(stderr, "Could not start the mock server\n");
+    return 0;
+  }
+  for (size_t seed= 0; seed < FUZZ_SEED_COUNT; seed++)
+  {
+    memset(&seeds[count], 0, sizeof(fuzz_buffer_st));
+    if (fuzz_capture(mock_server_port(server), fuzz_seeds[seed].scenario, fuzz_seeds[seed].query, &seeds[count]))
+    {
+      count++;
+    }
+    else
+    {
+      free(seeds[count].data);
+    }
+  }
+  mock_server_stop(server);
+  return count;
+}
+
+static int fuzz_write_corpus(const char *directory)
+{
+  fuzz_buffer_st seeds[FUZZ_SEED_COUNT];
+  size_t count= fuzz_generate_seeds(seeds);
+  char filename[4096];
+
+  for (size_t seed= 0; seed < count; seed++)
+  {
+    snprintf(filename, sizeof(filename), "%s/seed-%02zu", directory, seed);
+    FILE *file= fopen(filename, "wb");
+    if (file == NULL)
+    {
+      fprintf(stderr, "Could not write %s: %s\n", filename, strerror(errno));
+      return EXIT_FAILURE;
+    }
+    fwrite(seeds[seed].data, 1, seeds[seed].length, file);
+    fclose(file);
+    free(seeds[seed].data);
+  }
+  return (count == FUZZ_SEED_COUNT) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int fuzz_mutations(uint64_t iterations, uint64_t seed)
+{
+  fuzz_buffer_st seeds[FUZZ_SEED_COUNT];
+  fuzz_buffer_st input= {NULL, 0, 0};
+  size_t count= fuzz_generate_seeds(seeds);
+  uint64_t state= (seed > 0) ? seed : 1;
+
+  if (count == 0)
+  {
+    return EXIT_FAILURE;
+  }
+#ifdef __SANITIZE_ADDRESS__
+  /* AddressSanitizer handles the signals itself */
+  __sanitizer_set_death_callback(fuzz_write_crash);
+#else
+  signal(SIGSEGV, fuzz_signal);
+  signal(SIGBUS, fuzz_signal);
+  signal(SIGABRT, fuzz_signal);
+#endif
+  fuzz_current= &input;
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    fuzz_buffer_st *base= &seeds[fuzz_random(&state) % count];
+    input.length= 0;
+    fuzz_append(&input, base->data, base->length);
+    fuzz_mutate(&input, &state);
+    fuzz_one((const uint8_t*)input.data, input.length);
+    if (((iteration + 1) % 10000) == 0)
+    {
+      fprintf(stderr, "%" PRIu64 " inputs\n", iteration + 1);
+    }
+  }
+  fuzz_current= NULL;
+  for (size_t seed_number= 0; seed_number < count; seed_number++)
+  {
+    free(seeds[seed_number].data);
+  }
+  free(input.data);
+  return EXIT_SUCCESS;
+}
+
+static int fuzz_file(FILE *file)
+{
+  fuzz_buffer_st input= {NULL, 0, 0};
+  char chunk[4096];
+  size_t length;
+
+  while ((length= fread(chunk, 1, sizeof(chunk), file)) > 0)
+  {
+    fuzz_append(&input, chunk, length);
+  }
+  fuzz_one((const uint8_t*)input.data, input.length);
+  free(input.data);
+  return EXIT_SUCCESS;
+}
+
+/* Throughput of generated valid streams */
+
+struct fuzz_throughput_st
+{
+  fuzz_buffer_st input;
+  uint64_t rows;
+};
+
+static void fuzz_throughput(void *context, uint64_t iterations, bench_run_st *run)
+{
+  fuzz_throughput_st *throughput= (fuzz_throughput_st*)context;
+
+  for (uint64_t iteration= 0; iteration < iterations; iteration++)
+  {
+    if (fuzz_one((const uint8_t*)throughput->input.data, throughput->input.length) != throughput->rows)
+    {
+      run->failed= true;
+      return;
+    }
+  }
+  run->bytes= iterations * (throughput->input.length - 1);
+}
+
+static int fuzz_throughput_run(const bench_options_st *options)
+{
+  const struct
+  {
+    const char *name;
+    fuzz_scenario_t scenario;
+    const char *query;
+    uint64_t rows;
+    uint64_t iterations;
+  } streams[]=
+  {
+    { "parse_narrow_rows", FUZZ_SCENARIO_QUERY, "MOCK ROWS 20000 2 4", 20000, 100 },
+    { "parse_wide_rows", FUZZ_SCENARIO_QUERY, "MOCK ROWS 2000 16 64", 2000, 100 },
+    { "parse_large_values", FUZZ_SCENARIO_QUERY, "MOCK ROWS 200 4 60000", 200, 20 },
+    { "parse_buffered_rows", FUZZ_SCENARIO_QUERY_BUFFERED, "MOCK ROWS 20000 2 4", 20000, 100 },
+    { "parse_statement", FUZZ_SCENARIO_STATEMENT, "SELECT ?, ?, ?, ?", 1, 20000 }
+  };
+  mock_server_st *server= mock_server_start(0);
+
+  if (server == NULL)
+  {
+    fprintf(stderr, "Could not start the mock server\n");
+    return EXIT_FAILURE;
+  }
+  for (size_t stream= 0; stream < sizeof(streams) / sizeof(streams[0]); stream++)
+  {
+    fuzz_throughput_st throughput;
+    memset(&throughput, 0, sizeof(throughput));
+    throughput.rows= streams[stream].rows;
+    if (fuzz_capture(mock_server_port(server), streams[stream].scenario, streams[stream].query, &throughput.input))
+    {
+      bench_run(options, "parser", streams[stream].name, streams[stream].iterations, fuzz_throughput, &throughput);
+    }
+    free(throughput.input.data);
+  }
+  mock_server_stop(server);
+  return EXIT_SUCCESS;
+}
+
+static void fuzz_usage(const char *program)
+{
+  fprintf(stderr, "Usage: %s [file...]\n", program);
+  fprintf(stderr, "       %s -c directory\n", program);
+  fprintf(stderr, "       %s -f count [-S seed]\n", program);
+  fprintf(stderr, "       %s -t [-r repeats] [-s scale] [filter]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+  bench_options_st options;
+  const char *corpus= NULL;
+  uint64_t mutations= 0;
+  uint64_t seed= 1;
+  bool throughput= false;
+  int option;
+
+  options.repeats= 5;
+  options.scale= 1.0;
+  options.latency= 0;
+  options.filter= NULL;
+  while ((option= getopt(argc, argv, "c:f:S:tr:s:h")) != -1)
+  {
+    switch (option)
+    {
+      case 'c':
+        corpus= optarg;
+        break;
+      case 'f':
+        mutations= strtoull(optarg, NULL, 10);
+        break;
+      case 'S':
+        seed= strtoull(optarg, NULL, 10);
+        break;
+      case 't':
+        throughput= true;
+        break;
+      case 'r':
+        options.repeats= (uint32_t)strtoul(optarg, NULL, 10);
+        break;
+      case 's':
+        options.scale= strtod(optarg, NULL);
+        break;
+      default:
+        fuzz_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (corpus != NULL)
+  {
+    return fuzz_write_corpus(corpus);
+  }
+  if (mutations > 0)
+  {
+    return fuzz_mutations(mutations, seed);
+  }
+  if (throughput)
+  {
+    if ((options.repeats == 0) or (options.scale <= 0))
+    {
+      fuzz_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    options.filter= (optind < argc) ? argv[optind] : NULL;
+    return fuzz_throughput_run(&options);
+  }
+  if (optind == argc)
+  {
+    return fuzz_file(stdin);
+  }
+  for (int file_number= optind; file_number < argc; file_number++)
+  {
+    FILE *file= fopen(argv[file_number], "rb");
+    if (file == NULL)
+    {
+      fprintf(stderr, "Could not open %s: %s\n", argv[file_number], strerror(errno));
+      return EXIT_FAILURE;
+    }
+    fuzz_file(file);
+    fclose(file);
+  }
+  return EXIT_SUCCESS;
+}
+
+#endif
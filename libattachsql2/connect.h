@@ -33,6 +33,33 @@ const char *attachsql_connect_get_server_version(attachsql_connect_t *con);
 ASQL_API
 uint32_t attachsql_connect_get_connection_id(attachsql_connect_t *con);
 
+ASQL_API
+size_t attachsql_connect_get_buffer_size(attachsql_connect_t *con);
+
+ASQL_API
+void attachsql_connect_get_stats(attachsql_connect_t *con, attachsql_connect_stats_st *stats);
+
+ASQL_API
+bool attachsql_connect_set_trace_callback(attachsql_connect_t *con, attachsql_trace_fn *function, void *context);
+
+ASQL_API
+bool attachsql_connect_set_log_level(attachsql_connect_t *con, attachsql_log_level_t level);
+
+ASQL_API
+bool attachsql_connect_set_log_sampling(attachsql_connect_t *con, uint32_t packet_rate, uint16_t packet_bytes);
+
+ASQL_API
+bool attachsql_connect_set_log_callback(attachsql_connect_t *con, attachsql_log_fn *function, void *context);
+
+ASQL_API
+size_t attachsql_connect_get_log(attachsql_connect_t *con, char *buffer, size_t length);
+
+ASQL_API
+bool attachsql_connect_set_capture(attachsql_connect_t *con, const char *filename, attachsql_error_t **error);
+
+ASQL_API
+bool attachsql_connect_set_replay(attachsql_connect_t *con, const char *filename, attachsql_error_t **error);
+
 ASQL_API
 attachsql_return_t attachsql_connect_poll(attachsql_connect_t *con, attachsql_error_t **error);
 
@@ -42,9 +69,27 @@ bool attachsql_connect(attachsql_connect_t *con, attachsql_error_t **error);
 ASQL_API
 bool attachsql_connect_set_option(attachsql_connect_t *con, attachsql_options_t option, const void *arg);
 
+ASQL_API
+bool attachsql_connect_set_address(attachsql_connect_t *con, const struct sockaddr *address, attachsql_error_t **error);
+
 ASQL_API
 bool attachsql_connect_set_ssl(attachsql_connect_t *con, const char *key, const char *cert, const char *ca, const char *capath, const char *cipher, bool verify, attachsql_error_t **error);
 
+ASQL_API
+attachsql_ssl_context_t *attachsql_ssl_context_create(const char *key, const char *cert, const char *ca, const char *capath, const char *cipher, bool verify, attachsql_error_t **error);
+
+ASQL_API
+void attachsql_ssl_context_destroy(attachsql_ssl_context_t *ctx);
+
+ASQL_API
+bool attachsql_connect_set_ssl_context(attachsql_connect_t *con, attachsql_ssl_context_t *ctx, attachsql_error_t **error);
+
+ASQL_API
+bool attachsql_connect_ssl_session_reused(attachsql_connect_t *con);
+
+ASQL_API
+bool attachsql_connect_ssl_ktls_active(attachsql_connect_t *con);
+
 #ifdef __cplusplus
 }
 #endif
@@ -24,6 +24,9 @@ extern "C" {
 /* 5 bytes plus NUL terminator */
 #define ATTACHSQL_SQLSTATE_SIZE 6
 #define ATTACHSQL_MESSAGE_SIZE 256
+#define ATTACHSQL_HISTOGRAM_BUCKETS 96
+/* Indexed by the MySQL command byte, COM_QUERY is 3 */
+#define ATTACHSQL_STATS_COMMAND_TYPES 32
 
 struct attachsql_connect_t;
 typedef struct attachsql_connect_t attachsql_connect_t;
@@ -34,7 +37,8 @@ enum attachsql_events_t
   ATTACHSQL_EVENT_CONNECTED,
   ATTACHSQL_EVENT_ERROR,
   ATTACHSQL_EVENT_EOF,
-  ATTACHSQL_EVENT_ROW_READY
+  ATTACHSQL_EVENT_ROW_READY,
+  ATTACHSQL_EVENT_WARM_UP_COMPLETE
 };
 
 typedef enum attachsql_events_t attachsql_events_t;
@@ -63,11 +67,44 @@ enum attachsql_options_t
   ATTACHSQL_OPTION_MULTI_STATEMENTS,
   ATTACHSQL_OPTION_NO_SCHEMA,
   ATTACHSQL_OPTION_SSL_NO_VERIFY,
-  ATTACHSQL_OPTION_SEMI_BLOCKING
+  ATTACHSQL_OPTION_SEMI_BLOCKING,
+  ATTACHSQL_OPTION_SSL_MIN_VERSION,
+  ATTACHSQL_OPTION_SSL_MAX_VERSION,
+  ATTACHSQL_OPTION_SSL_KTLS,
+  ATTACHSQL_OPTION_COMPRESSION_LEVEL,
+  ATTACHSQL_OPTION_COMPRESSION_ALGORITHM,
+  ATTACHSQL_OPTION_COMPRESSION_MIN_SIZE,
+  ATTACHSQL_OPTION_COMPRESSION_MIN_SAVING,
+  ATTACHSQL_OPTION_COMPRESSION_MAX_TIME,
+  ATTACHSQL_OPTION_BUFFER_SHRINK_SIZE,
+  ATTACHSQL_OPTION_MAX_BUFFER_SIZE,
+  ATTACHSQL_OPTION_CONNECT_TIMEOUT,
+  ATTACHSQL_OPTION_READ_TIMEOUT,
+  ATTACHSQL_OPTION_WRITE_TIMEOUT,
+  ATTACHSQL_OPTION_QUERY_TIMEOUT
 };
 
 typedef enum attachsql_options_t attachsql_options_t;
 
+enum attachsql_compression_algorithm_t
+{
+  ATTACHSQL_COMPRESSION_ALGORITHM_ZLIB,
+  ATTACHSQL_COMPRESSION_ALGORITHM_ZSTD
+};
+
+typedef enum attachsql_compression_algorithm_t attachsql_compression_algorithm_t;
+
+enum attachsql_ssl_version_t
+{
+  ATTACHSQL_SSL_VERSION_DEFAULT,
+  ATTACHSQL_SSL_VERSION_TLS1_0,
+  ATTACHSQL_SSL_VERSION_TLS1_1,
+  ATTACHSQL_SSL_VERSION_TLS1_2,
+  ATTACHSQL_SSL_VERSION_TLS1_3
+};
+
+typedef enum attachsql_ssl_version_t attachsql_ssl_version_t;
+
 enum attachsql_column_type_t
 {
   ATTACHSQL_COLUMN_TYPE_DECIMAL=     0x00,
@@ -166,7 +203,8 @@ enum attachsql_error_codes_t
   ATTACHSQL_ERROR_CODE_PARAMETER=                 3000,
   ATTACHSQL_ERROR_CODE_BUFFERED_MODE=             3001,
   ATTACHSQL_ERROR_CODE_NO_SSL=                    3002,
-  ATTACHSQL_ERROR_CODE_SSL=                       3003
+  ATTACHSQL_ERROR_CODE_SSL=                       3003,
+  ATTACHSQL_ERROR_CODE_TIMEOUT=                   3004
 };
 
 typedef enum attachsql_error_codes_t attachsql_error_codes_t;
@@ -176,6 +214,9 @@ typedef struct attachsql_error_t attachsql_error_t;
 struct attachsql_pool_t;
 typedef struct attachsql_pool_t attachsql_pool_t;
 
+struct attachsql_ssl_context_t;
+typedef struct attachsql_ssl_context_t attachsql_ssl_context_t;
+
 enum attachsql_column_flags_t
 {
   ATTACHSQL_COLUMN_FLAGS_NONE=              0,
@@ -219,8 +260,46 @@ enum attachsql_query_parameter_type_t
 
 typedef enum attachsql_query_parameter_type_t attachsql_query_parameter_type_t;
 
+struct attachsql_query_template_t;
+typedef struct attachsql_query_template_t attachsql_query_template_t;
+
+enum attachsql_query_template_flags_t
+{
+  ATTACHSQL_QUERY_TEMPLATE_FLAG_NONE=         0,
+  ATTACHSQL_QUERY_TEMPLATE_FLAG_SKIP_QUOTED=  (1 << 0)
+};
+
+typedef enum attachsql_query_template_flags_t attachsql_query_template_flags_t;
+
 typedef void (attachsql_callback_fn)(attachsql_connect_t *con, uint32_t connection_id, attachsql_events_t events, void *context, attachsql_error_t *error);
 
+enum attachsql_trace_point_t
+{
+  ATTACHSQL_TRACE_BEGIN,
+  ATTACHSQL_TRACE_FIRST_BYTE,
+  ATTACHSQL_TRACE_FIRST_ROW,
+  ATTACHSQL_TRACE_END,
+  ATTACHSQL_TRACE_ERROR
+};
+
+typedef enum attachsql_trace_point_t attachsql_trace_point_t;
+
+typedef void (attachsql_trace_fn)(attachsql_connect_t *con, attachsql_trace_point_t point, uint64_t command_id, uint8_t command, uint64_t timestamp, void *context);
+
+enum attachsql_log_level_t
+{
+  ATTACHSQL_LOG_LEVEL_NONE,
+  ATTACHSQL_LOG_LEVEL_ERROR,
+  ATTACHSQL_LOG_LEVEL_WARNING,
+  ATTACHSQL_LOG_LEVEL_INFO,
+  ATTACHSQL_LOG_LEVEL_DEBUG,
+  ATTACHSQL_LOG_LEVEL_PACKET
+};
+
+typedef enum attachsql_log_level_t attachsql_log_level_t;
+
+typedef void (attachsql_log_fn)(attachsql_connect_t *con, const char *log, size_t length, void *context);
+
 #ifdef __cplusplus
 }
 #endif
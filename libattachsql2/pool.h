@@ -33,6 +33,30 @@ void attachsql_pool_add_connection(attachsql_pool_t *pool, attachsql_connect_t *
 ASQL_API
 void attachsql_pool_run(attachsql_pool_t *pool);
 
+ASQL_API
+bool attachsql_pool_warm_up(attachsql_pool_t *pool, attachsql_connect_t *con_template, uint32_t target, uint32_t max_concurrent, attachsql_error_t **error);
+
+ASQL_API
+bool attachsql_pool_get_warm_up_progress(attachsql_pool_t *pool, uint32_t *connected, uint32_t *failed);
+
+ASQL_API
+bool attachsql_pool_set_ssl_context(attachsql_pool_t *pool, attachsql_ssl_context_t *ctx, attachsql_error_t **error);
+
+ASQL_API
+bool attachsql_pool_set_max_buffer_size(attachsql_pool_t *pool, size_t size);
+
+ASQL_API
+bool attachsql_pool_set_keepalive(attachsql_pool_t *pool, uint32_t interval);
+
+ASQL_API
+bool attachsql_pool_set_max_lifetime(attachsql_pool_t *pool, uint32_t lifetime);
+
+ASQL_API
+size_t attachsql_pool_get_buffer_size(attachsql_pool_t *pool);
+
+ASQL_API
+void attachsql_pool_get_stats(attachsql_pool_t *pool, attachsql_connect_stats_st *stats);
+
 #ifdef __cplusplus
 }
 #endif
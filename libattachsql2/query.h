@@ -27,6 +27,9 @@ bool attachsql_query(attachsql_connect_t *con, size_t length, const char *statem
 ASQL_API
 void attachsql_query_close(attachsql_connect_t *con);
 
+ASQL_API
+bool attachsql_query_cancel(attachsql_connect_t *con, attachsql_error_t **error);
+
 ASQL_API
 uint16_t attachsql_query_column_count(attachsql_connect_t *con);
 
@@ -66,6 +69,18 @@ attachsql_query_row_st *attachsql_query_buffer_row_get(attachsql_connect_t *con)
 ASQL_API
 attachsql_query_row_st *attachsql_query_row_get_offset(attachsql_connect_t *con, uint64_t row_number);
 
+ASQL_API
+attachsql_query_template_t *attachsql_query_template_create(size_t length, const char *statement, attachsql_query_template_flags_t flags, attachsql_error_t **error);
+
+ASQL_API
+void attachsql_query_template_destroy(attachsql_query_template_t *tpl);
+
+ASQL_API
+uint16_t attachsql_query_template_parameter_count(attachsql_query_template_t *tpl);
+
+ASQL_API
+bool attachsql_query_template_execute(attachsql_connect_t *con, attachsql_query_template_t *tpl, uint16_t parameter_count, attachsql_query_parameter_st *parameters, attachsql_error_t **error);
+
 #ifdef __cplusplus
 }
 #endif
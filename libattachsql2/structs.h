@@ -57,6 +57,63 @@ struct attachsql_query_row_st
 
 typedef struct attachsql_query_row_st attachsql_query_row_st;
 
+struct attachsql_dns_cache_stats_st
+{
+  uint64_t hits;
+  uint64_t negative_hits;
+  uint64_t misses;
+  uint64_t expired;
+  uint64_t invalidated;
+  uint32_t entries;
+};
+
+typedef struct attachsql_dns_cache_stats_st attachsql_dns_cache_stats_st;
+
+struct attachsql_buffer_cache_stats_st
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t released;
+  uint64_t size;
+  uint32_t blocks;
+};
+
+typedef struct attachsql_buffer_cache_stats_st attachsql_buffer_cache_stats_st;
+
+/* Latencies in microseconds */
+struct attachsql_histogram_st
+{
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint64_t buckets[ATTACHSQL_HISTOGRAM_BUCKETS];
+};
+
+typedef struct attachsql_histogram_st attachsql_histogram_st;
+
+/* Only uint64_t members so that it can be read while it is being updated */
+struct attachsql_connect_stats_st
+{
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+  uint64_t packets_in;
+  uint64_t packets_out;
+  uint64_t commands[ATTACHSQL_STATS_COMMAND_TYPES];
+  uint64_t rows;
+  uint64_t compressed_bytes_in;
+  uint64_t uncompressed_bytes_in;
+  uint64_t compressed_bytes_out;
+  uint64_t uncompressed_bytes_out;
+  uint64_t compress_time;
+  uint64_t buffer_grows;
+  uint64_t buffer_shrinks;
+  attachsql_histogram_st connect_time;
+  attachsql_histogram_st first_row_time;
+  attachsql_histogram_st query_time;
+};
+
+typedef struct attachsql_connect_stats_st attachsql_connect_stats_st;
+
 #ifdef __cplusplus
 }
 #endif
@@ -36,6 +36,24 @@ uint8_t attachsql_get_library_version_patch(void);
 ASQL_API
 void attachsql_library_init(void);
 
+ASQL_API
+void attachsql_library_set_dns_cache_ttl(uint32_t ttl, uint32_t negative_ttl);
+
+ASQL_API
+void attachsql_library_flush_dns_cache(void);
+
+ASQL_API
+void attachsql_library_get_dns_cache_stats(attachsql_dns_cache_stats_st *stats);
+
+ASQL_API
+void attachsql_library_set_buffer_cache(size_t size, bool huge_pages);
+
+ASQL_API
+void attachsql_library_get_buffer_cache_stats(attachsql_buffer_cache_stats_st *stats);
+
+ASQL_API
+uint64_t attachsql_histogram_percentile(const attachsql_histogram_st *histogram, double percentile);
+
 #ifdef __cplusplus
 }
 #endif
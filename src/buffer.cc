@@ -22,6 +22,285 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#if defined(HAVE_MEMFD_CREATE) or defined(HAVE_MADVISE)
+# include <sys/mman.h>
+#endif
+#ifdef HAVE_MEMFD_CREATE
+# include <unistd.h>
+#endif
+
+/* Process-wide cache of buffer memory so that connections coming and going
+ * reuse blocks instead of mapping or allocating new ones.  Buffers are
+ * always the default size doubled some number of times, each of these size
+ * classes has a free list for rings and one for heap blocks.  The lists are
+ * linked through the first bytes of the free blocks. */
+
+#define BUFFER_CACHE_CLASSES 8
+#define BUFFER_HUGE_PAGE_SIZE ((size_t)2*1024*1024)
+
+struct buffer_cache_class_st
+{
+  char *rings;
+  char *blocks;
+};
+
+static uv_once_t buffer_cache_once= UV_ONCE_INIT;
+static uv_mutex_t buffer_cache_mutex;
+static buffer_cache_class_st buffer_cache_classes[BUFFER_CACHE_CLASSES];
+static size_t buffer_cache_max_size= ATTACHSQL_DEFAULT_BUFFER_CACHE_SIZE;
+/* Atomic so that mapping and allocating blocks can load it without taking
+ * the cache lock */
+static bool buffer_cache_huge_pages= false;
+static attachsql_buffer_cache_stats_st buffer_cache_stats;
+
+static void buffer_cache_init(void)
+{
+  uv_mutex_init(&buffer_cache_mutex);
+  memset(buffer_cache_classes, 0, sizeof(buffer_cache_classes));
+  memset(&buffer_cache_stats, 0, sizeof(buffer_cache_stats));
+}
+
+/* Returns the size class of a block or -1 if it doesn't have one */
+static int buffer_cache_class(size_t size)
+{
+  int size_class;
+
+  for (size_class= 0; size_class < BUFFER_CACHE_CLASSES; size_class++)
+  {
+    if (size == ((size_t)ATTACHSQL_DEFAULT_BUFFER_SIZE << size_class))
+    {
+      return size_class;
+    }
+  }
+  return -1;
+}
+
+/* Asks for transparent huge pages over the aligned part of a block */
+static void attachsql_buffer_advise(char *block, size_t size)
+{
+#if defined(HAVE_MADVISE) and defined(MADV_HUGEPAGE)
+  uintptr_t start= ((uintptr_t)block + BUFFER_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(BUFFER_HUGE_PAGE_SIZE - 1);
+  uintptr_t end= ((uintptr_t)block + size) & ~(uintptr_t)(BUFFER_HUGE_PAGE_SIZE - 1);
+
+  if (__atomic_load_n(&buffer_cache_huge_pages, __ATOMIC_RELAXED) and (end > start))
+  {
+    madvise((void*)start, end - start, MADV_HUGEPAGE);
+  }
+#else
+  (void) block;
+  (void) size;
+#endif
+}
+
+#ifdef HAVE_MEMFD_CREATE
+/* Maps the same pages twice back to back, anything written past the end of
+ * the first mapping appears at the start of it */
+static char *attachsql_buffer_ring_map(size_t size)
+{
+  int fd;
+  char *ring;
+  char *reserve;
+  size_t reserve_size= size * 2;
+  size_t align= 0;
+
+  fd= memfd_create("attachsql_buffer", MFD_CLOEXEC);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  if (ftruncate(fd, (off_t)size) != 0)
+  {
+    close(fd);
+    return NULL;
+  }
+  // Huge pages need the ring to start on a huge page boundary
+  if (__atomic_load_n(&buffer_cache_huge_pages, __ATOMIC_RELAXED) and (size >= BUFFER_HUGE_PAGE_SIZE))
+  {
+    align= BUFFER_HUGE_PAGE_SIZE;
+    reserve_size+= align;
+  }
+  // Reserve the address space for both halves first
+  reserve= (char*)mmap(NULL, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reserve == MAP_FAILED)
+  {
+    close(fd);
+    return NULL;
+  }
+  ring= reserve;
+  if (align)
+  {
+    ring= (char*)(((uintptr_t)reserve + align - 1) & ~(uintptr_t)(align - 1));
+    if (ring > reserve)
+    {
+      munmap(reserve, (size_t)(ring - reserve));
+    }
+    if (ring + size * 2 < reserve + reserve_size)
+    {
+      munmap(ring + size * 2, (size_t)(reserve + reserve_size - (ring + size * 2)));
+    }
+  }
+  if ((mmap(ring, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+      or (mmap(ring + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED))
+  {
+    munmap(ring, size * 2);
+    close(fd);
+    return NULL;
+  }
+  // The mappings keep the memory alive
+  close(fd);
+  if (align)
+  {
+    attachsql_buffer_advise(ring, size * 2);
+  }
+  return ring;
+}
+#endif
+
+/* Takes a block of the given size from the cache, NULL if there isn't one */
+static char *buffer_cache_get(size_t size, bool ring)
+{
+  int size_class= buffer_cache_class(size);
+  char **list;
+  char *block;
+
+  if (size_class < 0)
+  {
+    return NULL;
+  }
+  uv_once(&buffer_cache_once, buffer_cache_init);
+  uv_mutex_lock(&buffer_cache_mutex);
+  if (ring)
+  {
+    list= &buffer_cache_classes[size_class].rings;
+  }
+  else
+  {
+    list= &buffer_cache_classes[size_class].blocks;
+  }
+  block= *list;
+  if (block != NULL)
+  {
+    memcpy(list, block, sizeof(char*));
+    buffer_cache_stats.hits++;
+    buffer_cache_stats.blocks--;
+    buffer_cache_stats.size-= size;
+  }
+  else
+  {
+    buffer_cache_stats.misses++;
+  }
+  uv_mutex_unlock(&buffer_cache_mutex);
+  return block;
+}
+
+/* Gives a block to the cache, returns false if it is full or the block has
+ * no size class and the caller should release it */
+static bool buffer_cache_put(char *block, size_t size, bool ring)
+{
+  int size_class= buffer_cache_class(size);
+  char **list;
+  bool stored= false;
+
+  if (size_class < 0)
+  {
+    return false;
+  }
+  uv_once(&buffer_cache_once, buffer_cache_init);
+  uv_mutex_lock(&buffer_cache_mutex);
+  if (buffer_cache_stats.size + size <= buffer_cache_max_size)
+  {
+    if (ring)
+    {
+      list= &buffer_cache_classes[size_class].rings;
+    }
+    else
+    {
+      list= &buffer_cache_classes[size_class].blocks;
+    }
+    memcpy(block, list, sizeof(char*));
+    *list= block;
+    buffer_cache_stats.blocks++;
+    buffer_cache_stats.size+= size;
+    stored= true;
+  }
+  else
+  {
+    buffer_cache_stats.released++;
+  }
+  uv_mutex_unlock(&buffer_cache_mutex);
+  return stored;
+}
+
+static void attachsql_buffer_block_release(char *block, size_t size, bool ring)
+{
+#ifdef HAVE_MEMFD_CREATE
+  if (ring)
+  {
+    munmap(block, size * 2);
+    return;
+  }
+#else
+  (void) ring;
+#endif
+  (void) size;
+  free(block);
+}
+
+/* A ring if the platform can map one, otherwise a heap block */
+static char *attachsql_buffer_block_get(size_t size, bool *ring)
+{
+  char *block;
+
+#ifdef HAVE_MEMFD_CREATE
+  block= buffer_cache_get(size, true);
+  if (block == NULL)
+  {
+    block= attachsql_buffer_ring_map(size);
+  }
+  if (block != NULL)
+  {
+    *ring= true;
+    return block;
+  }
+#endif
+  *ring= false;
+  block= buffer_cache_get(size, false);
+  if (block == NULL)
+  {
+    block= (char*)malloc(size);
+    if (block != NULL)
+    {
+      attachsql_buffer_advise(block, size);
+    }
+  }
+  return block;
+}
+
+static void attachsql_buffer_block_put(char *block, size_t size, bool ring)
+{
+  if (not buffer_cache_put(block, size, ring))
+  {
+    attachsql_buffer_block_release(block, size, ring);
+  }
+}
+
+/* Keeps the read pointer in the first mapping of a ring, pointers into the
+ * second mapping see the same data so nothing is moved */
+static void attachsql_buffer_ring_wrap(buffer_st *buffer)
+{
+  if (not buffer->ring or (buffer->buffer_read_ptr < (buffer->buffer + buffer->buffer_size)))
+  {
+    return;
+  }
+  if (buffer->packet_end_ptr >= buffer->buffer_read_ptr)
+  {
+    buffer->packet_end_ptr-= buffer->buffer_size;
+  }
+  buffer->buffer_read_ptr-= buffer->buffer_size;
+  buffer->buffer_write_ptr-= buffer->buffer_size;
+}
 
 buffer_st *attachsql_buffer_create()
 {
@@ -33,7 +312,7 @@ buffer_st *attachsql_buffer_create()
     return NULL;
   }
 
-  buffer->buffer= (char*)malloc(ATTACHSQL_DEFAULT_BUFFER_SIZE);
+  buffer->buffer= attachsql_buffer_block_get(ATTACHSQL_DEFAULT_BUFFER_SIZE, &buffer->ring);
   if (buffer->buffer == NULL)
   {
     delete buffer;
@@ -49,17 +328,49 @@ buffer_st *attachsql_buffer_create()
 
 void attachsql_buffer_free(buffer_st *buffer)
 {
-  free(buffer->buffer);
+  attachsql_buffer_block_put(buffer->buffer, buffer->buffer_size, buffer->ring);
   delete buffer;
 }
 
+void attachsql_buffer_rewind(buffer_st *buffer)
+{
+  if (buffer == NULL)
+  {
+    return;
+  }
+  /* Reading from the start again when everything has been read keeps small
+   * packets in the same few cache lines rather than cycling through all of
+   * a ring, a packet end ahead of the pointers keeps its distance */
+  if ((buffer->buffer_read_ptr == buffer->buffer_write_ptr) and (buffer->buffer_read_ptr != buffer->buffer))
+  {
+    size_t buffer_stale= (size_t)(buffer->buffer_read_ptr - buffer->buffer);
+
+    if ((buffer->packet_end_ptr != NULL) and (buffer->packet_end_ptr >= buffer->buffer_read_ptr))
+    {
+      buffer->packet_end_ptr-= buffer_stale;
+    }
+    else
+    {
+      buffer->packet_end_ptr= buffer->buffer;
+    }
+    buffer->buffer_read_ptr= buffer->buffer;
+    buffer->buffer_write_ptr= buffer->buffer;
+    buffer->buffer_used= 0;
+  }
+  attachsql_buffer_ring_wrap(buffer);
+}
+
 size_t attachsql_buffer_get_available(buffer_st *buffer)
 {
   if (buffer == NULL)
   {
     return 0;
   }
-  return buffer->buffer_size - ((size_t)(buffer->buffer_read_ptr - buffer->buffer) + buffer->buffer_used);
+  if (buffer->ring)
+  {
+    return buffer->buffer_size - attachsql_buffer_unread_data(buffer);
+  }
+  return buffer->buffer_size - (size_t)(buffer->buffer_write_ptr - buffer->buffer);
 }
 
 attachsql_ret_t attachsql_buffer_increase(buffer_st *buffer)
@@ -69,16 +380,60 @@ attachsql_ret_t attachsql_buffer_increase(buffer_st *buffer)
     return ATTACHSQL_RET_PARAMETER_ERROR;
   }
 
-  size_t buffer_available= attachsql_buffer_get_available(buffer);
+#ifdef HAVE_MEMFD_CREATE
+  /* A ring never has stale data to shift out of the way, it is full so copy
+   * the unread data into a ring twice the size */
+  if (buffer->ring)
+  {
+    size_t buffer_unread= attachsql_buffer_unread_data(buffer);
+    size_t packet_end_size= 0;
+    size_t new_size= buffer->buffer_size * 2;
+    char *new_buffer= buffer_cache_get(new_size, true);
+    if (new_buffer == NULL)
+    {
+      new_buffer= attachsql_buffer_ring_map(new_size);
+    }
+    if (new_buffer == NULL)
+    {
+      return ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
+    }
+    memcpy(new_buffer, buffer->buffer_read_ptr, buffer_unread);
+    if ((buffer->packet_end_ptr != NULL) and (buffer->packet_end_ptr >= buffer->buffer_read_ptr))
+    {
+      packet_end_size= (size_t)(buffer->packet_end_ptr - buffer->buffer_read_ptr);
+    }
+    attachsql_buffer_block_put(buffer->buffer, buffer->buffer_size, true);
+    buffer->buffer= new_buffer;
+    buffer->buffer_size= new_size;
+    buffer->buffer_read_ptr= new_buffer;
+    buffer->buffer_write_ptr= new_buffer + buffer_unread;
+    buffer->packet_end_ptr= new_buffer + packet_end_size;
+    buffer->buffer_used= buffer_unread;
+    return ATTACHSQL_RET_OK;
+  }
+#endif
+
+  size_t buffer_stale= (size_t)(buffer->buffer_read_ptr - buffer->buffer);
 
   /* if the we have lots of stale data just shift
-   * algorithm for this at the moment is if only half the buffer is available
-   * move it
+   * algorithm for this at the moment is if at least half the buffer has
+   * already been read move the unread data to the start
    */
-  if (buffer_available + buffer->buffer_used < (buffer->buffer_size / 2))
+  if (buffer_stale >= (buffer->buffer_size / 2))
   {
-    memmove(buffer->buffer, buffer->buffer_read_ptr, buffer->buffer_used);
-    buffer->buffer_write_ptr= buffer->buffer + buffer->buffer_used;
+    size_t buffer_unread= attachsql_buffer_unread_data(buffer);
+    memmove(buffer->buffer, buffer->buffer_read_ptr, buffer_unread);
+    if ((buffer->packet_end_ptr != NULL) and (buffer->packet_end_ptr >= buffer->buffer_read_ptr))
+    {
+      buffer->packet_end_ptr-= buffer_stale;
+    }
+    else
+    {
+      buffer->packet_end_ptr= buffer->buffer;
+    }
+    buffer->buffer_read_ptr= buffer->buffer;
+    buffer->buffer_write_ptr= buffer->buffer + buffer_unread;
+    buffer->buffer_used= buffer_unread;
   }
   else
   {
@@ -94,10 +449,22 @@ attachsql_ret_t attachsql_buffer_increase(buffer_st *buffer)
       packet_end_size= 0;
     }
     size_t new_size= buffer->buffer_size * 2;
-    char *realloc_buffer= (char*)realloc(buffer->buffer, new_size);
-    if (realloc_buffer == NULL)
+    /* A cached block saves growing the heap, realloc() is cheaper than a
+     * copy when there isn't one */
+    char *realloc_buffer= buffer_cache_get(new_size, false);
+    if (realloc_buffer != NULL)
     {
-      return ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
+      memcpy(realloc_buffer, buffer->buffer, buffer_write_size);
+      attachsql_buffer_block_put(buffer->buffer, buffer->buffer_size, false);
+    }
+    else
+    {
+      realloc_buffer= (char*)realloc(buffer->buffer, new_size);
+      if (realloc_buffer == NULL)
+      {
+        return ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
+      }
+      attachsql_buffer_advise(realloc_buffer, new_size);
     }
     buffer->buffer_size= new_size;
     buffer->buffer= realloc_buffer;
@@ -110,6 +477,54 @@ attachsql_ret_t attachsql_buffer_increase(buffer_st *buffer)
   return ATTACHSQL_RET_OK;
 }
 
+/* How many bytes attachsql_buffer_increase() would add to the buffer, zero
+ * if it would only shift stale data out */
+size_t attachsql_buffer_growth(buffer_st *buffer)
+{
+  if (buffer == NULL)
+  {
+    return 0;
+  }
+  if ((not buffer->ring) and ((size_t)(buffer->buffer_read_ptr - buffer->buffer) >= (buffer->buffer_size / 2)))
+  {
+    return 0;
+  }
+  return buffer->buffer_size;
+}
+
+/* Returns an empty buffer which has grown past shrink_size to the default
+ * size, true if it was shrunk */
+bool attachsql_buffer_shrink(buffer_st *buffer, size_t shrink_size)
+{
+  char *new_buffer;
+  bool ring;
+
+  if ((buffer == NULL) or (shrink_size == 0) or (buffer->buffer_size <= shrink_size) or (buffer->buffer_size <= ATTACHSQL_DEFAULT_BUFFER_SIZE))
+  {
+    return false;
+  }
+  if (attachsql_buffer_unread_data(buffer) > 0)
+  {
+    return false;
+  }
+
+  asdebug("Shrinking buffer from %zu bytes", buffer->buffer_size);
+  new_buffer= attachsql_buffer_block_get(ATTACHSQL_DEFAULT_BUFFER_SIZE, &ring);
+  if (new_buffer == NULL)
+  {
+    return false;
+  }
+  attachsql_buffer_block_put(buffer->buffer, buffer->buffer_size, buffer->ring);
+  buffer->ring= ring;
+  buffer->buffer= new_buffer;
+  buffer->buffer_size= ATTACHSQL_DEFAULT_BUFFER_SIZE;
+  buffer->buffer_read_ptr= new_buffer;
+  buffer->buffer_write_ptr= new_buffer;
+  buffer->packet_end_ptr= new_buffer;
+  buffer->buffer_used= 0;
+  return true;
+}
+
 /* Moves the write pointer and returns the amount of unread data in the buffer */
 void attachsql_buffer_move_write_ptr(buffer_st *buffer, size_t len)
 {
@@ -137,5 +552,53 @@ void attachsql_buffer_packet_read_end(buffer_st *buffer)
   else
   {
     buffer->buffer_read_ptr= buffer->packet_end_ptr;
+    attachsql_buffer_ring_wrap(buffer);
+  }
+}
+
+void attachsql_library_set_buffer_cache(size_t size, bool huge_pages)
+{
+  int size_class;
+  char *block;
+
+  uv_once(&buffer_cache_once, buffer_cache_init);
+  uv_mutex_lock(&buffer_cache_mutex);
+  buffer_cache_max_size= size;
+  __atomic_store_n(&buffer_cache_huge_pages, huge_pages, __ATOMIC_RELAXED);
+  // Release the largest blocks first until the cache fits the new size
+  for (size_class= BUFFER_CACHE_CLASSES - 1; size_class >= 0; size_class--)
+  {
+    size_t block_size= (size_t)ATTACHSQL_DEFAULT_BUFFER_SIZE << size_class;
+    while ((buffer_cache_stats.size > buffer_cache_max_size) and (buffer_cache_classes[size_class].rings != NULL))
+    {
+      block= buffer_cache_classes[size_class].rings;
+      memcpy(&buffer_cache_classes[size_class].rings, block, sizeof(char*));
+      attachsql_buffer_block_release(block, block_size, true);
+      buffer_cache_stats.blocks--;
+      buffer_cache_stats.size-= block_size;
+      buffer_cache_stats.released++;
+    }
+    while ((buffer_cache_stats.size > buffer_cache_max_size) and (buffer_cache_classes[size_class].blocks != NULL))
+    {
+      block= buffer_cache_classes[size_class].blocks;
+      memcpy(&buffer_cache_classes[size_class].blocks, block, sizeof(char*));
+      attachsql_buffer_block_release(block, block_size, false);
+      buffer_cache_stats.blocks--;
+      buffer_cache_stats.size-= block_size;
+      buffer_cache_stats.released++;
+    }
+  }
+  uv_mutex_unlock(&buffer_cache_mutex);
+}
+
+void attachsql_library_get_buffer_cache_stats(attachsql_buffer_cache_stats_st *stats)
+{
+  if (stats == NULL)
+  {
+    return;
   }
+  uv_once(&buffer_cache_once, buffer_cache_init);
+  uv_mutex_lock(&buffer_cache_mutex);
+  memcpy(stats, &buffer_cache_stats, sizeof(attachsql_buffer_cache_stats_st));
+  uv_mutex_unlock(&buffer_cache_mutex);
 }
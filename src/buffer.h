@@ -27,10 +27,17 @@ extern "C" {
 #endif
 
 #define ATTACHSQL_DEFAULT_BUFFER_SIZE 1024*1024
+/* Buffers larger than this are shrunk when a command completes */
+#define ATTACHSQL_DEFAULT_BUFFER_SHRINK_SIZE ATTACHSQL_DEFAULT_BUFFER_SIZE*4
+/* Memory kept by the process-wide cache of freed buffers */
+#define ATTACHSQL_DEFAULT_BUFFER_CACHE_SIZE ATTACHSQL_DEFAULT_BUFFER_SIZE*32
 
+/* When the platform allows it the buffer is a ring mapped twice in a row
+ * so that data which wraps around the end is still contiguous in memory */
 struct buffer_st
 {
   char *buffer;
+  bool ring;
   size_t buffer_size;
   size_t buffer_used;
   char *buffer_write_ptr;
@@ -39,6 +46,7 @@ struct buffer_st
 
   buffer_st() :
     buffer(NULL),
+    ring(false),
     buffer_size(0),
     buffer_used(0),
     buffer_write_ptr(NULL),
@@ -49,8 +57,14 @@ struct buffer_st
 
 buffer_st *attachsql_buffer_create();
 void attachsql_buffer_free(buffer_st *buffer);
+/* Moves the pointers back before more data is written: an empty buffer
+ * starts again from the beginning and a ring's read pointer is kept in its
+ * first mapping */
+void attachsql_buffer_rewind(buffer_st *buffer);
 size_t attachsql_buffer_get_available(buffer_st *buffer);
 attachsql_ret_t attachsql_buffer_increase(buffer_st *buffer);
+size_t attachsql_buffer_growth(buffer_st *buffer);
+bool attachsql_buffer_shrink(buffer_st *buffer, size_t shrink_size);
 void attachsql_buffer_move_write_ptr(buffer_st *buffer, size_t len);
 size_t attachsql_buffer_unread_data(buffer_st *buffer);
 void attachsql_buffer_packet_read_end(buffer_st *buffer);
@@ -0,0 +1,340 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "config.h"
+#include "common.h"
+#include "capture.h"
+#include "net.h"
+#include "log.h"
+#include <errno.h>
+
+/* A capture is the plaintext of a connection, after TLS is removed and
+ * compression unpacked, so it can be played back without a server.  The
+ * file is the magic followed by records of:
+ *
+ *   1 byte     ATTACHSQL_CAPTURE_READ or ATTACHSQL_CAPTURE_WRITE
+ *   varint     nanoseconds since the previous record
+ *   varint     data length
+ *   data
+ */
+#define ATTACHSQL_CAPTURE_MAGIC "ASQLCAP1"
+#define ATTACHSQL_CAPTURE_MAGIC_SIZE 8
+#define ATTACHSQL_CAPTURE_READ 1
+#define ATTACHSQL_CAPTURE_WRITE 2
+#define ATTACHSQL_CAPTURE_VARINT_MAX 10
+
+static size_t attachsql_capture_pack_varint(unsigned char *buffer, uint64_t value)
+{
+  size_t length= 0;
+
+  while (value >= 0x80)
+  {
+    buffer[length++]= (unsigned char)(value | 0x80);
+    value>>= 7;
+  }
+  buffer[length++]= (unsigned char)value;
+  return length;
+}
+
+static bool attachsql_capture_unpack_varint(const char *data, size_t length, size_t *position, uint64_t *value)
+{
+  uint32_t shift= 0;
+  unsigned char byte;
+
+  *value= 0;
+  while (*position < length)
+  {
+    byte= (unsigned char)data[(*position)++];
+    *value|= (uint64_t)(byte & 0x7f) << shift;
+    if (not (byte & 0x80))
+    {
+      return true;
+    }
+    shift+= 7;
+    if (shift >= 64)
+    {
+      return false;
+    }
+  }
+  return false;
+}
+
+static void attachsql_capture_record(attachsql_connect_t *con, uint8_t type, size_t length)
+{
+  unsigned char header[1 + (ATTACHSQL_CAPTURE_VARINT_MAX * 2)];
+  size_t header_length= 0;
+  uint64_t now= uv_hrtime();
+
+  header[header_length++]= type;
+  header_length+= attachsql_capture_pack_varint(header + header_length, now - con->capture.last_time);
+  header_length+= attachsql_capture_pack_varint(header + header_length, length);
+  con->capture.last_time= now;
+  fwrite(header, 1, header_length, con->capture.file);
+}
+
+/* A failed capture shouldn't take the connection down with it */
+static void attachsql_capture_check(attachsql_connect_t *con)
+{
+  if (ferror(con->capture.file))
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Capture write failure, capture stopped");
+    fclose(con->capture.file);
+    con->capture.file= NULL;
+  }
+}
+
+void attachsql_capture_read(attachsql_connect_t *con, const char *data, size_t length)
+{
+  if (length == 0)
+  {
+    return;
+  }
+  attachsql_capture_record(con, ATTACHSQL_CAPTURE_READ, length);
+  fwrite(data, 1, length, con->capture.file);
+  attachsql_capture_check(con);
+}
+
+void attachsql_capture_write(attachsql_connect_t *con, uv_buf_t *buffers, unsigned int buffer_count)
+{
+  size_t length= 0;
+  unsigned int buffer;
+
+  for (buffer= 0; buffer < buffer_count; buffer++)
+  {
+    length+= buffers[buffer].len;
+  }
+  attachsql_capture_record(con, ATTACHSQL_CAPTURE_WRITE, length);
+  for (buffer= 0; buffer < buffer_count; buffer++)
+  {
+    fwrite(buffers[buffer].base, 1, buffers[buffer].len, con->capture.file);
+  }
+  attachsql_capture_check(con);
+}
+
+void attachsql_capture_free(attachsql_connect_t *con)
+{
+  if (con->capture.file != NULL)
+  {
+    fclose(con->capture.file);
+    con->capture.file= NULL;
+  }
+  free(con->replay.data);
+  con->replay.data= NULL;
+}
+
+bool attachsql_connect_set_capture(attachsql_connect_t *con, const char *filename, attachsql_error_t **error)
+{
+  if ((con == NULL) or (filename == NULL))
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Connection or filename parameter not valid");
+    return false;
+  }
+  if ((con->status != ATTACHSQL_CON_STATUS_NOT_CONNECTED) or (con->capture.file != NULL))
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "A capture must be set once before connecting");
+    return false;
+  }
+  con->capture.file= fopen(filename, "wb");
+  if (con->capture.file == NULL)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Could not open capture file: %s", strerror(errno));
+    return false;
+  }
+  fwrite(ATTACHSQL_CAPTURE_MAGIC, 1, ATTACHSQL_CAPTURE_MAGIC_SIZE, con->capture.file);
+  con->capture.last_time= uv_hrtime();
+  return true;
+}
+
+/* Reads the header of the record at position, data_position is set to the
+ * start of its data */
+static bool attachsql_replay_record(const char *data, size_t length, size_t position, uint8_t *type, size_t *data_position, size_t *data_length)
+{
+  uint64_t delta;
+  uint64_t record_length;
+
+  if (position >= length)
+  {
+    return false;
+  }
+  *type= (uint8_t)data[position++];
+  if ((*type != ATTACHSQL_CAPTURE_READ) and (*type != ATTACHSQL_CAPTURE_WRITE))
+  {
+    return false;
+  }
+  if ((not attachsql_capture_unpack_varint(data, length, &position, &delta)) or (not attachsql_capture_unpack_varint(data, length, &position, &record_length)))
+  {
+    return false;
+  }
+  if (record_length > (length - position))
+  {
+    return false;
+  }
+  *data_position= position;
+  *data_length= (size_t)record_length;
+  return true;
+}
+
+bool attachsql_replay_load(attachsql_connect_t *con, char *data, size_t length, attachsql_error_t **error)
+{
+  size_t position;
+  size_t data_position;
+  size_t data_length;
+  uint8_t type;
+
+  /* Check every record up front so playback can trust the data */
+  position= ATTACHSQL_CAPTURE_MAGIC_SIZE;
+  while (position < length)
+  {
+    if (not attachsql_replay_record(data, length, position, &type, &data_position, &data_length))
+    {
+      break;
+    }
+    position= data_position + data_length;
+  }
+  if ((length < ATTACHSQL_CAPTURE_MAGIC_SIZE) or (memcmp(data, ATTACHSQL_CAPTURE_MAGIC, ATTACHSQL_CAPTURE_MAGIC_SIZE) != 0) or (position != length))
+  {
+    free(data);
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Not a capture file or the capture is truncated");
+    return false;
+  }
+  con->replay.data= data;
+  con->replay.length= length;
+  con->replay.position= ATTACHSQL_CAPTURE_MAGIC_SIZE;
+  return true;
+}
+
+bool attachsql_connect_set_replay(attachsql_connect_t *con, const char *filename, attachsql_error_t **error)
+{
+  FILE *file;
+  long file_length;
+  char *data;
+  size_t length;
+
+  if ((con == NULL) or (filename == NULL))
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Connection or filename parameter not valid");
+    return false;
+  }
+  if ((con->status != ATTACHSQL_CON_STATUS_NOT_CONNECTED) or (con->replay.data != NULL))
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "A replay must be set once before connecting");
+    return false;
+  }
+  file= fopen(filename, "rb");
+  if (file == NULL)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Could not open capture file: %s", strerror(errno));
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  file_length= ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (file_length < ATTACHSQL_CAPTURE_MAGIC_SIZE)
+  {
+    fclose(file);
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Not a capture file");
+    return false;
+  }
+  data= (char*)malloc((size_t)file_length);
+  if (data == NULL)
+  {
+    fclose(file);
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_ALLOC, ATTACHSQL_ERROR_LEVEL_ERROR, "HY001", "Allocation failure for capture data");
+    return false;
+  }
+  length= fread(data, 1, (size_t)file_length, file);
+  fclose(file);
+  if (length != (size_t)file_length)
+  {
+    free(data);
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Not a capture file or the capture is truncated");
+    return false;
+  }
+  return attachsql_replay_load(con, data, length, error);
+}
+
+void attachsql_replay_write(attachsql_connect_t *con)
+{
+  con->replay.writes_sent++;
+  con->replay.write_done= true;
+}
+
+/* Stands in for a run of the event loop, a write completes and then the
+ * next read of the capture is delivered */
+void attachsql_replay_run(attachsql_connect_t *con)
+{
+  uint8_t type;
+  size_t data_position;
+  size_t data_length;
+  size_t used;
+
+  if (con->status == ATTACHSQL_CON_STATUS_NET_ERROR)
+  {
+    return;
+  }
+  if (con->replay.write_done)
+  {
+    con->replay.write_done= false;
+    attachsql_con_write_complete(con);
+  }
+  while (attachsql_replay_record(con->replay.data, con->replay.length, con->replay.position, &type, &data_position, &data_length))
+  {
+    if (type == ATTACHSQL_CAPTURE_WRITE)
+    {
+      /* The server's reply isn't delivered until the client sends the
+       * request it answers */
+      if (con->replay.writes_seen == con->replay.writes_sent)
+      {
+        break;
+      }
+      con->replay.writes_seen++;
+      con->replay.position= data_position + data_length;
+      continue;
+    }
+    used= attachsql_con_replay_read(con, con->replay.data + data_position + con->replay.record_offset, data_length - con->replay.record_offset);
+    con->replay.record_offset+= used;
+    if (con->replay.record_offset == data_length)
+    {
+      con->replay.record_offset= 0;
+      con->replay.position= data_position + data_length;
+    }
+    return;
+  }
+  attachsql_con_process_packets(con);
+  if ((con->status != ATTACHSQL_CON_STATUS_BUSY) and (con->status != ATTACHSQL_CON_STATUS_CONNECTING))
+  {
+    return;
+  }
+  /* Waiting for a reply the capture doesn't have, either it has ended or
+   * the client sent different commands to the captured one */
+  if (attachsql_replay_record(con->replay.data, con->replay.length, con->replay.position, &type, &data_position, &data_length))
+  {
+    if ((type != ATTACHSQL_CAPTURE_WRITE) or (con->replay.writes_seen != con->replay.writes_sent))
+    {
+      return;
+    }
+    snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "Net read failure: commands differ from the capture");
+  }
+  else
+  {
+    snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "Net read failure: end of the capture");
+  }
+  con->local_errcode= ATTACHSQL_RET_NET_READ_ERROR;
+  aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Replay failure: %s", con->errmsg);
+  con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
+  con->next_packet_queue_used= 0;
+  con->status= ATTACHSQL_CON_STATUS_NET_ERROR;
+}
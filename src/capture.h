@@ -0,0 +1,41 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#pragma once
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void attachsql_capture_read(attachsql_connect_t *con, const char *data, size_t length);
+
+void attachsql_capture_write(attachsql_connect_t *con, uv_buf_t *buffers, unsigned int buffer_count);
+
+void attachsql_capture_free(attachsql_connect_t *con);
+
+/* Takes ownership of data, a capture held in memory */
+bool attachsql_replay_load(attachsql_connect_t *con, char *data, size_t length, attachsql_error_t **error);
+
+void attachsql_replay_write(attachsql_connect_t *con);
+
+void attachsql_replay_run(attachsql_connect_t *con);
+
+#ifdef __cplusplus
+}
+#endif
@@ -17,6 +17,10 @@
 
 #include "command.h"
 #include "net.h"
+#include "stats.h"
+#include "log.h"
+#include "capture.h"
+#include "timeout.h"
 
 #ifdef HAVE_ZLIB
 attachsql_command_status_t attachsql_command_send_compressed(attachsql_connect_t *con, attachsql_command_t command, char *data, size_t length)
@@ -53,22 +57,52 @@ attachsql_command_status_t attachsql_command_send(attachsql_connect_t *con, atta
   con->warning_count= 0;
   con->server_errno= 0;
 
-  asdebug("Sending command 0x%02X to server", command);
+  aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Sending command 0x%02X to server", command);
+  if (command < ATTACHSQL_STATS_COMMAND_TYPES)
+  {
+    ATTACHSQL_STAT_ADD(con->stats.commands[command], 1);
+  }
+  ATTACHSQL_STAT_ADD(con->stats.packets_out, 1);
+  con->command_start= uv_hrtime();
+  con->command_first_row= false;
+  con->command_first_byte= false;
+  con->command_id++;
+  con->command_type= (uint8_t)command;
+  if (con->trace_fn != NULL)
+  {
+    con->trace_fn(con, ATTACHSQL_TRACE_BEGIN, con->command_id, con->command_type, con->command_start, con->trace_context);
+  }
   con->local_errcode= ATTACHSQL_RET_OK;
   con->errmsg[0]= '\0';
+  con->cancel.discarding= false;
+  attachsql_timeout_command_start(con);
+  if (con->pool != NULL)
+  {
+    con->maintenance.last_active= uv_now(con->uv_objects.loop);
+  }
 
   attachsql_pack_int3(con->packet_header, length + 1 + con->write_buffer_extra);
   con->packet_number= 0;
   con->packet_header[3] = con->packet_number;
+  con->write_buffer[0]= command;
+  if (con->capture.file != NULL)
+  {
+    send_buffer[0].base= con->packet_header;
+    send_buffer[0].len= 4;
+    send_buffer[1].base= con->write_buffer;
+    send_buffer[1].len= 1 + con->write_buffer_extra;
+    send_buffer[2].base= data;
+    send_buffer[2].len= length;
+    attachsql_capture_write(con, send_buffer, 3);
+  }
 
 #ifdef HAVE_ZLIB
-  if (con->client_capabilities & ATTACHSQL_CAPABILITY_COMPRESS)
+  if (con->client_capabilities & ATTACHSQL_CAPABILITY_ANY_COMPRESSION)
   {
     return attachsql_command_send_compressed(con, command, data, length);
   }
 #endif
 
-  con->write_buffer[0]= command;
   send_buffer[0].base= con->packet_header;
   send_buffer[0].len= 4;
   send_buffer[1].base= con->write_buffer;
@@ -78,39 +112,37 @@ attachsql_command_status_t attachsql_command_send(attachsql_connect_t *con, atta
   {
     send_buffer[2].base= data;
     send_buffer[2].len= length;
-    asdebug("Sending %zd bytes with %zd command bytes to server", length, send_buffer[1].len);
-    asdebug_hex(data, length);
+    aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Sending %zd bytes with %zd command bytes to server", length, send_buffer[1].len);
+    aslog_hex(con, data, length);
 #ifdef HAVE_OPENSSL
-    if (con->ssl.handshake_done)
+    if (con->ssl.handshake_done and not con->ssl.ktls_tx)
     {
       ret= attachsql_ssl_buffer_write(con, send_buffer, 3);
     }
     else
 #endif
     {
-      uv_write_t *req= new (std::nothrow) uv_write_t;
-      ret= uv_write(req, con->uv_objects.stream, send_buffer, 3, on_write);
+      ret= attachsql_con_write(con, send_buffer, 3);
     }
   }
   else
   {
-    asdebug("Sending %zd command bytes with no data", send_buffer[1].len);
+    aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Sending %zd command bytes with no data", send_buffer[1].len);
 #ifdef HAVE_OPENSSL
-    if (con->ssl.handshake_done)
+    if (con->ssl.handshake_done and not con->ssl.ktls_tx)
     {
       ret= attachsql_ssl_buffer_write(con, send_buffer, 2);
     }
     else
 #endif
     {
-      uv_write_t *req= new (std::nothrow) uv_write_t;
-      ret= uv_write(req, con->uv_objects.stream, send_buffer, 2, on_write);
+      ret= attachsql_con_write(con, send_buffer, 2);
     }
   }
   if (ret < 0)
   {
     con->local_errcode= ATTACHSQL_RET_NET_WRITE_ERROR;
-    asdebug("Write fail: %s", uv_err_name(ret));
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Write fail: %s", uv_err_name(ret));
     con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
     con->next_packet_queue_used= 0;
     con->local_errcode= ATTACHSQL_RET_NET_WRITE_ERROR;
@@ -140,6 +172,9 @@ attachsql_command_status_t attachsql_get_next_row(attachsql_connect_t *con)
   attachsql_buffer_packet_read_end(con->read_buffer);
   attachsql_packet_queue_push(con, ATTACHSQL_PACKET_TYPE_ROW);
   con->command_status= ATTACHSQL_COMMAND_STATUS_READ_ROW;
+  /* The next row may not have arrived yet, polling needs to read more */
+  con->status= ATTACHSQL_CON_STATUS_BUSY;
+  attachsql_timeout_read_activity(con);
   attachsql_con_process_packets(con);
   return con->command_status;
 }
@@ -162,6 +197,7 @@ bool attachsql_command_next_result(attachsql_connect_t *con)
     attachsql_packet_queue_push(con, ATTACHSQL_PACKET_TYPE_RESPONSE);
     con->command_status= ATTACHSQL_COMMAND_STATUS_READ_RESPONSE;
     con->status= ATTACHSQL_CON_STATUS_BUSY;
+    attachsql_timeout_read_activity(con);
     return true;
   }
   return false;
@@ -21,6 +21,12 @@
 #include "sha1.h"
 #include "net.h"
 #include "query_internal.h"
+#include "dns.h"
+#include "stats.h"
+#include "log.h"
+#include "capture.h"
+#include "timeout.h"
+#include "ssl_context.h"
 #include <errno.h>
 #include <string.h>
 #ifdef HAVE_OPENSSL
@@ -77,6 +83,11 @@ void attachsql_connect_destroy(attachsql_connect_t *con)
     attachsql_query_close(con);
   }
 
+  if (con->cancel.con != NULL)
+  {
+    attachsql_connect_destroy(con->cancel.con);
+  }
+
   if (con->read_buffer != NULL)
   {
     attachsql_buffer_free(con->read_buffer);
@@ -87,55 +98,99 @@ void attachsql_connect_destroy(attachsql_connect_t *con)
     attachsql_buffer_free(con->read_buffer_compress);
   }
 
-  if (con->uncompressed_buffer != NULL)
+#ifdef HAVE_ZLIB
+  if (con->deflate_ready)
+  {
+    deflateEnd(&con->deflate_stream);
+  }
+
+  if (con->inflate_ready)
+  {
+    inflateEnd(&con->inflate_stream);
+  }
+#endif
+
+#ifdef HAVE_ZSTD
+  if (con->zstd_cctx != NULL)
   {
-    free(con->uncompressed_buffer);
+    ZSTD_freeCCtx(con->zstd_cctx);
   }
 
+  if (con->zstd_dctx != NULL)
+  {
+    ZSTD_freeDCtx(con->zstd_dctx);
+  }
+#endif
+
   if (con->compressed_buffer != NULL)
   {
     free(con->compressed_buffer);
   }
 
+  if (con->query_alloc_buffer != NULL)
+  {
+    free(con->query_alloc_buffer);
+  }
+
   if (con->next_packet_queue != NULL)
   {
     free(con->next_packet_queue);
   }
 
-#ifdef HAVE_OPENSSL
-  if (con->ssl.bio_buffer != NULL)
+  attachsql_log_free(con);
+  attachsql_capture_free(con);
+
+  if (con->pool != NULL)
   {
-    free(con->ssl.bio_buffer);
+    attachsql_timer_wheel_cancel(&con->pool->wheel, &con->timeout.entry);
+    attachsql_timer_wheel_cancel(&con->pool->wheel, &con->maintenance.entry);
+    /* Stops a recycle reconnecting when its handles finish closing */
+    con->maintenance.recycling= false;
   }
+
+#ifdef HAVE_OPENSSL
   if (con->ssl.write_buffer != NULL)
   {
     attachsql_buffer_free(con->ssl.write_buffer);
   }
-  /* This frees BIOs as well */
+  /* This frees the SSL side of the BIO pair as well */
   if (con->ssl.ssl != NULL)
   {
+    /* OpenSSL marks the session as not resumable if a connection is freed
+     * without a shutdown, only do that if the connection failed */
+    if ((con->status != ATTACHSQL_CON_STATUS_SSL_ERROR) and (con->status != ATTACHSQL_CON_STATUS_NET_ERROR))
+    {
+      SSL_set_shutdown(con->ssl.ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    }
     SSL_free(con->ssl.ssl);
   }
+  if (con->ssl.network_bio != NULL)
+  {
+    BIO_free(con->ssl.network_bio);
+  }
   if (con->ssl.context != NULL)
   {
-    SSL_CTX_free(con->ssl.context);
+    attachsql_ssl_context_destroy(con->ssl.context);
   }
 #endif
   // On a net error we already closed the connection
   if ((con->uv_objects.stream != NULL) and (con->status != ATTACHSQL_CON_STATUS_NET_ERROR))
   {
     uv_check_stop(&con->uv_objects.check);
-    if (con->pool == NULL)
+  }
+  if (con->pool == NULL)
+  {
+    /* A connection which never connected has no loop */
+    if (con->uv_objects.loop != NULL)
     {
+      /* Closes the socket and the timeout timer, a failed connect can leave
+       * either open without a stream */
       uv_walk(con->uv_objects.loop, loop_walk_cb, NULL);
       uv_run(con->uv_objects.loop, UV_RUN_DEFAULT);
+      int ret= uv_loop_close(con->uv_objects.loop);
+      assert(ret == 0);
+      delete con->uv_objects.loop;
     }
-  }
-  if (con->pool == NULL)
-  {
-    int ret= uv_loop_close(con->uv_objects.loop);
-    assert(ret == 0);
-    delete con->uv_objects.loop;
     delete con;
   }
 }
@@ -143,7 +198,73 @@ void attachsql_connect_destroy(attachsql_connect_t *con)
 void loop_walk_cb(uv_handle_t *handle, void *arg)
 {
   (void) arg;
-  uv_close(handle, NULL);
+  /* Handles closed on an error are still on the loop */
+  if (not uv_is_closing(handle))
+  {
+    uv_close(handle, NULL);
+  }
+}
+
+static void attachsql_connect_recycle_close_cb(uv_handle_t *handle)
+{
+  attachsql_connect_t *con= (attachsql_connect_t*)handle->data;
+
+  con->maintenance.closing--;
+  if ((con->maintenance.closing > 0) or not con->maintenance.recycling)
+  {
+    return;
+  }
+  aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "Reconnecting recycled connection");
+  con->status= ATTACHSQL_CON_STATUS_NOT_CONNECTED;
+  attachsql_do_connect(con);
+}
+
+void attachsql_connect_recycle(attachsql_connect_t *con)
+{
+  aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "Recycling connection %u", con->connection_id);
+  /* The quit is small enough to go straight to the socket so it is written
+   * before the close, compressed connections would need it framed */
+  if (not con->options.compression)
+  {
+    attachsql_send_internal_command(con, ATTACHSQL_COMMAND_QUIT);
+  }
+  con->maintenance.recycling= true;
+  attachsql_timeout_clear(con);
+  attachsql_timer_wheel_cancel(&con->pool->wheel, &con->maintenance.entry);
+  /* Queries sent from here wait for the new connection */
+  con->status= ATTACHSQL_CON_STATUS_CONNECTING;
+  con->maintenance.closing= 2;
+  uv_check_stop(&con->uv_objects.check);
+  uv_close((uv_handle_t*)&con->uv_objects.check, attachsql_connect_recycle_close_cb);
+  uv_close((uv_handle_t*)con->uv_objects.stream, attachsql_connect_recycle_close_cb);
+  con->uv_objects.stream= NULL;
+  con->uv_objects.connect_req.data= NULL;
+
+  /* Nothing is held by the application so this is all set up again by the
+   * handshake */
+  if (con->read_buffer != NULL)
+  {
+    attachsql_buffer_free(con->read_buffer);
+    con->read_buffer= NULL;
+  }
+  if (con->read_buffer_compress != NULL)
+  {
+    attachsql_buffer_free(con->read_buffer_compress);
+    con->read_buffer_compress= NULL;
+  }
+  con->read_paused= false;
+  con->next_packet_queue_used= 0;
+  con->packet_number= 0;
+  con->compressed_packet_number= 0;
+  con->options.compression= false;
+  con->query_buffer_length= 0;
+  con->server_errno= 0;
+  con->local_errcode= ATTACHSQL_RET_OK;
+  con->errmsg[0]= '\0';
+  con->maintenance.ping_pending= false;
+#ifdef HAVE_OPENSSL
+  attachsql_ssl_reset(con);
+#endif
 }
 
 void on_resolved(uv_getaddrinfo_t *resolver, int status, struct addrinfo *res)
@@ -151,9 +272,23 @@ void on_resolved(uv_getaddrinfo_t *resolver, int status, struct addrinfo *res)
   attachsql_connect_t *con= (attachsql_connect_t *)resolver->data;
 
   asdebug("Resolver callback");
+  con->uv_objects.resolving= false;
+  /* Timed out, the error is already set */
+  if (con->status == ATTACHSQL_CON_STATUS_NET_ERROR)
+  {
+    if (status == 0)
+    {
+      uv_freeaddrinfo(res);
+    }
+    return;
+  }
   if (status < 0)
   {
-    asdebug("DNS lookup failure: %s", uv_err_name(status));
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "DNS lookup failure: %s", uv_err_name(status));
+    if (status != UV_ECANCELED)
+    {
+      attachsql_dns_cache_store(con->host, con->port, NULL, status);
+    }
     con->status= ATTACHSQL_CON_STATUS_CONNECT_FAILED;
     con->local_errcode= ATTACHSQL_RET_DNS_ERROR;
     snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "DNS lookup failure: %s", uv_err_name(status));
@@ -162,15 +297,30 @@ void on_resolved(uv_getaddrinfo_t *resolver, int status, struct addrinfo *res)
   char addr[17] = {'\0'};
 
   uv_ip4_name((struct sockaddr_in*) res->ai_addr, addr, 16);
-  asdebug("DNS lookup success: %s", addr);
-  uv_tcp_init(resolver->loop, &con->uv_objects.socket.tcp);
-  con->uv_objects.socket.tcp.data= con;
-  con->uv_objects.connect_req.data= (void*) &con->uv_objects.socket.tcp;
-  uv_tcp_connect(&con->uv_objects.connect_req, &con->uv_objects.socket.tcp, (const struct sockaddr*) res->ai_addr, on_connect);
+  aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "DNS lookup success: %s", addr);
+  attachsql_dns_cache_store(con->host, con->port, res->ai_addr, 0);
+  attachsql_connect_tcp(con, res->ai_addr);
 
   uv_freeaddrinfo(res);
 }
 
+void attachsql_connect_tcp(attachsql_connect_t *con, const struct sockaddr *address)
+{
+  int ret;
+
+  uv_tcp_init(con->uv_objects.loop, &con->uv_objects.socket.tcp);
+  con->uv_objects.socket.tcp.data= con;
+  con->uv_objects.connect_req.data= (void*) &con->uv_objects.socket.tcp;
+  ret= uv_tcp_connect(&con->uv_objects.connect_req, &con->uv_objects.socket.tcp, address, on_connect);
+  if (ret < 0)
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Connect fail: %s", uv_err_name(ret));
+    con->local_errcode= ATTACHSQL_RET_CONNECT_ERROR;
+    con->status= ATTACHSQL_CON_STATUS_CONNECT_FAILED;
+    snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "Connection failed: %s", uv_err_name(ret));
+  }
+}
+
 attachsql_con_status_t attachsql_do_poll(attachsql_connect_t *con)
 {
   //asdebug("Connection poll");
@@ -184,18 +334,29 @@ attachsql_con_status_t attachsql_do_poll(attachsql_connect_t *con)
     return con->status;
   }
 #ifdef HAVE_OPENSSL
-  if (con->ssl.handshake_done)
+  if (con->ssl.handshake_done and not con->ssl.ktls_rx)
   {
     attachsql_ssl_run(con);
   }
 #endif
-  attachsql_run_uv_loop(con);
+  if (con->replay.data != NULL)
+  {
+    attachsql_replay_run(con);
+  }
+  else
+  {
+    attachsql_run_uv_loop(con);
+  }
 
   return con->status;
 }
 
 void attachsql_send_callback(attachsql_connect_t *con, attachsql_events_t event, attachsql_error_t *error)
 {
+  if (event == ATTACHSQL_EVENT_ERROR)
+  {
+    attachsql_log_error(con, error);
+  }
   if (event == con->last_callback)
   {
     /* We already sent this event */
@@ -210,6 +371,19 @@ void attachsql_send_callback(attachsql_connect_t *con, attachsql_events_t event,
   }
 }
 
+/* A command lost to a network or SSL failure never reaches its end packet */
+static void attachsql_connect_trace_failure(attachsql_connect_t *con)
+{
+  if (con->command_start)
+  {
+    con->command_start= 0;
+    if (con->trace_fn != NULL)
+    {
+      con->trace_fn(con, ATTACHSQL_TRACE_ERROR, con->command_id, con->command_type, uv_hrtime(), con->trace_context);
+    }
+  }
+}
+
 attachsql_return_t attachsql_connect_poll(attachsql_connect_t *con, attachsql_error_t **error)
 {
   attachsql_con_status_t status;
@@ -219,6 +393,10 @@ attachsql_return_t attachsql_connect_poll(attachsql_connect_t *con, attachsql_er
     attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Invalid connection object");
     return ATTACHSQL_RETURN_ERROR;
   }
+  if (con->cancel.con != NULL)
+  {
+    attachsql_query_cancel_poll(con);
+  }
   if (con->pool == NULL)
   {
     status= attachsql_do_poll(con);
@@ -268,6 +446,7 @@ attachsql_return_t attachsql_connect_poll(attachsql_connect_t *con, attachsql_er
       return ATTACHSQL_RETURN_PROCESSING;
       break;
     case ATTACHSQL_CON_STATUS_SSL_ERROR:
+      attachsql_connect_trace_failure(con);
       attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "08000", con->errmsg);
       attachsql_send_callback(con, ATTACHSQL_EVENT_ERROR, *error);
       return ATTACHSQL_RETURN_ERROR;
@@ -289,6 +468,11 @@ attachsql_return_t attachsql_connect_poll(attachsql_connect_t *con, attachsql_er
       }
       else if (con->command_status == ATTACHSQL_COMMAND_STATUS_ROW_IN_BUFFER)
       {
+        if (con->cancel.discarding)
+        {
+          attachsql_query_cancel_discard(con);
+          return ATTACHSQL_RETURN_PROCESSING;
+        }
         if (con->buffer_rows)
         {
           return attachsql_query_row_buffer(con, error);
@@ -316,7 +500,19 @@ attachsql_return_t attachsql_connect_poll(attachsql_connect_t *con, attachsql_er
       return ATTACHSQL_RETURN_EOF;
       break;
     case ATTACHSQL_CON_STATUS_NET_ERROR:
-      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SERVER_LOST, ATTACHSQL_ERROR_LEVEL_ERROR, "08006", con->errmsg);
+      attachsql_connect_trace_failure(con);
+      if (con->local_errcode == ATTACHSQL_RET_BAD_PROTOCOL)
+      {
+        attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_MALFORMED_PACKET, ATTACHSQL_ERROR_LEVEL_ERROR, "08S01", con->errmsg);
+      }
+      else if (con->local_errcode == ATTACHSQL_RET_TIMEOUT)
+      {
+        attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_TIMEOUT, ATTACHSQL_ERROR_LEVEL_ERROR, "HYT00", con->errmsg);
+      }
+      else
+      {
+        attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SERVER_LOST, ATTACHSQL_ERROR_LEVEL_ERROR, "08006", con->errmsg);
+      }
       attachsql_send_callback(con, ATTACHSQL_EVENT_ERROR, *error);
       return ATTACHSQL_RETURN_ERROR;
       break;
@@ -334,6 +530,33 @@ void attachsql_check_for_data_cb(uv_check_t *handle)
   attachsql_con_process_packets(con);
 }
 
+/* The capture stands in for the server, it holds the plaintext so TLS and
+ * compression are not used */
+static attachsql_con_status_t attachsql_connect_replay(attachsql_connect_t *con)
+{
+#ifdef HAVE_OPENSSL
+  if (con->ssl.ssl != NULL)
+  {
+    con->local_errcode= ATTACHSQL_RET_CONNECT_ERROR;
+    snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "SSL cannot be used when replaying a capture");
+    con->status= ATTACHSQL_CON_STATUS_CONNECT_FAILED;
+    return con->status;
+  }
+#endif
+  if (con->pool != NULL)
+  {
+    con->local_errcode= ATTACHSQL_RET_CONNECT_ERROR;
+    snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "Pool connections cannot replay a capture");
+    con->status= ATTACHSQL_CON_STATUS_CONNECT_FAILED;
+    return con->status;
+  }
+  aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "Replaying capture");
+  con->client_capabilities&= ~ATTACHSQL_CAPABILITY_ANY_COMPRESSION;
+  con->status= ATTACHSQL_CON_STATUS_CONNECTING;
+  attachsql_packet_queue_push(con, ATTACHSQL_PACKET_TYPE_HANDSHAKE);
+  return con->status;
+}
+
 attachsql_con_status_t attachsql_do_connect(attachsql_connect_t *con)
 {
   int ret;
@@ -352,6 +575,7 @@ attachsql_con_status_t attachsql_do_connect(attachsql_connect_t *con)
   {
     return con->status;
   }
+  con->connect_start= uv_hrtime();
 
   if (con->pool == NULL)
   {
@@ -359,7 +583,7 @@ attachsql_con_status_t attachsql_do_connect(attachsql_connect_t *con)
     ret= uv_loop_init(con->uv_objects.loop);
     if (ret < 0)
     {
-      asdebug("Loop initalize failure");
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Loop initalize failure");
       con->local_errcode= ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
       snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "Loop initialization failure, either out of memory or out of file descripitors (usually the latter)");
       con->status= ATTACHSQL_CON_STATUS_CONNECT_FAILED;
@@ -367,6 +591,12 @@ attachsql_con_status_t attachsql_do_connect(attachsql_connect_t *con)
     }
   }
 
+  if (con->replay.data != NULL)
+  {
+    return attachsql_connect_replay(con);
+  }
+  attachsql_timeout_connect_start(con);
+
   snprintf(con->str_port, 6, "%d", con->port);
   // If port is 0 and no explicit option set then assume we mean UDS
   // instead of TCP
@@ -384,23 +614,47 @@ attachsql_con_status_t attachsql_do_connect(attachsql_connect_t *con)
   switch(con->options.protocol)
   {
     case ATTACHSQL_CON_PROTOCOL_TCP:
-      asdebug("TCP connection");
-      asdebug("Async DNS lookup: %s", con->host);
+      aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "TCP connection");
+      con->status= ATTACHSQL_CON_STATUS_CONNECTING;
+      if (con->address_set)
+      {
+        aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "Using supplied address");
+        attachsql_connect_tcp(con, (struct sockaddr*)&con->address);
+        attachsql_run_uv_loop(con);
+        break;
+      }
+      switch (attachsql_dns_cache_lookup(con->host, con->port, &con->address, &ret))
+      {
+        case ATTACHSQL_DNS_CACHE_HIT:
+          aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "DNS cache hit: %s", con->host);
+          attachsql_connect_tcp(con, (struct sockaddr*)&con->address);
+          attachsql_run_uv_loop(con);
+          return con->status;
+        case ATTACHSQL_DNS_CACHE_NEGATIVE:
+          aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "DNS negative cache hit: %s", con->host);
+          con->local_errcode= ATTACHSQL_RET_DNS_ERROR;
+          snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "DNS lookup failure: %s", uv_err_name(ret));
+          con->status= ATTACHSQL_CON_STATUS_CONNECT_FAILED;
+          return con->status;
+        case ATTACHSQL_DNS_CACHE_MISS:
+          break;
+      }
+      aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "Async DNS lookup: %s", con->host);
       con->uv_objects.resolver.data= con;
       ret= uv_getaddrinfo(con->uv_objects.loop, &con->uv_objects.resolver, on_resolved, con->host, con->str_port, &con->uv_objects.hints);
+      con->uv_objects.resolving= (ret == 0);
       if (ret < 0)
       {
-        asdebug("DNS lookup fail: %s", uv_err_name(ret));
+        aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "DNS lookup fail: %s", uv_err_name(ret));
         con->local_errcode= ATTACHSQL_RET_DNS_ERROR;
         snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "DNS lookup failure: %s", uv_err_name(ret));
         con->status= ATTACHSQL_CON_STATUS_CONNECT_FAILED;
         return con->status;
       }
-      con->status= ATTACHSQL_CON_STATUS_CONNECTING;
       attachsql_run_uv_loop(con);
       break;
     case ATTACHSQL_CON_PROTOCOL_UDS:
-      asdebug("UDS connection");
+      aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "UDS connection");
       uv_pipe_init(con->uv_objects.loop, &con->uv_objects.socket.uds, 1);
       con->uv_objects.socket.uds.data= con;
       con->uv_objects.connect_req.data= (void*) &con->uv_objects.socket.uds;
@@ -507,10 +761,127 @@ bool attachsql_connect(attachsql_connect_t *con, attachsql_error_t **error)
   return true;
 }
 
+bool attachsql_connect_set_address(attachsql_connect_t *con, const struct sockaddr *address, attachsql_error_t **error)
+{
+  if ((con == NULL) or (address == NULL))
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Connection or address parameter not valid");
+    return false;
+  }
+
+  if (con->status != ATTACHSQL_CON_STATUS_NOT_CONNECTED)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_ALREADY_CONNECTED, ATTACHSQL_ERROR_LEVEL_ERROR, "08002", "Cannot set address after connecting");
+    return false;
+  }
+
+  memset(&con->address, 0, sizeof(con->address));
+  switch (address->sa_family)
+  {
+    case AF_INET:
+      memcpy(&con->address, address, sizeof(struct sockaddr_in));
+      break;
+    case AF_INET6:
+      memcpy(&con->address, address, sizeof(struct sockaddr_in6));
+      break;
+    default:
+      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Address family not supported");
+      return false;
+  }
+  con->address_set= true;
+  con->options.protocol= ATTACHSQL_CON_PROTOCOL_TCP;
+
+  return true;
+}
+
+attachsql_connect_t *attachsql_connect_clone(attachsql_connect_t *con, attachsql_error_t **error)
+{
+  attachsql_connect_t *new_con;
+
+  new_con= attachsql_connect_create(con->host, con->port, con->user, con->pass, con->schema, error);
+  if (new_con == NULL)
+  {
+    return NULL;
+  }
+  /* Carries the compression request, options.compression is only set once
+   * the handshake has negotiated it */
+  new_con->client_capabilities= con->client_capabilities;
+  new_con->options.protocol= con->options.protocol;
+  new_con->options.semi_block= con->options.semi_block;
+  new_con->options.connect_timeout= con->options.connect_timeout;
+  new_con->options.read_timeout= con->options.read_timeout;
+  new_con->options.write_timeout= con->options.write_timeout;
+  new_con->options.query_timeout= con->options.query_timeout;
+  new_con->options.compression_algorithm= con->options.compression_algorithm;
+  new_con->options.compression_level= con->options.compression_level;
+  new_con->options.compression_min_size= con->options.compression_min_size;
+  new_con->options.compression_min_saving= con->options.compression_min_saving;
+  new_con->options.compression_max_time= con->options.compression_max_time;
+  new_con->options.buffer_shrink_size= con->options.buffer_shrink_size;
+  new_con->options.max_buffer_size= con->options.max_buffer_size;
+  new_con->trace_fn= con->trace_fn;
+  new_con->trace_context= con->trace_context;
+  new_con->log.packet_rate= con->log.packet_rate;
+  new_con->log.packet_bytes= con->log.packet_bytes;
+  new_con->log.fn= con->log.fn;
+  new_con->log.context= con->log.context;
+  attachsql_connect_set_log_level(new_con, (attachsql_log_level_t)__atomic_load_n(&con->log.level, __ATOMIC_RELAXED));
+  if (con->address_set)
+  {
+    memcpy(&new_con->address, &con->address, sizeof(con->address));
+    new_con->address_set= true;
+  }
+#ifdef HAVE_OPENSSL
+  new_con->ssl.no_verify= con->ssl.no_verify;
+  new_con->ssl.min_version= con->ssl.min_version;
+  new_con->ssl.max_version= con->ssl.max_version;
+  new_con->ssl.ktls_requested= con->ssl.ktls_requested;
+  /* Share the context rather than loading certificates again */
+  if ((con->ssl.context != NULL) and (not attachsql_connect_set_ssl_context(new_con, con->ssl.context, error)))
+  {
+    attachsql_connect_destroy(new_con);
+    return NULL;
+  }
+#endif
+
+  return new_con;
+}
+
+static bool compression_algorithm_supported(attachsql_compression_algorithm_t algorithm)
+{
+  switch (algorithm)
+  {
+    case ATTACHSQL_COMPRESSION_ALGORITHM_ZLIB:
+#ifdef HAVE_ZLIB
+      return true;
+#else
+      return false;
+#endif
+    case ATTACHSQL_COMPRESSION_ALGORITHM_ZSTD:
+#ifdef HAVE_ZSTD
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+static bool compression_level_valid(attachsql_compression_algorithm_t algorithm, int level)
+{
+  if (level < -1)
+  {
+    return false;
+  }
+  if (algorithm == ATTACHSQL_COMPRESSION_ALGORITHM_ZSTD)
+  {
+    return (level <= ATTACHSQL_MAX_ZSTD_COMPRESSION_LEVEL);
+  }
+  return (level <= ATTACHSQL_MAX_ZLIB_COMPRESSION_LEVEL);
+}
+
 bool attachsql_connect_set_option(attachsql_connect_t *con, attachsql_options_t option, const void *arg)
 {
-  // arg option is for later
-  (void) arg;
   if (con == NULL)
   {
     return false;
@@ -553,6 +924,130 @@ bool attachsql_connect_set_option(attachsql_connect_t *con, attachsql_options_t
     case ATTACHSQL_OPTION_SEMI_BLOCKING:
       con->options.semi_block= true;
       break;
+    case ATTACHSQL_OPTION_SSL_MIN_VERSION:
+    case ATTACHSQL_OPTION_SSL_MAX_VERSION:
+#ifdef HAVE_OPENSSL
+      if ((arg == NULL) or (not attachsql_ssl_version_supported(*(const attachsql_ssl_version_t*)arg)))
+      {
+        return false;
+      }
+      if (option == ATTACHSQL_OPTION_SSL_MIN_VERSION)
+      {
+        con->ssl.min_version= *(const attachsql_ssl_version_t*)arg;
+      }
+      else
+      {
+        con->ssl.max_version= *(const attachsql_ssl_version_t*)arg;
+      }
+#else
+      return false;
+#endif
+      break;
+    case ATTACHSQL_OPTION_SSL_KTLS:
+#ifdef HAVE_OPENSSL
+      con->ssl.ktls_requested= true;
+#else
+      return false;
+#endif
+      break;
+    case ATTACHSQL_OPTION_COMPRESSION_LEVEL:
+#ifdef HAVE_ZLIB
+      if ((arg == NULL) or not compression_level_valid(con->options.compression_algorithm, *(const int*)arg))
+      {
+        return false;
+      }
+      con->options.compression_level= *(const int*)arg;
+#else
+      return false;
+#endif
+      break;
+    case ATTACHSQL_OPTION_COMPRESSION_ALGORITHM:
+      if ((arg == NULL) or (not compression_algorithm_supported(*(const attachsql_compression_algorithm_t*)arg)))
+      {
+        return false;
+      }
+      /* A level set for zstd can be out of range for zlib */
+      if (not compression_level_valid(*(const attachsql_compression_algorithm_t*)arg, con->options.compression_level))
+      {
+        return false;
+      }
+      con->options.compression_algorithm= *(const attachsql_compression_algorithm_t*)arg;
+      break;
+    case ATTACHSQL_OPTION_COMPRESSION_MIN_SIZE:
+#ifdef HAVE_ZLIB
+      if (arg == NULL)
+      {
+        return false;
+      }
+      con->options.compression_min_size= *(const size_t*)arg;
+#else
+      return false;
+#endif
+      break;
+    case ATTACHSQL_OPTION_COMPRESSION_MIN_SAVING:
+#ifdef HAVE_ZLIB
+      if ((arg == NULL) or (*(const int*)arg < 0) or (*(const int*)arg > 100))
+      {
+        return false;
+      }
+      con->options.compression_min_saving= *(const int*)arg;
+#else
+      return false;
+#endif
+      break;
+    case ATTACHSQL_OPTION_COMPRESSION_MAX_TIME:
+#ifdef HAVE_ZLIB
+      if (arg == NULL)
+      {
+        return false;
+      }
+      con->options.compression_max_time= *(const uint32_t*)arg;
+#else
+      return false;
+#endif
+      break;
+    case ATTACHSQL_OPTION_BUFFER_SHRINK_SIZE:
+      if (arg == NULL)
+      {
+        return false;
+      }
+      con->options.buffer_shrink_size= *(const size_t*)arg;
+      break;
+    case ATTACHSQL_OPTION_MAX_BUFFER_SIZE:
+      if (arg == NULL)
+      {
+        return false;
+      }
+      con->options.max_buffer_size= *(const size_t*)arg;
+      break;
+    case ATTACHSQL_OPTION_CONNECT_TIMEOUT:
+      if (arg == NULL)
+      {
+        return false;
+      }
+      con->options.connect_timeout= *(const uint32_t*)arg;
+      break;
+    case ATTACHSQL_OPTION_READ_TIMEOUT:
+      if (arg == NULL)
+      {
+        return false;
+      }
+      con->options.read_timeout= *(const uint32_t*)arg;
+      break;
+    case ATTACHSQL_OPTION_WRITE_TIMEOUT:
+      if (arg == NULL)
+      {
+        return false;
+      }
+      con->options.write_timeout= *(const uint32_t*)arg;
+      break;
+    case ATTACHSQL_OPTION_QUERY_TIMEOUT:
+      if (arg == NULL)
+      {
+        return false;
+      }
+      con->options.query_timeout= *(const uint32_t*)arg;
+      break;
     case ATTACHSQL_OPTION_NONE:
       return false;
       break;
@@ -566,15 +1061,25 @@ void on_connect(uv_connect_t *req, int status)
 {
   attachsql_connect_t *con= (attachsql_connect_t*)req->handle->data;
   asdebug("Connect event callback");
+  /* Timed out, the error is already set */
+  if (con->status == ATTACHSQL_CON_STATUS_NET_ERROR)
+  {
+    return;
+  }
   if (status < 0)
   {
-    asdebug("Connect fail: %s", uv_err_name(status));
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Connect fail: %s", uv_err_name(status));
+    /* The host may have moved (failover), so resolve it again next time */
+    if ((con->options.protocol == ATTACHSQL_CON_PROTOCOL_TCP) and (not con->address_set))
+    {
+      attachsql_dns_cache_invalidate(con->host, con->port);
+    }
     con->local_errcode= ATTACHSQL_RET_CONNECT_ERROR;
     con->status= ATTACHSQL_CON_STATUS_CONNECT_FAILED;
     snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "Connection failed: %s", uv_err_name(status));
     return;
   }
-  asdebug("Connection succeeded!");
+  aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "Connection succeeded!");
   attachsql_packet_queue_push(con, ATTACHSQL_PACKET_TYPE_HANDSHAKE);
   // maybe move the set con->stream to connect function
   con->uv_objects.stream= (uv_stream_t*)req->data;
@@ -590,22 +1095,20 @@ void on_alloc(uv_handle_t *client, size_t suggested_size, uv_buf_t *buf)
   attachsql_connect_t *con= (attachsql_connect_t*) client->data;
 
 #ifdef HAVE_OPENSSL
-  if (con->ssl.handshake_done && (con->ssl.bio_buffer_size < suggested_size))
+  /* Encrypted data is read straight into the free space of the BIO pair so
+   * it doesn't need to be copied into the BIO afterwards, once the kernel
+   * decrypts the data is plaintext and takes the normal path */
+  if (con->ssl.handshake_done and not con->ssl.ktls_rx)
   {
-    asdebug("Increasing SSL read buffer to %zd", suggested_size);
-    char *realloc_buffer= (char*)realloc(con->ssl.bio_buffer, suggested_size);
-    if (realloc_buffer)
+    char *bio_ptr= NULL;
+    int bio_free= BIO_nwrite0(con->ssl.network_bio, &bio_ptr);
+    if (bio_free < 0)
     {
-      con->ssl.bio_buffer= realloc_buffer;
-      con->ssl.bio_buffer_size= suggested_size;
-    }
-    else
-    {
-      con->local_errcode= ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
-      asdebug("SSL buffer realloc failure");
-      con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
-      con->next_packet_queue_used= 0;
+      bio_free= 0;
     }
+    buf->base= bio_ptr;
+    buf->len= (size_t)bio_free;
+    return;
   }
 #endif
 
@@ -618,13 +1121,19 @@ void on_alloc(uv_handle_t *client, size_t suggested_size, uv_buf_t *buf)
       asdebug("Creating read buffer");
       con->read_buffer= attachsql_buffer_create();
     }
+    attachsql_buffer_rewind(con->read_buffer);
     buffer_free= attachsql_buffer_get_available(con->read_buffer);
-    if (buffer_free < suggested_size)
+    if ((buffer_free < suggested_size) and attachsql_con_buffer_can_grow(con, con->read_buffer))
     {
       asdebug("Enlarging buffer, free: %zd, requested: %zd", buffer_free, suggested_size);
-      attachsql_buffer_increase(con->read_buffer);
+      attachsql_con_buffer_increase(con, con->read_buffer);
       buffer_free= attachsql_buffer_get_available(con->read_buffer);
     }
+    else if (buffer_free == 0)
+    {
+      /* libuv gets no buffer so the read callback pauses reading */
+      con->read_paused= true;
+    }
     buf->base= con->read_buffer->buffer_write_ptr;
     buf->len= buffer_free;
   }
@@ -637,52 +1146,65 @@ void on_alloc(uv_handle_t *client, size_t suggested_size, uv_buf_t *buf)
       asdebug("Creating compressed read buffer");
       con->read_buffer_compress= attachsql_buffer_create();
     }
+    attachsql_buffer_rewind(con->read_buffer_compress);
     buffer_free= attachsql_buffer_get_available(con->read_buffer_compress);
-    if (buffer_free < suggested_size)
+    if ((buffer_free < suggested_size) and attachsql_con_buffer_can_grow(con, con->read_buffer_compress))
     {
       asdebug("Enlarging compress buffer, free: %zd, requested: %zd", buffer_free, suggested_size);
-      attachsql_buffer_increase(con->read_buffer_compress);
+      attachsql_con_buffer_increase(con, con->read_buffer_compress);
       buffer_free= attachsql_buffer_get_available(con->read_buffer_compress);
     }
+    else if (buffer_free == 0)
+    {
+      con->read_paused= true;
+    }
     buf->base= con->read_buffer_compress->buffer_write_ptr;
     buf->len= buffer_free;
   }
-
-#ifdef HAVE_OPENSSL
-  if (con->ssl.handshake_done)
-  {
-    buf->base= con->ssl.bio_buffer;
-    buf->len= con->ssl.bio_buffer_size;
-  }
-#endif
 }
 
 void attachsql_packet_read_handshake(attachsql_connect_t *con)
 {
   asdebug("Connect handshake packet");
   buffer_st *buffer= con->read_buffer;
+  uint32_t upper_capabilities;
+
+  if (con->packet_size == 0)
+  {
+    attachsql_packet_malformed(con);
+    return;
+  }
 
   // Rejection error before handshake
   if ((unsigned char)buffer->buffer_read_ptr[0] == 0xff)
   {
     attachsql_packet_read_response(con);
+    return;
   }
 
   // Protocol version
   if (buffer->buffer_read_ptr[0] != 10)
   {
-    // Note that 255 is a special immediate auth fail case
-    asdebug("Bad protocol version");
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Bad protocol version");
     con->local_errcode= ATTACHSQL_RET_BAD_PROTOCOL;
     snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "Incompatible protocol version");
+    con->next_packet_queue_used= 0;
+    con->status= ATTACHSQL_CON_STATUS_CONNECT_FAILED;
     return;
   }
 
   // Server version (null-terminated string)
   buffer->buffer_read_ptr++;
+  char *version_end= (char*)memchr(buffer->buffer_read_ptr, '\0', attachsql_packet_remaining(buffer));
+  // The thread ID to the end of the scramble is 43 bytes
+  if ((version_end == NULL) or ((size_t)(buffer->packet_end_ptr - version_end) < 44))
+  {
+    attachsql_packet_malformed(con);
+    return;
+  }
   strncpy(con->server_version, buffer->buffer_read_ptr, ATTACHSQL_MAX_SERVER_VERSION_LEN);
   con->server_version[ATTACHSQL_MAX_SERVER_VERSION_LEN - 1]= '\0';
-  buffer->buffer_read_ptr+= strlen(con->server_version) + 1;
+  buffer->buffer_read_ptr= version_end + 1;
 
   // Thread ID
   con->thread_id= attachsql_unpack_int4(buffer->buffer_read_ptr);
@@ -698,7 +1220,7 @@ void attachsql_packet_read_handshake(attachsql_connect_t *con)
   // Check MySQL 4.1 protocol capability is on, we won't support old auth
   if (not (con->server_capabilities & ATTACHSQL_CAPABILITY_PROTOCOL_41))
   {
-    asdebug("MySQL <4.1 Auth not supported");
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "MySQL <4.1 Auth not supported");
     con->local_errcode= ATTACHSQL_RET_NO_OLD_AUTH;
     snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "MySQL 4.1 protocol and higher required");
   }
@@ -707,6 +1229,10 @@ void attachsql_packet_read_handshake(attachsql_connect_t *con)
   buffer->buffer_read_ptr++;
 
   con->server_status= attachsql_unpack_int2(buffer->buffer_read_ptr);
+  // Upper capabilities, only the ones acted on are kept
+  upper_capabilities= (uint32_t)attachsql_unpack_int2(buffer->buffer_read_ptr + 2) << 16;
+  upper_capabilities&= (ATTACHSQL_CAPABILITY_PLUGIN_AUTH | ATTACHSQL_CAPABILITY_ZSTD_COMPRESSION);
+  con->server_capabilities= (attachsql_capabilities_t)(con->server_capabilities | upper_capabilities);
   // 13 byte filler and unrequired scramble length (until auth plugins)
   buffer->buffer_read_ptr+= 15;
 
@@ -726,19 +1252,39 @@ void attachsql_handshake_response(attachsql_connect_t *con)
   unsigned char *buffer_ptr;
   uint32_t capabilities;
 
-  asdebug("Sending handshake response");
+  aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Sending handshake response");
   buffer_ptr= (unsigned char*)con->write_buffer;
 
   capabilities= con->server_capabilities & ATTACHSQL_CAPABILITY_CLIENT;
   capabilities|= ATTACHSQL_CAPABILITY_MULTI_RESULTS;
   capabilities|= con->client_capabilities;
 
+#ifdef HAVE_ZLIB
+  /* zstd needs server support, otherwise fall back to zlib */
+  if (capabilities & ATTACHSQL_CAPABILITY_ANY_COMPRESSION)
+  {
+    capabilities&= ~ATTACHSQL_CAPABILITY_ANY_COMPRESSION;
+#ifdef HAVE_ZSTD
+    if ((con->options.compression_algorithm == ATTACHSQL_COMPRESSION_ALGORITHM_ZSTD) and (con->server_capabilities & ATTACHSQL_CAPABILITY_ZSTD_COMPRESSION))
+    {
+      capabilities|= ATTACHSQL_CAPABILITY_ZSTD_COMPRESSION;
+    }
+    else
+#endif
+    {
+      capabilities|= ATTACHSQL_CAPABILITY_COMPRESS;
+    }
+    con->client_capabilities&= ~ATTACHSQL_CAPABILITY_ANY_COMPRESSION;
+    con->client_capabilities|= (capabilities & ATTACHSQL_CAPABILITY_ANY_COMPRESSION);
+  }
+#endif
+
 #ifdef HAVE_OPENSSL
   if (con->ssl.ssl != NULL)
   {
     if (not (con->server_capabilities & ATTACHSQL_CAPABILITY_SSL))
     {
-      asdebug("SSL disabled on server");
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "SSL disabled on server");
       con->local_errcode= ATTACHSQL_RET_NET_SSL_ERROR;
       snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "SSL auth not supported enabled on server");
       con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
@@ -806,7 +1352,7 @@ void attachsql_handshake_response(attachsql_connect_t *con)
     ret= scramble_password(con, (unsigned char*)buffer_ptr);
     if (ret != ATTACHSQL_RET_OK)
     {
-      asdebug("Scramble problem!");
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Scramble problem!");
       con->local_errcode= ATTACHSQL_RET_BAD_SCRAMBLE;
       return;
     }
@@ -825,6 +1371,21 @@ void attachsql_handshake_response(attachsql_connect_t *con)
   }
   buffer_ptr[0]= '\0';
   buffer_ptr++;
+
+  // Auth plugin the scramble above was made for
+  if (capabilities & ATTACHSQL_CAPABILITY_PLUGIN_AUTH)
+  {
+    memcpy(buffer_ptr, ATTACHSQL_AUTH_PLUGIN_NAME, sizeof(ATTACHSQL_AUTH_PLUGIN_NAME));
+    buffer_ptr+= sizeof(ATTACHSQL_AUTH_PLUGIN_NAME);
+  }
+#ifdef HAVE_ZSTD
+  // The level the server should compress with, after the plugin name
+  if (capabilities & ATTACHSQL_CAPABILITY_ZSTD_COMPRESSION)
+  {
+    buffer_ptr[0]= (unsigned char)attachsql_zstd_level(con);
+    buffer_ptr++;
+  }
+#endif
   attachsql_send_data(con, con->write_buffer, (size_t)(buffer_ptr - (unsigned char*)con->write_buffer));
   attachsql_packet_queue_push(con, ATTACHSQL_PACKET_TYPE_RESPONSE);
 }
@@ -838,7 +1399,7 @@ attachsql_ret_t scramble_password(attachsql_connect_t *con, unsigned char *buffe
 
   if (con->scramble_buffer[0] == '\0')
   {
-    asdebug("No scramble supplied from server");
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "No scramble supplied from server");
     return ATTACHSQL_RET_NO_SCRAMBLE;
   }
 
@@ -884,77 +1445,106 @@ uint32_t attachsql_connect_get_connection_id(attachsql_connect_t *con)
   return con->thread_id;
 }
 
-#ifdef HAVE_OPENSSL
-bool attachsql_connect_set_ssl(attachsql_connect_t *con, const char *key, const char *cert, const char *ca, const char *capath, const char *cipher, bool verify, attachsql_error_t **error)
+size_t attachsql_connect_get_buffer_size(attachsql_connect_t *con)
 {
   if (con == NULL)
   {
-    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Connection parameter not valid");
-    return false;
+    return 0;
   }
+  return attachsql_con_buffer_size(con);
+}
 
-  con->ssl.context= SSL_CTX_new(TLSv1_client_method());
-
-  if (cipher != NULL)
+void attachsql_connect_get_stats(attachsql_connect_t *con, attachsql_connect_stats_st *stats)
+{
+  if ((con == NULL) or (stats == NULL))
   {
-    if (SSL_CTX_set_cipher_list(con->ssl.context, cipher) != 1)
-    {
-      strncpy(con->errmsg, "Error setting SSL cipher list", ATTACHSQL_ERROR_BUFFER_SIZE - 1);
-      con->errmsg[ATTACHSQL_ERROR_BUFFER_SIZE - 1]= '\0';
-      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", con->errmsg);
-      return false;
-    }
+    return;
   }
+  attachsql_stats_copy(stats, &con->stats);
+}
 
-  if (SSL_CTX_load_verify_locations(con->ssl.context, ca, capath) != 1)
+bool attachsql_connect_set_trace_callback(attachsql_connect_t *con, attachsql_trace_fn *function, void *context)
+{
+  if (con == NULL)
   {
-    strncpy(con->errmsg, "Error loading the SSL certificate authority file", ATTACHSQL_ERROR_BUFFER_SIZE -1);
-    con->errmsg[ATTACHSQL_ERROR_BUFFER_SIZE - 1]= '\0';
-    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", con->errmsg);
     return false;
   }
+  con->trace_fn= function;
+  con->trace_context= context;
+  return true;
+}
+
+bool attachsql_connect_set_log_level(attachsql_connect_t *con, attachsql_log_level_t level)
+{
+  attachsql_log_record_st *records;
+  attachsql_log_record_st *expected= NULL;
 
-  if (cert != NULL)
+  if ((con == NULL) or (level > ATTACHSQL_LOG_LEVEL_PACKET))
+  {
+    return false;
+  }
+  /* The ring is only allocated once logging is first enabled and is kept
+   * until the connection is destroyed */
+  if ((level != ATTACHSQL_LOG_LEVEL_NONE) and (__atomic_load_n(&con->log.records, __ATOMIC_ACQUIRE) == NULL))
   {
-    if (SSL_CTX_use_certificate_file(con->ssl.context, cert, SSL_FILETYPE_PEM) != 1)
+    records= new (std::nothrow) attachsql_log_record_st[ATTACHSQL_LOG_RECORDS];
+    if (records == NULL)
     {
-      strncpy(con->errmsg, "Error loading the SSL certificate file", ATTACHSQL_ERROR_BUFFER_SIZE - 1);
-      con->errmsg[ATTACHSQL_ERROR_BUFFER_SIZE - 1]= '\0';
-      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", con->errmsg);
       return false;
     }
-
-    if (key == NULL)
+    if (not __atomic_compare_exchange_n(&con->log.records, &expected, records, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
     {
-      key= cert;
+      delete[] records;
     }
+  }
+  __atomic_store_n(&con->log.level, (uint8_t)level, __ATOMIC_RELAXED);
+  return true;
+}
 
-    if (SSL_CTX_use_PrivateKey_file(con->ssl.context, key, SSL_FILETYPE_PEM) != 1)
-    {
-      strncpy(con->errmsg, "Cannot load the SSL key file", ATTACHSQL_ERROR_BUFFER_SIZE - 1);
-      con->errmsg[ATTACHSQL_ERROR_BUFFER_SIZE - 1]= '\0';
-      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", con->errmsg);
-      return false;
-    }
+bool attachsql_connect_set_log_sampling(attachsql_connect_t *con, uint32_t packet_rate, uint16_t packet_bytes)
+{
+  if (con == NULL)
+  {
+    return false;
+  }
+  con->log.packet_rate= packet_rate;
+  con->log.packet_bytes= packet_bytes;
+  return true;
+}
 
-    if (SSL_CTX_check_private_key(con->ssl.context) != 1)
-    {
-      strncpy(con->errmsg, "Error validating the SSL private key", ATTACHSQL_ERROR_BUFFER_SIZE - 1);
-      con->errmsg[ATTACHSQL_ERROR_BUFFER_SIZE - 1]= '\0';
-      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", con->errmsg);
-      return false;
-    }
+bool attachsql_connect_set_log_callback(attachsql_connect_t *con, attachsql_log_fn *function, void *context)
+{
+  if (con == NULL)
+  {
+    return false;
+  }
+  con->log.fn= function;
+  con->log.context= context;
+  return true;
+}
+
+#ifdef HAVE_OPENSSL
+bool attachsql_connect_set_ssl(attachsql_connect_t *con, const char *key, const char *cert, const char *ca, const char *capath, const char *cipher, bool verify, attachsql_error_t **error)
+{
+  attachsql_ssl_context_t *ctx;
+  bool ret;
+
+  if (con == NULL)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Connection parameter not valid");
+    return false;
   }
 
-  if (verify)
+  ctx= attachsql_ssl_context_create(key, cert, ca, capath, cipher, verify, error);
+  if (ctx == NULL)
   {
-    SSL_CTX_set_verify(con->ssl.context, SSL_VERIFY_PEER, NULL);
+    return false;
   }
-  con->ssl.ssl= SSL_new(con->ssl.context);
-  /* force client handshake mode to allow SSL_write before handshake complete */
-  SSL_set_connect_state(con->ssl.ssl);
+  ret= attachsql_connect_set_ssl_context(con, ctx, error);
+  /* The connection now holds the only reference */
+  attachsql_ssl_context_destroy(ctx);
 
-  return true;
+  return ret;
 }
 #else
 bool attachsql_connect_set_ssl(attachsql_connect_t *con, const char *key, const char *cert, const char *ca, const char *capath, const char *cipher, bool verify, attachsql_error_t **error)
@@ -37,8 +37,15 @@ attachsql_con_status_t attachsql_do_poll(attachsql_connect_t *con);
 
 void loop_walk_cb(uv_handle_t *handle, void *arg);
 
+/* Closes an idle pool connection and connects it again in its place */
+void attachsql_connect_recycle(attachsql_connect_t *con);
+
 void on_resolved(uv_getaddrinfo_t *resolver, int status, struct addrinfo *res);
 
+void attachsql_connect_tcp(attachsql_connect_t *con, const struct sockaddr *address);
+
+attachsql_connect_t *attachsql_connect_clone(attachsql_connect_t *con, attachsql_error_t **error);
+
 void on_connect(uv_connect_t *req, int status);
 
 void attachsql_packet_read_handshake(attachsql_connect_t *con);
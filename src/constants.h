@@ -33,9 +33,24 @@ extern "C" {
 #define ATTACHSQL_MAX_DEFAULT_VALUE_SIZE 2048
 #define ATTACHSQL_MAX_MESSAGE_LEN 2048
 #define ATTACHSQL_WRITE_BUFFER_SIZE 1024
+/* The only auth plugin scramble_password() implements */
+#define ATTACHSQL_AUTH_PLUGIN_NAME "mysql_native_password"
 #define ATTACHSQL_MINIMUM_COMPRESS_SIZE 50
+/* Minimum saving in percent for compression to carry on */
+#define ATTACHSQL_MINIMUM_COMPRESS_SAVING 10
+/* While compression is skipped every Nth packet is compressed to measure again */
+#define ATTACHSQL_COMPRESS_PROBE_INTERVAL 16
+/* Highest compression level of each algorithm, -1 is the default for both */
+#define ATTACHSQL_MAX_ZLIB_COMPRESSION_LEVEL 9
+#define ATTACHSQL_MAX_ZSTD_COMPRESSION_LEVEL 22
 #define ATTACHSQL_STMT_EXEC_DEFAULT_SIZE 16*1024
 #define ATTACHSQL_DEFAULT_PACKET_QUEUE_SIZE 64
+/* Records kept in a connection's log ring, must be a power of two */
+#define ATTACHSQL_LOG_RECORDS 256
+#define ATTACHSQL_LOG_MESSAGE_SIZE 120
+/* By default every packet is dumped at the packet log level, up to 64 bytes */
+#define ATTACHSQL_DEFAULT_LOG_PACKET_RATE 1
+#define ATTACHSQL_DEFAULT_LOG_PACKET_BYTES 64
 
 #define ATTACHSQL_STMT_PARAM_UNSIGNED_BIT 0x8000
 
@@ -81,7 +96,8 @@ enum attachsql_packet_type_t
   ATTACHSQL_PACKET_TYPE_PREPARE_COLUMN,
   ATTACHSQL_PACKET_TYPE_COLUMN,
   ATTACHSQL_PACKET_TYPE_ROW,
-  ATTACHSQL_PACKET_TYPE_STMT_ROW
+  ATTACHSQL_PACKET_TYPE_STMT_ROW,
+  ATTACHSQL_PACKET_TYPE_KEEPALIVE
 };
 
 enum attachsql_capabilities_t
@@ -106,6 +122,7 @@ enum attachsql_capabilities_t
   ATTACHSQL_CAPABILITY_MULTI_STATEMENTS=   (1 << 16),
   ATTACHSQL_CAPABILITY_MULTI_RESULTS=      (1 << 17),
   ATTACHSQL_CAPABILITY_PLUGIN_AUTH=        (1 << 19),
+  ATTACHSQL_CAPABILITY_ZSTD_COMPRESSION=   (1 << 26),
   ATTACHSQL_CAPABILITY_CLIENT=            (ATTACHSQL_CAPABILITY_LONG_PASSWORD    |
                                         ATTACHSQL_CAPABILITY_FOUND_ROWS       |
                                         ATTACHSQL_CAPABILITY_LONG_FLAG        |
@@ -113,7 +130,9 @@ enum attachsql_capabilities_t
                                         ATTACHSQL_CAPABILITY_PLUGIN_AUTH      |
                                         ATTACHSQL_CAPABILITY_TRANSACTIONS     |
                                         ATTACHSQL_CAPABILITY_PROTOCOL_41      |
-                                        ATTACHSQL_CAPABILITY_SERCURE_CONNECTION)
+                                        ATTACHSQL_CAPABILITY_SERCURE_CONNECTION),
+  ATTACHSQL_CAPABILITY_ANY_COMPRESSION=   (ATTACHSQL_CAPABILITY_COMPRESS |
+                                        ATTACHSQL_CAPABILITY_ZSTD_COMPRESSION)
 };
 
 
@@ -0,0 +1,231 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "config.h"
+#include "common.h"
+#include "dns.h"
+
+/* Process-wide resolver cache shared by every connection and pool.  The
+ * number of distinct hosts an application talks to is small so entries
+ * are kept in a flat array and searched linearly. */
+
+#define DNS_CACHE_NS_PER_SEC ((uint64_t)1000000000)
+
+struct dns_cache_entry_st
+{
+  char *host;
+  in_port_t port;
+  bool negative;
+  int error;
+  struct sockaddr_storage address;
+  uint64_t expires;
+};
+
+static uv_once_t dns_cache_once= UV_ONCE_INIT;
+static uv_mutex_t dns_cache_mutex;
+static dns_cache_entry_st dns_cache_entries[ATTACHSQL_DNS_CACHE_MAX_ENTRIES];
+static size_t dns_cache_entry_count= 0;
+static uint64_t dns_cache_ttl= ATTACHSQL_DNS_CACHE_DEFAULT_TTL * DNS_CACHE_NS_PER_SEC;
+static uint64_t dns_cache_negative_ttl= ATTACHSQL_DNS_CACHE_DEFAULT_NEGATIVE_TTL * DNS_CACHE_NS_PER_SEC;
+static attachsql_dns_cache_stats_st dns_cache_stats;
+
+static void dns_cache_init(void)
+{
+  uv_mutex_init(&dns_cache_mutex);
+  memset(&dns_cache_stats, 0, sizeof(dns_cache_stats));
+}
+
+/* Must be called with the mutex held */
+static void dns_cache_remove(size_t entry)
+{
+  free(dns_cache_entries[entry].host);
+  dns_cache_entry_count--;
+  if (entry != dns_cache_entry_count)
+  {
+    dns_cache_entries[entry]= dns_cache_entries[dns_cache_entry_count];
+  }
+}
+
+/* Must be called with the mutex held */
+static ssize_t dns_cache_find(const char *host, in_port_t port)
+{
+  size_t entry;
+
+  for (entry= 0; entry < dns_cache_entry_count; entry++)
+  {
+    if ((dns_cache_entries[entry].port == port) and (strcmp(dns_cache_entries[entry].host, host) == 0))
+    {
+      return (ssize_t)entry;
+    }
+  }
+  return -1;
+}
+
+attachsql_dns_cache_result_t attachsql_dns_cache_lookup(const char *host, in_port_t port, struct sockaddr_storage *address, int *error)
+{
+  ssize_t entry;
+  attachsql_dns_cache_result_t result= ATTACHSQL_DNS_CACHE_MISS;
+
+  uv_once(&dns_cache_once, dns_cache_init);
+  uv_mutex_lock(&dns_cache_mutex);
+  entry= dns_cache_find(host, port);
+  if ((entry >= 0) and (dns_cache_entries[entry].expires <= uv_hrtime()))
+  {
+    dns_cache_remove((size_t)entry);
+    dns_cache_stats.expired++;
+    entry= -1;
+  }
+  if (entry < 0)
+  {
+    dns_cache_stats.misses++;
+  }
+  else if (dns_cache_entries[entry].negative)
+  {
+    dns_cache_stats.negative_hits++;
+    *error= dns_cache_entries[entry].error;
+    result= ATTACHSQL_DNS_CACHE_NEGATIVE;
+  }
+  else
+  {
+    dns_cache_stats.hits++;
+    memcpy(address, &dns_cache_entries[entry].address, sizeof(struct sockaddr_storage));
+    result= ATTACHSQL_DNS_CACHE_HIT;
+  }
+  uv_mutex_unlock(&dns_cache_mutex);
+
+  return result;
+}
+
+void attachsql_dns_cache_store(const char *host, in_port_t port, const struct sockaddr *address, int error)
+{
+  ssize_t entry;
+  size_t oldest;
+  uint64_t ttl;
+  uint64_t now;
+  size_t address_length= 0;
+  char *host_copy;
+
+  uv_once(&dns_cache_once, dns_cache_init);
+  if (address != NULL)
+  {
+    if (address->sa_family == AF_INET6)
+    {
+      address_length= sizeof(struct sockaddr_in6);
+    }
+    else if (address->sa_family == AF_INET)
+    {
+      address_length= sizeof(struct sockaddr_in);
+    }
+    else
+    {
+      return;
+    }
+  }
+
+  uv_mutex_lock(&dns_cache_mutex);
+  ttl= (address == NULL) ? dns_cache_negative_ttl : dns_cache_ttl;
+  if (ttl == 0)
+  {
+    uv_mutex_unlock(&dns_cache_mutex);
+    return;
+  }
+  now= uv_hrtime();
+  entry= dns_cache_find(host, port);
+  if (entry < 0)
+  {
+    host_copy= strdup(host);
+    if (host_copy == NULL)
+    {
+      uv_mutex_unlock(&dns_cache_mutex);
+      return;
+    }
+    if (dns_cache_entry_count == ATTACHSQL_DNS_CACHE_MAX_ENTRIES)
+    {
+      /* Full, evict whichever entry expires first */
+      oldest= 0;
+      for (size_t pos= 1; pos < dns_cache_entry_count; pos++)
+      {
+        if (dns_cache_entries[pos].expires < dns_cache_entries[oldest].expires)
+        {
+          oldest= pos;
+        }
+      }
+      dns_cache_remove(oldest);
+    }
+    entry= (ssize_t)dns_cache_entry_count;
+    dns_cache_entry_count++;
+    dns_cache_entries[entry].host= host_copy;
+    dns_cache_entries[entry].port= port;
+  }
+  dns_cache_entries[entry].expires= now + ttl;
+  dns_cache_entries[entry].error= error;
+  dns_cache_entries[entry].negative= (address == NULL);
+  memset(&dns_cache_entries[entry].address, 0, sizeof(struct sockaddr_storage));
+  if (address != NULL)
+  {
+    memcpy(&dns_cache_entries[entry].address, address, address_length);
+  }
+  uv_mutex_unlock(&dns_cache_mutex);
+}
+
+void attachsql_dns_cache_invalidate(const char *host, in_port_t port)
+{
+  ssize_t entry;
+
+  uv_once(&dns_cache_once, dns_cache_init);
+  uv_mutex_lock(&dns_cache_mutex);
+  entry= dns_cache_find(host, port);
+  if (entry >= 0)
+  {
+    asdebug("Invalidating DNS cache entry for %s:%d", host, port);
+    dns_cache_remove((size_t)entry);
+    dns_cache_stats.invalidated++;
+  }
+  uv_mutex_unlock(&dns_cache_mutex);
+}
+
+void attachsql_library_set_dns_cache_ttl(uint32_t ttl, uint32_t negative_ttl)
+{
+  uv_once(&dns_cache_once, dns_cache_init);
+  uv_mutex_lock(&dns_cache_mutex);
+  dns_cache_ttl= ttl * DNS_CACHE_NS_PER_SEC;
+  dns_cache_negative_ttl= negative_ttl * DNS_CACHE_NS_PER_SEC;
+  uv_mutex_unlock(&dns_cache_mutex);
+}
+
+void attachsql_library_flush_dns_cache(void)
+{
+  uv_once(&dns_cache_once, dns_cache_init);
+  uv_mutex_lock(&dns_cache_mutex);
+  while (dns_cache_entry_count > 0)
+  {
+    dns_cache_remove(dns_cache_entry_count - 1);
+  }
+  uv_mutex_unlock(&dns_cache_mutex);
+}
+
+void attachsql_library_get_dns_cache_stats(attachsql_dns_cache_stats_st *stats)
+{
+  if (stats == NULL)
+  {
+    return;
+  }
+  uv_once(&dns_cache_once, dns_cache_init);
+  uv_mutex_lock(&dns_cache_mutex);
+  memcpy(stats, &dns_cache_stats, sizeof(attachsql_dns_cache_stats_st));
+  stats->entries= (uint32_t)dns_cache_entry_count;
+  uv_mutex_unlock(&dns_cache_mutex);
+}
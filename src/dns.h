@@ -0,0 +1,48 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "common.h"
+#ifndef _WIN32
+# include <sys/socket.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Defaults in seconds, a TTL of 0 disables that side of the cache */
+#define ATTACHSQL_DNS_CACHE_DEFAULT_TTL 30
+#define ATTACHSQL_DNS_CACHE_DEFAULT_NEGATIVE_TTL 5
+#define ATTACHSQL_DNS_CACHE_MAX_ENTRIES 256
+
+enum attachsql_dns_cache_result_t
+{
+  ATTACHSQL_DNS_CACHE_MISS,
+  ATTACHSQL_DNS_CACHE_HIT,
+  ATTACHSQL_DNS_CACHE_NEGATIVE
+};
+
+attachsql_dns_cache_result_t attachsql_dns_cache_lookup(const char *host, in_port_t port, struct sockaddr_storage *address, int *error);
+
+void attachsql_dns_cache_store(const char *host, in_port_t port, const struct sockaddr *address, int error);
+
+void attachsql_dns_cache_invalidate(const char *host, in_port_t port);
+
+#ifdef __cplusplus
+}
+#endif
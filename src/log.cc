@@ -0,0 +1,230 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "config.h"
+#include "common.h"
+#include "log.h"
+#include <stdarg.h>
+#include <inttypes.h>
+
+/* The ring is single writer, the thread running the connection, and any
+ * thread can read it.  A record's sequence is zeroed before it is written
+ * and set afterwards so readers can spot records overwritten under them. */
+
+#define ATTACHSQL_LOG_HEX_LINE_BYTES 16
+/* Enough for a formatted record including a long source path */
+#define ATTACHSQL_LOG_LINE_SIZE (ATTACHSQL_LOG_MESSAGE_SIZE + 128)
+
+static const char *attachsql_log_level_names[]= { "NONE", "ERROR", "WARNING", "INFO", "DEBUG", "PACKET" };
+
+static void attachsql_log_vwrite(attachsql_connect_t *con, attachsql_log_level_t level, const char *file, uint32_t line, const char *format, va_list args)
+{
+  attachsql_log_record_st *records;
+  attachsql_log_record_st *record;
+  uint64_t head;
+
+  records= __atomic_load_n(&con->log.records, __ATOMIC_ACQUIRE);
+  if (records == NULL)
+  {
+    return;
+  }
+  head= con->log.head;
+  record= &records[head & (ATTACHSQL_LOG_RECORDS - 1)];
+  __atomic_store_n(&record->sequence, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  record->timestamp= uv_hrtime();
+  record->file= file;
+  record->line= line;
+  record->level= level;
+  vsnprintf(record->message, ATTACHSQL_LOG_MESSAGE_SIZE, format, args);
+  __atomic_store_n(&record->sequence, head + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&con->log.head, head + 1, __ATOMIC_RELEASE);
+}
+
+__attribute__((__format__ (__printf__, 5, 6)))
+void attachsql_log_write(attachsql_connect_t *con, attachsql_log_level_t level, const char *file, uint32_t line, const char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  attachsql_log_vwrite(con, level, file, line, format, args);
+  va_end(args);
+}
+
+void attachsql_log_hex(attachsql_connect_t *con, const char *file, uint32_t line, const char *data, size_t length)
+{
+  char text[ATTACHSQL_LOG_MESSAGE_SIZE];
+  size_t dump_length;
+  size_t offset;
+  size_t pos;
+  size_t it;
+  unsigned char byte;
+
+  /* Only one in packet_rate packets is dumped, a rate of 0 dumps none */
+  if ((con->log.packet_rate == 0) or ((con->log.packet_count++ % con->log.packet_rate) != 0))
+  {
+    return;
+  }
+  dump_length= length;
+  if (dump_length > con->log.packet_bytes)
+  {
+    dump_length= con->log.packet_bytes;
+  }
+  attachsql_log_write(con, ATTACHSQL_LOG_LEVEL_PACKET, file, line, "Packet data, %zu bytes, dumping %zu", length, dump_length);
+  for (offset= 0; offset < dump_length; offset+= ATTACHSQL_LOG_HEX_LINE_BYTES)
+  {
+    pos= snprintf(text, sizeof(text), "%04zx: ", offset);
+    for (it= offset; it < offset + ATTACHSQL_LOG_HEX_LINE_BYTES; it++)
+    {
+      if (it < dump_length)
+      {
+        pos+= snprintf(text + pos, sizeof(text) - pos, "%02X ", (unsigned char)data[it]);
+      }
+      else
+      {
+        pos+= snprintf(text + pos, sizeof(text) - pos, "   ");
+      }
+    }
+    for (it= offset; (it < offset + ATTACHSQL_LOG_HEX_LINE_BYTES) and (it < dump_length); it++)
+    {
+      byte= (unsigned char)data[it];
+      text[pos++]= ((byte < 0x20) or (byte > 0x7e)) ? '.' : (char)byte;
+    }
+    text[pos]= '\0';
+    attachsql_log_write(con, ATTACHSQL_LOG_LEVEL_PACKET, file, line, "%s", text);
+  }
+}
+
+static bool attachsql_log_record_read(attachsql_log_record_st *records, uint64_t sequence, attachsql_log_record_st *copy)
+{
+  attachsql_log_record_st *record= &records[sequence & (ATTACHSQL_LOG_RECORDS - 1)];
+  uint64_t before;
+  uint64_t after;
+
+  before= __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+  if (before != sequence + 1)
+  {
+    return false;
+  }
+  memcpy(copy, record, sizeof(attachsql_log_record_st));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  after= __atomic_load_n(&record->sequence, __ATOMIC_RELAXED);
+  copy->message[ATTACHSQL_LOG_MESSAGE_SIZE - 1]= '\0';
+  return (before == after);
+}
+
+static int attachsql_log_record_format(attachsql_log_record_st *record, char *buffer, size_t length)
+{
+  return snprintf(buffer, length, "%" PRIu64 ".%06" PRIu64 " %s %s:%" PRIu32 " %s\n",
+    record->timestamp / 1000000000, (record->timestamp / 1000) % 1000000,
+    attachsql_log_level_names[record->level], record->file, record->line, record->message);
+}
+
+size_t attachsql_connect_get_log(attachsql_connect_t *con, char *buffer, size_t length)
+{
+  attachsql_log_record_st *records;
+  attachsql_log_record_st record;
+  uint64_t head;
+  uint64_t first;
+  uint64_t start;
+  uint64_t sequence;
+  size_t total= 0;
+  size_t pos= 0;
+  int line_length;
+
+  if ((con == NULL) or (buffer == NULL) or (length == 0))
+  {
+    return 0;
+  }
+  buffer[0]= '\0';
+  records= __atomic_load_n(&con->log.records, __ATOMIC_ACQUIRE);
+  if (records == NULL)
+  {
+    return 0;
+  }
+  head= __atomic_load_n(&con->log.head, __ATOMIC_ACQUIRE);
+  first= (head > ATTACHSQL_LOG_RECORDS) ? head - ATTACHSQL_LOG_RECORDS : 0;
+
+  /* Work back from the newest record to find how many fit the buffer */
+  for (start= head; start > first; start--)
+  {
+    if (not attachsql_log_record_read(records, start - 1, &record))
+    {
+      break;
+    }
+    line_length= attachsql_log_record_format(&record, NULL, 0);
+    if (total + line_length >= length)
+    {
+      break;
+    }
+    total+= line_length;
+  }
+
+  for (sequence= start; sequence < head; sequence++)
+  {
+    if (not attachsql_log_record_read(records, sequence, &record))
+    {
+      continue;
+    }
+    line_length= attachsql_log_record_format(&record, buffer + pos, length - pos);
+    if ((size_t)line_length >= length - pos)
+    {
+      buffer[pos]= '\0';
+      break;
+    }
+    pos+= line_length;
+  }
+  return pos;
+}
+
+void attachsql_log_error(attachsql_connect_t *con, attachsql_error_t *error)
+{
+  char *dump;
+  size_t dump_length;
+
+  if (not ATTACHSQL_LOG_ENABLED(con, ATTACHSQL_LOG_LEVEL_ERROR))
+  {
+    return;
+  }
+  /* Nothing new has been logged, this is the last error being polled again */
+  if ((con->log.dumped != 0) and (con->log.head == con->log.dumped))
+  {
+    return;
+  }
+  if (error != NULL)
+  {
+    attachsql_log_write(con, ATTACHSQL_LOG_LEVEL_ERROR, __FILE__, __LINE__, "Error %d (%s): %s", error->code, error->sqlstate, error->msg);
+  }
+  con->log.dumped= con->log.head;
+  if (con->log.fn == NULL)
+  {
+    return;
+  }
+  dump= (char*)malloc(ATTACHSQL_LOG_RECORDS * ATTACHSQL_LOG_LINE_SIZE);
+  if (dump == NULL)
+  {
+    return;
+  }
+  dump_length= attachsql_connect_get_log(con, dump, ATTACHSQL_LOG_RECORDS * ATTACHSQL_LOG_LINE_SIZE);
+  con->log.fn(con, dump, dump_length, con->log.context);
+  free(dump);
+}
+
+void attachsql_log_free(attachsql_connect_t *con)
+{
+  delete[] con->log.records;
+  con->log.records= NULL;
+}
@@ -0,0 +1,57 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#pragma once
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The level can be changed from any thread, reading it is a single relaxed
+ * load and compare so logging costs one branch when it is disabled */
+#define ATTACHSQL_LOG_ENABLED(CON, LEVEL) __builtin_expect(__atomic_load_n(&(CON)->log.level, __ATOMIC_RELAXED) >= (LEVEL), 0)
+
+/* Debug builds still get everything on stderr from asdebug */
+#define aslog(CON, LEVEL, MSG, ...) do { \
+  asdebug(MSG, ##__VA_ARGS__); \
+  if (ATTACHSQL_LOG_ENABLED(CON, LEVEL)) \
+  { \
+    attachsql_log_write(CON, LEVEL, __FILE__, __LINE__, MSG, ##__VA_ARGS__); \
+  } \
+} while(0)
+
+#define aslog_hex(CON, DATA, LEN) do { \
+  asdebug_hex(DATA, LEN); \
+  if (ATTACHSQL_LOG_ENABLED(CON, ATTACHSQL_LOG_LEVEL_PACKET)) \
+  { \
+    attachsql_log_hex(CON, __FILE__, __LINE__, DATA, LEN); \
+  } \
+} while(0)
+
+void attachsql_log_write(attachsql_connect_t *con, attachsql_log_level_t level, const char *file, uint32_t line, const char *format, ...);
+
+void attachsql_log_hex(attachsql_connect_t *con, const char *file, uint32_t line, const char *data, size_t length);
+
+void attachsql_log_error(attachsql_connect_t *con, attachsql_error_t *error);
+
+void attachsql_log_free(attachsql_connect_t *con);
+
+#ifdef __cplusplus
+}
+#endif
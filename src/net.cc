@@ -21,6 +21,13 @@
 #include "net.h"
 #include "pack.h"
 #include "pack_macros.h"
+#include "ssl_context.h"
+#include "ssl_ktls.h"
+#include "stats.h"
+#include "log.h"
+#include "capture.h"
+#include "timeout.h"
+#include "pool_internal.h"
 #ifdef HAVE_ZLIB
 # include <zlib.h>
 #endif
@@ -47,15 +54,88 @@ void attachsql_ssl_run(attachsql_connect_t *con)
   }
   else
   {
-    asdebug("Attempting SSL buffer read");
-    r= SSL_read(con->ssl.ssl, con->ssl.ssl_read_buffer, sizeof(con->ssl.ssl_read_buffer));
+    attachsql_ssl_read_all(con);
+  }
+}
+
+void attachsql_ssl_read_all(attachsql_connect_t *con)
+{
+  buffer_st *buffer;
+  size_t available_buffer;
+  size_t total_read= 0;
+  int r;
+
+  if (con->options.compression)
+  {
+    if (con->read_buffer_compress == NULL)
+    {
+      con->read_buffer_compress= attachsql_buffer_create();
+    }
+    buffer= con->read_buffer_compress;
+  }
+  else
+  {
+    if (con->read_buffer == NULL)
+    {
+      con->read_buffer= attachsql_buffer_create();
+    }
+    buffer= con->read_buffer;
+  }
+  if (buffer == NULL)
+  {
+    con->local_errcode= ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "SSL read buffer allocation failure");
+    con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
+    con->next_packet_queue_used= 0;
+    return;
+  }
+
+  /* A single socket read can contain many TLS records, decrypt all of them
+   * so the BIO pair is empty for the next socket read */
+  while (true)
+  {
+    attachsql_buffer_rewind(buffer);
+    available_buffer= attachsql_buffer_get_available(buffer);
+    if (available_buffer == 0)
+    {
+      /* Leave the rest in OpenSSL and stop reading the socket until rows
+       * have been consumed */
+      if (not attachsql_con_buffer_can_grow(con, buffer))
+      {
+        con->read_paused= true;
+        uv_read_stop(con->uv_objects.stream);
+        break;
+      }
+      if (attachsql_con_buffer_increase(con, buffer) != ATTACHSQL_RET_OK)
+      {
+        con->local_errcode= ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
+        aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "SSL read buffer realloc failure");
+        con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
+        con->next_packet_queue_used= 0;
+        return;
+      }
+      continue;
+    }
+    r= SSL_read(con->ssl.ssl, buffer->buffer_write_ptr, (int)available_buffer);
     if (r < 0)
     {
       attachsql_ssl_handle_error(con, r);
+      break;
     }
-    asdebug("Read %d encrypted bytes", r);
-    attachsql_ssl_data_check(con);
+    else if (r == 0)
+    {
+      break;
+    }
+    attachsql_buffer_move_write_ptr(buffer, r);
+    total_read+= r;
+  }
+  asdebug("Got unencrypted data, %zu bytes", total_read);
+  /* Compressed data is captured once it is unpacked */
+  if ((con->capture.file != NULL) and (buffer == con->read_buffer))
+  {
+    attachsql_capture_read(con, buffer->buffer_write_ptr - total_read, total_read);
   }
+  attachsql_ssl_ktls_try(con);
 }
 
 void attachsql_ssl_data_check(attachsql_connect_t *con)
@@ -75,7 +155,7 @@ void attachsql_ssl_data_check(attachsql_connect_t *con)
         if (error != SSL_ERROR_WANT_READ)
         {
           con->local_errcode= ATTACHSQL_RET_NET_SSL_ERROR;
-          asdebug("SSL write fail: %d", error);
+          aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "SSL write fail: %d", error);
           con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
           con->next_packet_queue_used= 0;
           con->status= ATTACHSQL_CON_STATUS_SSL_ERROR;
@@ -91,17 +171,20 @@ void attachsql_ssl_data_check(attachsql_connect_t *con)
     }
   }
 
-  while((bytes_read= BIO_read(con->ssl.write_bio, con->ssl.ssl_write_buffer, sizeof(con->ssl.ssl_write_buffer))) > 0)
+  while((bytes_read= BIO_read(con->ssl.network_bio, con->ssl.ssl_write_buffer, sizeof(con->ssl.ssl_write_buffer))) > 0)
   {
     asdebug("%d bytes sent from SSL to net", bytes_read);
+    if (con->ssl.ktls_requested)
+    {
+      attachsql_ssl_ktls_scan(&con->ssl.tx_scan, con->ssl.ssl_write_buffer, (size_t)bytes_read);
+    }
     send_buffer[0].base= con->ssl.ssl_write_buffer;
     send_buffer[0].len= bytes_read;
-    uv_write_t *req= new (std::nothrow) uv_write_t;
-    int ret= uv_write(req, con->uv_objects.stream, send_buffer, 1, on_write);
+    int ret= attachsql_con_write(con, send_buffer, 1);
     if (ret < 0)
     {
       con->local_errcode= ATTACHSQL_RET_NET_WRITE_ERROR;
-      asdebug("Write fail: %s", uv_err_name(ret));
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Write fail: %s", uv_err_name(ret));
       con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
       con->next_packet_queue_used= 0;
     }
@@ -119,7 +202,7 @@ void attachsql_ssl_handle_error(attachsql_connect_t *con, int result)
   {
     con->local_errcode= ATTACHSQL_RET_NET_SSL_ERROR;
     unsigned long errcode= ERR_get_error();
-    asdebug("SSL fail: %d, %s", error, ERR_error_string(errcode, NULL));
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "SSL fail: %d, %s", error, ERR_error_string(errcode, NULL));
     con->status= ATTACHSQL_CON_STATUS_SSL_ERROR;
     con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
     con->next_packet_queue_used= 0;
@@ -141,10 +224,14 @@ int attachsql_ssl_buffer_write(attachsql_connect_t *con, uv_buf_t *buf, int buf_
     asdebug("Creating SSL write buffer");
     con->ssl.write_buffer= attachsql_buffer_create();
   }
-  if (attachsql_buffer_get_available(con->ssl.write_buffer) < required_size)
+  attachsql_buffer_rewind(con->ssl.write_buffer);
+  while (attachsql_buffer_get_available(con->ssl.write_buffer) < required_size)
   {
     asdebug("Enlarging SSL write buffer");
-    attachsql_buffer_increase(con->ssl.write_buffer);
+    if (attachsql_con_buffer_increase(con, con->ssl.write_buffer) != ATTACHSQL_RET_OK)
+    {
+      return UV_ENOMEM;
+    }
   }
   for (current_buf= 0; current_buf < buf_len; current_buf++)
   {
@@ -164,9 +251,20 @@ void attachsql_send_data(attachsql_connect_t *con, char *data, size_t length)
 #ifdef HAVE_OPENSSL
   if (con->ssl.enabled and not con->ssl.handshake_done)
   {
-    con->ssl.read_bio= BIO_new(BIO_s_mem());
-    con->ssl.write_bio= BIO_new(BIO_s_mem());
-    SSL_set_bio(con->ssl.ssl, con->ssl.read_bio, con->ssl.write_bio);
+    BIO *internal_bio= NULL;
+    BIO_new_bio_pair(&internal_bio, ATTACHSQL_SSL_BIO_BUFFER_SIZE, &con->ssl.network_bio, ATTACHSQL_SSL_BIO_BUFFER_SIZE);
+    SSL_set_bio(con->ssl.ssl, internal_bio, internal_bio);
+    attachsql_ssl_context_apply_session(con->ssl.context, con->ssl.ssl);
+    if (not attachsql_ssl_set_versions(con->ssl.ssl, con->ssl.min_version, con->ssl.max_version))
+    {
+      con->local_errcode= ATTACHSQL_RET_NET_SSL_ERROR;
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "SSL version range rejected");
+      con->status= ATTACHSQL_CON_STATUS_SSL_ERROR;
+      con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
+      con->next_packet_queue_used= 0;
+      snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "SSL version range not supported");
+      return;
+    }
     SSL_set_connect_state(con->ssl.ssl);
     SSL_do_handshake(con->ssl.ssl);
     attachsql_ssl_run(con);
@@ -174,115 +272,310 @@ void attachsql_send_data(attachsql_connect_t *con, char *data, size_t length)
   }
 #endif
 
-  asdebug("Sending %zd bytes to server", length);
+  aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Sending %zd bytes to server", length);
+  ATTACHSQL_STAT_ADD(con->stats.packets_out, 1);
   attachsql_pack_int3(con->packet_header, length);
   con->packet_number++;
   con->packet_header[3]= con->packet_number;
+  send_buffer[0].base= con->packet_header;
+  send_buffer[0].len= 4;
+  send_buffer[1].base= data;
+  send_buffer[1].len= length;
+  if (con->capture.file != NULL)
+  {
+#ifdef HAVE_OPENSSL
+    /* The SSL request is part of setting up TLS, not the MySQL session */
+    if ((con->ssl.ssl == NULL) or con->ssl.handshake_done)
+#endif
+    {
+      attachsql_capture_write(con, send_buffer, 2);
+    }
+  }
 
 #ifdef HAVE_ZLIB
   /* Can't use con->options.compression because at this point we haven't even connected so the flag isn't set */
-  if ((con->client_capabilities & ATTACHSQL_CAPABILITY_COMPRESS) && (con->status != ATTACHSQL_CON_STATUS_CONNECTING))
+  if ((con->client_capabilities & ATTACHSQL_CAPABILITY_ANY_COMPRESSION) && (con->status != ATTACHSQL_CON_STATUS_CONNECTING))
   {
     attachsql_send_compressed_packet(con, data, length, 0);
     return;
   }
 #endif
 
-  send_buffer[0].base= con->packet_header;
-  send_buffer[0].len= 4;
-  send_buffer[1].base= data;
-  send_buffer[1].len= length;
-  asdebug_hex(data, length);
+  aslog_hex(con, data, length);
   con->command_status= ATTACHSQL_COMMAND_STATUS_READ_RESPONSE;
 
   int r;
 #ifdef HAVE_OPENSSL
-  if (con->ssl.handshake_done)
+  if (con->ssl.handshake_done and not con->ssl.ktls_tx)
   {
     r= attachsql_ssl_buffer_write(con, send_buffer, 2);
   }
   else
 #endif
   {
-    uv_write_t *req= new (std::nothrow) uv_write_t;
-    r= uv_write(req, con->uv_objects.stream, send_buffer, 2, on_write);
+    r= attachsql_con_write(con, send_buffer, 2);
   }
   if (r < 0)
   {
       con->local_errcode= ATTACHSQL_RET_NET_WRITE_ERROR;
-      asdebug("Write fail: %s", uv_err_name(r));
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Write fail: %s", uv_err_name(r));
       con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
       con->next_packet_queue_used= 0;
   }
 }
 
 #ifdef HAVE_ZLIB
-void attachsql_send_compressed_packet(attachsql_connect_t *con, char *data, size_t length, uint8_t command)
+/* Every packet has to be a complete zlib stream so the deflate state is
+ * reset rather than allocated again */
+static bool attachsql_compress_zlib(attachsql_connect_t *con, uv_buf_t *payload, unsigned int payload_count, size_t *compressed_length)
 {
-  uv_buf_t send_buffer[2];
-  char *realloc_buffer;
-  size_t required_uncompressed;
-  size_t new_size;
-  size_t compressed_length;
+  unsigned int part;
+  int res= Z_OK;
 
-  asdebug("Packet compress");
-  required_uncompressed= length + 4;  // Data plus packet header
-  if (command)
+  if (not con->deflate_ready)
   {
-    required_uncompressed+= 1 + con->write_buffer_extra;
-    con->compressed_packet_number= 0;
+    int level= con->options.compression_level;
+    if (level > Z_BEST_COMPRESSION)
+    {
+      level= Z_BEST_COMPRESSION;
+    }
+    if (deflateInit(&con->deflate_stream, level) != Z_OK)
+    {
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Compression init failure");
+      return false;
+    }
+    con->deflate_ready= true;
+  }
+  else
+  {
+    deflateReset(&con->deflate_stream);
+  }
+  con->deflate_stream.next_out= (Bytef*)con->compressed_buffer;
+  con->deflate_stream.avail_out= (uInt)con->compressed_buffer_len;
+  for (part= 0; (part < payload_count) and (res == Z_OK); part++)
+  {
+    con->deflate_stream.next_in= (Bytef*)payload[part].base;
+    con->deflate_stream.avail_in= (uInt)payload[part].len;
+    res= deflate(&con->deflate_stream, (part == payload_count - 1) ? Z_FINISH : Z_NO_FLUSH);
+  }
+  if (res != Z_STREAM_END)
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Compression failure: %d", res);
+    return false;
+  }
+  *compressed_length= (size_t)con->deflate_stream.total_out;
+  return true;
+}
+
+static bool attachsql_decompress_zlib(attachsql_connect_t *con, char *source, size_t source_length, char *destination, size_t destination_length)
+{
+  int res;
+
+  if (not con->inflate_ready)
+  {
+    res= inflateInit(&con->inflate_stream);
+    con->inflate_ready= (res == Z_OK);
+  }
+  else
+  {
+    res= inflateReset(&con->inflate_stream);
+  }
+  if (res == Z_OK)
+  {
+    con->inflate_stream.next_in= (Bytef*)source;
+    con->inflate_stream.avail_in= (uInt)source_length;
+    con->inflate_stream.next_out= (Bytef*)destination;
+    con->inflate_stream.avail_out= (uInt)destination_length;
+    res= inflate(&con->inflate_stream, Z_FINISH);
+  }
+  if ((res != Z_STREAM_END) or (con->inflate_stream.total_out != destination_length))
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Decompression error: %d", res);
+    return false;
   }
-  if (con->uncompressed_buffer_len < required_uncompressed)
+  return true;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/* Each packet is a single zstd frame, the contexts are reused */
+static bool attachsql_compress_zstd(attachsql_connect_t *con, uv_buf_t *payload, unsigned int payload_count, size_t required_uncompressed, size_t *compressed_length)
+{
+  ZSTD_outBuffer output= { con->compressed_buffer, con->compressed_buffer_len, 0 };
+  ZSTD_inBuffer input;
+  unsigned int part;
+  size_t res;
+
+  if (con->zstd_cctx == NULL)
   {
-    /* Enlarge to a multiple of ATTACHSQL_WRITE_BUFFER_SIZE */
-    size_t rounding= required_uncompressed % ATTACHSQL_WRITE_BUFFER_SIZE;
-    new_size= required_uncompressed + ATTACHSQL_WRITE_BUFFER_SIZE - rounding;
-    asdebug("Enlarging uncompressed buffer to %zu bytes", new_size);
-    realloc_buffer= (char*)realloc(con->uncompressed_buffer, new_size);
-    if (realloc_buffer == NULL)
+    con->zstd_cctx= ZSTD_createCCtx();
+    if (con->zstd_cctx == NULL)
     {
-      con->local_errcode= ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
-      asdebug("Uncompressed buffer realloc failure");
-      con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
-      con->next_packet_queue_used= 0;
-      return;
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Compression init failure");
+      return false;
     }
-    con->uncompressed_buffer= realloc_buffer;
-    con->uncompressed_buffer_len= new_size;
+    ZSTD_CCtx_setParameter(con->zstd_cctx, ZSTD_c_compressionLevel, attachsql_zstd_level(con));
   }
-  memcpy(con->uncompressed_buffer, con->packet_header, 4);
-  if (command)
+  ZSTD_CCtx_reset(con->zstd_cctx, ZSTD_reset_session_only);
+  ZSTD_CCtx_setPledgedSrcSize(con->zstd_cctx, required_uncompressed);
+  for (part= 0; part < payload_count; part++)
+  {
+    ZSTD_EndDirective mode= (part == payload_count - 1) ? ZSTD_e_end : ZSTD_e_continue;
+    input.src= payload[part].base;
+    input.size= payload[part].len;
+    input.pos= 0;
+    do
+    {
+      res= ZSTD_compressStream2(con->zstd_cctx, &output, &input, mode);
+      if (ZSTD_isError(res))
+      {
+        aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Compression failure: %s", ZSTD_getErrorName(res));
+        return false;
+      }
+    } while ((input.pos < input.size) or ((mode == ZSTD_e_end) and (res > 0)));
+  }
+  *compressed_length= output.pos;
+  return true;
+}
+
+static bool attachsql_decompress_zstd(attachsql_connect_t *con, char *source, size_t source_length, char *destination, size_t destination_length)
+{
+  size_t res;
+
+  if (con->zstd_dctx == NULL)
   {
-    con->uncompressed_buffer[4]= (char)command;
-    if (con->write_buffer_extra)
+    con->zstd_dctx= ZSTD_createDCtx();
+    if (con->zstd_dctx == NULL)
     {
-      memcpy(&con->uncompressed_buffer[5], &con->write_buffer[1], con->write_buffer_extra);
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Decompression init failure");
+      return false;
     }
-    memcpy(&con->uncompressed_buffer[5 + con->write_buffer_extra], data, length);
+  }
+  res= ZSTD_decompressDCtx(con->zstd_dctx, destination, destination_length, source, source_length);
+  if (ZSTD_isError(res) or (res != destination_length))
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Decompression error: %s", ZSTD_isError(res) ? ZSTD_getErrorName(res) : "size mismatch");
+    return false;
+  }
+  return true;
+}
+
+int attachsql_zstd_level(attachsql_connect_t *con)
+{
+  if (con->options.compression_level < 1)
+  {
+    return ZSTD_CLEVEL_DEFAULT;
+  }
+  return con->options.compression_level;
+}
+#endif
+
+#ifdef HAVE_ZLIB
+/* Skips compression while recent packets haven't compressed well, such as
+ * already compressed BLOBs, or took too long to compress, probing every so
+ * often in case the data changed */
+static bool attachsql_compress_worthwhile(attachsql_connect_t *con, size_t length)
+{
+  if (length <= con->options.compression_min_size)
+  {
+    return false;
+  }
+  if ((con->compress_history.saving >= (con->options.compression_min_saving * 10))
+      and ((con->options.compression_max_time == 0) or (con->compress_history.time_per_kb <= con->options.compression_max_time)))
+  {
+    return true;
+  }
+  con->compress_history.skipped++;
+  if (con->compress_history.skipped >= ATTACHSQL_COMPRESS_PROBE_INTERVAL)
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Probing compression, average saving %d.%d%%, %" PRIu64 "ns per KB", con->compress_history.saving / 10, con->compress_history.saving % 10, con->compress_history.time_per_kb);
+    con->compress_history.skipped= 0;
+    return true;
+  }
+  return false;
+}
+
+static void attachsql_compress_history_add(attachsql_connect_t *con, size_t uncompressed_length, size_t compressed_length, uint64_t time_taken)
+{
+  int saving= 0;
+
+  if (compressed_length < uncompressed_length)
+  {
+    saving= (int)(1000 - ((compressed_length * 1000) / uncompressed_length));
+  }
+  /* Moving averages weighted 3:1 towards history */
+  con->compress_history.saving= ((con->compress_history.saving * 3) + saving) / 4;
+  con->compress_history.time_per_kb= ((con->compress_history.time_per_kb * 3) + ((time_taken * 1024) / uncompressed_length)) / 4;
+  aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Compression saving %d, average %d, %" PRIu64 "ns per KB", saving, con->compress_history.saving, con->compress_history.time_per_kb);
+}
+
+void attachsql_send_compressed_packet(attachsql_connect_t *con, char *data, size_t length, uint8_t command)
+{
+  uv_buf_t send_buffer[4];
+  uv_buf_t *payload= &send_buffer[1];
+  unsigned int payload_count= 0;
+  unsigned int buffer_count;
+  unsigned int part;
+  char *realloc_buffer;
+  size_t required_uncompressed= 0;
+  size_t new_size;
+  size_t compressed_length;
+  bool compressed= false;
+
+  asdebug("Packet compress");
+  /* The packet is compressed straight from its parts rather than copying
+   * them into one buffer first */
+  payload[payload_count].base= con->packet_header;
+  payload[payload_count].len= 4;
+  payload_count++;
+  if (command)
+  {
+    con->write_buffer[0]= (char)command;
+    payload[payload_count].base= con->write_buffer;
+    payload[payload_count].len= 1 + con->write_buffer_extra;
+    payload_count++;
     con->write_buffer_extra= 0;
+    con->compressed_packet_number= 0;
   }
-  else
+  if (length > 0)
+  {
+    payload[payload_count].base= data;
+    payload[payload_count].len= length;
+    payload_count++;
+  }
+  for (part= 0; part < payload_count; part++)
   {
-    memcpy(&con->uncompressed_buffer[4], data, length);
+    required_uncompressed+= payload[part].len;
   }
+  buffer_count= payload_count + 1;
 
-  if (length > ATTACHSQL_MINIMUM_COMPRESS_SIZE)
+  if (attachsql_compress_worthwhile(con, length))
   {
     size_t required_compressed;
-    /* compress the packet */
+    bool compress_ok;
+    uint64_t compress_start;
     asdebug("Compressing packet");
-    required_compressed= (size_t)compressBound((uLong) required_uncompressed);
+#ifdef HAVE_ZSTD
+    if (con->client_capabilities & ATTACHSQL_CAPABILITY_ZSTD_COMPRESSION)
+    {
+      required_compressed= ZSTD_compressBound(required_uncompressed);
+    }
+    else
+#endif
+    {
+      required_compressed= (size_t)compressBound((uLong) required_uncompressed);
+    }
     if (con->compressed_buffer_len < required_compressed)
     {
       /* Enlarge to a multiple of ATTACHSQL_WRITE_BUFFER_SIZE */
       size_t rounding= required_compressed % ATTACHSQL_WRITE_BUFFER_SIZE;
       new_size= required_compressed + ATTACHSQL_WRITE_BUFFER_SIZE - rounding;
-      asdebug("Enlarging compressed buffer to %zu bytes", new_size);
+      aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Enlarging compressed buffer to %zu bytes", new_size);
       realloc_buffer= (char*)realloc(con->compressed_buffer, new_size);
       if (realloc_buffer == NULL)
       {
         con->local_errcode= ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
-        asdebug("Compressed buffer realloc failure");
+        aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Compressed buffer realloc failure");
         con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
         con->next_packet_queue_used= 0;
         return;
@@ -290,77 +583,132 @@ void attachsql_send_compressed_packet(attachsql_connect_t *con, char *data, size
       con->compressed_buffer= realloc_buffer;
       con->compressed_buffer_len= new_size;
     }
-    compressed_length= con->compressed_buffer_len;
-    int res= compress((Bytef*)con->compressed_buffer, (uLongf*)&compressed_length, (Bytef*)con->uncompressed_buffer, (uLong)required_uncompressed);
-    if ((res != Z_OK) || (con->uncompressed_buffer_len < compressed_length))
+    compress_start= uv_hrtime();
+#ifdef HAVE_ZSTD
+    if (con->client_capabilities & ATTACHSQL_CAPABILITY_ZSTD_COMPRESSION)
+    {
+      compress_ok= attachsql_compress_zstd(con, payload, payload_count, required_uncompressed, &compressed_length);
+    }
+    else
+#endif
+    {
+      compress_ok= attachsql_compress_zlib(con, payload, payload_count, &compressed_length);
+    }
+    if (not compress_ok)
     {
       con->local_errcode= ATTACHSQL_RET_COMPRESSION_FAILURE;
-      asdebug("Compression failure");
       con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
       con->next_packet_queue_used= 0;
       return;
     }
-    attachsql_pack_int3(con->compressed_packet_header, compressed_length);
-    con->compressed_packet_header[3]= con->compressed_packet_number;
-    attachsql_pack_int3(con->compressed_packet_header+4, required_uncompressed);
-    send_buffer[0].base= con->compressed_packet_header;
-    send_buffer[0].len= 7;
-    send_buffer[1].base= con->compressed_buffer;
-    send_buffer[1].len= compressed_length;
     asdebug("Old size: %zu, new size: %zu", required_uncompressed, compressed_length);
+    compress_start= uv_hrtime() - compress_start;
+    attachsql_compress_history_add(con, required_uncompressed, compressed_length, compress_start);
+    ATTACHSQL_STAT_ADD(con->stats.compress_time, compress_start);
+    /* Incompressible data is sent as it is, as the server does */
+    if (compressed_length < required_uncompressed)
+    {
+      attachsql_pack_int3(con->compressed_packet_header, compressed_length);
+      con->compressed_packet_header[3]= con->compressed_packet_number;
+      attachsql_pack_int3(con->compressed_packet_header+4, required_uncompressed);
+      send_buffer[1].base= con->compressed_buffer;
+      send_buffer[1].len= compressed_length;
+      buffer_count= 2;
+      compressed= true;
+    }
   }
-  else
+  if (not compressed)
   {
     attachsql_pack_int3(con->compressed_packet_header, required_uncompressed);
     con->compressed_packet_header[3]= con->compressed_packet_number;
     attachsql_pack_int3(con->compressed_packet_header+4, 0);
     asdebug_hex(con->compressed_packet_header, 7);
-    send_buffer[0].base= con->compressed_packet_header;
-    send_buffer[0].len= 7;
-    send_buffer[1].base= con->uncompressed_buffer;
-    send_buffer[1].len= required_uncompressed;
-    asdebug("Packet too small to compress, sending %zu bytes", required_uncompressed);
-    asdebug_hex(con->uncompressed_buffer, required_uncompressed);
-  }
-  asdebug_hex(data, length);
+    asdebug("Sending %zu bytes uncompressed", required_uncompressed);
+  }
+  ATTACHSQL_STAT_ADD(con->stats.uncompressed_bytes_out, required_uncompressed);
+  ATTACHSQL_STAT_ADD(con->stats.compressed_bytes_out, compressed ? compressed_length : required_uncompressed);
+  send_buffer[0].base= con->compressed_packet_header;
+  send_buffer[0].len= 7;
+  aslog_hex(con, data, length);
   con->command_status= ATTACHSQL_COMMAND_STATUS_READ_RESPONSE;
 
   int r;
 #ifdef HAVE_OPENSSL
-  if (con->ssl.handshake_done)
+  if (con->ssl.handshake_done and not con->ssl.ktls_tx)
   {
-    r= attachsql_ssl_buffer_write(con, send_buffer, 2);
+    r= attachsql_ssl_buffer_write(con, send_buffer, (int)buffer_count);
   }
   else
 #endif
   {
-    uv_write_t *req= new (std::nothrow) uv_write_t;
-    r= uv_write(req, con->uv_objects.stream, send_buffer, 2, on_write);
+    r= attachsql_con_write(con, send_buffer, buffer_count);
   }
   if (r < 0)
   {
     con->local_errcode= ATTACHSQL_RET_NET_WRITE_ERROR;
-    asdebug("Write fail: %s", uv_err_name(r));
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Write fail: %s", uv_err_name(r));
     con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
     con->next_packet_queue_used= 0;
   }
 }
 #endif
 
-void on_write(uv_write_t *req, int status)
+int attachsql_con_write(attachsql_connect_t *con, uv_buf_t *buffers, unsigned int buffer_count)
 {
-  attachsql_connect_t *con= (attachsql_connect_t*)req->handle->data;
-  asdebug("Write callback, status: %d", status);
+  int ret= 0;
 
+  if (con->replay.data != NULL)
+  {
+    attachsql_replay_write(con);
+  }
+  else
+  {
+    uv_write_t *req= new (std::nothrow) uv_write_t;
+    ret= uv_write(req, con->uv_objects.stream, buffers, buffer_count, on_write);
+    if (ret == 0)
+    {
+      attachsql_timeout_write_start(con);
+    }
+  }
+  attachsql_stats_written(con, buffers, buffer_count);
+  return ret;
+}
+
+void attachsql_con_write_complete(attachsql_connect_t *con)
+{
   if (attachsql_packet_queue_peek(con) == ATTACHSQL_PACKET_TYPE_NONE)
   {
     con->status= ATTACHSQL_CON_STATUS_IDLE;
     con->command_status= ATTACHSQL_COMMAND_STATUS_EOF;
+    /* The command has no response */
+    attachsql_timeout_command_end(con);
+  }
+}
+
+void on_write(uv_write_t *req, int status)
+{
+  attachsql_connect_t *con= (attachsql_connect_t*)req->handle->data;
+  asdebug("Write callback, status: %d", status);
+
+  attachsql_timeout_write_end(con);
+  /* Written before a recycled connection's stream was closed, nothing
+   * waits on it */
+  if (con->maintenance.closing > 0)
+  {
+    delete req;
+    return;
+  }
+  if (status == UV_ECANCELED)
+  {
+    /* The stream was closed under the write, the error is already set */
+    delete req;
+    return;
   }
+  attachsql_con_write_complete(con);
   if (status < 0)
   {
     con->local_errcode= ATTACHSQL_RET_NET_WRITE_ERROR;
-    asdebug("Write fail: %s", uv_err_name(status));
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Write fail: %s", uv_err_name(status));
     con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
     con->next_packet_queue_used= 0;
     con->status= ATTACHSQL_CON_STATUS_NET_ERROR;
@@ -371,148 +719,480 @@ void on_write(uv_write_t *req, int status)
   delete req;
 }
 
+size_t attachsql_con_buffer_size(attachsql_connect_t *con)
+{
+  size_t size= 0;
+
+  if (con->read_buffer != NULL)
+  {
+    size+= con->read_buffer->buffer_size;
+  }
+  if (con->read_buffer_compress != NULL)
+  {
+    size+= con->read_buffer_compress->buffer_size;
+  }
+#ifdef HAVE_OPENSSL
+  if (con->ssl.write_buffer != NULL)
+  {
+    size+= con->ssl.write_buffer->buffer_size;
+  }
+#endif
+  return size;
+}
+
+/* Whether growing a read buffer keeps the connection and its pool inside
+ * their buffer limits */
+bool attachsql_con_buffer_can_grow(attachsql_connect_t *con, buffer_st *buffer)
+{
+  size_t growth= attachsql_buffer_growth(buffer);
+
+  if (growth == 0)
+  {
+    return true;
+  }
+  if ((con->options.max_buffer_size > 0) and ((attachsql_con_buffer_size(con) + growth) > con->options.max_buffer_size))
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Connection buffer limit of %zu bytes reached", con->options.max_buffer_size);
+    return false;
+  }
+  if ((con->pool != NULL) and (con->pool->max_buffer_size > 0) and ((attachsql_pool_get_buffer_size(con->pool) + growth) > con->pool->max_buffer_size))
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Pool buffer limit of %zu bytes reached", con->pool->max_buffer_size);
+    return false;
+  }
+  return true;
+}
+
+attachsql_ret_t attachsql_con_buffer_increase(attachsql_connect_t *con, buffer_st *buffer)
+{
+  if (attachsql_buffer_growth(buffer) > 0)
+  {
+    ATTACHSQL_STAT_ADD(con->stats.buffer_grows, 1);
+  }
+  return attachsql_buffer_increase(buffer);
+}
+
+void attachsql_con_buffer_shrink(attachsql_connect_t *con)
+{
+  if (attachsql_buffer_shrink(con->read_buffer, con->options.buffer_shrink_size))
+  {
+    ATTACHSQL_STAT_ADD(con->stats.buffer_shrinks, 1);
+  }
+  if (attachsql_buffer_shrink(con->read_buffer_compress, con->options.buffer_shrink_size))
+  {
+    ATTACHSQL_STAT_ADD(con->stats.buffer_shrinks, 1);
+  }
+#ifdef HAVE_OPENSSL
+  if (attachsql_buffer_shrink(con->ssl.write_buffer, con->options.buffer_shrink_size))
+  {
+    ATTACHSQL_STAT_ADD(con->stats.buffer_shrinks, 1);
+  }
+#endif
+}
+
 void attachsql_read_data_cb(uv_stream_t* tcp, ssize_t read_size, const uv_buf_t *buf)
 {
   (void) buf; // If we enter this with HAVE_OPENSSL undefined buf is unused
 
-  struct attachsql_connect_t *con= (struct attachsql_connect_t*)tcp->data;
+  struct attachsql_connect_t *con= (struct attachsql_connect_t*)tcp->data;
+
+  /* on_alloc had no room to give, stop reading until rows are consumed */
+  if ((read_size == UV_ENOBUFS) and con->read_paused)
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Read buffer full, pausing reads");
+    uv_read_stop(tcp);
+    return;
+  }
+
+  if (read_size < 0)
+  {
+    con->local_errcode= ATTACHSQL_RET_NET_READ_ERROR;
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Read fail: %s", uv_err_name((int)read_size));
+    con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
+    con->next_packet_queue_used= 0;
+    con->status= ATTACHSQL_CON_STATUS_NET_ERROR;
+    snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "Net read failure: %s", uv_err_name((int)read_size));
+    uv_check_stop(&con->uv_objects.check);
+    uv_close((uv_handle_t*)con->uv_objects.stream, NULL);
+    return;
+  }
+
+  ATTACHSQL_STAT_ADD(con->stats.bytes_in, (uint64_t)read_size);
+  attachsql_timeout_read_activity(con);
+  if ((con->trace_fn != NULL) and con->command_start and not con->command_first_byte)
+  {
+    con->command_first_byte= true;
+    con->trace_fn(con, ATTACHSQL_TRACE_FIRST_BYTE, con->command_id, con->command_type, uv_hrtime(), con->trace_context);
+  }
+#ifdef HAVE_OPENSSL
+  if (con->ssl.handshake_done and not con->ssl.ktls_rx)
+  {
+    asdebug("Got encrypted data, %zd bytes", read_size);
+    /* on_alloc gave libuv the BIO pair's own buffer, just commit the data */
+    char *bio_ptr;
+    BIO_nwrite(con->ssl.network_bio, &bio_ptr, (int)read_size);
+    if (con->ssl.ktls_requested)
+    {
+      attachsql_ssl_ktls_scan(&con->ssl.rx_scan, bio_ptr, (size_t)read_size);
+    }
+    attachsql_ssl_read_all(con);
+    return;
+  }
+#endif
+
+  asdebug("Got data, %zd bytes", read_size);
+  if (con->options.compression)
+  {
+    attachsql_buffer_move_write_ptr(con->read_buffer_compress, read_size);
+  }
+  else
+  {
+    attachsql_buffer_move_write_ptr(con->read_buffer, read_size);
+    if (con->capture.file != NULL)
+    {
+      attachsql_capture_read(con, con->read_buffer->buffer_write_ptr - read_size, (size_t)read_size);
+    }
+  }
+  attachsql_con_process_packets(con);
+}
+
+/* Delivers captured data as if it had been read from the socket, returns
+ * how much fitted in the read buffer */
+size_t attachsql_con_replay_read(attachsql_connect_t *con, const char *data, size_t length)
+{
+  size_t available;
+
+  if (con->read_buffer == NULL)
+  {
+    con->read_buffer= attachsql_buffer_create();
+    if (con->read_buffer == NULL)
+    {
+      return 0;
+    }
+  }
+  attachsql_buffer_rewind(con->read_buffer);
+  available= attachsql_buffer_get_available(con->read_buffer);
+  if ((available < length) and attachsql_con_buffer_can_grow(con, con->read_buffer))
+  {
+    attachsql_con_buffer_increase(con, con->read_buffer);
+    available= attachsql_buffer_get_available(con->read_buffer);
+  }
+  if (available > length)
+  {
+    available= length;
+  }
+  if (available > 0)
+  {
+    ATTACHSQL_STAT_ADD(con->stats.bytes_in, available);
+    if ((con->trace_fn != NULL) and con->command_start and not con->command_first_byte)
+    {
+      con->command_first_byte= true;
+      con->trace_fn(con, ATTACHSQL_TRACE_FIRST_BYTE, con->command_id, con->command_type, uv_hrtime(), con->trace_context);
+    }
+    memcpy(con->read_buffer->buffer_write_ptr, data, available);
+    attachsql_buffer_move_write_ptr(con->read_buffer, available);
+  }
+  attachsql_con_process_packets(con);
+  return available;
+}
+
+/* Whether the buffer holds the whole of the next packet */
+static bool attachsql_con_packet_complete(buffer_st *buffer)
+{
+  size_t data_size= attachsql_buffer_unread_data(buffer);
+
+  if (data_size < 4)
+  {
+    return false;
+  }
+  return ((attachsql_unpack_int3(buffer->buffer_read_ptr) + 4) <= data_size);
+}
+
+/* The rest of the stream can't be read so the connection is dropped */
+void attachsql_con_read_abort(attachsql_connect_t *con, attachsql_ret_t ret, const char *message)
+{
+  con->local_errcode= ret;
+  aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "%s", message);
+  con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
+  con->next_packet_queue_used= 0;
+  con->status= ATTACHSQL_CON_STATUS_NET_ERROR;
+  snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "%s", message);
+  /* A replayed connection has no socket */
+  if (con->uv_objects.stream != NULL)
+  {
+    uv_check_stop(&con->uv_objects.check);
+    uv_close((uv_handle_t*)con->uv_objects.stream, NULL);
+  }
+}
+
+/* A packet can't fit in the buffer limits */
+static void attachsql_con_buffer_limit_error(attachsql_connect_t *con)
+{
+  attachsql_con_read_abort(con, ATTACHSQL_RET_BUFFER_LIMIT, "Packet too large for the buffer limit");
+}
+
+void attachsql_packet_malformed(attachsql_connect_t *con)
+{
+  attachsql_con_read_abort(con, ATTACHSQL_RET_BAD_PROTOCOL, "Malformed packet");
+}
+
+size_t attachsql_packet_remaining(buffer_st *buffer)
+{
+  if (buffer->buffer_read_ptr >= buffer->packet_end_ptr)
+  {
+    return 0;
+  }
+  return (size_t)(buffer->packet_end_ptr - buffer->buffer_read_ptr);
+}
+
+/* Reads a length encoded string from the packet, copying up to
+ * field_size - 1 bytes of it into field when that isn't NULL.  Returns false
+ * if the string runs past the end of the packet. */
+static bool attachsql_packet_get_string(buffer_st *buffer, char *field, size_t field_size, size_t *field_length)
+{
+  uint8_t bytes;
+  uint64_t str_len;
+  size_t str_read;
+  attachsql_pack_status_t status;
+
+  str_len= attachsql_unpack_length_bounded(buffer->buffer_read_ptr, buffer->packet_end_ptr, &bytes, &status);
+  if (status == ATTACHSQL_PACK_TRUNCATED)
+  {
+    return false;
+  }
+  buffer->buffer_read_ptr+= bytes;
+  if (str_len > attachsql_packet_remaining(buffer))
+  {
+    return false;
+  }
+  if (field != NULL)
+  {
+    str_read= (str_len >= field_size) ? field_size - 1 : (size_t)str_len;
+    if (str_read > 0)
+    {
+      memcpy(field, buffer->buffer_read_ptr, str_read);
+    }
+    field[str_read]= '\0';
+    if (field_length != NULL)
+    {
+      *field_length= str_read;
+    }
+  }
+  buffer->buffer_read_ptr+= str_len;
+  return true;
+}
+
+/* Starts reading the socket again after on_alloc or the SSL reader paused
+ * it for a full read buffer */
+static void attachsql_con_read_resume(attachsql_connect_t *con)
+{
+  buffer_st *buffer;
+
+  buffer= con->options.compression ? con->read_buffer_compress : con->read_buffer;
+  attachsql_buffer_rewind(buffer);
+  if ((attachsql_buffer_get_available(buffer) == 0) and (not attachsql_con_buffer_can_grow(con, buffer)))
+  {
+    // Full of a partial packet
+    attachsql_con_buffer_limit_error(con);
+    return;
+  }
+  aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Resuming reads");
+  con->read_paused= false;
+  uv_read_start(con->uv_objects.stream, on_alloc, attachsql_read_data_cb);
+#ifdef HAVE_OPENSSL
+  // Decrypt what was left in OpenSSL when reading paused
+  if (con->ssl.handshake_done and not con->ssl.ktls_rx)
+  {
+    attachsql_ssl_read_all(con);
+  }
+#endif
+}
+
+#ifdef HAVE_ZLIB
+/* Unpacks one complete compressed packet into space already reserved in
+ * the read buffer */
+static bool attachsql_con_decompress_packet(attachsql_connect_t *con)
+{
+  uint32_t compressed_packet_size;
+  uint32_t uncompressed_packet_size;
+  bool decompress_ok;
+
+  // First 3 bytes are packet size
+  compressed_packet_size= attachsql_unpack_int3(con->read_buffer_compress->buffer_read_ptr);
+  con->compressed_packet_number++;
+
+  // Fourth byte is packet number
+  asdebug("Got compressed packet %d, expected %d", con->read_buffer_compress->buffer_read_ptr[3], con->compressed_packet_number);
 
-  if (read_size < 0)
+  if (con->compressed_packet_number != (uint8_t)con->read_buffer_compress->buffer_read_ptr[3])
   {
-    con->local_errcode= ATTACHSQL_RET_NET_READ_ERROR;
-    asdebug("Read fail: %s", uv_err_name((int)read_size));
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Compressed packet out of sequence!");
+    con->local_errcode= ATTACHSQL_RET_PACKET_OUT_OF_SEQUENCE;
     con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
     con->next_packet_queue_used= 0;
-    con->status= ATTACHSQL_CON_STATUS_NET_ERROR;
-    snprintf(con->errmsg, ATTACHSQL_ERROR_BUFFER_SIZE, "Net read failure: %s", uv_err_name((int)read_size));
-    uv_check_stop(&con->uv_objects.check);
-    uv_close((uv_handle_t*)con->uv_objects.stream, NULL);
-    return;
+    return false;
   }
+  uncompressed_packet_size= attachsql_unpack_int3(con->read_buffer_compress->buffer_read_ptr+4);
+  con->read_buffer_compress->buffer_read_ptr+= 7;
+  ATTACHSQL_STAT_ADD(con->stats.compressed_bytes_in, compressed_packet_size);
+  ATTACHSQL_STAT_ADD(con->stats.uncompressed_bytes_in, uncompressed_packet_size ? uncompressed_packet_size : compressed_packet_size);
+  con->read_buffer_compress->packet_end_ptr= con->read_buffer_compress->buffer_read_ptr + compressed_packet_size;
 
-#ifdef HAVE_OPENSSL
-  if (con->ssl.handshake_done)
+  if (not uncompressed_packet_size)
   {
-    asdebug("Got encrypted data, %zd bytes", read_size);
-    BIO_write(con->ssl.read_bio, buf->base, (int)read_size);
-    buffer_st *buffer= NULL;
-    if (con->options.compression)
-    {
-      buffer= con->read_buffer_compress;
-    }
-    else
-    {
-      buffer= con->read_buffer;
-    }
-    size_t available_buffer= attachsql_buffer_get_available(buffer);
-    int r= SSL_read(con->ssl.ssl, buffer->buffer_write_ptr, (int)available_buffer);
-    if (r < 0)
-    {
-      attachsql_ssl_handle_error(con, r);
-    }
-    else if (r > 0)
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Compression packet with no compression");
+    memcpy(con->read_buffer->buffer_write_ptr, con->read_buffer_compress->buffer_read_ptr, compressed_packet_size);
+    con->read_buffer_compress->buffer_read_ptr+= compressed_packet_size;
+    attachsql_buffer_move_write_ptr(con->read_buffer, compressed_packet_size);
+    if (con->capture.file != NULL)
     {
-      asdebug("Got unencrypted data, %d bytes", r);
-      attachsql_buffer_move_write_ptr(buffer, r);
+      attachsql_capture_read(con, con->read_buffer->buffer_write_ptr - compressed_packet_size, compressed_packet_size);
     }
-    return;
+    return true;
   }
-#endif
 
-  asdebug("Got data, %zd bytes", read_size);
-  if (con->options.compression)
+  asdebug("Decompressing %u bytes into %u bytes", compressed_packet_size, uncompressed_packet_size);
+#ifdef HAVE_ZSTD
+  if (con->client_capabilities & ATTACHSQL_CAPABILITY_ZSTD_COMPRESSION)
   {
-    attachsql_buffer_move_write_ptr(con->read_buffer_compress, read_size);
+    decompress_ok= attachsql_decompress_zstd(con, con->read_buffer_compress->buffer_read_ptr, compressed_packet_size, con->read_buffer->buffer_write_ptr, uncompressed_packet_size);
   }
   else
+#endif
   {
-    attachsql_buffer_move_write_ptr(con->read_buffer, read_size);
+    decompress_ok= attachsql_decompress_zlib(con, con->read_buffer_compress->buffer_read_ptr, compressed_packet_size, con->read_buffer->buffer_write_ptr, uncompressed_packet_size);
   }
-  attachsql_con_process_packets(con);
+  if (not decompress_ok)
+  {
+    con->local_errcode= ATTACHSQL_RET_COMPRESSION_FAILURE;
+    con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
+    con->next_packet_queue_used= 0;
+    return false;
+  }
+  con->read_buffer_compress->buffer_read_ptr+= compressed_packet_size;
+  attachsql_buffer_move_write_ptr(con->read_buffer, uncompressed_packet_size);
+  if (con->capture.file != NULL)
+  {
+    attachsql_capture_read(con, con->read_buffer->buffer_write_ptr - uncompressed_packet_size, uncompressed_packet_size);
+  }
+  return true;
 }
 
-#ifdef HAVE_ZLIB
 bool attachsql_con_decompress_read_buffer(attachsql_connect_t *con)
 {
   size_t data_size;
   size_t buffer_free;
+  size_t required_size= 0;
+  size_t packet_count= 0;
+  size_t packets_unpacked= 0;
   uint32_t compressed_packet_size;
   uint32_t uncompressed_packet_size;
+  char *packet_ptr;
 
-  /* compress packet header is 7 bytes */
+  /* Find every complete compressed packet that has been read so the read
+   * buffer only needs to be sized once for all of them */
   data_size= attachsql_buffer_unread_data(con->read_buffer_compress);
-  if (data_size < 7)
+  packet_ptr= con->read_buffer_compress->buffer_read_ptr;
+  // compress packet header is 7 bytes
+  while (data_size >= 7)
   {
-    return false;
+    compressed_packet_size= attachsql_unpack_int3(packet_ptr);
+    if ((compressed_packet_size + 7) > data_size)
+    {
+      asdebug("Don't have whole compressed packet, expected %u bytes, got %zu", compressed_packet_size, data_size - 7);
+      break;
+    }
+    uncompressed_packet_size= attachsql_unpack_int3(packet_ptr+4);
+    // A packet which wasn't compressed is copied as it is
+    required_size+= uncompressed_packet_size ? uncompressed_packet_size : compressed_packet_size;
+    packet_ptr+= compressed_packet_size + 7;
+    data_size-= compressed_packet_size + 7;
+    packet_count++;
   }
-  // First 3 bytes are packet size
-  compressed_packet_size= attachsql_unpack_int3(con->read_buffer_compress->buffer_read_ptr);
-  //con->packet_size= packet_len;
-
-  if ((compressed_packet_size + 7) > data_size)
+  if (packet_count == 0)
   {
-    asdebug("Don't have whole compressed packet, expected %u bytes, got %zu", compressed_packet_size, data_size - 7);
     return false;
   }
-
-  con->compressed_packet_number++;
-
-  // Fourth byte is packet number
-  asdebug("Got compressed packet %d, expected %d", con->read_buffer_compress->buffer_read_ptr[3], con->compressed_packet_number);
-
-  if (con->compressed_packet_number != con->read_buffer_compress->buffer_read_ptr[3])
-  {
-    asdebug("Compressed packet out of sequence!");
-    con->local_errcode= ATTACHSQL_RET_PACKET_OUT_OF_SEQUENCE;
-    con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
-    con->next_packet_queue_used= 0;
-    return true;
-  }
-  uncompressed_packet_size= attachsql_unpack_int3(con->read_buffer_compress->buffer_read_ptr+4);
-  asdebug("%u bytes requested for read buffer", uncompressed_packet_size);
-  con->read_buffer_compress->buffer_read_ptr+= 7;
+  asdebug("%zu compressed packets, %zu bytes requested for read buffer", packet_count, required_size);
 
   if (con->read_buffer == NULL)
   {
     asdebug("Creating read buffer");
     con->read_buffer= attachsql_buffer_create();
   }
+  attachsql_buffer_rewind(con->read_buffer);
   buffer_free= attachsql_buffer_get_available(con->read_buffer);
-  if (buffer_free < uncompressed_packet_size)
+  while (buffer_free < required_size)
   {
-    asdebug("Enlarging buffer, free: %zu, requested: %u", buffer_free, uncompressed_packet_size);
-    attachsql_buffer_increase(con->read_buffer);
+    // Over the buffer limit only the packets which fit are unpacked
+    if (not attachsql_con_buffer_can_grow(con, con->read_buffer))
+    {
+      break;
+    }
+    asdebug("Enlarging buffer, free: %zu, requested: %zu", buffer_free, required_size);
+    if (attachsql_con_buffer_increase(con, con->read_buffer) != ATTACHSQL_RET_OK)
+    {
+      con->local_errcode= ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Read buffer realloc failure");
+      con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
+      con->next_packet_queue_used= 0;
+      return true;
+    }
     buffer_free= attachsql_buffer_get_available(con->read_buffer);
   }
-  con->read_buffer_compress->packet_end_ptr= con->read_buffer_compress->buffer_read_ptr + compressed_packet_size;
 
-  if (not uncompressed_packet_size)
+  while (packet_count > 0)
   {
-    asdebug("Compression packet with no compression");
-    memcpy(con->read_buffer->buffer_write_ptr, con->read_buffer_compress->buffer_read_ptr, compressed_packet_size);
-    con->read_buffer_compress->buffer_read_ptr+= compressed_packet_size;
-    attachsql_buffer_move_write_ptr(con->read_buffer, compressed_packet_size);
-    return true;
+    uncompressed_packet_size= attachsql_unpack_int3(con->read_buffer_compress->buffer_read_ptr+4);
+    if (uncompressed_packet_size == 0)
+    {
+      uncompressed_packet_size= attachsql_unpack_int3(con->read_buffer_compress->buffer_read_ptr);
+    }
+    if (uncompressed_packet_size > attachsql_buffer_get_available(con->read_buffer))
+    {
+      break;
+    }
+    if (not attachsql_con_decompress_packet(con))
+    {
+      return true;
+    }
+    packet_count--;
+    packets_unpacked++;
   }
-  else
+
+  if (packets_unpacked == 0)
   {
-    asdebug("Decompressing %u bytes into %u bytes", compressed_packet_size, uncompressed_packet_size);
-    int res= uncompress((Bytef*)con->read_buffer->buffer_write_ptr, (uLongf*)&buffer_free, (Bytef*)con->read_buffer_compress->buffer_read_ptr, (uLong)compressed_packet_size);
-    if (res != Z_OK)
+    // Waiting for rows to be consumed won't help if there aren't any
+    if ((attachsql_packet_queue_peek(con) != ATTACHSQL_PACKET_TYPE_NONE) and (not attachsql_con_packet_complete(con->read_buffer)))
     {
-      asdebug("Decompression error: %d", res);
-      con->local_errcode= ATTACHSQL_RET_COMPRESSION_FAILURE;
-      con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
-      con->next_packet_queue_used= 0;
+      attachsql_con_buffer_limit_error(con);
       return true;
     }
-    con->read_buffer_compress->buffer_read_ptr+= compressed_packet_size;
-    attachsql_buffer_move_write_ptr(con->read_buffer, buffer_free);
-    return true;
+    return false;
   }
+  return true;
 }
 #endif
 
+/* Called when the read buffer doesn't hold a whole packet, returns true if
+ * more data could be added to it without waiting for the socket */
+static bool attachsql_con_read_more(attachsql_connect_t *con)
+{
+  size_t data_size= attachsql_buffer_unread_data(con->read_buffer);
+
+  if (con->read_paused)
+  {
+    attachsql_con_read_resume(con);
+  }
+#ifdef HAVE_ZLIB
+  if (con->options.compression and (con->local_errcode == ATTACHSQL_RET_OK))
+  {
+    attachsql_con_decompress_read_buffer(con);
+  }
+#endif
+  return ((con->local_errcode == ATTACHSQL_RET_OK) and (attachsql_buffer_unread_data(con->read_buffer) > data_size));
+}
+
 bool attachsql_con_process_packets(attachsql_connect_t *con)
 {
   uint32_t packet_len;
@@ -543,6 +1223,10 @@ bool attachsql_con_process_packets(attachsql_connect_t *con)
     data_size= attachsql_buffer_unread_data(con->read_buffer);
     if (data_size < 4)
     {
+      if (attachsql_con_read_more(con))
+      {
+        continue;
+      }
       asdebug("Read less than 4 bytes (%zu bytes), waiting for more", data_size);
       return false;
     }
@@ -553,6 +1237,10 @@ bool attachsql_con_process_packets(attachsql_connect_t *con)
 
     if ((packet_len + 4) > data_size)
     {
+      if (attachsql_con_read_more(con))
+      {
+        continue;
+      }
       asdebug("Don't have whole packet, expected %u bytes, got %zu", packet_len, data_size - 4);
       return false;
     }
@@ -563,11 +1251,18 @@ bool attachsql_con_process_packets(attachsql_connect_t *con)
       con->packet_number++;
     }
     attachsql_packet_queue_pop(con);
+    ATTACHSQL_STAT_ADD(con->stats.packets_in, 1);
     // Fourth byte is packet number
     asdebug("Got packet %d, expected %d", con->read_buffer->buffer_read_ptr[3], con->packet_number);
-    if (con->packet_number != con->read_buffer->buffer_read_ptr[3])
+    /* A capture made over SSL has the handshake numbered after the SSL
+     * request, which isn't sent when it is replayed */
+    if ((con->replay.data != NULL) and (con->status == ATTACHSQL_CON_STATUS_CONNECTING))
     {
-      asdebug("Packet out of sequence!");
+      con->packet_number= (uint8_t)con->read_buffer->buffer_read_ptr[3];
+    }
+    if (con->packet_number != (uint8_t)con->read_buffer->buffer_read_ptr[3])
+    {
+      aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Packet out of sequence!");
       con->local_errcode= ATTACHSQL_RET_PACKET_OUT_OF_SEQUENCE;
       con->command_status= ATTACHSQL_COMMAND_STATUS_READ_FAILED;
       con->next_packet_queue_used= 0;
@@ -575,7 +1270,7 @@ bool attachsql_con_process_packets(attachsql_connect_t *con)
     }
     con->read_buffer->buffer_read_ptr+= 4;
     con->read_buffer->packet_end_ptr= con->read_buffer->buffer_read_ptr + packet_len;
-    asdebug_hex(con->read_buffer->buffer_read_ptr, packet_len);
+    aslog_hex(con, con->read_buffer->buffer_read_ptr, packet_len);
     switch(next_packet_type)
     {
       case ATTACHSQL_PACKET_TYPE_NONE:
@@ -607,6 +1302,9 @@ bool attachsql_con_process_packets(attachsql_connect_t *con)
         attachsql_packet_read_row(con);
         return true;
         break;
+      case ATTACHSQL_PACKET_TYPE_KEEPALIVE:
+        attachsql_packet_read_keepalive(con);
+        break;
     }
   }
 
@@ -615,26 +1313,115 @@ bool attachsql_con_process_packets(attachsql_connect_t *con)
 
 void attachsql_packet_read_row(attachsql_connect_t *con)
 {
-  // If we hit an EOF instead
-  if ((unsigned char)con->read_buffer->buffer_read_ptr[0] == 0xfe)
+  // If we hit an EOF instead, a row can start with 0xfe for a long value
+  if (con->packet_size == 0)
+  {
+    attachsql_packet_malformed(con);
+    return;
+  }
+  if (((unsigned char)con->read_buffer->buffer_read_ptr[0] == 0xfe) and (con->packet_size < 9))
   {
-    con->result.row_data= NULL;
     con->result.row_length= 0;
     attachsql_packet_read_response(con);
     return;
   }
   asdebug("Row read");
-  con->result.row_data= con->read_buffer->buffer_read_ptr;
+  ATTACHSQL_STAT_ADD(con->stats.rows, 1);
+  if (not con->command_first_row)
+  {
+    con->command_first_row= true;
+    attachsql_stats_histogram_add(&con->stats.first_row_time, con->command_start);
+    if (con->trace_fn != NULL)
+    {
+      con->trace_fn(con, ATTACHSQL_TRACE_FIRST_ROW, con->command_id, con->command_type, uv_hrtime(), con->trace_context);
+    }
+  }
+  /* The row is read from the buffer's read pointer rather than a saved
+   * pointer because more data can arrive and move the buffer before the row
+   * is fetched */
   con->result.row_length= con->packet_size;
   con->command_status= ATTACHSQL_COMMAND_STATUS_ROW_IN_BUFFER;
   con->status= ATTACHSQL_CON_STATUS_IDLE;
 }
 
+int attachsql_send_internal_command(attachsql_connect_t *con, attachsql_command_t command)
+{
+  uv_buf_t send_buffer;
+  int ret;
+
+  /* Nothing else is using the connection so the command can have the packet
+   * numbers, a keepalive reply resets them for a command sent behind it */
+  attachsql_pack_int3(con->maintenance.command_packet, 1);
+  con->maintenance.command_packet[3]= 0;
+  con->maintenance.command_packet[4]= (char)command;
+  con->packet_number= 0;
+  send_buffer.base= con->maintenance.command_packet;
+  send_buffer.len= 5;
+  aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Sending internal command 0x%02X", command);
+  ATTACHSQL_STAT_ADD(con->stats.commands[command], 1);
+  ATTACHSQL_STAT_ADD(con->stats.packets_out, 1);
+  if (con->capture.file != NULL)
+  {
+    attachsql_capture_write(con, &send_buffer, 1);
+  }
+#ifdef HAVE_OPENSSL
+  if (con->ssl.handshake_done and not con->ssl.ktls_tx)
+  {
+    ret= attachsql_ssl_buffer_write(con, &send_buffer, 1);
+  }
+  else
+#endif
+  {
+    ret= attachsql_con_write(con, &send_buffer, 1);
+  }
+  if (ret < 0)
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Write fail: %s", uv_err_name(ret));
+  }
+  return ret;
+}
+
+void attachsql_packet_read_keepalive(attachsql_connect_t *con)
+{
+  if ((con->packet_size > 0) and ((unsigned char)con->read_buffer->buffer_read_ptr[0] == 0xff))
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Keepalive ping returned an error");
+  }
+  else
+  {
+    asdebug("Keepalive ping returned");
+  }
+  con->maintenance.ping_pending= false;
+  con->packet_number= 0;
+  attachsql_buffer_packet_read_end(con->read_buffer);
+}
+
 void attachsql_packet_read_end(attachsql_connect_t *con)
 {
   asdebug("Packet end");
 
   attachsql_buffer_packet_read_end(con->read_buffer);
+  /* A multi-statement query is timed until its last result */
+  if (con->command_start and not (con->server_status & ATTACHSQL_SERVER_STATUS_MORE_RESULTS))
+  {
+    attachsql_stats_histogram_add(&con->stats.query_time, con->command_start);
+    con->command_start= 0;
+    attachsql_timeout_command_end(con);
+    if (con->pool != NULL)
+    {
+      con->maintenance.last_active= uv_now(con->uv_objects.loop);
+    }
+    if (con->trace_fn != NULL)
+    {
+      con->trace_fn(con, con->server_errno ? ATTACHSQL_TRACE_ERROR : ATTACHSQL_TRACE_END, con->command_id, con->command_type, uv_hrtime(), con->trace_context);
+    }
+  }
+  /* The command is complete, buffered rows still point into the buffer
+   * until the query is closed */
+  if (not con->buffer_rows)
+  {
+    attachsql_con_buffer_shrink(con);
+  }
 }
 
 void attachsql_packet_read_prepare_response(attachsql_connect_t *con)
@@ -642,15 +1429,19 @@ void attachsql_packet_read_prepare_response(attachsql_connect_t *con)
   asdebug("Prepare response packet");
   buffer_st *buffer= con->read_buffer;
 
-  if (buffer->buffer_read_ptr[0] != 0x00)
+  if ((con->packet_size > 0) and ((unsigned char)buffer->buffer_read_ptr[0] == 0xff))
   {
     /* Stmt error packets are the same as normal ones */
     attachsql_packet_read_response(con);
   }
+  else if ((con->packet_size < 12) or (buffer->buffer_read_ptr[0] != 0x00))
+  {
+    attachsql_packet_malformed(con);
+  }
   else
   {
     uint32_t data_read= 0;
-    asdebug("Got PREPARE_OK packet");
+    aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Got PREPARE_OK packet");
     buffer->buffer_read_ptr++;
     data_read++;
     con->stmt->id= attachsql_unpack_int4(buffer->buffer_read_ptr);
@@ -697,34 +1488,47 @@ void attachsql_packet_read_response(attachsql_connect_t *con)
 {
   asdebug("Response packet");
   uint8_t bytes;
-  uint32_t data_read= 0;
+  attachsql_pack_status_t status;
+  size_t remaining;
   buffer_st *buffer= con->read_buffer;
 
+  if (con->packet_size == 0)
+  {
+    attachsql_packet_malformed(con);
+    return;
+  }
   if (buffer->buffer_read_ptr[0] == 0x00)
   {
     // This is an OK packet
-    asdebug("Got OK packet");
+    aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Got OK packet");
     buffer->buffer_read_ptr++;
-    data_read++;
-    con->affected_rows= attachsql_unpack_length(buffer->buffer_read_ptr, &bytes, NULL);
+    con->affected_rows= attachsql_unpack_length_bounded(buffer->buffer_read_ptr, buffer->packet_end_ptr, &bytes, &status);
     buffer->buffer_read_ptr+= bytes;
-    data_read+= bytes;
-    con->insert_id= attachsql_unpack_length(buffer->buffer_read_ptr, &bytes, NULL);
+    con->insert_id= attachsql_unpack_length_bounded(buffer->buffer_read_ptr, buffer->packet_end_ptr, &bytes, &status);
     buffer->buffer_read_ptr+= bytes;
-    data_read+= bytes;
+    if ((status == ATTACHSQL_PACK_TRUNCATED) or (attachsql_packet_remaining(buffer) < 4))
+    {
+      attachsql_packet_malformed(con);
+      return;
+    }
     con->server_status= attachsql_unpack_int2(buffer->buffer_read_ptr);
     buffer->buffer_read_ptr+= 2;
-    data_read+= 2;
     con->warning_count= attachsql_unpack_int2(buffer->buffer_read_ptr);
     buffer->buffer_read_ptr+= 2;
-    data_read+= 2;
-    snprintf(con->server_message, ATTACHSQL_MAX_MESSAGE_LEN, "%.*s", (con->packet_size - data_read), buffer->buffer_read_ptr);
+    remaining= attachsql_packet_remaining(buffer);
+    snprintf(con->server_message, ATTACHSQL_MAX_MESSAGE_LEN, "%.*s", (int)remaining, buffer->buffer_read_ptr);
     con->server_message[ATTACHSQL_MAX_MESSAGE_LEN - 1]= '\0';
-    buffer->buffer_read_ptr+= (con->packet_size - data_read);
+    buffer->buffer_read_ptr+= remaining;
     if (con->status == ATTACHSQL_CON_STATUS_CONNECTING)
     {
       con->command_status= ATTACHSQL_COMMAND_STATUS_CONNECTED;
-      if (con->client_capabilities & ATTACHSQL_CAPABILITY_COMPRESS)
+      attachsql_stats_histogram_add(&con->stats.connect_time, con->connect_start);
+      attachsql_timeout_connect_end(con);
+      if (con->pool != NULL)
+      {
+        attachsql_pool_connection_ready(con);
+      }
+      if (con->client_capabilities & ATTACHSQL_CAPABILITY_ANY_COMPRESSION)
       {
         con->options.compression= true;
       }
@@ -739,19 +1543,22 @@ void attachsql_packet_read_response(attachsql_connect_t *con)
   else if ((unsigned char)buffer->buffer_read_ptr[0] == 0xff)
   {
     // This is an Error packet
-    asdebug("Got Error packet");
+    aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Got Error packet");
+    if (con->packet_size < 9)
+    {
+      attachsql_packet_malformed(con);
+      return;
+    }
     buffer->buffer_read_ptr++;
-    data_read++;
     con->server_errno= attachsql_unpack_int2(buffer->buffer_read_ptr);
     // Also skip the SQLSTATE marker, always a '#'
     buffer->buffer_read_ptr+= 3;
-    data_read+= 3;
     memcpy(con->sqlstate, buffer->buffer_read_ptr, 5);
     buffer->buffer_read_ptr+= 5;
-    data_read+= 5;
-    snprintf(con->server_message, ATTACHSQL_MAX_MESSAGE_LEN, "%.*s", (con->packet_size - data_read), buffer->buffer_read_ptr);
+    remaining= attachsql_packet_remaining(buffer);
+    snprintf(con->server_message, ATTACHSQL_MAX_MESSAGE_LEN, "%.*s", (int)remaining, buffer->buffer_read_ptr);
     con->server_message[ATTACHSQL_MAX_MESSAGE_LEN - 1]= '\0';
-    buffer->buffer_read_ptr+= (con->packet_size - data_read);
+    buffer->buffer_read_ptr+= remaining;
     if (con->command_status == ATTACHSQL_COMMAND_STATUS_READ_RESPONSE)
     {
       con->status= ATTACHSQL_CON_STATUS_CONNECT_FAILED;
@@ -767,7 +1574,12 @@ void attachsql_packet_read_response(attachsql_connect_t *con)
   else if ((unsigned char)buffer->buffer_read_ptr[0] == 0xfe)
   {
     // This is an EOF packet
-    asdebug("Got EOF packet");
+    aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Got EOF packet");
+    if (con->packet_size < 5)
+    {
+      attachsql_packet_malformed(con);
+      return;
+    }
     buffer->buffer_read_ptr++;
     con->warning_count= attachsql_unpack_int2(buffer->buffer_read_ptr);
     buffer->buffer_read_ptr+= 2;
@@ -804,10 +1616,24 @@ void attachsql_packet_read_response(attachsql_connect_t *con)
   else
   {
     // This is a result packet
-    asdebug("Got result packet");
-    con->result.column_count= attachsql_unpack_length(buffer->buffer_read_ptr, &bytes, NULL);
+    aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Got result packet");
+    uint64_t column_count= attachsql_unpack_length_bounded(buffer->buffer_read_ptr, buffer->packet_end_ptr, &bytes, &status);
+    /* 0xfb asks for a LOCAL INFILE which isn't supported, a result can't
+     * start in the middle of another one */
+    if ((status != ATTACHSQL_PACK_OK) or (column_count == 0) or (column_count > UINT16_MAX)
+        or ((con->command_status != ATTACHSQL_COMMAND_STATUS_SEND) and (con->command_status != ATTACHSQL_COMMAND_STATUS_READ_RESPONSE)))
+    {
+      attachsql_packet_malformed(con);
+      return;
+    }
     buffer->buffer_read_ptr+= bytes;
+    con->result.column_count= (uint16_t)column_count;
     con->result.columns= new (std::nothrow) column_t[con->result.column_count];
+    if (con->result.columns == NULL)
+    {
+      attachsql_con_read_abort(con, ATTACHSQL_RET_OUT_OF_MEMORY_ERROR, "Allocation failure for columns");
+      return;
+    }
     attachsql_buffer_packet_read_end(con->read_buffer);
     attachsql_packet_queue_push(con, ATTACHSQL_PACKET_TYPE_COLUMN);
     con->command_status= ATTACHSQL_COMMAND_STATUS_READ_COLUMN;
@@ -820,7 +1646,11 @@ void attachsql_packet_read_prepare_parameter(attachsql_connect_t *con)
   column_t *column;
 
   column= &con->stmt->params[con->stmt->current_param];
-  attachsql_packet_get_column(con, column);
+  if (not attachsql_packet_get_column(con, column))
+  {
+    attachsql_packet_malformed(con);
+    return;
+  }
   con->stmt->current_param++;
   if (con->stmt->current_param == con->stmt->param_count)
   {
@@ -854,7 +1684,11 @@ void attachsql_packet_read_column(attachsql_connect_t *con)
   column_t *column;
 
   column= &con->result.columns[con->result.current_column];
-  attachsql_packet_get_column(con, column);
+  if (not attachsql_packet_get_column(con, column))
+  {
+    attachsql_packet_malformed(con);
+    return;
+  }
   con->result.current_column++;
   if (con->result.current_column == con->result.column_count)
   {
@@ -866,109 +1700,26 @@ void attachsql_packet_read_column(attachsql_connect_t *con)
   }
 }
 
-void attachsql_packet_get_column(attachsql_connect_t *con, column_t *column)
+bool attachsql_packet_get_column(attachsql_connect_t *con, column_t *column)
 {
-  uint8_t bytes;
-  uint64_t str_len;
-  size_t str_read;
   buffer_st *buffer= con->read_buffer;
 
   // Skip catalog since no MySQL version actually uses this yet
-  str_len= attachsql_unpack_length(buffer->buffer_read_ptr, &bytes, NULL);
-  buffer->buffer_read_ptr+= bytes;
-  buffer->buffer_read_ptr+= str_len;
-
-  // Schema
-  str_len= attachsql_unpack_length(buffer->buffer_read_ptr, &bytes, NULL);
-  buffer->buffer_read_ptr+= bytes;
-  if (str_len >= ATTACHSQL_MAX_SCHEMA_SIZE)
-  {
-    str_read= ATTACHSQL_MAX_SCHEMA_SIZE - 1;
-  }
-  else
-  {
-    str_read= (size_t)str_len;
-  }
-  if (str_read > 0)
-  {
-    memcpy(column->schema, buffer->buffer_read_ptr, str_read);
-  }
-  column->schema[str_read]= '\0';
-  buffer->buffer_read_ptr+= str_len;
-
-  // Table
-  str_len= attachsql_unpack_length(buffer->buffer_read_ptr, &bytes, NULL);
-  buffer->buffer_read_ptr+= bytes;
-  if (str_len >= ATTACHSQL_MAX_TABLE_SIZE)
-  {
-    str_read= ATTACHSQL_MAX_TABLE_SIZE -1;
-  }
-  else
-  {
-    str_read= (size_t)str_len;
-  }
-  if (str_read > 0)
-  {
-    memcpy(column->table, buffer->buffer_read_ptr, str_read);
-  }
-  column->table[str_read]= '\0';
-  buffer->buffer_read_ptr+= str_len;
-
-  // Origin table
-  str_len= attachsql_unpack_length(buffer->buffer_read_ptr, &bytes, NULL);
-  buffer->buffer_read_ptr+= bytes;
-  if (str_len >= ATTACHSQL_MAX_TABLE_SIZE)
-  {
-    str_read= ATTACHSQL_MAX_TABLE_SIZE -1;
-  }
-  else
-  {
-    str_read= (size_t)str_len;
-  }
-  if (str_read > 0)
-  {
-    memcpy(column->origin_table, buffer->buffer_read_ptr, str_read);
-  }
-  column->origin_table[str_read]= '\0';
-  buffer->buffer_read_ptr+= str_len;
-
-  // Column
-  str_len= attachsql_unpack_length(buffer->buffer_read_ptr, &bytes, NULL);
-  buffer->buffer_read_ptr+= bytes;
-  if (str_len >= ATTACHSQL_MAX_COLUMN_SIZE)
-  {
-    str_read= ATTACHSQL_MAX_COLUMN_SIZE -1;
-  }
-  else
-  {
-    str_read= (size_t)str_len;
-  }
-  if (str_read > 0)
+  if (not attachsql_packet_get_string(buffer, NULL, 0, NULL)
+      or not attachsql_packet_get_string(buffer, column->schema, ATTACHSQL_MAX_SCHEMA_SIZE, NULL)
+      or not attachsql_packet_get_string(buffer, column->table, ATTACHSQL_MAX_TABLE_SIZE, NULL)
+      or not attachsql_packet_get_string(buffer, column->origin_table, ATTACHSQL_MAX_TABLE_SIZE, NULL)
+      or not attachsql_packet_get_string(buffer, column->column, ATTACHSQL_MAX_COLUMN_SIZE, NULL)
+      or not attachsql_packet_get_string(buffer, column->origin_column, ATTACHSQL_MAX_COLUMN_SIZE, NULL))
   {
-    memcpy(column->column, buffer->buffer_read_ptr, str_read);
+    return false;
   }
-  column->column[str_read]= '\0';
-  buffer->buffer_read_ptr+= str_len;
 
-  // Origin column
-  str_len= attachsql_unpack_length(buffer->buffer_read_ptr, &bytes, NULL);
-  buffer->buffer_read_ptr+= bytes;
-  if (str_len >= ATTACHSQL_MAX_COLUMN_SIZE)
-  {
-    str_read= ATTACHSQL_MAX_COLUMN_SIZE -1;
-  }
-  else
-  {
-    str_read= (size_t)str_len;
-  }
-  if (str_read > 0)
+  // Padding, charset, length, type, flags, decimals and padding
+  if (attachsql_packet_remaining(buffer) < 13)
   {
-    memcpy(column->origin_column, buffer->buffer_read_ptr, str_read);
+    return false;
   }
-  column->origin_column[str_read]= '\0';
-  buffer->buffer_read_ptr+= str_len;
-
-  // Padding
   buffer->buffer_read_ptr++;
 
   // Charset
@@ -996,25 +1747,18 @@ void attachsql_packet_get_column(attachsql_connect_t *con, column_t *column)
   // Padding
   buffer->buffer_read_ptr+= 2;
 
-  // Default value
-  str_len= attachsql_unpack_length(buffer->buffer_read_ptr, &bytes, NULL);
-  buffer->buffer_read_ptr+= bytes;
-  if (str_len >= ATTACHSQL_MAX_DEFAULT_VALUE_SIZE)
-  {
-    str_read= ATTACHSQL_MAX_DEFAULT_VALUE_SIZE -1;
-  }
-  else
-  {
-    str_read= (size_t)str_len;
-  }
-  if (str_read > 0)
+  // Default value, only sent for COM_FIELD_LIST
+  column->default_size= 0;
+  if (attachsql_packet_remaining(buffer) > 0)
   {
-    memcpy(column->default_value, buffer->buffer_read_ptr, str_read);
+    if (not attachsql_packet_get_string(buffer, column->default_value, ATTACHSQL_MAX_DEFAULT_VALUE_SIZE, &column->default_size))
+    {
+      return false;
+    }
   }
-  column->default_size= str_read;
-  buffer->buffer_read_ptr+= str_len;
   asdebug("Got column %s.%s.%s", column->schema, column->table, column->column);
   attachsql_buffer_packet_read_end(con->read_buffer);
+  return true;
 }
 
 void attachsql_run_uv_loop(attachsql_connect_t *con)
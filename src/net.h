@@ -25,14 +25,37 @@ extern "C" {
 
 void attachsql_send_data(attachsql_connect_t *con, char *data, size_t length);
 
+int attachsql_con_write(attachsql_connect_t *con, uv_buf_t *buffers, unsigned int buffer_count);
+
+void attachsql_con_write_complete(attachsql_connect_t *con);
+
 void on_write(uv_write_t *req, int status);
 
 void attachsql_read_data_cb(uv_stream_t* tcp, ssize_t read_size, const uv_buf_t *buf);
 
+size_t attachsql_con_replay_read(attachsql_connect_t *con, const char *data, size_t length);
+
 bool attachsql_con_process_packets(attachsql_connect_t *con);
 
+size_t attachsql_con_buffer_size(attachsql_connect_t *con);
+
+bool attachsql_con_buffer_can_grow(attachsql_connect_t *con, buffer_st *buffer);
+
+attachsql_ret_t attachsql_con_buffer_increase(attachsql_connect_t *con, buffer_st *buffer);
+
+void attachsql_con_buffer_shrink(attachsql_connect_t *con);
+
 void attachsql_packet_read_end(attachsql_connect_t *con);
 
+/* Drops the connection, ret and message become the connection's error */
+void attachsql_con_read_abort(attachsql_connect_t *con, attachsql_ret_t ret, const char *message);
+
+/* Drops the connection after a packet which can't be parsed */
+void attachsql_packet_malformed(attachsql_connect_t *con);
+
+/* Bytes left in the packet being read */
+size_t attachsql_packet_remaining(buffer_st *buffer);
+
 void attachsql_packet_read_response(attachsql_connect_t *con);
 
 void attachsql_packet_read_prepare_response(attachsql_connect_t *con);
@@ -41,7 +64,7 @@ void attachsql_packet_read_prepare_parameter(attachsql_connect_t *con);
 
 void attachsql_packet_read_prepare_column(attachsql_connect_t *con);
 
-void attachsql_packet_get_column(attachsql_connect_t *con, column_t *column);
+bool attachsql_packet_get_column(attachsql_connect_t *con, column_t *column);
 
 void attachsql_packet_read_column(attachsql_connect_t *con);
 
@@ -49,6 +72,12 @@ void attachsql_packet_stmt_read_row(attachsql_connect_t *con);
 
 void attachsql_packet_read_row(attachsql_connect_t *con);
 
+/* Sends a command with no data which the application doesn't see, such as
+ * a keepalive ping, for uncompressed connections only */
+int attachsql_send_internal_command(attachsql_connect_t *con, attachsql_command_t command);
+
+void attachsql_packet_read_keepalive(attachsql_connect_t *con);
+
 void attachsql_run_uv_loop(attachsql_connect_t *con);
 
 bool attachsql_packet_queue_push(attachsql_connect_t *con, attachsql_packet_type_t packet_type);
@@ -61,9 +90,19 @@ attachsql_packet_type_t attachsql_packet_queue_peek(attachsql_connect_t *con);
 void attachsql_send_compressed_packet(attachsql_connect_t *con, char *data, size_t length, uint8_t command);
 #endif
 
+#ifdef HAVE_ZSTD
+int attachsql_zstd_level(attachsql_connect_t *con);
+#endif
+
 #ifdef HAVE_OPENSSL
+/* Size of each direction of the SSL BIO pair, enough for several maximum
+ * sized TLS records */
+#define ATTACHSQL_SSL_BIO_BUFFER_SIZE 1024*64
+
 void attachsql_ssl_run(attachsql_connect_t *con);
 
+void attachsql_ssl_read_all(attachsql_connect_t *con);
+
 void attachsql_ssl_data_check(attachsql_connect_t *con);
 
 void attachsql_ssl_handle_error(attachsql_connect_t *con, int result);
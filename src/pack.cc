@@ -68,6 +68,53 @@ uint64_t attachsql_unpack_length(char *buffer, uint8_t *bytes, attachsql_pack_st
   // If you get here, your compiler doesn't love you
 }
 
+/* As attachsql_unpack_length() for data ending at 'end'.  If the int runs
+ * past 'end' 'status' is ATTACHSQL_PACK_TRUNCATED and 'bytes' is 0.  The
+ * caller still needs to check any data the int is the length of.
+ */
+uint64_t attachsql_unpack_length_bounded(char *buffer, char *end, uint8_t *bytes, attachsql_pack_status_t *status)
+{
+  attachsql_pack_status_t unused_status;
+  size_t needed;
+  if (status == NULL)
+  {
+    status= &unused_status;
+  }
+  if ((bytes == NULL) || (buffer == NULL) || (end == NULL))
+  {
+    *status= ATTACHSQL_PACK_INVALID_ARGUMENT;
+    return 0;
+  }
+
+  if (buffer >= end)
+  {
+    needed= 1;
+  }
+  else if ((unsigned char)buffer[0] <= 0xfb)
+  {
+    needed= 1;
+  }
+  else if ((unsigned char)buffer[0] == 0xfc)
+  {
+    needed= 3;
+  }
+  else if ((unsigned char)buffer[0] == 0xfd)
+  {
+    needed= 4;
+  }
+  else
+  {
+    needed= 9;
+  }
+  if ((buffer >= end) || (needed > (size_t)(end - buffer)))
+  {
+    *bytes= 0;
+    *status= ATTACHSQL_PACK_TRUNCATED;
+    return 0;
+  }
+  return attachsql_unpack_length(buffer, bytes, status);
+}
+
 char *attachsql_pack_data(char *buffer, size_t length, char *data)
 {
   buffer= attachsql_pack_length(buffer, length);
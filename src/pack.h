@@ -30,11 +30,14 @@ enum attachsql_pack_status_t
 {
   ATTACHSQL_PACK_OK,
   ATTACHSQL_PACK_INVALID_ARGUMENT,
-  ATTACHSQL_PACK_NULL
+  ATTACHSQL_PACK_NULL,
+  ATTACHSQL_PACK_TRUNCATED
 };
 
 uint64_t attachsql_unpack_length(char *buffer, uint8_t *bytes, attachsql_pack_status_t *status);
 
+uint64_t attachsql_unpack_length_bounded(char *buffer, char *end, uint8_t *bytes, attachsql_pack_status_t *status);
+
 char *attachsql_pack_data(char *buffer, size_t length, char *data);
 
 char *attachsql_pack_length(char *buffer, size_t length);
@@ -17,6 +17,17 @@
 
 #include "config.h"
 #include "common.h"
+#include "connect.h"
+#include "dns.h"
+#include "net.h"
+#include "stats.h"
+#include "ssl_context.h"
+#include "pool_internal.h"
+#include "log.h"
+
+/* How often a connection past its lifetime is looked at again while the
+ * application is using it */
+#define ATTACHSQL_POOL_RECYCLE_RETRY 1000
 
 attachsql_pool_t *attachsql_pool_create(attachsql_callback_fn *function, void *context, attachsql_error_t **error)
 {
@@ -37,6 +48,8 @@ attachsql_pool_t *attachsql_pool_create(attachsql_callback_fn *function, void *c
     delete pool;
     return NULL;
   }
+  attachsql_timer_wheel_init(&pool->wheel, pool->loop);
+  uv_mutex_init(&pool->connections_lock);
   pool->callback_fn= function;
   pool->callback_context= context;
   return pool;
@@ -49,6 +62,10 @@ void attachsql_pool_destroy(attachsql_pool_t *pool)
   {
     return;
   }
+  if (pool->warm_up.resolving)
+  {
+    uv_cancel((uv_req_t*)&pool->warm_up.resolver);
+  }
   for (connection= 0; connection < pool->connection_count; connection++)
   {
     attachsql_connect_destroy(pool->connections[connection]);
@@ -66,6 +83,11 @@ void attachsql_pool_destroy(attachsql_pool_t *pool)
   {
     free(pool->connections);
   }
+  if (pool->ssl_context != NULL)
+  {
+    attachsql_ssl_context_destroy(pool->ssl_context);
+  }
+  uv_mutex_destroy(&pool->connections_lock);
   delete pool;
 }
 
@@ -79,6 +101,18 @@ void attachsql_pool_add_connection(attachsql_pool_t *pool, attachsql_connect_t *
     return;
   }
 
+#ifdef HAVE_OPENSSL
+  /* Connections without their own SSL settings use the pool's */
+  if ((pool->ssl_context != NULL) and (con->ssl.context == NULL))
+  {
+    if (not attachsql_connect_set_ssl_context(con, pool->ssl_context, error))
+    {
+      return;
+    }
+  }
+#endif
+
+  uv_mutex_lock(&pool->connections_lock);
   tmp_cons= (attachsql_connect_t**)realloc(pool->connections, sizeof(attachsql_connect_t*) * (pool->connection_count + 1));
   if (tmp_cons != NULL)
   {
@@ -89,16 +123,395 @@ void attachsql_pool_add_connection(attachsql_pool_t *pool, attachsql_connect_t *
     pool->connection_count++;
     con->connection_id= pool->connection_count;
   }
-  else
+  uv_mutex_unlock(&pool->connections_lock);
+  if (tmp_cons == NULL)
   {
     attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_ALLOC, ATTACHSQL_ERROR_LEVEL_ERROR, "82100", "Allocation failure for pool connection add");
   }
 }
 
+bool attachsql_pool_set_max_buffer_size(attachsql_pool_t *pool, size_t size)
+{
+  if (pool == NULL)
+  {
+    return false;
+  }
+  pool->max_buffer_size= size;
+  return true;
+}
+
+/* Nothing is in flight and the application isn't holding a result */
+static bool attachsql_pool_connection_idle(attachsql_connect_t *con)
+{
+  return ((con->status == ATTACHSQL_CON_STATUS_IDLE) and not con->in_query and (con->next_packet_queue_used == 0)
+          and ((con->command_status == ATTACHSQL_COMMAND_STATUS_EOF) or (con->command_status == ATTACHSQL_COMMAND_STATUS_CONNECTED)));
+}
+
+static uint64_t attachsql_pool_earliest(uint64_t current, uint64_t time)
+{
+  if ((current == 0) or (time < current))
+  {
+    return time;
+  }
+  return current;
+}
+
+/* The wheel entry of a connection is only ever set for the next time
+ * something may need doing, everything is worked out again when it runs */
+static void attachsql_pool_maintain(timer_wheel_entry_st *entry)
+{
+  attachsql_connect_t *con= (attachsql_connect_t*)entry->data;
+  attachsql_pool_t *pool= con->pool;
+  uint64_t now= uv_now(pool->loop);
+  uint64_t next= 0;
+  bool idle;
+
+  /* Failed or reconnecting connections start again when connected */
+  if ((con->status != ATTACHSQL_CON_STATUS_IDLE) and (con->status != ATTACHSQL_CON_STATUS_BUSY))
+  {
+    return;
+  }
+  idle= attachsql_pool_connection_idle(con);
+
+  if (con->maintenance.ping_pending and pool->keepalive_interval)
+  {
+    if (now >= con->maintenance.ping_sent + pool->keepalive_interval)
+    {
+      attachsql_con_read_abort(con, ATTACHSQL_RET_TIMEOUT, "Keepalive timeout");
+      return;
+    }
+    next= con->maintenance.ping_sent + pool->keepalive_interval;
+  }
+
+  if (pool->max_lifetime)
+  {
+    if (now < con->maintenance.connected_at + pool->max_lifetime)
+    {
+      next= attachsql_pool_earliest(next, con->maintenance.connected_at + pool->max_lifetime);
+    }
+    /* Server side prepared statements would be lost */
+    else if (idle and (con->stmt == NULL))
+    {
+      attachsql_connect_recycle(con);
+      return;
+    }
+    else
+    {
+      next= attachsql_pool_earliest(next, now + ATTACHSQL_POOL_RECYCLE_RETRY);
+    }
+  }
+
+  /* A ping can't be slotted in between compressed packets */
+  if (pool->keepalive_interval and not con->maintenance.ping_pending and not con->options.compression)
+  {
+    if (not idle)
+    {
+      next= attachsql_pool_earliest(next, now + pool->keepalive_interval);
+    }
+    else if (now < con->maintenance.last_active + pool->keepalive_interval)
+    {
+      next= attachsql_pool_earliest(next, con->maintenance.last_active + pool->keepalive_interval);
+    }
+    else if (attachsql_send_internal_command(con, ATTACHSQL_COMMAND_PING) < 0)
+    {
+      attachsql_con_read_abort(con, ATTACHSQL_RET_NET_WRITE_ERROR, "Keepalive write failure");
+      return;
+    }
+    else
+    {
+      attachsql_packet_queue_push(con, ATTACHSQL_PACKET_TYPE_KEEPALIVE);
+      con->maintenance.ping_pending= true;
+      con->maintenance.ping_sent= now;
+      con->maintenance.last_active= now;
+      next= attachsql_pool_earliest(next, now + pool->keepalive_interval);
+    }
+  }
+
+  if (next)
+  {
+    attachsql_timer_wheel_schedule(&pool->wheel, entry, next);
+  }
+}
+
+static void attachsql_pool_maintain_schedule(attachsql_connect_t *con)
+{
+  attachsql_pool_t *pool= con->pool;
+  uint64_t next= 0;
+
+  if (pool->keepalive_interval)
+  {
+    next= con->maintenance.last_active + pool->keepalive_interval;
+  }
+  if (pool->max_lifetime)
+  {
+    next= attachsql_pool_earliest(next, con->maintenance.connected_at + pool->max_lifetime);
+  }
+  if (next == 0)
+  {
+    attachsql_timer_wheel_cancel(&pool->wheel, &con->maintenance.entry);
+    return;
+  }
+  if (con->maintenance.entry.fn == NULL)
+  {
+    attachsql_timer_wheel_entry_init(&con->maintenance.entry, attachsql_pool_maintain, con);
+  }
+  attachsql_timer_wheel_schedule(&pool->wheel, &con->maintenance.entry, next);
+}
+
+void attachsql_pool_connection_ready(attachsql_connect_t *con)
+{
+  uint64_t now= uv_now(con->uv_objects.loop);
+
+  con->maintenance.connected_at= now;
+  con->maintenance.last_active= now;
+  con->maintenance.ping_pending= false;
+  if (con->maintenance.recycling)
+  {
+    con->maintenance.recycling= false;
+    /* The application only hears about it if it sent something in the
+     * meantime, that is sent when the connected status is polled */
+    if (con->query_buffer_length == 0)
+    {
+      con->command_status= ATTACHSQL_COMMAND_STATUS_EOF;
+      con->last_callback= ATTACHSQL_EVENT_EOF;
+    }
+  }
+  attachsql_pool_maintain_schedule(con);
+}
+
+/* Settings apply to connections already in the pool too */
+static void attachsql_pool_maintain_reschedule(attachsql_pool_t *pool)
+{
+  uint32_t connection;
+
+  for (connection= 0; connection < pool->connection_count; connection++)
+  {
+    if (pool->connections[connection]->maintenance.connected_at)
+    {
+      attachsql_pool_maintain_schedule(pool->connections[connection]);
+    }
+  }
+}
+
+bool attachsql_pool_set_keepalive(attachsql_pool_t *pool, uint32_t interval)
+{
+  if (pool == NULL)
+  {
+    return false;
+  }
+  pool->keepalive_interval= interval;
+  attachsql_pool_maintain_reschedule(pool);
+  return true;
+}
+
+bool attachsql_pool_set_max_lifetime(attachsql_pool_t *pool, uint32_t lifetime)
+{
+  if (pool == NULL)
+  {
+    return false;
+  }
+  pool->max_lifetime= lifetime;
+  attachsql_pool_maintain_reschedule(pool);
+  return true;
+}
+
+size_t attachsql_pool_get_buffer_size(attachsql_pool_t *pool)
+{
+  size_t connection;
+  size_t size= 0;
+
+  if (pool == NULL)
+  {
+    return 0;
+  }
+  for (connection= 0; connection < pool->connection_count; connection++)
+  {
+    size+= attachsql_con_buffer_size(pool->connections[connection]);
+  }
+  return size;
+}
+
+void attachsql_pool_get_stats(attachsql_pool_t *pool, attachsql_connect_stats_st *stats)
+{
+  attachsql_connect_stats_st con_stats;
+  size_t connection;
+
+  if ((pool == NULL) or (stats == NULL))
+  {
+    return;
+  }
+  memset(stats, 0, sizeof(attachsql_connect_stats_st));
+  /* Connections can be added by the thread running the pool meanwhile, the
+   * counters themselves are safe to copy */
+  uv_mutex_lock(&pool->connections_lock);
+  for (connection= 0; connection < pool->connection_count; connection++)
+  {
+    attachsql_stats_copy(&con_stats, &pool->connections[connection]->stats);
+    attachsql_stats_merge(stats, &con_stats);
+  }
+  uv_mutex_unlock(&pool->connections_lock);
+}
+
+static void pool_warm_up_resolved(uv_getaddrinfo_t *resolver, int status, struct addrinfo *res)
+{
+  attachsql_pool_t *pool= (attachsql_pool_t*)resolver->data;
+  attachsql_connect_t *con_template= pool->warm_up.con_template;
+
+  pool->warm_up.resolving= false;
+  pool->warm_up.resolved= true;
+  if (status < 0)
+  {
+    /* The connections will pick up the failure from the DNS cache and
+     * report it through the callback */
+    asdebug("Warm up DNS lookup failure: %s", uv_err_name(status));
+    if (status != UV_ECANCELED)
+    {
+      attachsql_dns_cache_store(con_template->host, con_template->port, NULL, status);
+    }
+    return;
+  }
+  memcpy(&pool->warm_up.address, res->ai_addr, res->ai_addrlen);
+  pool->warm_up.address_set= true;
+  attachsql_dns_cache_store(con_template->host, con_template->port, res->ai_addr, 0);
+  uv_freeaddrinfo(res);
+}
+
+static void pool_warm_up_connect(attachsql_pool_t *pool)
+{
+  attachsql_connect_t *con;
+  attachsql_error_t *error;
+
+  while ((pool->warm_up.in_progress < pool->warm_up.max_concurrent) and (pool->warm_up.started < pool->warm_up.target))
+  {
+    error= NULL;
+    pool->warm_up.started++;
+    con= attachsql_connect_clone(pool->warm_up.con_template, &error);
+    if (con == NULL)
+    {
+      attachsql_error_free(error);
+      pool->warm_up.failed++;
+      continue;
+    }
+    if (pool->warm_up.address_set)
+    {
+      memcpy(&con->address, &pool->warm_up.address, sizeof(con->address));
+      con->address_set= true;
+    }
+    attachsql_pool_add_connection(pool, con, &error);
+    if (error != NULL)
+    {
+      attachsql_error_free(error);
+      attachsql_connect_destroy(con);
+      pool->warm_up.failed++;
+      continue;
+    }
+    con->pool_warming= true;
+    pool->warm_up.in_progress++;
+    /* Failures are reported through the callback and counted in
+     * attachsql_pool_run() */
+    attachsql_connect(con, &error);
+  }
+}
+
+bool attachsql_pool_warm_up(attachsql_pool_t *pool, attachsql_connect_t *con_template, uint32_t target, uint32_t max_concurrent, attachsql_error_t **error)
+{
+  int ret;
+  attachsql_dns_cache_result_t cache_result;
+  int cache_error;
+
+  if ((pool == NULL) or (con_template == NULL) or (max_concurrent == 0))
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Bad parameter");
+    return false;
+  }
+
+  if (pool->warm_up.active)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_OUT_OF_SYNC, ATTACHSQL_ERROR_LEVEL_ERROR, "08002", "Pool warm up already in progress");
+    return false;
+  }
+
+  pool->warm_up.con_template= con_template;
+  pool->warm_up.target= target;
+  pool->warm_up.max_concurrent= max_concurrent;
+  pool->warm_up.started= 0;
+  pool->warm_up.in_progress= 0;
+  pool->warm_up.connected= 0;
+  pool->warm_up.failed= 0;
+  pool->warm_up.active= true;
+  pool->warm_up.resolved= false;
+  pool->warm_up.address_set= false;
+
+  /* Resolve once for the whole pool rather than once per connection */
+  if ((con_template->address_set) or (con_template->port == 0) or (con_template->options.protocol == ATTACHSQL_CON_PROTOCOL_UDS))
+  {
+    pool->warm_up.resolved= true;
+  }
+  else
+  {
+    cache_result= attachsql_dns_cache_lookup(con_template->host, con_template->port, &pool->warm_up.address, &cache_error);
+    if (cache_result == ATTACHSQL_DNS_CACHE_HIT)
+    {
+      pool->warm_up.address_set= true;
+      pool->warm_up.resolved= true;
+    }
+    else if (cache_result == ATTACHSQL_DNS_CACHE_NEGATIVE)
+    {
+      pool->warm_up.resolved= true;
+    }
+    else
+    {
+      snprintf(con_template->str_port, 6, "%d", con_template->port);
+      pool->warm_up.hints.ai_family = PF_INET;
+      pool->warm_up.hints.ai_socktype = SOCK_STREAM;
+      pool->warm_up.hints.ai_protocol = IPPROTO_TCP;
+      pool->warm_up.hints.ai_flags = 0;
+      pool->warm_up.resolver.data= pool;
+      ret= uv_getaddrinfo(pool->loop, &pool->warm_up.resolver, pool_warm_up_resolved, con_template->host, con_template->str_port, &pool->warm_up.hints);
+      if (ret < 0)
+      {
+        /* Let the connections try on their own */
+        asdebug("Warm up DNS lookup fail: %s", uv_err_name(ret));
+        pool->warm_up.resolved= true;
+      }
+      else
+      {
+        pool->warm_up.resolving= true;
+      }
+    }
+  }
+
+  if (pool->warm_up.resolved)
+  {
+    pool_warm_up_connect(pool);
+  }
+  return true;
+}
+
+bool attachsql_pool_get_warm_up_progress(attachsql_pool_t *pool, uint32_t *connected, uint32_t *failed)
+{
+  if (pool == NULL)
+  {
+    return false;
+  }
+  if (connected != NULL)
+  {
+    *connected= pool->warm_up.connected;
+  }
+  if (failed != NULL)
+  {
+    *failed= pool->warm_up.failed;
+  }
+  return not pool->warm_up.active;
+}
+
 void attachsql_pool_run(attachsql_pool_t *pool)
 {
   size_t connection;
   attachsql_error_t *error= NULL;
+  attachsql_connect_t *con;
+  attachsql_return_t ret;
+
   if (pool == NULL)
   {
     return;
@@ -106,6 +519,38 @@ void attachsql_pool_run(attachsql_pool_t *pool)
   uv_run(pool->loop, UV_RUN_NOWAIT);
   for (connection= 0; connection < pool->connection_count; connection++)
   {
-    attachsql_connect_poll(pool->connections[connection], &error);
+    con= pool->connections[connection];
+    ret= attachsql_connect_poll(con, &error);
+    if (con->pool_warming)
+    {
+      if (ret == ATTACHSQL_RETURN_ERROR)
+      {
+        pool->warm_up.failed++;
+      }
+      else if ((con->status == ATTACHSQL_CON_STATUS_IDLE) or (con->status == ATTACHSQL_CON_STATUS_BUSY))
+      {
+        pool->warm_up.connected++;
+      }
+      else
+      {
+        continue;
+      }
+      con->pool_warming= false;
+      pool->warm_up.in_progress--;
+    }
+  }
+
+  if (pool->warm_up.active and pool->warm_up.resolved)
+  {
+    pool_warm_up_connect(pool);
+    if (pool->warm_up.connected + pool->warm_up.failed == pool->warm_up.target)
+    {
+      asdebug("Pool warm up complete, %u connected, %u failed", pool->warm_up.connected, pool->warm_up.failed);
+      pool->warm_up.active= false;
+      if (pool->callback_fn != NULL)
+      {
+        pool->callback_fn(NULL, 0, ATTACHSQL_EVENT_WARM_UP_COMPLETE, pool->callback_context, NULL);
+      }
+    }
   }
 }
@@ -19,6 +19,282 @@
 #include "common.h"
 #include "query_internal.h"
 #include "ascore.h"
+#include "log.h"
+#include "stats.h"
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+# include <immintrin.h>
+#endif
+
+/* Replacement character for bytes which need a backslash escape, 0 if the
+ * byte can be copied as-is */
+static const char attachsql_escape_map[256]=
+{
+  /* 0x00 */ '0', 0, 0, 0, 0, 0, 0, 0, 0, 0, 'n', 0, 0, 'r', 0, 0,
+  /* 0x10 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 'Z', 0, 0, 0, 0, 0,
+  /* 0x20 */ 0, 0, '\"', 0, 0, 0, 0, '\'', 0, 0, 0, 0, 0, 0, 0, 0,
+  /* 0x30 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  /* 0x40 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  /* 0x50 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0
+  /* 0x60 - 0xff are all zero */
+};
+
+static const char attachsql_digit_pairs[201]=
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/* Returns the offset of the first byte in data which needs escaping or
+ * length if there are none.  The vector paths compare 16/32 bytes at a time
+ * against all seven escapable characters. */
+size_t attachsql_query_escape_scan(const char *data, size_t length)
+{
+  size_t pos= 0;
+
+#if defined(__AVX2__)
+  const __m256i avx_nul= _mm256_setzero_si256();
+  const __m256i avx_nl= _mm256_set1_epi8('\n');
+  const __m256i avx_cr= _mm256_set1_epi8('\r');
+  const __m256i avx_sub= _mm256_set1_epi8('\032');
+  const __m256i avx_bs= _mm256_set1_epi8('\\');
+  const __m256i avx_sq= _mm256_set1_epi8('\'');
+  const __m256i avx_dq= _mm256_set1_epi8('\"');
+  while (pos + 32 <= length)
+  {
+    __m256i chunk= _mm256_loadu_si256((const __m256i*)(data + pos));
+    __m256i match= _mm256_or_si256(
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, avx_nul), _mm256_cmpeq_epi8(chunk, avx_nl)),
+                      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, avx_cr), _mm256_cmpeq_epi8(chunk, avx_sub))),
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, avx_bs), _mm256_cmpeq_epi8(chunk, avx_sq)),
+                      _mm256_cmpeq_epi8(chunk, avx_dq)));
+    uint32_t mask= (uint32_t)_mm256_movemask_epi8(match);
+    if (mask)
+    {
+      return pos + (size_t)__builtin_ctz(mask);
+    }
+    pos+= 32;
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i nul= _mm_setzero_si128();
+  const __m128i nl= _mm_set1_epi8('\n');
+  const __m128i cr= _mm_set1_epi8('\r');
+  const __m128i sub= _mm_set1_epi8('\032');
+  const __m128i bs= _mm_set1_epi8('\\');
+  const __m128i sq= _mm_set1_epi8('\'');
+  const __m128i dq= _mm_set1_epi8('\"');
+  while (pos + 16 <= length)
+  {
+    __m128i chunk= _mm_loadu_si128((const __m128i*)(data + pos));
+    __m128i match= _mm_or_si128(
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, nul), _mm_cmpeq_epi8(chunk, nl)),
+                   _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, sub))),
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, bs), _mm_cmpeq_epi8(chunk, sq)),
+                   _mm_cmpeq_epi8(chunk, dq)));
+    int mask= _mm_movemask_epi8(match);
+    if (mask)
+    {
+      return pos + (size_t)__builtin_ctz((unsigned int)mask);
+    }
+    pos+= 16;
+  }
+#endif
+  for (; pos < length; pos++)
+  {
+    if (attachsql_escape_map[(unsigned char)data[pos]])
+    {
+      return pos;
+    }
+  }
+  return length;
+}
+
+/* Writes the decimal representation of value, returns number of bytes */
+size_t attachsql_query_uint_to_str(char *buffer, uint64_t value)
+{
+  char tmp[20];
+  char *ptr= tmp + sizeof(tmp);
+  size_t length;
+
+  while (value >= 100)
+  {
+    uint32_t pair= (uint32_t)(value % 100) * 2;
+    value/= 100;
+    ptr-= 2;
+    ptr[0]= attachsql_digit_pairs[pair];
+    ptr[1]= attachsql_digit_pairs[pair + 1];
+  }
+  if (value >= 10)
+  {
+    uint32_t pair= (uint32_t)value * 2;
+    ptr-= 2;
+    ptr[0]= attachsql_digit_pairs[pair];
+    ptr[1]= attachsql_digit_pairs[pair + 1];
+  }
+  else
+  {
+    ptr--;
+    ptr[0]= (char)('0' + value);
+  }
+  length= (size_t)(tmp + sizeof(tmp) - ptr);
+  memcpy(buffer, ptr, length);
+  return length;
+}
+
+size_t attachsql_query_int_to_str(char *buffer, int64_t value)
+{
+  if (value < 0)
+  {
+    buffer[0]= '-';
+    /* Negate as unsigned so INT64_MIN doesn't overflow */
+    return attachsql_query_uint_to_str(buffer + 1, (uint64_t)0 - (uint64_t)value) + 1;
+  }
+  return attachsql_query_uint_to_str(buffer, (uint64_t)value);
+}
+
+bool attachsql_query_buffer_reserve(attachsql_connect_t *con, size_t length)
+{
+  char *realloc_buffer;
+
+  if (con->query_alloc_buffer_size >= length)
+  {
+    return true;
+  }
+  /* Round up to a multiple of ATTACHSQL_WRITE_BUFFER_SIZE */
+  size_t new_size= length + ATTACHSQL_WRITE_BUFFER_SIZE - (length % ATTACHSQL_WRITE_BUFFER_SIZE);
+  asdebug("Enlarging query buffer to %zu bytes", new_size);
+  realloc_buffer= (char*)realloc(con->query_alloc_buffer, new_size);
+  if (realloc_buffer == NULL)
+  {
+    return false;
+  }
+  con->query_alloc_buffer= realloc_buffer;
+  con->query_alloc_buffer_size= new_size;
+  return true;
+}
+
+void attachsql_query_buffer_shrink(attachsql_connect_t *con)
+{
+  char *realloc_buffer;
+  size_t shrink_size= con->options.buffer_shrink_size;
+
+  if ((shrink_size == 0) or (con->query_alloc_buffer_size <= shrink_size))
+  {
+    return;
+  }
+  /* Uncompressed queries are written straight from this buffer */
+  if ((con->uv_objects.stream != NULL) and (con->uv_objects.stream->write_queue_size > 0))
+  {
+    return;
+  }
+  asdebug("Shrinking query buffer from %zu bytes", con->query_alloc_buffer_size);
+  realloc_buffer= (char*)realloc(con->query_alloc_buffer, shrink_size);
+  if (realloc_buffer == NULL)
+  {
+    return;
+  }
+  con->query_alloc_buffer= realloc_buffer;
+  con->query_alloc_buffer_size= shrink_size;
+  ATTACHSQL_STAT_ADD(con->stats.buffer_shrinks, 1);
+}
+
+size_t attachsql_query_parameter_max_length(attachsql_query_parameter_st *parameter)
+{
+  switch (parameter->type)
+  {
+    case ATTACHSQL_ESCAPE_TYPE_NONE:
+      return parameter->length;
+    case ATTACHSQL_ESCAPE_TYPE_CHAR:
+      return (parameter->length * 2) + 2;
+    case ATTACHSQL_ESCAPE_TYPE_CHAR_LIKE:
+      return (parameter->length * 2);
+    case ATTACHSQL_ESCAPE_TYPE_INT:
+      /* sign plus 10 digits */
+      return 11;
+    case ATTACHSQL_ESCAPE_TYPE_BIGINT:
+      return 20;
+    case ATTACHSQL_ESCAPE_TYPE_FLOAT:
+      return FLOAT_MAX_LEN;
+    case ATTACHSQL_ESCAPE_TYPE_DOUBLE:
+      return DOUBLE_MAX_LEN;
+  }
+  return 0;
+}
+
+size_t attachsql_query_render_parameter(attachsql_connect_t *con, char *buffer, attachsql_query_parameter_st *parameter)
+{
+  size_t buffer_pos= 0;
+
+  switch (parameter->type)
+  {
+    case ATTACHSQL_ESCAPE_TYPE_NONE:
+      memcpy(buffer, parameter->data, parameter->length);
+      buffer_pos= parameter->length;
+      break;
+    case ATTACHSQL_ESCAPE_TYPE_CHAR:
+      buffer[0]= '\'';
+      buffer_pos++;
+      if (con->server_status & ATTACHSQL_SERVER_STATUS_NO_BACKSLASH_ESCAPES)
+      {
+        buffer_pos+= attachsql_query_no_backslash_escape_data(&buffer[buffer_pos], (char*)parameter->data, parameter->length);
+      }
+      else
+      {
+        buffer_pos+= attachsql_query_escape_data(&buffer[buffer_pos], (char*)parameter->data, parameter->length);
+      }
+      buffer[buffer_pos]= '\'';
+      buffer_pos++;
+      break;
+    case ATTACHSQL_ESCAPE_TYPE_CHAR_LIKE:
+      if (con->server_status & ATTACHSQL_SERVER_STATUS_NO_BACKSLASH_ESCAPES)
+      {
+        buffer_pos= attachsql_query_no_backslash_escape_data(buffer, (char*)parameter->data, parameter->length);
+      }
+      else
+      {
+        buffer_pos= attachsql_query_escape_data(buffer, (char*)parameter->data, parameter->length);
+      }
+      break;
+    case ATTACHSQL_ESCAPE_TYPE_INT:
+      if (parameter->is_unsigned)
+      {
+        buffer_pos= attachsql_query_uint_to_str(buffer, *(uint32_t*)parameter->data);
+      }
+      else
+      {
+        buffer_pos= attachsql_query_int_to_str(buffer, *(int32_t*)parameter->data);
+      }
+      break;
+    case ATTACHSQL_ESCAPE_TYPE_BIGINT:
+      if (parameter->is_unsigned)
+      {
+        buffer_pos= attachsql_query_uint_to_str(buffer, *(uint64_t*)parameter->data);
+      }
+      else
+      {
+        buffer_pos= attachsql_query_int_to_str(buffer, *(int64_t*)parameter->data);
+      }
+      break;
+    case ATTACHSQL_ESCAPE_TYPE_FLOAT:
+      // Significant digit length from http://msdn.microsoft.com/en-us/library/hd7199ke.aspx
+      buffer_pos= snprintf(buffer, FLOAT_MAX_LEN, "%.7f", *(float*)parameter->data);
+      break;
+    case ATTACHSQL_ESCAPE_TYPE_DOUBLE:
+      buffer_pos= snprintf(buffer, DOUBLE_MAX_LEN, "%.15f", *(double*)parameter->data);
+      break;
+  }
+  return buffer_pos;
+}
 
 bool attachsql_query(attachsql_connect_t *con, size_t length, const char *statement, uint16_t parameter_count, attachsql_query_parameter_st *parameters, attachsql_error_t **error)
 {
@@ -26,7 +302,6 @@ bool attachsql_query(attachsql_connect_t *con, size_t length, const char *statem
   size_t buffer_pos= 0;
   size_t out_len;
   uint16_t param;
-  attachsql_command_status_t ret;
 
   if (con == NULL)
   {
@@ -44,21 +319,10 @@ bool attachsql_query(attachsql_connect_t *con, size_t length, const char *statem
   /* No parameters so we can send now */
   if (parameter_count == 0)
   {
-    if (con->status == ATTACHSQL_CON_STATUS_NOT_CONNECTED)
-    {
-      con->query_buffer= (char*)statement;
-      con->query_buffer_length= length;
-      con->query_buffer_alloc= false;
-      con->query_buffer_statement= false;
-      return attachsql_connect(con, error);
-    }
-    ret= attachsql_command_send(con, ATTACHSQL_COMMAND_QUERY, (char*)statement, length);
-    if (ret == ATTACHSQL_COMMAND_STATUS_SEND_FAILED)
-    {
-      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SERVER_GONE, ATTACHSQL_ERROR_LEVEL_ERROR, "08006", con->errmsg);
-      return false;
-    }
-    return true;
+    con->query_buffer= (char*)statement;
+    con->query_buffer_length= length;
+    con->query_buffer_alloc= false;
+    return attachsql_query_send_buffer(con, error);
   }
 
   /* Work out buffer size */
@@ -66,113 +330,64 @@ bool attachsql_query(attachsql_connect_t *con, size_t length, const char *statem
 
   for (param= 0; param < parameter_count; param++)
   {
-    switch (parameters[param].type)
-    {
-      case ATTACHSQL_ESCAPE_TYPE_NONE:
-        out_len+= parameters[param].length;
-        break;
-      case ATTACHSQL_ESCAPE_TYPE_CHAR:
-        out_len+= (parameters[param].length * 2) + 2;
-        break;
-      case ATTACHSQL_ESCAPE_TYPE_CHAR_LIKE:
-        out_len+= (parameters[param].length * 2);
-        break;
-      case ATTACHSQL_ESCAPE_TYPE_INT:
-        out_len+= 10;
-        break;
-      case ATTACHSQL_ESCAPE_TYPE_BIGINT:
-        out_len+= 20;
-        break;
-      case ATTACHSQL_ESCAPE_TYPE_FLOAT:
-        out_len+= FLOAT_MAX_LEN;
-        break;
-      case ATTACHSQL_ESCAPE_TYPE_DOUBLE:
-        out_len+= DOUBLE_MAX_LEN;
-        break;
-    }
+    out_len+= attachsql_query_parameter_max_length(&parameters[param]);
+  }
+  if (not attachsql_query_buffer_reserve(con, out_len))
+  {
+    con->in_query= false;
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_ALLOC, ATTACHSQL_ERROR_LEVEL_ERROR, "82100", "Allocation failure for query buffer");
+    return false;
   }
-  con->query_buffer= new (std::nothrow) char[out_len];
+  con->query_buffer= con->query_alloc_buffer;
   con->query_buffer_alloc= true;
 
-  /* Copy into buffer and replace */
+  /* Copy clean runs between placeholders in one go and replace */
   param= 0;
-  for (pos= 0; pos < length; pos++)
+  pos= 0;
+  while (pos < length)
   {
-    if (statement[pos] != '?')
+    const char *placeholder= (const char*)memchr(statement + pos, '?', length - pos);
+    size_t run= (placeholder == NULL) ? (length - pos) : (size_t)(placeholder - (statement + pos));
+
+    memcpy(&con->query_buffer[buffer_pos], statement + pos, run);
+    buffer_pos+= run;
+    pos+= run;
+    if (placeholder == NULL)
+    {
+      break;
+    }
+    /* More placeholders than parameters, leave the rest untouched */
+    if (param >= parameter_count)
     {
-      con->query_buffer[buffer_pos] = statement[pos];
+      con->query_buffer[buffer_pos]= '?';
       buffer_pos++;
     }
     else
     {
-      switch (parameters[param].type)
-      {
-        case ATTACHSQL_ESCAPE_TYPE_NONE:
-          memcpy(&con->query_buffer[buffer_pos], parameters[param].data, parameters[param].length);
-          buffer_pos+= parameters[param].length;
-          break;
-        case ATTACHSQL_ESCAPE_TYPE_CHAR:
-          con->query_buffer[buffer_pos] = '\'';
-          buffer_pos++;
-          if (con->server_status & ATTACHSQL_SERVER_STATUS_NO_BACKSLASH_ESCAPES)
-          {
-            buffer_pos+= attachsql_query_no_backslash_escape_data(&con->query_buffer[buffer_pos], (char*)parameters[param].data, parameters[param].length);
-          }
-          else
-          {
-            buffer_pos+= attachsql_query_escape_data(&con->query_buffer[buffer_pos], (char*)parameters[param].data, parameters[param].length);
-          }
-          con->query_buffer[buffer_pos] = '\'';
-          buffer_pos++;
-          break;
-        case ATTACHSQL_ESCAPE_TYPE_CHAR_LIKE:
-          if (con->server_status & ATTACHSQL_SERVER_STATUS_NO_BACKSLASH_ESCAPES)
-          {
-            buffer_pos+= attachsql_query_no_backslash_escape_data(&con->query_buffer[buffer_pos], (char*)parameters[param].data, parameters[param].length);
-          }
-          else
-          {
-            buffer_pos+= attachsql_query_escape_data(&con->query_buffer[buffer_pos], (char*)parameters[param].data, parameters[param].length);
-          }
-          break;
-        case ATTACHSQL_ESCAPE_TYPE_INT:
-          if (parameters[param].is_unsigned)
-          {
-            buffer_pos+= sprintf(&con->query_buffer[buffer_pos], "%u", *(unsigned int*)parameters[param].data);
-          }
-          else
-          {
-            buffer_pos+= sprintf(&con->query_buffer[buffer_pos], "%d", *(int*)parameters[param].data);
-          }
-          break;
-        case ATTACHSQL_ESCAPE_TYPE_BIGINT:
-          if (parameters[param].is_unsigned)
-          {
-            buffer_pos+= sprintf(&con->query_buffer[buffer_pos], "%" PRId64, *(int64_t*)parameters[param].data);
-          }
-          else
-          {
-            buffer_pos+= sprintf(&con->query_buffer[buffer_pos], "%" PRIu64, *(uint64_t*)parameters[param].data);
-          }
-          break;
-        case ATTACHSQL_ESCAPE_TYPE_FLOAT:
-          // Significant digit length from http://msdn.microsoft.com/en-us/library/hd7199ke.aspx
-          buffer_pos+= snprintf(&con->query_buffer[buffer_pos], FLOAT_MAX_LEN, "%.7f", *(float*)parameters[param].data);
-          break;
-        case ATTACHSQL_ESCAPE_TYPE_DOUBLE:
-          buffer_pos+= snprintf(&con->query_buffer[buffer_pos], DOUBLE_MAX_LEN, "%.15f", *(double*)parameters[param].data);
-          break;
-      }
+      buffer_pos+= attachsql_query_render_parameter(con, &con->query_buffer[buffer_pos], &parameters[param]);
       param++;
     }
+    pos++;
   }
 
   con->query_buffer_length= buffer_pos;
+  return attachsql_query_send_buffer(con, error);
+}
+
+bool attachsql_query_send_buffer(attachsql_connect_t *con, attachsql_error_t **error)
+{
+  attachsql_command_status_t ret;
+
   con->query_buffer_statement= false;
   if (con->status == ATTACHSQL_CON_STATUS_NOT_CONNECTED)
   {
     return attachsql_connect(con, error);
   }
+  /* A pool connection being recycled sends it when connected again */
+  if (con->maintenance.recycling and (con->status == ATTACHSQL_CON_STATUS_CONNECTING))
+  {
+    return true;
+  }
   ret= attachsql_command_send(con, ATTACHSQL_COMMAND_QUERY, con->query_buffer, con->query_buffer_length);
   if (ret == ATTACHSQL_COMMAND_STATUS_SEND_FAILED)
   {
@@ -185,17 +400,22 @@ bool attachsql_query(attachsql_connect_t *con, size_t length, const char *statem
 size_t attachsql_query_no_backslash_escape_data(char *buffer, char *data, size_t length)
 {
   size_t buffer_pos= 0;
-  size_t pos;
+  size_t pos= 0;
 
-  for (pos= 0; pos < length; pos++)
+  /* Only single quotes need doubling, memchr is vectorised by libc */
+  while (pos < length)
   {
-    if (data[pos] == '\'')
+    const char *quote= (const char*)memchr(data + pos, '\'', length - pos);
+    size_t run= (quote == NULL) ? (length - pos) : (size_t)(quote - (data + pos)) + 1;
+
+    memcpy(&buffer[buffer_pos], data + pos, run);
+    buffer_pos+= run;
+    pos+= run;
+    if (quote != NULL)
     {
       buffer[buffer_pos]= '\'';
       buffer_pos++;
     }
-    buffer[buffer_pos]= data[pos];
-    buffer_pos++;
   }
 
   return buffer_pos;
@@ -204,53 +424,23 @@ size_t attachsql_query_no_backslash_escape_data(char *buffer, char *data, size_t
 size_t attachsql_query_escape_data(char *buffer, char *data, size_t length)
 {
   size_t buffer_pos= 0;
-  size_t pos;
-  char newchar;
+  size_t pos= 0;
 
-  for (pos= 0; pos < length; pos++)
+  while (pos < length)
   {
-    newchar= '\0';
-    if (not (data[pos] & 0x80))
-    {
-      switch(data[pos])
-      {
-        case 0:
-          newchar= '0';
-          break;
-        case '\n':
-          newchar= 'n';
-          break;
-        case '\r':
-          newchar= 'r';
-          break;
-        case '\032':
-          newchar= 'Z';
-          break;
-        case '\\':
-          newchar= '\\';
-          break;
-        case '\'':
-          newchar= '\'';
-          break;
-        case '\"':
-          newchar= '\"';
-          break;
-        default:
-          break;
-      }
-    }
-    if (newchar != '\0')
-    {
-      buffer[buffer_pos]= '\\';
-      buffer_pos++;
-      buffer[buffer_pos]= newchar;
-      buffer_pos++;
-    }
-    else
+    size_t run= attachsql_query_escape_scan(data + pos, length - pos);
+
+    memcpy(&buffer[buffer_pos], data + pos, run);
+    buffer_pos+= run;
+    pos+= run;
+    if (pos == length)
     {
-      buffer[buffer_pos]= data[pos];
-      buffer_pos++;
+      break;
     }
+    buffer[buffer_pos]= '\\';
+    buffer[buffer_pos + 1]= attachsql_escape_map[(unsigned char)data[pos]];
+    buffer_pos+= 2;
+    pos++;
   }
   return buffer_pos;
 }
@@ -262,13 +452,12 @@ void attachsql_query_close(attachsql_connect_t *con)
     return;
   }
 
-  if (con->query_buffer_alloc and (con->query_buffer_length != 0))
-  {
-    delete[] con->query_buffer;
-    con->query_buffer= NULL;
-  }
+  /* The allocation is kept for the next query unless a large one grew it,
+   * it is freed in attachsql_connect_destroy() */
+  con->query_buffer= NULL;
   con->query_buffer_alloc= false;
   con->query_buffer_length= 0;
+  attachsql_query_buffer_shrink(con);
 
   if (con->columns != NULL)
   {
@@ -299,6 +488,103 @@ void attachsql_query_close(attachsql_connect_t *con)
   con->row_buffer_position= 0;
   con->row_buffer_count= 0;
   con->all_rows_buffered= false;
+  /* Buffered rows pointed into the read buffer so it couldn't be shrunk when
+   * the result completed */
+  if (con->buffer_rows)
+  {
+    attachsql_con_buffer_shrink(con);
+  }
+}
+
+/* The server is told to stop the query on a separate connection, the query
+ * then ends with an error (or normally if the kill was too late) and rows
+ * which arrive in the meantime are thrown away */
+bool attachsql_query_cancel(attachsql_connect_t *con, attachsql_error_t **error)
+{
+  if (con == NULL)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Connection parameter not valid");
+    return false;
+  }
+
+  /* Already complete or already cancelled */
+  if (((con->status != ATTACHSQL_CON_STATUS_BUSY) and (con->command_status != ATTACHSQL_COMMAND_STATUS_ROW_IN_BUFFER)) or con->cancel.discarding)
+  {
+    return true;
+  }
+
+  /* A replayed capture has no server to tell */
+  if ((con->thread_id == 0) or (con->replay.data != NULL))
+  {
+    con->cancel.discarding= true;
+    return true;
+  }
+
+  if (con->cancel.con == NULL)
+  {
+    con->cancel.con= attachsql_connect_clone(con, error);
+    if (con->cancel.con == NULL)
+    {
+      return false;
+    }
+    /* Polling this connection mustn't block on the other one */
+    con->cancel.con->options.semi_block= false;
+    con->cancel.con->client_capabilities&= ~ATTACHSQL_CAPABILITY_ANY_COMPRESSION;
+    con->cancel.con->trace_fn= NULL;
+  }
+  /* A kill for an earlier query is still going, the connection is only
+   * free again once the server has finished with it */
+  if (con->cancel.con->in_query)
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "Query cancel already in progress");
+    con->cancel.discarding= true;
+    return true;
+  }
+  snprintf(con->cancel.query, sizeof(con->cancel.query), "KILL QUERY %u", con->thread_id);
+  aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "Cancelling query on thread %u", con->thread_id);
+  if (not attachsql_query(con->cancel.con, strlen(con->cancel.query), con->cancel.query, 0, NULL, error))
+  {
+    return false;
+  }
+  con->cancel.discarding= true;
+  return true;
+}
+
+void attachsql_query_cancel_poll(attachsql_connect_t *con)
+{
+  attachsql_connect_t *cancel_con= con->cancel.con;
+  attachsql_error_t *error= NULL;
+  attachsql_return_t ret;
+
+  if (not cancel_con->in_query)
+  {
+    return;
+  }
+  ret= attachsql_connect_poll(cancel_con, &error);
+  if (ret == ATTACHSQL_RETURN_EOF)
+  {
+    attachsql_query_close(cancel_con);
+  }
+  else if (ret == ATTACHSQL_RETURN_ERROR)
+  {
+    /* The query still finishes by itself, it just isn't stopped early */
+    aslog(con, ATTACHSQL_LOG_LEVEL_ERROR, "Query cancel failed: %s", attachsql_error_message(error));
+    attachsql_error_free(error);
+    attachsql_query_close(cancel_con);
+    if ((cancel_con->status != ATTACHSQL_CON_STATUS_IDLE) and (cancel_con->status != ATTACHSQL_CON_STATUS_BUSY))
+    {
+      attachsql_connect_destroy(cancel_con);
+      con->cancel.con= NULL;
+    }
+  }
+}
+
+void attachsql_query_cancel_discard(attachsql_connect_t *con)
+{
+  while ((con->status == ATTACHSQL_CON_STATUS_IDLE) and (con->command_status == ATTACHSQL_COMMAND_STATUS_ROW_IN_BUFFER))
+  {
+    attachsql_get_next_row(con);
+  }
 }
 
 uint16_t attachsql_query_column_count(attachsql_connect_t *con)
@@ -336,6 +622,8 @@ attachsql_query_column_st *attachsql_query_column_get(attachsql_connect_t *con,
       con->columns[current_col].schema= core_column->schema;
       con->columns[current_col].table= core_column->table;
       con->columns[current_col].origin_table= core_column->origin_table;
+      con->columns[current_col].column= core_column->column;
+      con->columns[current_col].origin_column= core_column->origin_column;
       con->columns[current_col].charset= core_column->charset;
       con->columns[current_col].length= core_column->length;
       con->columns[current_col].type= (attachsql_column_type_t) core_column->type;
@@ -348,13 +636,35 @@ attachsql_query_column_st *attachsql_query_column_get(attachsql_connect_t *con,
   return &con->columns[column - 1];
 }
 
-attachsql_query_row_st *attachsql_query_row_get(attachsql_connect_t *con, attachsql_error_t **error)
+/* Splits the row in the read buffer into its columns, returns false if a
+ * column runs past the end of the row */
+static bool attachsql_query_row_parse(attachsql_connect_t *con, attachsql_query_row_st *row)
 {
   uint16_t column;
-  uint16_t total_columns;
   uint64_t length;
   uint8_t bytes;
-  char *raw_row;
+  attachsql_pack_status_t status;
+  char *raw_row= con->read_buffer->buffer_read_ptr;
+  char *row_end= raw_row + con->result.row_length;
+
+  for (column= 0; column < con->result.column_count; column++)
+  {
+    length= attachsql_unpack_length_bounded(raw_row, row_end, &bytes, &status);
+    raw_row+= bytes;
+    if ((status == ATTACHSQL_PACK_TRUNCATED) or (length > (uint64_t)(row_end - raw_row)))
+    {
+      return false;
+    }
+    row[column].length= (size_t)length;
+    row[column].data= raw_row;
+    raw_row+= length;
+  }
+  return true;
+}
+
+attachsql_query_row_st *attachsql_query_row_get(attachsql_connect_t *con, attachsql_error_t **error)
+{
+  uint16_t total_columns;
 
   if (con == NULL)
   {
@@ -386,14 +696,10 @@ attachsql_query_row_st *attachsql_query_row_get(attachsql_connect_t *con, attach
     return NULL;
   }
 
-  raw_row= con->result.row_data;
-  for (column= 0; column < total_columns; column++)
+  if (not attachsql_query_row_parse(con, con->row))
   {
-    length= attachsql_unpack_length(raw_row, &bytes, NULL);
-    raw_row+= bytes;
-    con->row[column].length= (size_t)length;
-    con->row[column].data= raw_row;
-    raw_row+= length;
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_MALFORMED_PACKET, ATTACHSQL_ERROR_LEVEL_ERROR, "08S01", "Malformed row");
+    return NULL;
   }
   return con->row;
 }
@@ -506,11 +812,7 @@ uint64_t attachsql_query_row_count(attachsql_connect_t *con)
 
 attachsql_return_t attachsql_query_row_buffer(attachsql_connect_t *con, attachsql_error_t **error)
 {
-  uint16_t column;
   uint16_t total_columns;
-  uint64_t length;
-  uint8_t bytes;
-  char *raw_row;
   attachsql_query_row_st *row= NULL;
 
   do
@@ -536,14 +838,11 @@ attachsql_return_t attachsql_query_row_buffer(attachsql_connect_t *con, attachsq
       return ATTACHSQL_RETURN_ERROR;
     }
 
-    raw_row= con->result.row_data;
-    for (column= 0; column < total_columns; column++)
+    if (not attachsql_query_row_parse(con, row))
     {
-      length= attachsql_unpack_length(raw_row, &bytes, NULL);
-      raw_row+= bytes;
-      row[column].length= (size_t)length;
-      row[column].data= raw_row;
-      raw_row+= length;
+      delete[] row;
+      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_MALFORMED_PACKET, ATTACHSQL_ERROR_LEVEL_ERROR, "08S01", "Malformed row");
+      return ATTACHSQL_RETURN_ERROR;
     }
 
     con->row_buffer[con->row_buffer_count]= row;
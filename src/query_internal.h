@@ -26,8 +26,8 @@ extern "C" {
 
 // Float and Double lengths from: http://stackoverflow.com/questions/1701055/what-is-the-maximum-length-in-chars-needed-to-represent-any-double-value
 
-#define FLOAT_MAX_LEN 3 + FLT_MANT_DIG - FLT_MIN_EXP
-#define DOUBLE_MAX_LEN 3 + DBL_MANT_DIG - DBL_MIN_EXP
+#define FLOAT_MAX_LEN (3 + FLT_MANT_DIG - FLT_MIN_EXP)
+#define DOUBLE_MAX_LEN (3 + DBL_MANT_DIG - DBL_MIN_EXP)
 
 size_t attachsql_query_escape_data(char *buffer, char *data, size_t length);
 
@@ -35,6 +35,28 @@ attachsql_return_t attachsql_query_row_buffer(attachsql_connect_t *con, attachsq
 
 size_t attachsql_query_no_backslash_escape_data(char *buffer, char *data, size_t length);
 
+size_t attachsql_query_escape_scan(const char *data, size_t length);
+
+size_t attachsql_query_uint_to_str(char *buffer, uint64_t value);
+
+size_t attachsql_query_int_to_str(char *buffer, int64_t value);
+
+bool attachsql_query_buffer_reserve(attachsql_connect_t *con, size_t length);
+
+void attachsql_query_buffer_shrink(attachsql_connect_t *con);
+
+size_t attachsql_query_parameter_max_length(attachsql_query_parameter_st *parameter);
+
+size_t attachsql_query_render_parameter(attachsql_connect_t *con, char *buffer, attachsql_query_parameter_st *parameter);
+
+bool attachsql_query_send_buffer(attachsql_connect_t *con, attachsql_error_t **error);
+
+/* Drives the KILL QUERY of attachsql_query_cancel() */
+void attachsql_query_cancel_poll(attachsql_connect_t *con);
+
+/* Throws away rows of a cancelled query that have already arrived */
+void attachsql_query_cancel_discard(attachsql_connect_t *con);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,266 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "query_internal.h"
+
+/* Returns the position after a quoted string starting at pos */
+static size_t template_skip_quoted(const char *statement, size_t length, size_t pos)
+{
+  char quote= statement[pos];
+
+  pos++;
+  while (pos < length)
+  {
+    /* Backticks don't use backslash escapes */
+    if ((statement[pos] == '\\') and (quote != '`'))
+    {
+      pos+= 2;
+      continue;
+    }
+    if (statement[pos] == quote)
+    {
+      /* A doubled quote is an escaped quote */
+      if ((pos + 1 < length) and (statement[pos + 1] == quote))
+      {
+        pos+= 2;
+        continue;
+      }
+      return pos + 1;
+    }
+    pos++;
+  }
+  return length;
+}
+
+/* Returns the position after the comment starting at pos, or pos if there
+ * isn't one */
+static size_t template_skip_comment(const char *statement, size_t length, size_t pos)
+{
+  const char *end;
+  bool line_comment= false;
+
+  if (statement[pos] == '#')
+  {
+    line_comment= true;
+  }
+  /* MySQL requires whitespace after the second dash */
+  else if ((statement[pos] == '-') and (pos + 1 < length) and (statement[pos + 1] == '-') and ((pos + 2 == length) or ((unsigned char)statement[pos + 2] <= ' ')))
+  {
+    line_comment= true;
+  }
+
+  if (line_comment)
+  {
+    end= (const char*)memchr(statement + pos, '\n', length - pos);
+    return (end == NULL) ? length : (size_t)(end - statement) + 1;
+  }
+
+  if ((statement[pos] == '/') and (pos + 1 < length) and (statement[pos + 1] == '*'))
+  {
+    pos+= 2;
+    while (pos + 1 < length)
+    {
+      if ((statement[pos] == '*') and (statement[pos + 1] == '/'))
+      {
+        return pos + 2;
+      }
+      pos++;
+    }
+    return length;
+  }
+  return pos;
+}
+
+attachsql_query_template_t *attachsql_query_template_create(size_t length, const char *statement, attachsql_query_template_flags_t flags, attachsql_error_t **error)
+{
+  attachsql_query_template_t *tpl;
+  size_t pos;
+  size_t next;
+  size_t placeholder_alloc= 0;
+  size_t *realloc_placeholders;
+
+  if ((statement == NULL) and (length > 0))
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Statement parameter not valid");
+    return NULL;
+  }
+
+  tpl= new (std::nothrow) attachsql_query_template_t;
+  if (tpl == NULL)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_ALLOC, ATTACHSQL_ERROR_LEVEL_ERROR, "82100", "Allocation failure for query template");
+    return NULL;
+  }
+
+  /* Always allocate at least one byte so an empty statement still has a
+   * valid pointer to send */
+  tpl->statement= (char*)malloc(length + 1);
+  if (tpl->statement == NULL)
+  {
+    delete tpl;
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_ALLOC, ATTACHSQL_ERROR_LEVEL_ERROR, "82100", "Allocation failure for query template");
+    return NULL;
+  }
+  memcpy(tpl->statement, statement, length);
+  tpl->statement[length]= '\0';
+  tpl->length= length;
+
+  pos= 0;
+  while (pos < length)
+  {
+    if (flags & ATTACHSQL_QUERY_TEMPLATE_FLAG_SKIP_QUOTED)
+    {
+      char ch= statement[pos];
+      if ((ch == '\'') or (ch == '"') or (ch == '`'))
+      {
+        pos= template_skip_quoted(statement, length, pos);
+        continue;
+      }
+      next= template_skip_comment(statement, length, pos);
+      if (next != pos)
+      {
+        pos= next;
+        continue;
+      }
+      if (ch != '?')
+      {
+        pos++;
+        continue;
+      }
+    }
+    else
+    {
+      const char *placeholder= (const char*)memchr(statement + pos, '?', length - pos);
+      if (placeholder == NULL)
+      {
+        break;
+      }
+      pos= (size_t)(placeholder - statement);
+    }
+
+    if (tpl->placeholder_count == UINT16_MAX)
+    {
+      attachsql_query_template_destroy(tpl);
+      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Too many placeholders in query template");
+      return NULL;
+    }
+    if (tpl->placeholder_count == placeholder_alloc)
+    {
+      placeholder_alloc= (placeholder_alloc == 0) ? 8 : placeholder_alloc * 2;
+      realloc_placeholders= (size_t*)realloc(tpl->placeholders, placeholder_alloc * sizeof(size_t));
+      if (realloc_placeholders == NULL)
+      {
+        attachsql_query_template_destroy(tpl);
+        attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_ALLOC, ATTACHSQL_ERROR_LEVEL_ERROR, "82100", "Allocation failure for query template");
+        return NULL;
+      }
+      tpl->placeholders= realloc_placeholders;
+    }
+    tpl->placeholders[tpl->placeholder_count]= pos;
+    tpl->placeholder_count++;
+    pos++;
+  }
+  asdebug("Query template created with %" PRIu16 " placeholders", tpl->placeholder_count);
+
+  return tpl;
+}
+
+void attachsql_query_template_destroy(attachsql_query_template_t *tpl)
+{
+  if (tpl == NULL)
+  {
+    return;
+  }
+  free(tpl->statement);
+  free(tpl->placeholders);
+  delete tpl;
+}
+
+uint16_t attachsql_query_template_parameter_count(attachsql_query_template_t *tpl)
+{
+  if (tpl == NULL)
+  {
+    return 0;
+  }
+  return tpl->placeholder_count;
+}
+
+bool attachsql_query_template_execute(attachsql_connect_t *con, attachsql_query_template_t *tpl, uint16_t parameter_count, attachsql_query_parameter_st *parameters, attachsql_error_t **error)
+{
+  size_t out_len;
+  size_t buffer_pos= 0;
+  size_t segment_start= 0;
+  uint16_t param;
+
+  if ((con == NULL) or (tpl == NULL))
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Connection or template parameter not valid");
+    return false;
+  }
+
+  if (parameter_count < tpl->placeholder_count)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Template requires %" PRIu16 " parameters, %" PRIu16 " provided", tpl->placeholder_count, parameter_count);
+    return false;
+  }
+
+  if (con->in_query)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_OUT_OF_SYNC, ATTACHSQL_ERROR_LEVEL_ERROR, "08002", "Connection already used for query");
+    return false;
+  }
+  con->in_query= true;
+
+  /* Nothing to substitute so the template text is sent directly */
+  if (tpl->placeholder_count == 0)
+  {
+    con->query_buffer= tpl->statement;
+    con->query_buffer_length= tpl->length;
+    con->query_buffer_alloc= false;
+    return attachsql_query_send_buffer(con, error);
+  }
+
+  out_len= tpl->length + 1;
+  for (param= 0; param < tpl->placeholder_count; param++)
+  {
+    out_len+= attachsql_query_parameter_max_length(&parameters[param]);
+  }
+  if (not attachsql_query_buffer_reserve(con, out_len))
+  {
+    con->in_query= false;
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_ALLOC, ATTACHSQL_ERROR_LEVEL_ERROR, "82100", "Allocation failure for query buffer");
+    return false;
+  }
+  con->query_buffer= con->query_alloc_buffer;
+  con->query_buffer_alloc= true;
+
+  for (param= 0; param < tpl->placeholder_count; param++)
+  {
+    size_t segment_length= tpl->placeholders[param] - segment_start;
+    memcpy(&con->query_buffer[buffer_pos], &tpl->statement[segment_start], segment_length);
+    buffer_pos+= segment_length;
+    buffer_pos+= attachsql_query_render_parameter(con, &con->query_buffer[buffer_pos], &parameters[param]);
+    segment_start= tpl->placeholders[param] + 1;
+  }
+  memcpy(&con->query_buffer[buffer_pos], &tpl->statement[segment_start], tpl->length - segment_start);
+  buffer_pos+= tpl->length - segment_start;
+
+  con->query_buffer_length= buffer_pos;
+  return attachsql_query_send_buffer(con, error);
+}
@@ -39,7 +39,9 @@ enum attachsql_ret_t {
   ATTACHSQL_RET_NO_OLD_AUTH,
   ATTACHSQL_RET_BAD_SCRAMBLE,
   ATTACHSQL_RET_COMPRESSION_FAILURE,
-  ATTACHSQL_RET_BAD_STMT_PARAMETER
+  ATTACHSQL_RET_BAD_STMT_PARAMETER,
+  ATTACHSQL_RET_BUFFER_LIMIT,
+  ATTACHSQL_RET_TIMEOUT
 };
 
 #ifdef __cplusplus
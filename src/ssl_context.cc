@@ -0,0 +1,430 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "config.h"
+#include "common.h"
+#include "ssl_context.h"
+
+#ifdef HAVE_OPENSSL
+#define ATTACHSQL_SSL_CIPHERS_AES_FIRST "ECDHE+AESGCM:ECDHE+CHACHA20:DHE+AESGCM:DHE+CHACHA20:ECDHE+AES:DHE+AES:RSA+AESGCM:RSA+AES:!aNULL:!eNULL:!MD5:!RC4:!3DES:!DSS"
+#define ATTACHSQL_SSL_CIPHERS_CHACHA_FIRST "ECDHE+CHACHA20:ECDHE+AESGCM:DHE+CHACHA20:DHE+AESGCM:ECDHE+AES:DHE+AES:RSA+AESGCM:RSA+AES:!aNULL:!eNULL:!MD5:!RC4:!3DES:!DSS"
+#define ATTACHSQL_SSL_TLS13_SUITES_AES_FIRST "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256"
+#define ATTACHSQL_SSL_TLS13_SUITES_CHACHA_FIRST "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384"
+
+/* Called by OpenSSL whenever the server hands us a session (or a TLS 1.3
+ * ticket), the newest one is kept for the next connection to resume */
+static int ssl_context_new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+  attachsql_ssl_context_t *ctx= (attachsql_ssl_context_t*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+
+  uv_mutex_lock(&ctx->lock);
+  if (ctx->session != NULL)
+  {
+    SSL_SESSION_free(ctx->session);
+  }
+  ctx->session= session;
+  uv_mutex_unlock(&ctx->lock);
+
+  /* We now own the reference */
+  return 1;
+}
+
+/* Whether the CPU has AES instructions, without them ChaCha20-Poly1305 is
+ * considerably faster than AES-GCM */
+static bool ssl_context_hardware_aes()
+{
+#if defined(__GNUC__) and (defined(__x86_64__) or defined(__i386__))
+  return __builtin_cpu_supports("aes");
+#else
+  return true;
+#endif
+}
+
+/* Returns the OpenSSL protocol version, 0 for the library default or -1 if
+ * the version is not supported by this OpenSSL */
+static int ssl_context_protocol_version(attachsql_ssl_version_t version)
+{
+  switch (version)
+  {
+    case ATTACHSQL_SSL_VERSION_DEFAULT:
+      return 0;
+    case ATTACHSQL_SSL_VERSION_TLS1_0:
+      return TLS1_VERSION;
+#ifdef TLS1_1_VERSION
+    case ATTACHSQL_SSL_VERSION_TLS1_1:
+      return TLS1_1_VERSION;
+#endif
+#ifdef TLS1_2_VERSION
+    case ATTACHSQL_SSL_VERSION_TLS1_2:
+      return TLS1_2_VERSION;
+#endif
+#ifdef TLS1_3_VERSION
+    case ATTACHSQL_SSL_VERSION_TLS1_3:
+      return TLS1_3_VERSION;
+#endif
+    default:
+      return -1;
+  }
+}
+
+bool attachsql_ssl_version_supported(attachsql_ssl_version_t version)
+{
+  return (ssl_context_protocol_version(version) >= 0);
+}
+
+bool attachsql_ssl_set_versions(SSL *ssl, attachsql_ssl_version_t min_version, attachsql_ssl_version_t max_version)
+{
+  int min_proto= ssl_context_protocol_version(min_version);
+  int max_proto= ssl_context_protocol_version(max_version);
+
+  if ((min_proto < 0) or (max_proto < 0))
+  {
+    return false;
+  }
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  if (SSL_set_min_proto_version(ssl, min_proto) != 1)
+  {
+    return false;
+  }
+  if (SSL_set_max_proto_version(ssl, max_proto) != 1)
+  {
+    return false;
+  }
+#else
+  /* Older OpenSSL can only switch individual versions off */
+  long options= 0;
+  if ((min_proto > TLS1_VERSION) or ((max_proto != 0) and (max_proto < TLS1_VERSION)))
+  {
+    options|= SSL_OP_NO_TLSv1;
+  }
+# ifdef TLS1_1_VERSION
+  if ((min_proto > TLS1_1_VERSION) or ((max_proto != 0) and (max_proto < TLS1_1_VERSION)))
+  {
+    options|= SSL_OP_NO_TLSv1_1;
+  }
+# endif
+# ifdef TLS1_2_VERSION
+  if ((max_proto != 0) and (max_proto < TLS1_2_VERSION))
+  {
+    options|= SSL_OP_NO_TLSv1_2;
+  }
+# endif
+  SSL_set_options(ssl, options);
+#endif
+  return true;
+}
+
+attachsql_ssl_context_t *attachsql_ssl_context_create(const char *key, const char *cert, const char *ca, const char *capath, const char *cipher, bool verify, attachsql_error_t **error)
+{
+  attachsql_ssl_context_t *ctx;
+
+  ctx= new (std::nothrow) attachsql_ssl_context_t;
+  if (ctx == NULL)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_ALLOC, ATTACHSQL_ERROR_LEVEL_ERROR, "82100", "Allocation failure for SSL context");
+    return NULL;
+  }
+  uv_mutex_init(&ctx->lock);
+
+  /* Negotiate the highest version both sides support, the range can be
+   * narrowed per connection with the SSL version options */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  ctx->context= SSL_CTX_new(TLS_client_method());
+#else
+  ctx->context= SSL_CTX_new(SSLv23_client_method());
+#endif
+  if (ctx->context == NULL)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Error creating the SSL context");
+    attachsql_ssl_context_destroy(ctx);
+    return NULL;
+  }
+  SSL_CTX_set_options(ctx->context, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
+
+  if (cipher == NULL)
+  {
+    /* Prefer forward secret AEAD ciphers, whichever of AES-GCM and
+     * ChaCha20-Poly1305 is faster on this CPU first.  The CBC suites are
+     * kept at the end for older servers */
+    if (ssl_context_hardware_aes())
+    {
+      cipher= ATTACHSQL_SSL_CIPHERS_AES_FIRST;
+    }
+    else
+    {
+      cipher= ATTACHSQL_SSL_CIPHERS_CHACHA_FIRST;
+    }
+  }
+  if (SSL_CTX_set_cipher_list(ctx->context, cipher) != 1)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Error setting SSL cipher list");
+    attachsql_ssl_context_destroy(ctx);
+    return NULL;
+  }
+#ifdef TLS1_3_VERSION
+  /* TLS 1.3 suites are configured separately from the cipher list */
+  if (ssl_context_hardware_aes())
+  {
+    SSL_CTX_set_ciphersuites(ctx->context, ATTACHSQL_SSL_TLS13_SUITES_AES_FIRST);
+  }
+  else
+  {
+    SSL_CTX_set_ciphersuites(ctx->context, ATTACHSQL_SSL_TLS13_SUITES_CHACHA_FIRST);
+  }
+#endif
+
+  if (SSL_CTX_load_verify_locations(ctx->context, ca, capath) != 1)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Error loading the SSL certificate authority file");
+    attachsql_ssl_context_destroy(ctx);
+    return NULL;
+  }
+
+  if (cert != NULL)
+  {
+    if (SSL_CTX_use_certificate_file(ctx->context, cert, SSL_FILETYPE_PEM) != 1)
+    {
+      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Error loading the SSL certificate file");
+      attachsql_ssl_context_destroy(ctx);
+      return NULL;
+    }
+
+    if (key == NULL)
+    {
+      key= cert;
+    }
+
+    if (SSL_CTX_use_PrivateKey_file(ctx->context, key, SSL_FILETYPE_PEM) != 1)
+    {
+      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Cannot load the SSL key file");
+      attachsql_ssl_context_destroy(ctx);
+      return NULL;
+    }
+
+    if (SSL_CTX_check_private_key(ctx->context) != 1)
+    {
+      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Error validating the SSL private key");
+      attachsql_ssl_context_destroy(ctx);
+      return NULL;
+    }
+  }
+
+  if (verify)
+  {
+    SSL_CTX_set_verify(ctx->context, SSL_VERIFY_PEER, NULL);
+  }
+
+  /* Client side session caching, the session is stored by the callback
+   * rather than OpenSSL's internal cache which is only used by servers */
+  SSL_CTX_set_app_data(ctx->context, ctx);
+  SSL_CTX_set_session_cache_mode(ctx->context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx->context, ssl_context_new_session_cb);
+
+  return ctx;
+}
+
+void attachsql_ssl_context_destroy(attachsql_ssl_context_t *ctx)
+{
+  uint32_t references;
+
+  if (ctx == NULL)
+  {
+    return;
+  }
+
+  uv_mutex_lock(&ctx->lock);
+  ctx->references--;
+  references= ctx->references;
+  uv_mutex_unlock(&ctx->lock);
+  if (references > 0)
+  {
+    return;
+  }
+
+  if (ctx->session != NULL)
+  {
+    SSL_SESSION_free(ctx->session);
+  }
+  if (ctx->context != NULL)
+  {
+    SSL_CTX_free(ctx->context);
+  }
+  uv_mutex_destroy(&ctx->lock);
+  delete ctx;
+}
+
+void attachsql_ssl_context_ref(attachsql_ssl_context_t *ctx)
+{
+  uv_mutex_lock(&ctx->lock);
+  ctx->references++;
+  uv_mutex_unlock(&ctx->lock);
+}
+
+void attachsql_ssl_context_apply_session(attachsql_ssl_context_t *ctx, SSL *ssl)
+{
+  uv_mutex_lock(&ctx->lock);
+  if (ctx->session != NULL)
+  {
+    asdebug("Attempting SSL session resumption");
+    SSL_set_session(ssl, ctx->session);
+  }
+  uv_mutex_unlock(&ctx->lock);
+}
+
+bool attachsql_connect_set_ssl_context(attachsql_connect_t *con, attachsql_ssl_context_t *ctx, attachsql_error_t **error)
+{
+  if ((con == NULL) or (ctx == NULL))
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Connection or SSL context parameter not valid");
+    return false;
+  }
+
+  if (con->status != ATTACHSQL_CON_STATUS_NOT_CONNECTED)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_ALREADY_CONNECTED, ATTACHSQL_ERROR_LEVEL_ERROR, "08002", "Cannot set SSL after connecting");
+    return false;
+  }
+
+  if (con->ssl.ssl != NULL)
+  {
+    SSL_free(con->ssl.ssl);
+    con->ssl.ssl= NULL;
+  }
+  if (con->ssl.context != NULL)
+  {
+    attachsql_ssl_context_destroy(con->ssl.context);
+    con->ssl.context= NULL;
+  }
+
+  con->ssl.ssl= SSL_new(ctx->context);
+  if (con->ssl.ssl == NULL)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Could not create SSL object for connection");
+    return false;
+  }
+  attachsql_ssl_context_ref(ctx);
+  con->ssl.context= ctx;
+  /* force client handshake mode to allow SSL_write before handshake complete */
+  SSL_set_connect_state(con->ssl.ssl);
+
+  return true;
+}
+
+void attachsql_ssl_reset(attachsql_connect_t *con)
+{
+  if (con->ssl.write_buffer != NULL)
+  {
+    attachsql_buffer_free(con->ssl.write_buffer);
+    con->ssl.write_buffer= NULL;
+  }
+  if (con->ssl.ssl != NULL)
+  {
+    /* Keeps the session resumable for the new connection */
+    SSL_set_shutdown(con->ssl.ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    SSL_free(con->ssl.ssl);
+    con->ssl.ssl= NULL;
+  }
+  if (con->ssl.network_bio != NULL)
+  {
+    BIO_free(con->ssl.network_bio);
+    con->ssl.network_bio= NULL;
+  }
+  con->ssl.enabled= false;
+  con->ssl.handshake_done= false;
+  con->ssl.ktls_checked= false;
+  con->ssl.ktls_rx= false;
+  con->ssl.ktls_tx= false;
+  con->ssl.rx_scan= attachsql_ssl_record_scan_st();
+  con->ssl.tx_scan= attachsql_ssl_record_scan_st();
+  if (con->ssl.context != NULL)
+  {
+    con->ssl.ssl= SSL_new(con->ssl.context->context);
+    if (con->ssl.ssl != NULL)
+    {
+      SSL_set_connect_state(con->ssl.ssl);
+    }
+  }
+}
+
+bool attachsql_connect_ssl_session_reused(attachsql_connect_t *con)
+{
+  if ((con == NULL) or (con->ssl.ssl == NULL) or (not con->ssl.handshake_done))
+  {
+    return false;
+  }
+  return (SSL_session_reused(con->ssl.ssl) == 1);
+}
+
+bool attachsql_pool_set_ssl_context(attachsql_pool_t *pool, attachsql_ssl_context_t *ctx, attachsql_error_t **error)
+{
+  if ((pool == NULL) or (ctx == NULL))
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_PARAMETER, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "Pool or SSL context parameter not valid");
+    return false;
+  }
+
+  attachsql_ssl_context_ref(ctx);
+  if (pool->ssl_context != NULL)
+  {
+    attachsql_ssl_context_destroy(pool->ssl_context);
+  }
+  pool->ssl_context= ctx;
+
+  return true;
+}
+#else
+attachsql_ssl_context_t *attachsql_ssl_context_create(const char *key, const char *cert, const char *ca, const char *capath, const char *cipher, bool verify, attachsql_error_t **error)
+{
+  (void) key;
+  (void) cert;
+  (void) ca;
+  (void) capath;
+  (void) cipher;
+  (void) verify;
+
+  attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_NO_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "SSL support has not been compiled in");
+  return NULL;
+}
+
+void attachsql_ssl_context_destroy(attachsql_ssl_context_t *ctx)
+{
+  (void) ctx;
+}
+
+bool attachsql_connect_set_ssl_context(attachsql_connect_t *con, attachsql_ssl_context_t *ctx, attachsql_error_t **error)
+{
+  (void) con;
+  (void) ctx;
+
+  attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_NO_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "SSL support has not been compiled in");
+  return false;
+}
+
+bool attachsql_connect_ssl_session_reused(attachsql_connect_t *con)
+{
+  (void) con;
+  return false;
+}
+
+bool attachsql_pool_set_ssl_context(attachsql_pool_t *pool, attachsql_ssl_context_t *ctx, attachsql_error_t **error)
+{
+  (void) pool;
+  (void) ctx;
+
+  attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_NO_SSL, ATTACHSQL_ERROR_LEVEL_ERROR, "22023", "SSL support has not been compiled in");
+  return false;
+}
+#endif
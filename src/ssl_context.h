@@ -0,0 +1,41 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HAVE_OPENSSL
+void attachsql_ssl_context_ref(attachsql_ssl_context_t *ctx);
+
+void attachsql_ssl_context_apply_session(attachsql_ssl_context_t *ctx, SSL *ssl);
+
+bool attachsql_ssl_version_supported(attachsql_ssl_version_t version);
+
+bool attachsql_ssl_set_versions(SSL *ssl, attachsql_ssl_version_t min_version, attachsql_ssl_version_t max_version);
+
+/* Replaces a connection's SSL object with a fresh one from its context so
+ * that it can connect again */
+void attachsql_ssl_reset(attachsql_connect_t *con);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,279 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "ssl_ktls.h"
+#include "log.h"
+
+#ifdef HAVE_OPENSSL
+# include <openssl/evp.h>
+# include <openssl/kdf.h>
+#endif
+
+#if defined(HAVE_OPENSSL) and defined(HAVE_LINUX_TLS_H) and (OPENSSL_VERSION_NUMBER >= 0x10101000L)
+# define ATTACHSQL_KTLS 1
+# include <netinet/in.h>
+# include <linux/tls.h>
+# ifndef TCP_ULP
+#  define TCP_ULP 31
+# endif
+# ifndef SOL_TLS
+#  define SOL_TLS 282
+# endif
+#endif
+
+#ifdef HAVE_OPENSSL
+#define SSL_RECORD_CHANGE_CIPHER_SPEC 20
+
+static void ssl_ktls_record_end(attachsql_ssl_record_scan_st *scan)
+{
+  /* TLS 1.2 record sequence numbers restart at zero after the change cipher
+   * spec, the Finished message is record zero */
+  if (scan->header[0] == SSL_RECORD_CHANGE_CIPHER_SPEC)
+  {
+    scan->encrypted= true;
+    scan->sequence= 0;
+  }
+  else if (scan->encrypted)
+  {
+    scan->sequence++;
+  }
+  scan->header_length= 0;
+}
+
+void attachsql_ssl_ktls_scan(attachsql_ssl_record_scan_st *scan, const char *data, size_t length)
+{
+  size_t skip;
+
+  while (length > 0)
+  {
+    if (scan->remaining > 0)
+    {
+      skip= (scan->remaining < length) ? scan->remaining : length;
+      scan->remaining-= skip;
+      data+= skip;
+      length-= skip;
+      if (scan->remaining == 0)
+      {
+        ssl_ktls_record_end(scan);
+      }
+      continue;
+    }
+
+    scan->header[scan->header_length]= (uint8_t)*data;
+    scan->header_length++;
+    data++;
+    length--;
+    if (scan->header_length == sizeof(scan->header))
+    {
+      scan->remaining= ((size_t)scan->header[3] << 8) | scan->header[4];
+      if (scan->remaining == 0)
+      {
+        ssl_ktls_record_end(scan);
+      }
+    }
+  }
+}
+
+static bool ssl_ktls_at_boundary(attachsql_ssl_record_scan_st *scan)
+{
+  return (scan->encrypted and (scan->header_length == 0) and (scan->remaining == 0));
+}
+
+#ifdef ATTACHSQL_KTLS
+union ssl_ktls_crypto_info
+{
+  struct tls12_crypto_info_aes_gcm_128 gcm128;
+  struct tls12_crypto_info_aes_gcm_256 gcm256;
+};
+
+/* Derives the TLS 1.2 key block, OpenSSL doesn't expose the keys it
+ * derived itself */
+static bool ssl_ktls_key_block(SSL *ssl, const EVP_MD *md, unsigned char *key_block, size_t length)
+{
+  unsigned char master_key[SSL_MAX_MASTER_KEY_LENGTH];
+  unsigned char randoms[SSL3_RANDOM_SIZE * 2];
+  size_t master_key_length;
+  EVP_PKEY_CTX *pctx;
+  bool ret= false;
+
+  master_key_length= SSL_SESSION_get_master_key(SSL_get_session(ssl), master_key, sizeof(master_key));
+  /* Server random comes first for key expansion */
+  SSL_get_server_random(ssl, randoms, SSL3_RANDOM_SIZE);
+  SSL_get_client_random(ssl, randoms + SSL3_RANDOM_SIZE, SSL3_RANDOM_SIZE);
+
+  pctx= EVP_PKEY_CTX_new_id(EVP_PKEY_TLS1_PRF, NULL);
+  if ((pctx != NULL)
+      and (EVP_PKEY_derive_init(pctx) > 0)
+      and (EVP_PKEY_CTX_set_tls1_prf_md(pctx, md) > 0)
+      and (EVP_PKEY_CTX_set1_tls1_prf_secret(pctx, master_key, (int)master_key_length) > 0)
+      and (EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, (const unsigned char*)"key expansion", 13) > 0)
+      and (EVP_PKEY_CTX_add1_tls1_prf_seed(pctx, randoms, sizeof(randoms)) > 0)
+      and (EVP_PKEY_derive(pctx, key_block, &length) > 0))
+  {
+    ret= true;
+  }
+  EVP_PKEY_CTX_free(pctx);
+  OPENSSL_cleanse(master_key, sizeof(master_key));
+  return ret;
+}
+
+static socklen_t ssl_ktls_crypto_info_fill(union ssl_ktls_crypto_info *info, size_t key_length, const unsigned char *key, const unsigned char *salt, uint64_t sequence)
+{
+  unsigned char rec_seq[8];
+  int byte;
+
+  for (byte= 7; byte >= 0; byte--)
+  {
+    rec_seq[byte]= (unsigned char)(sequence & 0xff);
+    sequence>>= 8;
+  }
+
+  memset(info, 0, sizeof(*info));
+  /* The explicit nonce only has to be unique, the record sequence is used
+   * as OpenSSL does */
+  if (key_length == TLS_CIPHER_AES_GCM_128_KEY_SIZE)
+  {
+    info->gcm128.info.version= TLS_1_2_VERSION;
+    info->gcm128.info.cipher_type= TLS_CIPHER_AES_GCM_128;
+    memcpy(info->gcm128.key, key, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+    memcpy(info->gcm128.salt, salt, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+    memcpy(info->gcm128.iv, rec_seq, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+    memcpy(info->gcm128.rec_seq, rec_seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+    return sizeof(info->gcm128);
+  }
+  info->gcm256.info.version= TLS_1_2_VERSION;
+  info->gcm256.info.cipher_type= TLS_CIPHER_AES_GCM_256;
+  memcpy(info->gcm256.key, key, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+  memcpy(info->gcm256.salt, salt, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+  memcpy(info->gcm256.iv, rec_seq, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+  memcpy(info->gcm256.rec_seq, rec_seq, TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+  return sizeof(info->gcm256);
+}
+
+static void ssl_ktls_install(attachsql_connect_t *con)
+{
+  const SSL_CIPHER *cipher;
+  size_t key_length;
+  unsigned char key_block[(TLS_CIPHER_AES_GCM_256_KEY_SIZE + TLS_CIPHER_AES_GCM_256_SALT_SIZE) * 2];
+  union ssl_ktls_crypto_info info;
+  socklen_t info_length;
+  uv_os_fd_t fd;
+
+  if (con->options.protocol != ATTACHSQL_CON_PROTOCOL_TCP)
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "kTLS only supported with TCP");
+    return;
+  }
+
+  /* TLS 1.3 sends post-handshake messages the kernel can't pass through a
+   * plain read, so only TLS 1.2 is offloaded */
+  if (SSL_version(con->ssl.ssl) != TLS1_2_VERSION)
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "kTLS not used, TLS version is not 1.2");
+    return;
+  }
+
+  cipher= SSL_get_current_cipher(con->ssl.ssl);
+  switch (SSL_CIPHER_get_cipher_nid(cipher))
+  {
+    case NID_aes_128_gcm:
+      key_length= TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+      break;
+    case NID_aes_256_gcm:
+      key_length= TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+      break;
+    default:
+      aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "kTLS not used, cipher %s not supported", SSL_CIPHER_get_name(cipher));
+      return;
+  }
+
+  /* Key block is client key, server key, client salt, server salt */
+  if (not ssl_ktls_key_block(con->ssl.ssl, SSL_CIPHER_get_handshake_digest(cipher), key_block, (key_length + TLS_CIPHER_AES_GCM_128_SALT_SIZE) * 2))
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_WARNING, "kTLS key derivation failed");
+    return;
+  }
+
+  if ((uv_fileno((uv_handle_t*)con->uv_objects.stream, &fd) != 0)
+      or (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) != 0))
+  {
+    aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "kTLS not available in the kernel");
+    OPENSSL_cleanse(key_block, sizeof(key_block));
+    return;
+  }
+
+  info_length= ssl_ktls_crypto_info_fill(&info, key_length, key_block, key_block + (key_length * 2), con->ssl.tx_scan.sequence);
+  if (setsockopt(fd, SOL_TLS, TLS_TX, &info, info_length) == 0)
+  {
+    con->ssl.ktls_tx= true;
+  }
+  info_length= ssl_ktls_crypto_info_fill(&info, key_length, key_block + key_length, key_block + (key_length * 2) + TLS_CIPHER_AES_GCM_128_SALT_SIZE, con->ssl.rx_scan.sequence);
+  if (setsockopt(fd, SOL_TLS, TLS_RX, &info, info_length) == 0)
+  {
+    con->ssl.ktls_rx= true;
+  }
+  OPENSSL_cleanse(&info, sizeof(info));
+  OPENSSL_cleanse(key_block, sizeof(key_block));
+  aslog(con, ATTACHSQL_LOG_LEVEL_INFO, "kTLS enabled, TX: %d, RX: %d", con->ssl.ktls_tx, con->ssl.ktls_rx);
+}
+#endif
+
+void attachsql_ssl_ktls_try(attachsql_connect_t *con)
+{
+  if ((not con->ssl.ktls_requested) or con->ssl.ktls_checked or (not SSL_is_init_finished(con->ssl.ssl)))
+  {
+    return;
+  }
+
+  /* Everything OpenSSL encrypted must have reached the kernel and everything
+   * received must have been decrypted, on a record boundary both ways */
+  if ((not ssl_ktls_at_boundary(&con->ssl.rx_scan))
+      or (not ssl_ktls_at_boundary(&con->ssl.tx_scan))
+      or (SSL_pending(con->ssl.ssl) > 0)
+      or (BIO_ctrl_pending(SSL_get_rbio(con->ssl.ssl)) > 0)
+      or (BIO_ctrl_pending(con->ssl.network_bio) > 0)
+      or ((con->ssl.write_buffer != NULL) and (attachsql_buffer_unread_data(con->ssl.write_buffer) > 0))
+      or (con->uv_objects.stream->write_queue_size > 0))
+  {
+    return;
+  }
+
+  con->ssl.ktls_checked= true;
+#ifdef ATTACHSQL_KTLS
+  ssl_ktls_install(con);
+#else
+  asdebug("kTLS not supported on this platform");
+#endif
+}
+
+bool attachsql_connect_ssl_ktls_active(attachsql_connect_t *con)
+{
+  if (con == NULL)
+  {
+    return false;
+  }
+  return (con->ssl.ktls_rx or con->ssl.ktls_tx);
+}
+#else
+bool attachsql_connect_ssl_ktls_active(attachsql_connect_t *con)
+{
+  (void) con;
+  return false;
+}
+#endif
@@ -20,15 +20,20 @@
 #include "statement.h"
 #include "command.h"
 #include "net.h"
+#include "log.h"
 
 bool attachsql_statement_prepare(attachsql_connect_t *con, size_t length, const char *statement, attachsql_error_t **error)
 {
-  if (con->status == ATTACHSQL_CON_STATUS_NOT_CONNECTED)
+  if ((con->status == ATTACHSQL_CON_STATUS_NOT_CONNECTED) or (con->maintenance.recycling and (con->status == ATTACHSQL_CON_STATUS_CONNECTING)))
   {
     con->query_buffer= (char*)statement;
     con->query_buffer_length= length;
     con->query_buffer_alloc= false;
     con->query_buffer_statement= true;
+    if (con->status == ATTACHSQL_CON_STATUS_CONNECTING)
+    {
+      return true;
+    }
     return attachsql_connect(con, error);
   }
   con->stmt= new (std::nothrow) attachsql_stmt_st;
@@ -42,7 +47,7 @@ bool attachsql_statement_prepare(attachsql_connect_t *con, size_t length, const
   }
 
   con->stmt->con= con;
-  asdebug("Sending MySQL prepare");
+  aslog(con, ATTACHSQL_LOG_LEVEL_DEBUG, "Sending MySQL prepare");
   attachsql_command_send(con, ATTACHSQL_COMMAND_STMT_PREPARE, (char*)statement, length);
 
   return true;
@@ -228,7 +233,7 @@ bool attachsql_stmt_execute(attachsql_stmt_st *stmt)
       case ATTACHSQL_COLUMN_TYPE_ERROR:
       default:
         stmt->con->local_errcode= ATTACHSQL_RET_BAD_STMT_PARAMETER;
-        asdebug("Bad stmt parameter type provided: %d", param_data->type);
+        aslog(stmt->con, ATTACHSQL_LOG_LEVEL_ERROR, "Bad stmt parameter type provided: %d", param_data->type);
         stmt->con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
         stmt->con->next_packet_queue_used= 0;
         return false;
@@ -261,7 +266,7 @@ bool attachsql_stmt_check_buffer_size(attachsql_stmt_st *stmt, size_t required)
     if (realloc_buffer == NULL)
     {
       stmt->con->local_errcode= ATTACHSQL_RET_OUT_OF_MEMORY_ERROR;
-      asdebug("Exec buffer realloc failure");
+      aslog(stmt->con, ATTACHSQL_LOG_LEVEL_ERROR, "Exec buffer realloc failure");
       stmt->con->command_status= ATTACHSQL_COMMAND_STATUS_SEND_FAILED;
       stmt->con->next_packet_queue_used= 0;
       return false;
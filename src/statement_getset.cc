@@ -221,10 +221,12 @@ bool attachsql_statement_set_param(attachsql_connect_t *con, attachsql_column_ty
 bool attachsql_statement_row_get(attachsql_connect_t *con, attachsql_error_t **error)
 {
   char *raw_row;
+  char *row_end;
   uint16_t column;
   uint16_t total_columns;
   uint8_t bytes= 0;
   uint64_t length;
+  attachsql_pack_status_t status;
 
   if (con == NULL)
   {
@@ -244,10 +246,16 @@ bool attachsql_statement_row_get(attachsql_connect_t *con, attachsql_error_t **e
     return false;
   }
 
-  raw_row= con->result.row_data;
+  raw_row= con->read_buffer->buffer_read_ptr;
+  row_end= raw_row + con->result.row_length;
+  con->stmt_null_bitmap_length= ((total_columns+7+2)/8);
+  if ((size_t)(row_end - raw_row) < (size_t)con->stmt_null_bitmap_length + 1)
+  {
+    attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_MALFORMED_PACKET, ATTACHSQL_ERROR_LEVEL_ERROR, "08S01", "Malformed row");
+    return false;
+  }
   /* packet header */
   raw_row++;
-  con->stmt_null_bitmap_length= ((total_columns+7+2)/8);
   con->stmt_null_bitmap= raw_row;
   raw_row+= con->stmt_null_bitmap_length;
 
@@ -274,14 +282,24 @@ bool attachsql_statement_row_get(attachsql_connect_t *con, attachsql_error_t **e
       case ATTACHSQL_COLUMN_TYPE_BIT:
       case ATTACHSQL_COLUMN_TYPE_DECIMAL:
       case ATTACHSQL_COLUMN_TYPE_NEWDECIMAL:
-        length= attachsql_unpack_length(raw_row, &bytes, NULL);
+        length= attachsql_unpack_length_bounded(raw_row, row_end, &bytes, &status);
+        if (status == ATTACHSQL_PACK_TRUNCATED)
+        {
+          attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_MALFORMED_PACKET, ATTACHSQL_ERROR_LEVEL_ERROR, "08S01", "Malformed row");
+          return false;
+        }
         raw_row+= bytes;
         break;
       case ATTACHSQL_COLUMN_TYPE_DATE:
       case ATTACHSQL_COLUMN_TYPE_DATETIME:
       case ATTACHSQL_COLUMN_TYPE_TIMESTAMP:
       case ATTACHSQL_COLUMN_TYPE_TIME:
-        length= raw_row[0];
+        if (raw_row >= row_end)
+        {
+          attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_MALFORMED_PACKET, ATTACHSQL_ERROR_LEVEL_ERROR, "08S01", "Malformed row");
+          return false;
+        }
+        length= (unsigned char)raw_row[0];
         raw_row++;
         break;
       case ATTACHSQL_COLUMN_TYPE_LONGLONG:
@@ -309,6 +327,11 @@ bool attachsql_statement_row_get(attachsql_connect_t *con, attachsql_error_t **e
         attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_UNKNOWN, ATTACHSQL_ERROR_LEVEL_ERROR, "60000", "Bad data in statement result");
         return false;
     }
+    if (length > (uint64_t)(row_end - raw_row))
+    {
+      attachsql_error_client_create(error, ATTACHSQL_ERROR_CODE_MALFORMED_PACKET, ATTACHSQL_ERROR_LEVEL_ERROR, "08S01", "Malformed row");
+      return false;
+    }
     con->stmt_row[column].data= raw_row;
     con->stmt_row[column].length= (size_t)length;
     con->stmt_row[column].type= type;
@@ -0,0 +1,178 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "config.h"
+#include "common.h"
+#include "stats.h"
+
+/* Histograms are log-linear in microseconds, every power of two is split
+ * into ATTACHSQL_STATS_SUB_BUCKETS buckets so the error is at most 25% */
+#define ATTACHSQL_STATS_SUB_BUCKET_BITS 2
+#define ATTACHSQL_STATS_SUB_BUCKETS (1 << ATTACHSQL_STATS_SUB_BUCKET_BITS)
+#define ATTACHSQL_STATS_NS_PER_US 1000
+
+static uint32_t attachsql_stats_bucket(uint64_t value)
+{
+  uint32_t msb= 0;
+  uint32_t bucket;
+
+  if (value < ATTACHSQL_STATS_SUB_BUCKETS)
+  {
+    return (uint32_t)value;
+  }
+  while ((value >> (msb + 1)) != 0)
+  {
+    msb++;
+  }
+  bucket= ((msb - ATTACHSQL_STATS_SUB_BUCKET_BITS + 1) * ATTACHSQL_STATS_SUB_BUCKETS)
+          + (uint32_t)((value >> (msb - ATTACHSQL_STATS_SUB_BUCKET_BITS)) & (ATTACHSQL_STATS_SUB_BUCKETS - 1));
+  if (bucket >= ATTACHSQL_HISTOGRAM_BUCKETS)
+  {
+    bucket= ATTACHSQL_HISTOGRAM_BUCKETS - 1;
+  }
+  return bucket;
+}
+
+/* The largest value which lands in a bucket */
+static uint64_t attachsql_stats_bucket_max(uint32_t bucket)
+{
+  uint32_t shift;
+
+  if (bucket < ATTACHSQL_STATS_SUB_BUCKETS)
+  {
+    return bucket;
+  }
+  shift= (bucket / ATTACHSQL_STATS_SUB_BUCKETS) - 1;
+  return ((((uint64_t)(bucket % ATTACHSQL_STATS_SUB_BUCKETS) + ATTACHSQL_STATS_SUB_BUCKETS + 1) << shift) - 1);
+}
+
+/* Records the time since start, a uv_hrtime() value */
+void attachsql_stats_histogram_add(attachsql_histogram_st *histogram, uint64_t start)
+{
+  uint64_t value= (uv_hrtime() - start) / ATTACHSQL_STATS_NS_PER_US;
+  uint32_t bucket= attachsql_stats_bucket(value);
+
+  ATTACHSQL_STAT_ADD(histogram->buckets[bucket], 1);
+  ATTACHSQL_STAT_ADD(histogram->count, 1);
+  ATTACHSQL_STAT_ADD(histogram->total, value);
+  if (value > histogram->max)
+  {
+    ATTACHSQL_STAT_SET(histogram->max, value);
+  }
+}
+
+void attachsql_stats_written(attachsql_connect_t *con, uv_buf_t *buffers, unsigned int buffer_count)
+{
+  unsigned int buffer;
+  uint64_t length= 0;
+
+  for (buffer= 0; buffer < buffer_count; buffer++)
+  {
+    length+= buffers[buffer].len;
+  }
+  ATTACHSQL_STAT_ADD(con->stats.bytes_out, length);
+}
+
+/* Every member of the stats struct is a uint64_t so it is copied as an
+ * array of them */
+void attachsql_stats_copy(attachsql_connect_stats_st *destination, attachsql_connect_stats_st *source)
+{
+  uint64_t *to= (uint64_t*)destination;
+  uint64_t *from= (uint64_t*)source;
+  size_t word;
+
+  for (word= 0; word < (sizeof(attachsql_connect_stats_st) / sizeof(uint64_t)); word++)
+  {
+    to[word]= ATTACHSQL_STAT_GET(from[word]);
+  }
+}
+
+static void attachsql_stats_histogram_merge(attachsql_histogram_st *destination, attachsql_histogram_st *source)
+{
+  uint32_t bucket;
+
+  destination->count+= source->count;
+  destination->total+= source->total;
+  if (source->max > destination->max)
+  {
+    destination->max= source->max;
+  }
+  for (bucket= 0; bucket < ATTACHSQL_HISTOGRAM_BUCKETS; bucket++)
+  {
+    destination->buckets[bucket]+= source->buckets[bucket];
+  }
+}
+
+/* Adds a copy made by attachsql_stats_copy() to a total */
+void attachsql_stats_merge(attachsql_connect_stats_st *destination, attachsql_connect_stats_st *source)
+{
+  uint32_t command;
+
+  destination->bytes_in+= source->bytes_in;
+  destination->bytes_out+= source->bytes_out;
+  destination->packets_in+= source->packets_in;
+  destination->packets_out+= source->packets_out;
+  for (command= 0; command < ATTACHSQL_STATS_COMMAND_TYPES; command++)
+  {
+    destination->commands[command]+= source->commands[command];
+  }
+  destination->rows+= source->rows;
+  destination->compressed_bytes_in+= source->compressed_bytes_in;
+  destination->uncompressed_bytes_in+= source->uncompressed_bytes_in;
+  destination->compressed_bytes_out+= source->compressed_bytes_out;
+  destination->uncompressed_bytes_out+= source->uncompressed_bytes_out;
+  destination->compress_time+= source->compress_time;
+  destination->buffer_grows+= source->buffer_grows;
+  destination->buffer_shrinks+= source->buffer_shrinks;
+  attachsql_stats_histogram_merge(&destination->connect_time, &source->connect_time);
+  attachsql_stats_histogram_merge(&destination->first_row_time, &source->first_row_time);
+  attachsql_stats_histogram_merge(&destination->query_time, &source->query_time);
+}
+
+uint64_t attachsql_histogram_percentile(const attachsql_histogram_st *histogram, double percentile)
+{
+  uint64_t target;
+  uint64_t seen= 0;
+  uint32_t bucket;
+
+  if ((histogram == NULL) or (histogram->count == 0))
+  {
+    return 0;
+  }
+  if (percentile > 100)
+  {
+    percentile= 100;
+  }
+  target= (uint64_t)((percentile / 100) * histogram->count);
+  if (target == 0)
+  {
+    target= 1;
+  }
+  for (bucket= 0; bucket < ATTACHSQL_HISTOGRAM_BUCKETS; bucket++)
+  {
+    seen+= histogram->buckets[bucket];
+    if (seen >= target)
+    {
+      break;
+    }
+  }
+  // The last bucket also holds everything too large for the others
+  if ((bucket >= ATTACHSQL_HISTOGRAM_BUCKETS - 1) or (attachsql_stats_bucket_max(bucket) > histogram->max))
+  {
+    return histogram->max;
+  }
+  return attachsql_stats_bucket_max(bucket);
+}
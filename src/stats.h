@@ -0,0 +1,48 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#pragma once
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The stats are only written by the thread running the connection, other
+ * threads can read them at any time.  Single writer relaxed stores and
+ * loads avoid torn values without a lock or a locked instruction. */
+#if defined(__GNUC__)
+# define ATTACHSQL_STAT_ADD(counter, value) __atomic_store_n(&(counter), (counter) + (value), __ATOMIC_RELAXED)
+# define ATTACHSQL_STAT_SET(counter, value) __atomic_store_n(&(counter), (value), __ATOMIC_RELAXED)
+# define ATTACHSQL_STAT_GET(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#else
+# define ATTACHSQL_STAT_ADD(counter, value) (counter)+= (value)
+# define ATTACHSQL_STAT_SET(counter, value) (counter)= (value)
+# define ATTACHSQL_STAT_GET(counter) (counter)
+#endif
+
+void attachsql_stats_histogram_add(attachsql_histogram_st *histogram, uint64_t start);
+
+void attachsql_stats_written(attachsql_connect_t *con, uv_buf_t *buffers, unsigned int buffer_count);
+
+void attachsql_stats_copy(attachsql_connect_stats_st *destination, attachsql_connect_stats_st *source);
+
+void attachsql_stats_merge(attachsql_connect_stats_st *destination, attachsql_connect_stats_st *source);
+
+#ifdef __cplusplus
+}
+#endif
@@ -19,9 +19,11 @@
 
 #include "constants.h"
 #include "buffer.h"
+#include "timer_wheel.h"
 #include "return.h"
 #include <sys/types.h>
 #include <stdint.h>
+#include <stdio.h>
 #ifdef _WIN32
 
 typedef uint16_t in_port_t;
@@ -38,6 +40,14 @@ typedef uint16_t in_port_t;
 # include <openssl/ssl.h>
 #endif
 
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
 #ifdef __cplusplus
 #include <cstddef>
 extern "C" {
@@ -84,7 +94,6 @@ struct result_t
   uint64_t extra;
   column_t *columns;
   uint16_t current_column;
-  char *row_data;
   size_t row_length;
 
   result_t() :
@@ -92,7 +101,6 @@ struct result_t
     extra(0),
     columns(NULL),
     current_column(0),
-    row_data(NULL),
     row_length(0)
   { }
 };
@@ -179,24 +187,90 @@ struct attachsql_stmt_st
   { }
 };
 
+#ifdef HAVE_OPENSSL
+/* Follows the TLS record boundaries in one direction of the encrypted
+ * stream so it can be handed to kernel TLS mid-stream */
+struct attachsql_ssl_record_scan_st
+{
+  uint8_t header[5];
+  uint8_t header_length;
+  size_t remaining;
+  bool encrypted;
+  uint64_t sequence;
+
+  attachsql_ssl_record_scan_st() :
+    header(),
+    header_length(0),
+    remaining(0),
+    encrypted(false),
+    sequence(0)
+  { }
+};
+#endif
+
+/* A sequence of 0 marks a record which is being written */
+struct attachsql_log_record_st
+{
+  uint64_t sequence;
+  uint64_t timestamp;
+  const char *file;
+  uint32_t line;
+  uint8_t level;
+  char message[ATTACHSQL_LOG_MESSAGE_SIZE];
+
+  attachsql_log_record_st() :
+    sequence(0),
+    timestamp(0),
+    file(NULL),
+    line(0),
+    level(0)
+  {
+    message[0]= '\0';
+  }
+};
+
 struct attachsql_connect_t
 {
   const char *host;
   in_port_t port;
   char str_port[6];
+  struct sockaddr_storage address;
+  bool address_set;
   const char *user;
   const char *pass;
   const char *schema;
   struct options_t
   {
     bool compression;
+    attachsql_compression_algorithm_t compression_algorithm;
+    int compression_level; // -1 is the library default
+    size_t compression_min_size;
+    int compression_min_saving; // percent
+    uint32_t compression_max_time; // nanoseconds per KB, 0 is unlimited
     attachsql_con_protocol_t protocol;
     bool semi_block;
+    size_t buffer_shrink_size; // 0 never shrinks
+    size_t max_buffer_size; // 0 is unlimited
+    uint32_t connect_timeout; // milliseconds, 0 never times out
+    uint32_t read_timeout;
+    uint32_t write_timeout;
+    uint32_t query_timeout;
 
     options_t() :
       compression(false),
+      compression_algorithm(ATTACHSQL_COMPRESSION_ALGORITHM_ZLIB),
+      compression_level(-1),
+      compression_min_size(ATTACHSQL_MINIMUM_COMPRESS_SIZE),
+      compression_min_saving(ATTACHSQL_MINIMUM_COMPRESS_SAVING),
+      compression_max_time(0),
       protocol(ATTACHSQL_CON_PROTOCOL_UNKNOWN),
-      semi_block(false)
+      semi_block(false),
+      buffer_shrink_size(ATTACHSQL_DEFAULT_BUFFER_SHRINK_SIZE),
+      max_buffer_size(0),
+      connect_timeout(0),
+      read_timeout(0),
+      write_timeout(0),
+      query_timeout(0)
     { }
   } options;
 
@@ -205,6 +279,7 @@ struct attachsql_connect_t
   attachsql_ret_t local_errcode;
   buffer_st *read_buffer;
   buffer_st *read_buffer_compress;
+  bool read_paused; /* socket reads stopped until the buffer has room */
   char write_buffer[ATTACHSQL_WRITE_BUFFER_SIZE];
   uint8_t write_buffer_extra; /* for extra bytes in packet header due to prepared statement */
   uint8_t packet_number;
@@ -229,12 +304,35 @@ struct attachsql_connect_t
   attachsql_packet_type_t *next_packet_queue;
   size_t next_packet_queue_size;
   size_t next_packet_queue_used;
-  char *uncompressed_buffer;
-  size_t uncompressed_buffer_len;
   char *compressed_buffer;
   size_t compressed_buffer_len;
   char compressed_packet_header[7];
   uint8_t compressed_packet_number;
+#ifdef HAVE_ZLIB
+  /* Kept for the life of the connection and reset for every packet */
+  z_stream deflate_stream;
+  z_stream inflate_stream;
+  bool deflate_ready;
+  bool inflate_ready;
+  /* Recent results of compressing sent packets, used to skip compression
+   * when the data isn't compressing or is too slow to compress */
+  struct compress_history_t
+  {
+    int saving; // moving average in tenths of a percent
+    uint64_t time_per_kb; // moving average in nanoseconds
+    uint32_t skipped;
+
+    compress_history_t() :
+      saving(1000),
+      time_per_kb(0),
+      skipped(0)
+    { }
+  } compress_history;
+#endif
+#ifdef HAVE_ZSTD
+  ZSTD_CCtx *zstd_cctx;
+  ZSTD_DCtx *zstd_dctx;
+#endif
   struct uv_objects_t
   {
     uv_loop_t *loop;
@@ -248,27 +346,35 @@ struct attachsql_connect_t
       uv_tcp_t tcp;
       uv_pipe_t uds;
     } socket;
+    bool resolving;
 
     uv_objects_t() :
       loop(NULL),
-      stream(NULL)
-    { }
+      stream(NULL),
+      resolving(false)
+    {
+      connect_req.data= NULL;
+    }
   } uv_objects;
 #ifdef HAVE_OPENSSL
   struct ssl_t
   {
     SSL *ssl;
-    SSL_CTX *context;
+    attachsql_ssl_context_t *context;
     bool no_verify;
     bool enabled; // set to true after first handshake to signify send/receive should be encrypted.
     bool handshake_done;
-    BIO* read_bio;
-    BIO* write_bio;
-    char ssl_read_buffer[1024*16];
+    attachsql_ssl_version_t min_version;
+    attachsql_ssl_version_t max_version;
+    bool ktls_requested;
+    bool ktls_checked; // handover to kernel TLS has been attempted
+    bool ktls_rx; // reads are decrypted by the kernel
+    bool ktls_tx; // writes are encrypted by the kernel
+    attachsql_ssl_record_scan_st rx_scan;
+    attachsql_ssl_record_scan_st tx_scan;
+    BIO* network_bio; // network side of the BIO pair, the SSL object owns the other side
     char ssl_write_buffer[1024*16];
     buffer_st *write_buffer;
-    char* bio_buffer;
-    size_t bio_buffer_size;
 
     ssl_t() :
       ssl(NULL),
@@ -276,13 +382,17 @@ struct attachsql_connect_t
       no_verify(false),
       enabled(false),
       handshake_done(false),
-      read_bio(NULL),
-      write_bio(NULL),
-      write_buffer(NULL),
-      bio_buffer(NULL),
-      bio_buffer_size(0)
+      min_version(ATTACHSQL_SSL_VERSION_DEFAULT),
+      max_version(ATTACHSQL_SSL_VERSION_DEFAULT),
+      ktls_requested(false),
+      ktls_checked(false),
+      ktls_rx(false),
+      ktls_tx(false),
+      rx_scan(),
+      tx_scan(),
+      network_bio(NULL),
+      write_buffer(NULL)
     {
-      ssl_read_buffer[0]= '\0';
       ssl_write_buffer[0]= '\0';
     }
   } ssl;
@@ -291,8 +401,11 @@ struct attachsql_connect_t
   attachsql_stmt_st *stmt;
   /* the following has been migrated during struct merge */
   attachsql_pool_t *pool;
+  bool pool_warming;
   char *query_buffer;
   size_t query_buffer_length;
+  char *query_alloc_buffer; /* kept between queries to avoid reallocating */
+  size_t query_alloc_buffer_size;
   bool query_buffer_alloc;
   bool query_buffer_statement;
   bool in_query;
@@ -309,10 +422,146 @@ struct attachsql_connect_t
   uint16_t stmt_null_bitmap_length;
   char stmt_tmp_buffer[ATTACHSQL_STMT_CHAR_BUFFER_SIZE];
   attachsql_events_t last_callback;
+  attachsql_connect_stats_st stats;
+  uint64_t connect_start; /* uv_hrtime() values for the latency stats */
+  uint64_t command_start;
+  bool command_first_row;
+  /* Tracing is only done when trace_fn is set */
+  attachsql_trace_fn *trace_fn;
+  void *trace_context;
+  uint64_t command_id;
+  uint8_t command_type;
+  bool command_first_byte;
+  /* Records are only written by the thread running the connection and can
+   * be read from any thread, see log.cc */
+  struct log_t
+  {
+    uint8_t level;
+    attachsql_log_record_st *records;
+    uint64_t head;
+    uint64_t dumped;
+    uint32_t packet_rate;
+    uint16_t packet_bytes;
+    uint32_t packet_count;
+    attachsql_log_fn *fn;
+    void *context;
+
+    log_t() :
+      level(ATTACHSQL_LOG_LEVEL_NONE),
+      records(NULL),
+      head(0),
+      dumped(0),
+      packet_rate(ATTACHSQL_DEFAULT_LOG_PACKET_RATE),
+      packet_bytes(ATTACHSQL_DEFAULT_LOG_PACKET_BYTES),
+      packet_count(0),
+      fn(NULL),
+      context(NULL)
+    { }
+  } log;
+  /* Plaintext of the connection recorded to a file, see capture.cc */
+  struct capture_t
+  {
+    FILE *file;
+    uint64_t last_time;
+
+    capture_t() :
+      file(NULL),
+      last_time(0)
+    { }
+  } capture;
+  /* A capture played back in place of the network */
+  struct replay_t
+  {
+    char *data;
+    size_t length;
+    size_t position;
+    size_t record_offset;
+    uint64_t writes_sent;
+    uint64_t writes_seen;
+    bool write_done;
+
+    replay_t() :
+      data(NULL),
+      length(0),
+      position(0),
+      record_offset(0),
+      writes_sent(0),
+      writes_seen(0),
+      write_done(false)
+    { }
+  } replay;
+  /* Deadlines are uv_now() values, 0 when not set, see timeout.cc.  Pool
+   * connections use the pool's timer wheel instead of a timer each */
+  struct timeout_t
+  {
+    uv_timer_t timer;
+    timer_wheel_entry_st entry;
+    bool timer_ready;
+    uint64_t due;
+    uint64_t connect_deadline;
+    uint64_t query_deadline;
+    uint64_t read_deadline;
+    uint64_t last_read;
+    uint64_t write_deadline;
+    uint32_t writes_pending;
+
+    timeout_t() :
+      entry(),
+      timer_ready(false),
+      due(0),
+      connect_deadline(0),
+      query_deadline(0),
+      read_deadline(0),
+      last_read(0),
+      write_deadline(0),
+      writes_pending(0)
+    { }
+  } timeout;
+  /* Keepalive pings and max lifetime recycling of pool connections, see
+   * pool.cc */
+  struct maintenance_t
+  {
+    timer_wheel_entry_st entry;
+    uint64_t connected_at; /* uv_now() values */
+    uint64_t last_active;
+    uint64_t ping_sent;
+    bool ping_pending;
+    bool recycling;
+    uint8_t closing; /* handles still closing before reconnecting */
+    char command_packet[5];
+
+    maintenance_t() :
+      entry(),
+      connected_at(0),
+      last_active(0),
+      ping_sent(0),
+      ping_pending(false),
+      recycling(false),
+      closing(0)
+    {
+      command_packet[0]= '\0';
+    }
+  } maintenance;
+  /* attachsql_query_cancel() */
+  struct cancel_t
+  {
+    attachsql_connect_t *con; /* sends KILL QUERY, kept for the next cancel */
+    bool discarding; /* rows of the cancelled query are thrown away */
+    char query[32];
+
+    cancel_t() :
+      con(NULL),
+      discarding(false)
+    {
+      query[0]= '\0';
+    }
+  } cancel;
 
   attachsql_connect_t() :
     host(NULL),
     port(0),
+    address(),
+    address_set(false),
     user(NULL),
     pass(NULL),
     schema(NULL),
@@ -320,6 +569,7 @@ struct attachsql_connect_t
     local_errcode(ATTACHSQL_RET_OK),
     read_buffer(NULL),
     read_buffer_compress(NULL),
+    read_paused(false),
     write_buffer_extra(0),
     packet_number(0),
     thread_id(0),
@@ -337,16 +587,27 @@ struct attachsql_connect_t
     next_packet_queue(NULL),
     next_packet_queue_size(0),
     next_packet_queue_used(0),
-    uncompressed_buffer(NULL),
-    uncompressed_buffer_len(0),
     compressed_buffer(NULL),
     compressed_buffer_len(0),
     compressed_packet_number(0),
+#ifdef HAVE_ZLIB
+    deflate_stream(),
+    inflate_stream(),
+    deflate_ready(false),
+    inflate_ready(false),
+#endif
+#ifdef HAVE_ZSTD
+    zstd_cctx(NULL),
+    zstd_dctx(NULL),
+#endif
     in_statement(false),
     stmt(NULL),
     pool(NULL),
+    pool_warming(false),
     query_buffer(NULL),
     query_buffer_length(0),
+    query_alloc_buffer(NULL),
+    query_alloc_buffer_size(0),
     query_buffer_alloc(false),
     query_buffer_statement(false),
     in_query(false),
@@ -361,7 +622,21 @@ struct attachsql_connect_t
     stmt_row(NULL),
     stmt_null_bitmap(NULL),
     stmt_null_bitmap_length(0),
-    last_callback(ATTACHSQL_EVENT_NONE)
+    last_callback(ATTACHSQL_EVENT_NONE),
+    stats(),
+    connect_start(0),
+    command_start(0),
+    command_first_row(false),
+    trace_fn(NULL),
+    trace_context(NULL),
+    command_id(0),
+    command_type(0),
+    command_first_byte(false),
+    log(),
+    capture(),
+    replay(),
+    timeout(),
+    maintenance()
   {
     str_port[0]= '\0';
     errmsg[0]= '\0';
@@ -392,20 +667,97 @@ struct attachsql_error_t
   }
 };
 
+#ifdef HAVE_OPENSSL
+struct attachsql_ssl_context_t
+{
+  SSL_CTX *context;
+  SSL_SESSION *session;
+  uv_mutex_t lock;
+  uint32_t references;
+
+  attachsql_ssl_context_t() :
+    context(NULL),
+    session(NULL),
+    references(1)
+  { }
+};
+#endif
+
+struct attachsql_query_template_t
+{
+  char *statement;
+  size_t length;
+  size_t *placeholders;
+  uint16_t placeholder_count;
+
+  attachsql_query_template_t() :
+    statement(NULL),
+    length(0),
+    placeholders(NULL),
+    placeholder_count(0)
+  { }
+};
+
 struct attachsql_pool_t
 {
   attachsql_connect_t **connections;
   uint32_t connection_count;
+  /* Held while the connection list changes so that stats can be collected
+   * from another thread */
+  uv_mutex_t connections_lock;
   attachsql_callback_fn *callback_fn;
   void *callback_context;
   uv_loop_t *loop;
+  attachsql_ssl_context_t *ssl_context;
+  size_t max_buffer_size; // 0 is unlimited
+  uint32_t keepalive_interval; // milliseconds, 0 is disabled
+  uint32_t max_lifetime; // milliseconds, 0 is unlimited
+  /* Deadlines, keepalives and recycling for every connection in the pool */
+  timer_wheel_st wheel;
+  struct warm_up_t
+  {
+    attachsql_connect_t *con_template;
+    uint32_t target;
+    uint32_t max_concurrent;
+    uint32_t started;
+    uint32_t in_progress;
+    uint32_t connected;
+    uint32_t failed;
+    bool active;
+    bool resolving;
+    bool resolved;
+    bool address_set;
+    struct sockaddr_storage address;
+    struct addrinfo hints;
+    uv_getaddrinfo_t resolver;
+
+    warm_up_t() :
+      con_template(NULL),
+      target(0),
+      max_concurrent(0),
+      started(0),
+      in_progress(0),
+      connected(0),
+      failed(0),
+      active(false),
+      resolving(false),
+      resolved(false),
+      address_set(false),
+      address()
+    { }
+  } warm_up;
 
   attachsql_pool_t() :
     connections(NULL),
     connection_count(0),
     callback_fn(NULL),
     callback_context(NULL),
-    loop(NULL)
+    loop(NULL),
+    ssl_context(NULL),
+    max_buffer_size(0),
+    keepalive_interval(0),
+    max_lifetime(0),
+    wheel()
   { }
 
 };
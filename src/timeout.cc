@@ -0,0 +1,308 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "timeout.h"
+#include "net.h"
+#include "log.h"
+
+/* Each connection has one timer on its loop, or an entry in the pool's
+ * timer wheel for pool connections, which is set for the earliest
+ * deadline.  Deadlines are only moved later without touching the timer,
+ * when it fires the deadlines are checked again and the timer set for the
+ * next one.  This keeps the read timeout down to storing a time for every
+ * read.
+ *
+ * The connect timeout covers everything up to the handshake completing,
+ * the query timeout a command from being sent to its last packet.  The read
+ * timeout is the time the server goes quiet whilst we are waiting on it, it
+ * doesn't count whilst the application holds a row.  The write timeout is
+ * the time a write waits on a full socket.
+ */
+
+static void attachsql_timeout_cb(uv_timer_t *timer);
+
+static void attachsql_timeout_wheel_cb(timer_wheel_entry_st *entry);
+
+static uint64_t attachsql_timeout_now(attachsql_connect_t *con)
+{
+  /* The cached loop time is stale if the application hasn't polled for a
+   * while */
+  uv_update_time(con->uv_objects.loop);
+  return uv_now(con->uv_objects.loop);
+}
+
+static void attachsql_timeout_arm(attachsql_connect_t *con, uint64_t deadline)
+{
+  if ((con->timeout.due != 0) and (con->timeout.due <= deadline))
+  {
+    return;
+  }
+  con->timeout.due= deadline;
+  if (con->pool != NULL)
+  {
+    if (con->timeout.entry.fn == NULL)
+    {
+      attachsql_timer_wheel_entry_init(&con->timeout.entry, attachsql_timeout_wheel_cb, con);
+    }
+    attachsql_timer_wheel_schedule(&con->pool->wheel, &con->timeout.entry, deadline);
+    return;
+  }
+  if (not con->timeout.timer_ready)
+  {
+    uv_timer_init(con->uv_objects.loop, &con->timeout.timer);
+    con->timeout.timer.data= con;
+    con->timeout.timer_ready= true;
+  }
+  uint64_t now= uv_now(con->uv_objects.loop);
+  uv_timer_start(&con->timeout.timer, attachsql_timeout_cb, (deadline > now) ? deadline - now : 0, 0);
+}
+
+/* The server owes us data, rather than the application holding a row or
+ * the read buffer being full */
+static bool attachsql_timeout_waiting(attachsql_connect_t *con)
+{
+  return ((con->status == ATTACHSQL_CON_STATUS_BUSY) and (con->next_packet_queue_used > 0) and not con->read_paused);
+}
+
+static void attachsql_timeout_fire(attachsql_connect_t *con, const char *message)
+{
+  /* A connect still in progress has no stream yet, the callbacks see the
+   * cancellation and leave the error alone */
+  if (con->uv_objects.stream == NULL)
+  {
+    if (con->uv_objects.resolving)
+    {
+      uv_cancel((uv_req_t*)&con->uv_objects.resolver);
+    }
+    else if ((con->uv_objects.connect_req.data != NULL) and not uv_is_closing((uv_handle_t*)con->uv_objects.connect_req.data))
+    {
+      uv_close((uv_handle_t*)con->uv_objects.connect_req.data, NULL);
+    }
+  }
+  con->timeout.connect_deadline= 0;
+  con->timeout.query_deadline= 0;
+  con->timeout.read_deadline= 0;
+  con->timeout.write_deadline= 0;
+  attachsql_con_read_abort(con, ATTACHSQL_RET_TIMEOUT, message);
+}
+
+static void attachsql_timeout_check(attachsql_connect_t *con)
+{
+  uint64_t now= uv_now(con->uv_objects.loop);
+  uint64_t next= 0;
+
+  con->timeout.due= 0;
+  if ((con->status != ATTACHSQL_CON_STATUS_CONNECTING) and (con->status != ATTACHSQL_CON_STATUS_BUSY) and (con->status != ATTACHSQL_CON_STATUS_IDLE))
+  {
+    return;
+  }
+
+  if (con->timeout.connect_deadline)
+  {
+    if (con->status != ATTACHSQL_CON_STATUS_CONNECTING)
+    {
+      con->timeout.connect_deadline= 0;
+    }
+    else if (now >= con->timeout.connect_deadline)
+    {
+      attachsql_timeout_fire(con, "Connect timeout");
+      return;
+    }
+    else
+    {
+      next= con->timeout.connect_deadline;
+    }
+  }
+
+  if (con->timeout.query_deadline)
+  {
+    if (now >= con->timeout.query_deadline)
+    {
+      attachsql_timeout_fire(con, "Query timeout");
+      return;
+    }
+    if ((next == 0) or (con->timeout.query_deadline < next))
+    {
+      next= con->timeout.query_deadline;
+    }
+  }
+
+  if (con->timeout.write_deadline)
+  {
+    if (now >= con->timeout.write_deadline)
+    {
+      attachsql_timeout_fire(con, "Write timeout");
+      return;
+    }
+    if ((next == 0) or (con->timeout.write_deadline < next))
+    {
+      next= con->timeout.write_deadline;
+    }
+  }
+
+  if (con->timeout.read_deadline)
+  {
+    if (not attachsql_timeout_waiting(con))
+    {
+      /* Check again later, the application restarts the clock when it asks
+       * for more */
+      con->timeout.read_deadline= now + con->options.read_timeout;
+    }
+    else
+    {
+      con->timeout.read_deadline= con->timeout.last_read + con->options.read_timeout;
+      if (now >= con->timeout.read_deadline)
+      {
+        attachsql_timeout_fire(con, "Read timeout");
+        return;
+      }
+    }
+    if ((next == 0) or (con->timeout.read_deadline < next))
+    {
+      next= con->timeout.read_deadline;
+    }
+  }
+
+  if (next)
+  {
+    attachsql_timeout_arm(con, next);
+  }
+}
+
+static void attachsql_timeout_cb(uv_timer_t *timer)
+{
+  attachsql_timeout_check((attachsql_connect_t*)timer->data);
+}
+
+static void attachsql_timeout_wheel_cb(timer_wheel_entry_st *entry)
+{
+  attachsql_timeout_check((attachsql_connect_t*)entry->data);
+}
+
+void attachsql_timeout_connect_start(attachsql_connect_t *con)
+{
+  if (con->options.connect_timeout == 0)
+  {
+    return;
+  }
+  con->timeout.connect_deadline= attachsql_timeout_now(con) + con->options.connect_timeout;
+  attachsql_timeout_arm(con, con->timeout.connect_deadline);
+}
+
+void attachsql_timeout_command_start(attachsql_connect_t *con)
+{
+  uint64_t now;
+
+  if ((con->options.query_timeout == 0) and (con->options.read_timeout == 0))
+  {
+    return;
+  }
+  now= attachsql_timeout_now(con);
+  if (con->options.query_timeout)
+  {
+    con->timeout.query_deadline= now + con->options.query_timeout;
+    attachsql_timeout_arm(con, con->timeout.query_deadline);
+  }
+  if (con->options.read_timeout)
+  {
+    con->timeout.last_read= now;
+    con->timeout.read_deadline= now + con->options.read_timeout;
+    attachsql_timeout_arm(con, con->timeout.read_deadline);
+  }
+}
+
+/* Nothing is left to time so don't wake the loop up for nothing */
+static void attachsql_timeout_stop_unused(attachsql_connect_t *con)
+{
+  if ((con->timeout.due != 0) and (con->timeout.connect_deadline == 0) and (con->timeout.query_deadline == 0) and (con->timeout.read_deadline == 0) and (con->timeout.write_deadline == 0))
+  {
+    if (con->pool != NULL)
+    {
+      attachsql_timer_wheel_cancel(&con->pool->wheel, &con->timeout.entry);
+    }
+    else
+    {
+      uv_timer_stop(&con->timeout.timer);
+    }
+    con->timeout.due= 0;
+  }
+}
+
+void attachsql_timeout_connect_end(attachsql_connect_t *con)
+{
+  con->timeout.connect_deadline= 0;
+  attachsql_timeout_stop_unused(con);
+}
+
+void attachsql_timeout_command_end(attachsql_connect_t *con)
+{
+  con->timeout.query_deadline= 0;
+  con->timeout.read_deadline= 0;
+  attachsql_timeout_stop_unused(con);
+}
+
+void attachsql_timeout_read_activity(attachsql_connect_t *con)
+{
+  if (con->timeout.read_deadline)
+  {
+    con->timeout.last_read= attachsql_timeout_now(con);
+  }
+}
+
+void attachsql_timeout_write_start(attachsql_connect_t *con)
+{
+  if (con->options.write_timeout == 0)
+  {
+    return;
+  }
+  con->timeout.writes_pending++;
+  if (con->timeout.writes_pending == 1)
+  {
+    con->timeout.write_deadline= attachsql_timeout_now(con) + con->options.write_timeout;
+    attachsql_timeout_arm(con, con->timeout.write_deadline);
+  }
+}
+
+void attachsql_timeout_write_end(attachsql_connect_t *con)
+{
+  if (con->timeout.writes_pending == 0)
+  {
+    return;
+  }
+  con->timeout.writes_pending--;
+  if (con->timeout.writes_pending == 0)
+  {
+    con->timeout.write_deadline= 0;
+  }
+  else
+  {
+    /* Another write is queued behind this one, it gets its own time */
+    con->timeout.write_deadline= uv_now(con->uv_objects.loop) + con->options.write_timeout;
+  }
+}
+
+void attachsql_timeout_clear(attachsql_connect_t *con)
+{
+  con->timeout.connect_deadline= 0;
+  con->timeout.query_deadline= 0;
+  con->timeout.read_deadline= 0;
+  con->timeout.write_deadline= 0;
+  con->timeout.writes_pending= 0;
+  attachsql_timeout_stop_unused(con);
+}
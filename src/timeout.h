@@ -0,0 +1,47 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#pragma once
+
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void attachsql_timeout_connect_start(attachsql_connect_t *con);
+
+void attachsql_timeout_connect_end(attachsql_connect_t *con);
+
+void attachsql_timeout_command_start(attachsql_connect_t *con);
+
+void attachsql_timeout_command_end(attachsql_connect_t *con);
+
+/* Data arrived or the application is ready for more, restarts the read
+ * timeout */
+void attachsql_timeout_read_activity(attachsql_connect_t *con);
+
+void attachsql_timeout_write_start(attachsql_connect_t *con);
+
+void attachsql_timeout_write_end(attachsql_connect_t *con);
+
+/* Forgets every deadline, for a connection being reconnected */
+void attachsql_timeout_clear(attachsql_connect_t *con);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,244 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "config.h"
+#include "timer_wheel.h"
+
+/* A hierarchical timer wheel so that thousands of pool connections can have
+ * deadlines without a libuv timer each.  Level 0 has a slot per tick, each
+ * level above a slot per 64 ticks of the level below.  When level 0 wraps
+ * the next slot of level 1 is moved down a level, and so on up, so that
+ * inserting and cancelling are O(1).  Entries past the top level wait in its
+ * furthest slot and are moved again when it comes round.
+ *
+ * One repeating libuv timer drives the wheel while anything is scheduled.
+ */
+
+static void attachsql_timer_wheel_unlink(timer_wheel_entry_st *entry)
+{
+  entry->prev->next= entry->next;
+  entry->next->prev= entry->prev;
+  entry->next= NULL;
+  entry->prev= NULL;
+}
+
+static void attachsql_timer_wheel_link(timer_wheel_entry_st *head, timer_wheel_entry_st *entry)
+{
+  entry->prev= head->prev;
+  entry->next= head;
+  head->prev->next= entry;
+  head->prev= entry;
+}
+
+/* Moves a slot's entries to a list of our own so callbacks can schedule
+ * into the slot again */
+static void attachsql_timer_wheel_detach(timer_wheel_entry_st *head, timer_wheel_entry_st *list)
+{
+  if (head->next == head)
+  {
+    list->next= list;
+    list->prev= list;
+    return;
+  }
+  list->next= head->next;
+  list->prev= head->prev;
+  list->next->prev= list;
+  list->prev->next= list;
+  head->next= head;
+  head->prev= head;
+}
+
+static void attachsql_timer_wheel_insert(timer_wheel_st *wheel, timer_wheel_entry_st *entry)
+{
+  uint64_t expires= entry->expires;
+  uint64_t delta= (expires > wheel->now) ? expires - wheel->now : 0;
+  uint8_t level;
+
+  for (level= 0; level < ATTACHSQL_TIMER_WHEEL_LEVELS - 1; level++)
+  {
+    if (delta < ((uint64_t)1 << (ATTACHSQL_TIMER_WHEEL_BITS * (level + 1))))
+    {
+      break;
+    }
+  }
+  if (delta >= ((uint64_t)1 << (ATTACHSQL_TIMER_WHEEL_BITS * ATTACHSQL_TIMER_WHEEL_LEVELS)))
+  {
+    expires= wheel->now + ((uint64_t)1 << (ATTACHSQL_TIMER_WHEEL_BITS * ATTACHSQL_TIMER_WHEEL_LEVELS)) - 1;
+  }
+  else if (delta == 0)
+  {
+    expires= wheel->now;
+  }
+  size_t slot= (size_t)((expires >> (ATTACHSQL_TIMER_WHEEL_BITS * level)) & (ATTACHSQL_TIMER_WHEEL_SLOTS - 1));
+  attachsql_timer_wheel_link(&wheel->slots[level][slot], entry);
+}
+
+static void attachsql_timer_wheel_cascade(timer_wheel_st *wheel, uint8_t level, size_t slot)
+{
+  timer_wheel_entry_st list;
+  timer_wheel_entry_st *entry;
+
+  attachsql_timer_wheel_detach(&wheel->slots[level][slot], &list);
+  while (list.next != &list)
+  {
+    entry= list.next;
+    attachsql_timer_wheel_unlink(entry);
+    attachsql_timer_wheel_insert(wheel, entry);
+  }
+}
+
+static void attachsql_timer_wheel_run_tick(timer_wheel_st *wheel)
+{
+  timer_wheel_entry_st list;
+  timer_wheel_entry_st *entry;
+  uint8_t level;
+  size_t slot= (size_t)(wheel->now & (ATTACHSQL_TIMER_WHEEL_SLOTS - 1));
+
+  /* Each time a level wraps pull the next slot of the level above down */
+  for (level= 1; (level < ATTACHSQL_TIMER_WHEEL_LEVELS) and (((wheel->now >> (ATTACHSQL_TIMER_WHEEL_BITS * (level - 1))) & (ATTACHSQL_TIMER_WHEEL_SLOTS - 1)) == 0); level++)
+  {
+    attachsql_timer_wheel_cascade(wheel, level, (size_t)((wheel->now >> (ATTACHSQL_TIMER_WHEEL_BITS * level)) & (ATTACHSQL_TIMER_WHEEL_SLOTS - 1)));
+  }
+
+  attachsql_timer_wheel_detach(&wheel->slots[0][slot], &list);
+  while (list.next != &list)
+  {
+    entry= list.next;
+    attachsql_timer_wheel_unlink(entry);
+    /* Beyond the top level, not due yet */
+    if (entry->expires > wheel->now)
+    {
+      attachsql_timer_wheel_insert(wheel, entry);
+      continue;
+    }
+    wheel->count--;
+    entry->fn(entry);
+  }
+}
+
+static uint64_t attachsql_timer_wheel_current(timer_wheel_st *wheel)
+{
+  uint64_t time= uv_now(wheel->timer.loop);
+
+  if (time <= wheel->start)
+  {
+    return 0;
+  }
+  return (time - wheel->start) / ATTACHSQL_TIMER_WHEEL_TICK;
+}
+
+static void attachsql_timer_wheel_cb(uv_timer_t *timer)
+{
+  timer_wheel_st *wheel= (timer_wheel_st*)timer->data;
+  uint64_t target= attachsql_timer_wheel_current(wheel);
+
+  wheel->running= true;
+  /* Catches up if the loop wasn't run for a while */
+  while ((wheel->now < target) and (wheel->count > 0))
+  {
+    wheel->now++;
+    attachsql_timer_wheel_run_tick(wheel);
+  }
+  wheel->running= false;
+  if (wheel->count == 0)
+  {
+    wheel->now= target;
+    uv_timer_stop(&wheel->timer);
+  }
+}
+
+void attachsql_timer_wheel_init(timer_wheel_st *wheel, uv_loop_t *loop)
+{
+  uint8_t level;
+  size_t slot;
+
+  for (level= 0; level < ATTACHSQL_TIMER_WHEEL_LEVELS; level++)
+  {
+    for (slot= 0; slot < ATTACHSQL_TIMER_WHEEL_SLOTS; slot++)
+    {
+      wheel->slots[level][slot].next= &wheel->slots[level][slot];
+      wheel->slots[level][slot].prev= &wheel->slots[level][slot];
+    }
+  }
+  uv_timer_init(loop, &wheel->timer);
+  wheel->timer.data= wheel;
+  uv_update_time(loop);
+  wheel->start= uv_now(loop);
+  wheel->now= 0;
+  wheel->count= 0;
+  wheel->ready= true;
+}
+
+void attachsql_timer_wheel_entry_init(timer_wheel_entry_st *entry, timer_wheel_fn *fn, void *data)
+{
+  entry->next= NULL;
+  entry->prev= NULL;
+  entry->expires= 0;
+  entry->fn= fn;
+  entry->data= data;
+}
+
+void attachsql_timer_wheel_schedule(timer_wheel_st *wheel, timer_wheel_entry_st *entry, uint64_t deadline)
+{
+  uint64_t expires= 0;
+
+  if (entry->next != NULL)
+  {
+    attachsql_timer_wheel_unlink(entry);
+    wheel->count--;
+  }
+  /* Nothing was waiting so the idle ticks don't need to be run */
+  if ((wheel->count == 0) and not wheel->running)
+  {
+    wheel->now= attachsql_timer_wheel_current(wheel);
+  }
+  if (deadline > wheel->start)
+  {
+    /* Rounded up so nothing runs early */
+    expires= (deadline - wheel->start + ATTACHSQL_TIMER_WHEEL_TICK - 1) / ATTACHSQL_TIMER_WHEEL_TICK;
+  }
+  if (expires <= wheel->now)
+  {
+    expires= wheel->now + 1;
+  }
+  entry->expires= expires;
+  attachsql_timer_wheel_insert(wheel, entry);
+  wheel->count++;
+  if ((wheel->count == 1) and not wheel->running)
+  {
+    uv_timer_start(&wheel->timer, attachsql_timer_wheel_cb, ATTACHSQL_TIMER_WHEEL_TICK, ATTACHSQL_TIMER_WHEEL_TICK);
+  }
+}
+
+void attachsql_timer_wheel_cancel(timer_wheel_st *wheel, timer_wheel_entry_st *entry)
+{
+  if (entry->next == NULL)
+  {
+    return;
+  }
+  attachsql_timer_wheel_unlink(entry);
+  wheel->count--;
+  if ((wheel->count == 0) and not wheel->running)
+  {
+    uv_timer_stop(&wheel->timer);
+  }
+}
+
+bool attachsql_timer_wheel_scheduled(timer_wheel_entry_st *entry)
+{
+  return (entry->next != NULL);
+}
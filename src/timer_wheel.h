@@ -0,0 +1,93 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain 
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <uv.h>
+
+#ifdef __cplusplus
+#include <cstddef>
+extern "C" {
+#endif
+
+/* Milliseconds per tick, deadlines are rounded up to a tick */
+#define ATTACHSQL_TIMER_WHEEL_TICK 10
+/* Each level has 64 slots covering 64 times the span of the level below,
+ * four levels reach about 46 hours at 10ms ticks */
+#define ATTACHSQL_TIMER_WHEEL_BITS 6
+#define ATTACHSQL_TIMER_WHEEL_SLOTS (1 << ATTACHSQL_TIMER_WHEEL_BITS)
+#define ATTACHSQL_TIMER_WHEEL_LEVELS 4
+
+struct timer_wheel_entry_st;
+
+typedef void (timer_wheel_fn)(struct timer_wheel_entry_st *entry);
+
+/* Embedded in whatever is being timed, an entry is in at most one slot */
+struct timer_wheel_entry_st
+{
+  timer_wheel_entry_st *next;
+  timer_wheel_entry_st *prev;
+  uint64_t expires; /* in ticks */
+  timer_wheel_fn *fn;
+  void *data;
+
+  timer_wheel_entry_st() :
+    next(NULL),
+    prev(NULL),
+    expires(0),
+    fn(NULL),
+    data(NULL)
+  { }
+};
+
+struct timer_wheel_st
+{
+  uv_timer_t timer;
+  bool ready;
+  bool running; /* entries are being run so now can't jump */
+  uint64_t start; /* uv_now() of tick 0 */
+  uint64_t now; /* the last tick run */
+  uint32_t count;
+  /* Each slot is the head of a circular list */
+  timer_wheel_entry_st slots[ATTACHSQL_TIMER_WHEEL_LEVELS][ATTACHSQL_TIMER_WHEEL_SLOTS];
+
+  timer_wheel_st() :
+    ready(false),
+    running(false),
+    start(0),
+    now(0),
+    count(0)
+  { }
+};
+
+void attachsql_timer_wheel_init(timer_wheel_st *wheel, uv_loop_t *loop);
+
+void attachsql_timer_wheel_entry_init(timer_wheel_entry_st *entry, timer_wheel_fn *fn, void *data);
+
+/* Runs fn at or just after deadline, a uv_now() value, moving the entry if
+ * it is already scheduled */
+void attachsql_timer_wheel_schedule(timer_wheel_st *wheel, timer_wheel_entry_st *entry, uint64_t deadline);
+
+void attachsql_timer_wheel_cancel(timer_wheel_st *wheel, timer_wheel_entry_st *entry);
+
+bool attachsql_timer_wheel_scheduled(timer_wheel_entry_st *entry);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,270 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain 
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/* Exercises the buffer cache through the buffer API so it is built from the
+ * library sources like t/buffer_ring, and checks that connections reuse the
+ * cached buffers against the mock server */
+
+#include "config.h"
+#include <yatl/lite.h>
+#include "src/buffer.h"
+#include <libattachsql2/attachsql.h>
+#include "tests/mock_server.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+#if defined(HAVE_MADVISE)
+# include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE ((size_t)2*1024*1024)
+
+/* Buffers are taken from and given back to the free list of their size
+ * class */
+static void test_get_put(void)
+{
+  attachsql_buffer_cache_stats_st before;
+  attachsql_buffer_cache_stats_st stats;
+  size_t size= ATTACHSQL_DEFAULT_BUFFER_SIZE;
+  buffer_st *block;
+
+  attachsql_library_set_buffer_cache(0, false);
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_EQ_(0, stats.blocks, "Buffer cache not empty");
+  ASSERT_EQ_(0, stats.size, "Buffer cache not empty");
+  attachsql_library_set_buffer_cache(32*1024*1024, false);
+
+  attachsql_library_get_buffer_cache_stats(&before);
+  block= attachsql_buffer_create();
+  ASSERT_TRUE_(block, "Could not create a buffer");
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_EQ_(before.misses + 1, stats.misses, "Empty cache not missed");
+  attachsql_buffer_free(block);
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_EQ_(1, stats.blocks, "Freed buffer not cached");
+  ASSERT_EQ_(size, stats.size, "Wrong cache size");
+
+  block= attachsql_buffer_create();
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_EQ_(before.hits + 1, stats.hits, "Cached buffer not reused");
+  ASSERT_EQ_(0, stats.blocks, "Reused buffer still cached");
+  ASSERT_EQ_(0, stats.size, "Wrong cache size");
+  attachsql_buffer_free(block);
+}
+
+/* A grown buffer goes back to the cache in the class of its new size and is
+ * only handed out for that size */
+static void test_size_classes(void)
+{
+  attachsql_buffer_cache_stats_st before;
+  attachsql_buffer_cache_stats_st stats;
+  size_t size= ATTACHSQL_DEFAULT_BUFFER_SIZE;
+  buffer_st *block;
+  bool ring;
+
+  attachsql_library_set_buffer_cache(0, false);
+  attachsql_library_set_buffer_cache(32*1024*1024, false);
+  block= attachsql_buffer_create();
+  ring= block->ring;
+  ASSERT_EQ_(ATTACHSQL_RET_OK, attachsql_buffer_increase(block), "Could not grow the buffer");
+  ASSERT_EQ_(size * 2, block->buffer_size, "Buffer didn't double");
+  attachsql_buffer_free(block);
+  attachsql_library_get_buffer_cache_stats(&stats);
+  /* A heap buffer grows with realloc() so only a ring gives its old block
+   * back */
+  ASSERT_EQ_(ring ? 2 : 1, stats.blocks, "Wrong number of cached blocks");
+  ASSERT_EQ_(ring ? size * 3 : size * 2, stats.size, "Wrong cache size");
+
+  /* A new buffer doesn't take the larger block */
+  attachsql_library_get_buffer_cache_stats(&before);
+  block= attachsql_buffer_create();
+  ASSERT_EQ_(size, block->buffer_size, "New buffer has the wrong size");
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_EQ_(ring ? before.hits + 1 : before.hits, stats.hits, "Wrong cache hits for a new buffer");
+  ASSERT_EQ_(size * 2, stats.size, "Larger block taken for a new buffer");
+
+  /* Growing it takes the larger block */
+  attachsql_library_get_buffer_cache_stats(&before);
+  ASSERT_EQ_(ATTACHSQL_RET_OK, attachsql_buffer_increase(block), "Could not grow the buffer");
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_EQ_(before.hits + 1, stats.hits, "Cached larger block not used to grow");
+
+  /* A cache too small for a block releases it */
+  attachsql_library_set_buffer_cache(size, false);
+  attachsql_library_get_buffer_cache_stats(&before);
+  ASSERT_TRUE_(before.size <= size, "Cache not trimmed to its new size");
+  attachsql_buffer_free(block);
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_EQ_(before.released + 1, stats.released, "Block over the cache size not released");
+  ASSERT_EQ_(before.blocks, stats.blocks, "Block over the cache size cached");
+
+  attachsql_library_set_buffer_cache(0, false);
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_EQ_(0, stats.blocks, "Buffer cache not emptied");
+  ASSERT_EQ_(0, stats.size, "Buffer cache not emptied");
+}
+
+/* Whether the mapping holding address has been advised to use huge pages,
+ * false with no way to tell */
+static bool huge_pages_advised(const char *address, bool *known)
+{
+  char line[512];
+  bool in_mapping= false;
+  bool advised= false;
+  FILE *smaps= fopen("/proc/self/smaps", "r");
+
+  *known= false;
+  if (smaps == NULL)
+  {
+    return false;
+  }
+  while (fgets(line, sizeof(line), smaps) != NULL)
+  {
+    uintptr_t start;
+    uintptr_t end;
+    if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) == 2)
+    {
+      in_mapping= ((uintptr_t)address >= start) and ((uintptr_t)address < end);
+    }
+    else if (in_mapping and (strncmp(line, "VmFlags:", 8) == 0))
+    {
+      *known= true;
+      advised= (strstr(line, " hg") != NULL);
+      break;
+    }
+  }
+  fclose(smaps);
+  return advised;
+}
+
+/* Grows a new buffer to a huge page with data in it */
+static buffer_st *huge_buffer(void)
+{
+  buffer_st *block= attachsql_buffer_create();
+  size_t filled;
+
+  while (block->buffer_size < HUGE_PAGE_SIZE)
+  {
+    filled= attachsql_buffer_get_available(block);
+    memset(block->buffer_write_ptr, 'h', filled);
+    attachsql_buffer_move_write_ptr(block, filled);
+    ASSERT_EQ_(ATTACHSQL_RET_OK, attachsql_buffer_increase(block), "Could not grow the buffer");
+  }
+  filled= attachsql_buffer_unread_data(block);
+  ASSERT_EQ_(ATTACHSQL_DEFAULT_BUFFER_SIZE, filled, "Unread data lost growing");
+  for (size_t byte= 0; byte < filled; byte++)
+  {
+    ASSERT_EQ_('h', block->buffer_read_ptr[byte], "Data corrupted growing");
+  }
+  return block;
+}
+
+/* Rings of a huge page or more are mapped on a huge page boundary and
+ * advised to use huge pages only while the setting is on */
+static void test_huge_pages(void)
+{
+  buffer_st *block;
+  bool known;
+  bool advised;
+
+  attachsql_library_set_buffer_cache(0, false);
+  attachsql_library_set_buffer_cache(32*1024*1024, true);
+  block= huge_buffer();
+  if (block->ring)
+  {
+    ASSERT_EQ_(0, (uintptr_t)block->buffer % HUGE_PAGE_SIZE, "Ring not aligned to a huge page");
+    advised= huge_pages_advised(block->buffer, &known);
+#if defined(HAVE_MADVISE) and defined(MADV_HUGEPAGE)
+    ASSERT_TRUE_(advised or not known, "Ring not advised to use huge pages");
+#endif
+  }
+  attachsql_buffer_free(block);
+
+  /* With the setting off new rings aren't advised */
+  attachsql_library_set_buffer_cache(0, false);
+  attachsql_library_set_buffer_cache(32*1024*1024, false);
+  block= huge_buffer();
+  if (block->ring)
+  {
+    advised= huge_pages_advised(block->buffer, &known);
+    ASSERT_FALSE_(advised, "Ring advised to use huge pages with the setting off");
+  }
+  attachsql_buffer_free(block);
+  attachsql_library_set_buffer_cache(0, false);
+}
+
+static void query_wait(attachsql_connect_t *con)
+{
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  const char *data= "SELECT 1";
+
+  attachsql_query(con, strlen(data), data, 0, NULL, &error);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+    if (aret == ATTACHSQL_RETURN_ROW_READY)
+    {
+      attachsql_query_row_next(con);
+    }
+  }
+  ASSERT_FALSE_(error, "Query error");
+  attachsql_query_close(con);
+}
+
+/* A connection's buffers are cached when it is destroyed and reused by the
+ * next one */
+static void test_connections(void)
+{
+  attachsql_connect_t *con;
+  attachsql_buffer_cache_stats_st stats;
+  uint64_t hits;
+
+  mock_server_st *server= mock_server_start(0);
+  ASSERT_TRUE_(server, "Could not start the mock server");
+  attachsql_library_set_buffer_cache(0, false);
+  attachsql_library_set_buffer_cache(32*1024*1024, false);
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  query_wait(con);
+  attachsql_connect_destroy(con);
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_TRUE_(stats.blocks > 0, "Destroyed connection's buffers not cached");
+  hits= stats.hits;
+
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  query_wait(con);
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_TRUE_(stats.hits > hits, "Buffer cache not used");
+  attachsql_connect_destroy(con);
+  mock_server_stop(server);
+
+  attachsql_library_set_buffer_cache(0, false);
+  attachsql_library_get_buffer_cache_stats(&stats);
+  ASSERT_EQ_(0, stats.blocks, "Buffer cache not emptied");
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+
+  test_get_put();
+  test_size_classes();
+  test_huge_pages();
+  test_connections();
+}
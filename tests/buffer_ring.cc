@@ -0,0 +1,230 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+/* Exercises the ring buffer directly so it is built from the library
+ * sources like the benchmarks */
+
+#include "config.h"
+#include <yatl/lite.h>
+#include "src/buffer.h"
+#include <new>
+#include <inttypes.h>
+#include <string.h>
+
+#define PACKET_PAYLOAD 1001
+#define PACKET_SIZE (PACKET_PAYLOAD + 4)
+#define READ_SIZE 4096
+
+/* The byte at an offset of a stream of packets, each one has a header with
+ * its length and sequence number and a payload depending on both */
+static char stream_byte(uint64_t offset)
+{
+  uint64_t packet= offset / PACKET_SIZE;
+  uint64_t position= offset % PACKET_SIZE;
+
+  if (position < 3)
+  {
+    return (char)((PACKET_PAYLOAD >> (position * 8)) & 0xff);
+  }
+  if (position == 3)
+  {
+    return (char)(packet & 0xff);
+  }
+  return (char)((packet * 7) + position);
+}
+
+/* Simulates a socket read of length bytes of the stream */
+static void stream_write(buffer_st *ring, uint64_t *offset, size_t length)
+{
+  attachsql_buffer_rewind(ring);
+  ASSERT_TRUE_(attachsql_buffer_get_available(ring) >= length, "No room for the read");
+  for (size_t byte= 0; byte < length; byte++)
+  {
+    ring->buffer_write_ptr[byte]= stream_byte(*offset + byte);
+  }
+  attachsql_buffer_move_write_ptr(ring, length);
+  *offset+= length;
+}
+
+static bool stream_check(const char *data, uint64_t offset, size_t length)
+{
+  for (size_t byte= 0; byte < length; byte++)
+  {
+    if (data[byte] != stream_byte(offset + byte))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void buffer_consume(buffer_st *ring, size_t length)
+{
+  ring->packet_end_ptr= ring->buffer_read_ptr + length;
+  attachsql_buffer_packet_read_end(ring);
+}
+
+/* Reads and parses packets for three times the size of the ring, packets
+ * straddle the end of the first mapping as the reads only end on a packet
+ * boundary, emptying the buffer, every 4MB */
+static void test_packets(void)
+{
+  buffer_st *ring= attachsql_buffer_create();
+  uint64_t written= 0;
+  uint64_t parsed= 0;
+  uint32_t straddled= 0;
+  size_t size= ring->buffer_size;
+
+  while (written < (uint64_t)size * 3)
+  {
+    stream_write(ring, &written, READ_SIZE);
+    while (attachsql_buffer_unread_data(ring) >= PACKET_SIZE)
+    {
+      const char *packet= ring->buffer_read_ptr;
+      size_t length= (uint8_t)packet[0] | ((size_t)(uint8_t)packet[1] << 8) | ((size_t)(uint8_t)packet[2] << 16);
+      ASSERT_EQ_(PACKET_PAYLOAD, length, "Wrong packet length at offset %" PRIu64, parsed);
+      ASSERT_TRUE_(stream_check(packet, parsed, PACKET_SIZE), "Packet corrupted at offset %" PRIu64, parsed);
+      if ((size_t)(packet - ring->buffer) + PACKET_SIZE > size)
+      {
+        straddled++;
+      }
+      buffer_consume(ring, PACKET_SIZE);
+      parsed+= PACKET_SIZE;
+      ASSERT_TRUE_(ring->buffer_read_ptr < ring->buffer + size, "Read pointer not wrapped");
+      ASSERT_TRUE_(ring->buffer_write_ptr >= ring->buffer_read_ptr, "Write pointer behind the read pointer");
+    }
+  }
+  ASSERT_TRUE_(straddled >= 2, "Only %u packets straddled the end of the ring", straddled);
+  ASSERT_EQ_(size, ring->buffer_size, "Buffer grew although it was read");
+  attachsql_buffer_free(ring);
+}
+
+/* The read pointer crossing the end of the first mapping moves both
+ * pointers and a packet end ahead of them back by the size of the ring */
+static void test_packet_end(void)
+{
+  buffer_st *ring= attachsql_buffer_create();
+  uint64_t written= 0;
+  size_t size= ring->buffer_size;
+
+  stream_write(ring, &written, size - 10);
+  buffer_consume(ring, size - 20);
+  stream_write(ring, &written, 30);
+  ASSERT_TRUE_(ring->buffer_write_ptr > ring->buffer + size, "Write pointer not in the second mapping");
+
+  /* A packet ending past the end of the first mapping */
+  buffer_consume(ring, 30);
+  ASSERT_TRUE_(ring->buffer_read_ptr == ring->buffer + 10, "Read pointer not wrapped");
+  ASSERT_TRUE_(ring->buffer_write_ptr == ring->buffer + 20, "Write pointer not wrapped");
+  ASSERT_TRUE_(ring->packet_end_ptr == ring->buffer_read_ptr, "Packet end not wrapped");
+  ASSERT_TRUE_(stream_check(ring->buffer_read_ptr, size + 10, 10), "Unread data corrupted");
+
+  /* A header straddling the end is skipped over by the parser with more of
+   * the packet still to come */
+  buffer_consume(ring, 10);
+  ASSERT_TRUE_(ring->buffer_read_ptr == ring->buffer, "Empty buffer not rewound");
+  stream_write(ring, &written, size - 1);
+  buffer_consume(ring, size - 2);
+  stream_write(ring, &written, 7);
+  ring->buffer_read_ptr+= 4;
+  ring->packet_end_ptr= ring->buffer_read_ptr + 100;
+  ASSERT_EQ_(size - 4, attachsql_buffer_get_available(ring), "Wrong available space");
+  ASSERT_TRUE_(ring->buffer_read_ptr == ring->buffer + size + 2, "Getting the available space moved the read pointer");
+  attachsql_buffer_rewind(ring);
+  ASSERT_EQ_(size - 4, attachsql_buffer_get_available(ring), "Wrong available space after rewinding");
+  ASSERT_TRUE_(ring->buffer_read_ptr == ring->buffer + 2, "Read pointer not wrapped");
+  ASSERT_TRUE_(ring->buffer_write_ptr == ring->buffer + 6, "Write pointer not wrapped");
+  ASSERT_TRUE_(ring->packet_end_ptr == ring->buffer + 102, "Packet end not moved with the read pointer");
+  ASSERT_TRUE_(stream_check(ring->buffer_read_ptr, written - 4, 4), "Unread data corrupted");
+  attachsql_buffer_free(ring);
+}
+
+/* A buffer read to the end without a packet end, as the compressed buffer
+ * is, only starts from the beginning again when rewound */
+static void test_rewind(void)
+{
+  buffer_st *ring= attachsql_buffer_create();
+  uint64_t written= 0;
+  size_t size= ring->buffer_size;
+
+  stream_write(ring, &written, 100);
+  ring->buffer_read_ptr= ring->buffer_write_ptr;
+  ASSERT_EQ_(size, attachsql_buffer_get_available(ring), "Wrong available space");
+  ASSERT_EQ_(size, attachsql_buffer_get_available(ring), "Wrong available space on a second call");
+  ASSERT_TRUE_(ring->buffer_read_ptr == ring->buffer + 100, "Getting the available space rewound the buffer");
+  ASSERT_TRUE_(ring->buffer_write_ptr == ring->buffer + 100, "Getting the available space rewound the buffer");
+
+  attachsql_buffer_rewind(ring);
+  ASSERT_TRUE_(ring->buffer_read_ptr == ring->buffer, "Read pointer not rewound");
+  ASSERT_TRUE_(ring->buffer_write_ptr == ring->buffer, "Write pointer not rewound");
+  ASSERT_TRUE_(ring->packet_end_ptr == ring->buffer, "Packet end not rewound");
+  ASSERT_EQ_(size, attachsql_buffer_get_available(ring), "Wrong available space after rewinding");
+  stream_write(ring, &written, 10);
+  ASSERT_TRUE_(stream_check(ring->buffer_read_ptr, 100, 10), "Data corrupted after rewinding");
+  attachsql_buffer_free(ring);
+}
+
+/* A full ring whose data wraps around is copied in order into one twice the
+ * size */
+static void test_grow_full(void)
+{
+  buffer_st *ring= attachsql_buffer_create();
+  uint64_t written= 0;
+  uint64_t unread_offset;
+  size_t size= ring->buffer_size;
+  size_t available;
+
+  stream_write(ring, &written, size - 100);
+  buffer_consume(ring, size - 200);
+  unread_offset= size - 200;
+  available= attachsql_buffer_get_available(ring);
+  ASSERT_EQ_(size - 100, available, "Wrong available space");
+  stream_write(ring, &written, available);
+  ASSERT_EQ_(0, attachsql_buffer_get_available(ring), "Ring not full");
+  ring->packet_end_ptr= ring->buffer_read_ptr + 50;
+
+  ASSERT_EQ_(ATTACHSQL_RET_OK, attachsql_buffer_increase(ring), "Could not grow the ring");
+  ASSERT_TRUE_(ring->ring, "Grown buffer isn't a ring");
+  ASSERT_EQ_(size * 2, ring->buffer_size, "Ring didn't double");
+  ASSERT_TRUE_(ring->buffer_read_ptr == ring->buffer, "Unread data not at the start");
+  ASSERT_EQ_(size, attachsql_buffer_unread_data(ring), "Unread data lost");
+  ASSERT_TRUE_(stream_check(ring->buffer_read_ptr, unread_offset, size), "Unread data corrupted");
+  ASSERT_TRUE_(ring->packet_end_ptr == ring->buffer_read_ptr + 50, "Packet end not moved");
+  ASSERT_EQ_(size, attachsql_buffer_get_available(ring), "Wrong available space after growing");
+
+  /* Carries on as a ring */
+  stream_write(ring, &written, size);
+  buffer_consume(ring, size + 10);
+  ASSERT_TRUE_(stream_check(ring->buffer_read_ptr, unread_offset + size + 10, size - 10), "Data corrupted after growing");
+  attachsql_buffer_free(ring);
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  buffer_st *ring= attachsql_buffer_create();
+
+  ASSERT_TRUE_(ring, "Could not create a buffer");
+  bool supported= ring->ring;
+  attachsql_buffer_free(ring);
+  SKIP_IF_(not supported, "Ring buffers not supported on this platform");
+
+  test_packets();
+  test_packet_end();
+  test_rewind();
+  test_grow_full();
+}
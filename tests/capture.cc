@@ -0,0 +1,102 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain 
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Runs the queries and returns a sum of the row data so a replay can be
+ * compared with the original run */
+static uint64_t run_queries(attachsql_connect_t *con, attachsql_error_t **error)
+{
+  const char *queries[]= { "SELECT 1", "SHOW DATABASES" };
+  attachsql_return_t aret;
+  attachsql_query_row_st *row;
+  uint64_t sum= 0;
+  size_t query;
+  size_t pos;
+
+  for (query= 0; query < 2; query++)
+  {
+    aret= ATTACHSQL_RETURN_NONE;
+    attachsql_query(con, strlen(queries[query]), queries[query], 0, NULL, error);
+    while ((aret != ATTACHSQL_RETURN_EOF) and (*error == NULL))
+    {
+      aret= attachsql_connect_poll(con, error);
+      if (aret == ATTACHSQL_RETURN_ROW_READY)
+      {
+        row= attachsql_query_row_get(con, error);
+        for (pos= 0; pos < row[0].length; pos++)
+        {
+          sum= (sum * 31) + (unsigned char)row[0].data[pos];
+        }
+        attachsql_query_row_next(con);
+      }
+    }
+    if (*error != NULL)
+    {
+      return 0;
+    }
+    attachsql_query_close(con);
+  }
+  return sum;
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_connect_t *con;
+  attachsql_error_t *error= NULL;
+  char filename[]= "/tmp/attachsql_capture_XXXXXX";
+  uint64_t captured;
+  uint64_t replayed;
+  int fd;
+
+  fd= mkstemp(filename);
+  ASSERT_TRUE_(fd >= 0, "Could not create a capture file");
+  close(fd);
+
+  con= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
+  ASSERT_FALSE_(attachsql_connect_set_replay(con, "/nonexistent/capture", &error), "Replay of a missing file allowed");
+  attachsql_error_free(error);
+  error= NULL;
+  ASSERT_TRUE_(attachsql_connect_set_capture(con, filename, &error), "Capture not set");
+  captured= run_queries(con, &error);
+  attachsql_connect_destroy(con);
+  if (error && (attachsql_error_code(error) == 2002))
+  {
+    unlink(filename);
+    SKIP_IF_(true, "No MYSQL server");
+  }
+  else if (error)
+  {
+    unlink(filename);
+    ASSERT_FALSE_(true, "Error exists: %d", attachsql_error_code(error));
+  }
+
+  /* No server is involved in the replay */
+  con= attachsql_connect_create("localhost", 1, "test", "test", "", NULL);
+  ASSERT_TRUE_(attachsql_connect_set_replay(con, filename, &error), "Replay not set");
+  replayed= run_queries(con, &error);
+  ASSERT_NULL_(error, "Replay error: %s", error ? attachsql_error_message(error) : "");
+  ASSERT_EQ_(captured, replayed, "Replayed rows differ");
+  attachsql_connect_destroy(con);
+  unlink(filename);
+}
@@ -0,0 +1,89 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain 
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+
+static bool connect_wait(attachsql_connect_t *con)
+{
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+
+  attachsql_connect(con, &error);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+  }
+  if (error != NULL)
+  {
+    ASSERT_EQ_(2002, attachsql_error_code(error), "Error exists: %s", attachsql_error_message(error));
+    attachsql_error_free(error);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_connect_t *con;
+  attachsql_error_t *error= NULL;
+  attachsql_dns_cache_stats_st stats;
+  struct sockaddr_in address;
+
+  attachsql_library_flush_dns_cache();
+  attachsql_library_get_dns_cache_stats(&stats);
+  ASSERT_EQ_(0, stats.entries, "DNS cache not empty");
+
+  con= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
+  if (not connect_wait(con))
+  {
+    /* A failed connect must drop the cached address */
+    attachsql_library_get_dns_cache_stats(&stats);
+    ASSERT_EQ_(1, stats.misses, "Unexpected DNS cache misses");
+    ASSERT_EQ_(1, stats.invalidated, "Failed connect did not invalidate DNS cache");
+    ASSERT_EQ_(0, stats.entries, "DNS cache not empty");
+    attachsql_connect_destroy(con);
+    SKIP_IF_(true, "No MYSQL server");
+  }
+  attachsql_connect_destroy(con);
+  attachsql_library_get_dns_cache_stats(&stats);
+  ASSERT_EQ_(1, stats.misses, "Unexpected DNS cache misses");
+  ASSERT_EQ_(1, stats.entries, "Unexpected DNS cache entries");
+
+  /* Second connection should come from the cache */
+  con= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
+  ASSERT_TRUE_(connect_wait(con), "Second connection failed");
+  attachsql_connect_destroy(con);
+  attachsql_library_get_dns_cache_stats(&stats);
+  ASSERT_EQ_(1, stats.hits, "DNS cache not used");
+
+  /* Pre-resolved address skips the cache entirely */
+  memset(&address, 0, sizeof(address));
+  address.sin_family= AF_INET;
+  address.sin_port= htons(3306);
+  address.sin_addr.s_addr= htonl(INADDR_LOOPBACK);
+  con= attachsql_connect_create("unused.invalid", 3306, "test", "test", "", NULL);
+  attachsql_connect_set_address(con, (struct sockaddr*)&address, &error);
+  ASSERT_NULL_(error, "Error not NULL");
+  ASSERT_TRUE_(connect_wait(con), "Connection to supplied address failed");
+  attachsql_connect_destroy(con);
+  attachsql_library_get_dns_cache_stats(&stats);
+  ASSERT_EQ_(1, stats.hits, "Unexpected DNS cache hits");
+  ASSERT_EQ_(1, stats.misses, "Unexpected DNS cache misses");
+}
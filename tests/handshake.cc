@@ -0,0 +1,114 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+#include "tests/mock_server.h"
+#include <string.h>
+
+#define CAP_CONNECT_WITH_DB (1 << 3)
+#define CAP_PLUGIN_AUTH (1 << 19)
+#define CAP_ZSTD (1 << 26)
+
+static uint32_t unpack4(const char *data)
+{
+  const unsigned char *bytes= (const unsigned char*)data;
+  return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/* Connects, runs a query and returns the handshake response the server saw */
+static size_t connect_and_capture(mock_server_st *server, attachsql_connect_t *con, char *response, size_t length)
+{
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  const char *query= "SELECT 1";
+
+  attachsql_query(con, strlen(query), query, 0, NULL, &error);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+    if (aret == ATTACHSQL_RETURN_ROW_READY)
+    {
+      attachsql_query_row_next(con);
+    }
+  }
+  ASSERT_FALSE_(error, "Query error");
+  attachsql_query_close(con);
+  return mock_server_handshake_response(server, response, length);
+}
+
+/* Checks everything after the 32 byte fixed part: user, auth data, schema
+ * and plugin name, returning the position after the plugin name */
+static size_t check_layout(const char *response, size_t length)
+{
+  const char *plugin= "mysql_native_password";
+  uint32_t capabilities= unpack4(response);
+  size_t position= 32;
+
+  ASSERT_TRUE_(capabilities & CAP_CONNECT_WITH_DB, "Schema capability not sent");
+  ASSERT_TRUE_(capabilities & CAP_PLUGIN_AUTH, "Plugin auth capability not sent");
+  ASSERT_TRUE_(length > position + 5, "Handshake response too short");
+  ASSERT_EQ_(0, memcmp(response + position, "user", 5), "Wrong user");
+  position+= 5;
+  ASSERT_EQ_(20, (uint8_t)response[position], "Wrong auth data length");
+  position+= 21;
+  ASSERT_TRUE_(length >= position + 3, "Handshake response too short");
+  ASSERT_EQ_(0, memcmp(response + position, "db", 3), "Wrong schema");
+  position+= 3;
+  ASSERT_TRUE_(length >= position + strlen(plugin) + 1, "Plugin name missing");
+  ASSERT_EQ_(0, memcmp(response + position, plugin, strlen(plugin) + 1), "Wrong plugin name");
+  return position + strlen(plugin) + 1;
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_connect_t *con;
+  char response[1024];
+  size_t length;
+
+  mock_server_st *server= mock_server_start(0);
+  ASSERT_TRUE_(server, "Could not start the mock server");
+
+  /* Nothing may follow the plugin name without compression */
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "user", "pass", "db", NULL);
+  length= connect_and_capture(server, con, response, sizeof(response));
+  ASSERT_EQ_(length, check_layout(response, length), "Trailing bytes after the plugin name");
+  ASSERT_FALSE_(unpack4(response) & CAP_ZSTD, "zstd capability sent");
+  attachsql_connect_destroy(con);
+
+  /* The zstd level comes straight after the plugin name */
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "user", "pass", "db", NULL);
+  attachsql_compression_algorithm_t algorithm= ATTACHSQL_COMPRESSION_ALGORITHM_ZSTD;
+  int level= 7;
+  if (attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_ALGORITHM, &algorithm))
+  {
+    ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESS, NULL), "Compression not set");
+    ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_LEVEL, &level), "Level not set");
+    length= connect_and_capture(server, con, response, sizeof(response));
+    ASSERT_TRUE_(unpack4(response) & CAP_ZSTD, "zstd capability not sent");
+    size_t position= check_layout(response, length);
+    ASSERT_EQ_(position + 1, length, "Wrong zstd level position");
+    ASSERT_EQ_(level, (uint8_t)response[position], "Wrong zstd level");
+  }
+  attachsql_connect_destroy(con);
+
+  mock_server_stop(server);
+  return 0;
+}
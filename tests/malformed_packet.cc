@@ -0,0 +1,135 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain 
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static const char greeting[]=
+  "\x4e\x00\x00\x00"
+  "\x0a" "5.5.0-test\0"
+  "\x01\x00\x00\x00" "abcdefgh\0"
+  "\x0f\xa2" "\x21" "\x02\x00" "\x0b\x00"
+  "\x15" "\0\0\0\0\0\0\0\0\0\0"
+  "ijklmnopqrst\0"
+  "mysql_native_password";
+
+static const char login_ok[]= "\x07\x00\x00\x02\x00\x00\x00\x02\x00\x00\x00";
+
+static const char column_count[]= "\x01\x00\x00\x01\x01";
+
+static const char column[]=
+  "\x1e\x00\x00\x02"
+  "\x03" "def" "\x04" "mock" "\x00" "\x00" "\x02" "c0" "\x02" "c0"
+  "\x0c" "\x21\x00" "\xff\x00\x00\x00" "\xfd" "\x00\x00" "\x00" "\x00\x00";
+
+/* The schema length needs 3 bytes but the packet ends */
+static const char column_truncated[]= "\x06\x00\x00\x02\x03" "def" "\xfc\xff";
+
+static const char eof_columns[]= "\x05\x00\x00\x03\xfe\x00\x00\x02\x00";
+
+/* The column claims 5 bytes but the row has 2 */
+static const char row_overrun[]= "\x03\x00\x00\x04\x05" "ab";
+
+static const char eof_rows[]= "\x05\x00\x00\x05\xfe\x00\x00\x02\x00";
+
+static void write_record(FILE *file, uint8_t type, const char *data, size_t length)
+{
+  fputc(type, file);
+  /* No time delta */
+  fputc(0, file);
+  /* Every record here is under 128 bytes so the length is one byte */
+  fputc((int)length, file);
+  fwrite(data, 1, length, file);
+}
+
+/* Writes a capture of the login and then a query with the response being
+ * the given packets */
+static void write_capture(const char *filename, const char * const *packets, const size_t *lengths, size_t count)
+{
+  FILE *file= fopen(filename, "wb");
+  ASSERT_TRUE_(file, "Could not create capture");
+  fwrite("ASQLCAP1", 1, 8, file);
+  write_record(file, 1, greeting, sizeof(greeting));
+  write_record(file, 2, NULL, 0);
+  write_record(file, 1, login_ok, sizeof(login_ok) - 1);
+  write_record(file, 2, NULL, 0);
+  for (size_t packet= 0; packet < count; packet++)
+  {
+    write_record(file, 1, packets[packet], lengths[packet]);
+  }
+  fclose(file);
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_connect_t *con;
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  attachsql_query_row_st *row= NULL;
+  char filename[]= "/tmp/attachsql_malformed_XXXXXX";
+  int fd= mkstemp(filename);
+  ASSERT_TRUE_(fd >= 0, "Could not create capture file");
+  close(fd);
+
+  /* A column definition shorter than its lengths drops the connection */
+  const char *truncated[]= { column_count, column_truncated };
+  size_t truncated_lengths[]= { sizeof(column_count) - 1, sizeof(column_truncated) - 1 };
+  write_capture(filename, truncated, truncated_lengths, 2);
+  con= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
+  ASSERT_TRUE_(attachsql_connect_set_replay(con, filename, &error), "Could not set replay");
+  attachsql_query(con, 8, "SELECT 1", 0, NULL, &error);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+  }
+  ASSERT_TRUE_(error, "Malformed column not detected");
+  ASSERT_EQ_(ATTACHSQL_ERROR_CODE_MALFORMED_PACKET, attachsql_error_code(error), "Wrong error code: %s", attachsql_error_message(error));
+  attachsql_error_free(error);
+  error= NULL;
+  attachsql_connect_destroy(con);
+
+  /* A column running past the end of its row is an error for the row */
+  const char *overrun[]= { column_count, column, eof_columns, row_overrun, eof_rows };
+  size_t overrun_lengths[]= { sizeof(column_count) - 1, sizeof(column) - 1, sizeof(eof_columns) - 1, sizeof(row_overrun) - 1, sizeof(eof_rows) - 1 };
+  write_capture(filename, overrun, overrun_lengths, 5);
+  con= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
+  ASSERT_TRUE_(attachsql_connect_set_replay(con, filename, &error), "Could not set replay");
+  attachsql_query(con, 8, "SELECT 1", 0, NULL, &error);
+  aret= ATTACHSQL_RETURN_NONE;
+  while ((aret != ATTACHSQL_RETURN_ROW_READY) and (aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+  }
+  ASSERT_FALSE_(error, "Query error: %s", attachsql_error_message(error));
+  ASSERT_EQ_(ATTACHSQL_RETURN_ROW_READY, aret, "No row returned");
+  ASSERT_STREQ_("c0", attachsql_query_column_get(con, 1)->column, "Wrong column name");
+  row= attachsql_query_row_get(con, &error);
+  ASSERT_FALSE_(row, "Malformed row returned");
+  ASSERT_TRUE_(error, "Malformed row not detected");
+  ASSERT_EQ_(ATTACHSQL_ERROR_CODE_MALFORMED_PACKET, attachsql_error_code(error), "Wrong error code: %s", attachsql_error_message(error));
+  attachsql_error_free(error);
+  error= NULL;
+  attachsql_query_close(con);
+  attachsql_connect_destroy(con);
+
+  unlink(filename);
+}
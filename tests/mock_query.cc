@@ -0,0 +1,240 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+#include "tests/mock_server.h"
+#include <sys/time.h>
+
+/* Runs a query to completion returning the number of rows, the row with
+ * index check_row is copied into check_value */
+static uint64_t run_query(attachsql_connect_t *con, const char *query, uint64_t check_row, char *check_value, attachsql_error_t **error)
+{
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  attachsql_query_row_st *row;
+  uint64_t rows= 0;
+
+  attachsql_query(con, strlen(query), query, 0, NULL, error);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (*error == NULL))
+  {
+    aret= attachsql_connect_poll(con, error);
+    if (aret == ATTACHSQL_RETURN_ROW_READY)
+    {
+      row= attachsql_query_row_get(con, error);
+      if ((rows == check_row) and (check_value != NULL))
+      {
+        memcpy(check_value, row[0].data, row[0].length);
+        check_value[row[0].length]= '\0';
+      }
+      rows++;
+      attachsql_query_row_next(con);
+    }
+  }
+  attachsql_query_close(con);
+  return rows;
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_connect_t *con;
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  char value[64];
+  const char *columns[]= {"name", "value"};
+  const char *values[]= {"a", "1", "b", NULL};
+  struct timeval start, end;
+  uint32_t connections= 5;
+
+  mock_server_st *server= mock_server_start(0);
+  ASSERT_TRUE_(server, "Could not start the mock server");
+  mock_server_add_result(server, "SHOW STATUS", 2, columns, 2, values);
+
+  /* Generated and scripted text results */
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  ASSERT_EQ_(1000, run_query(con, "MOCK ROWS 1000 3 10", 42, value, &error), "Wrong generated row count");
+  ASSERT_FALSE_(error, "Query error");
+  ASSERT_STREQ_("0000000042", value, "Wrong generated row value");
+  ASSERT_EQ_(2, run_query(con, "SHOW STATUS", 1, value, &error), "Wrong scripted row count");
+  ASSERT_STREQ_("b", value, "Wrong scripted row value");
+  ASSERT_EQ_(1, run_query(con, "SELECT 1", 0, value, &error), "Wrong echo row count");
+  ASSERT_STREQ_("1", value, "Wrong echo row value");
+  run_query(con, "MOCK OK 5 7", 0, NULL, &error);
+  ASSERT_FALSE_(error, "Query error");
+  ASSERT_EQ_(5, attachsql_query_affected_rows(con), "Wrong affected rows");
+  ASSERT_EQ_(7, attachsql_connection_last_insert_id(con), "Wrong insert ID");
+  run_query(con, "MOCK ERROR 1146", 0, NULL, &error);
+  ASSERT_TRUE_(error, "No error returned");
+  ASSERT_EQ_(1146, attachsql_error_code(error), "Wrong error code");
+  attachsql_error_free(error);
+  error= NULL;
+
+  /* Latency */
+  mock_server_set_latency(server, 50);
+  gettimeofday(&start, NULL);
+  run_query(con, "SELECT 1", 0, NULL, &error);
+  gettimeofday(&end, NULL);
+  mock_server_set_latency(server, 0);
+  ASSERT_FALSE_(error, "Query error");
+  ASSERT_TRUE_(((end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec)) >= 50000, "Latency not applied");
+  attachsql_connect_destroy(con);
+
+  /* Multiple results */
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  attachsql_connect_set_option(con, ATTACHSQL_OPTION_MULTI_STATEMENTS, NULL);
+  ASSERT_EQ_(1, run_query(con, "SELECT 1; MOCK ROWS 5", 0, NULL, &error), "Wrong first result row count");
+  ASSERT_FALSE_(error, "Query error");
+  aret= attachsql_query_next_result(con);
+  ASSERT_EQ_(ATTACHSQL_RETURN_PROCESSING, aret, "No second result");
+  uint64_t rows= 0;
+  while (aret != ATTACHSQL_RETURN_EOF)
+  {
+    aret= attachsql_connect_poll(con, &error);
+    ASSERT_FALSE_(error, "Query error");
+    if (aret == ATTACHSQL_RETURN_ROW_READY)
+    {
+      attachsql_query_row_get(con, &error);
+      rows++;
+      attachsql_query_row_next(con);
+    }
+  }
+  attachsql_query_close(con);
+  ASSERT_EQ_(5, rows, "Wrong second result row count");
+  ASSERT_EQ_(ATTACHSQL_RETURN_EOF, attachsql_query_next_result(con), "Unexpected third result");
+  attachsql_connect_destroy(con);
+
+  /* Compression */
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESS, NULL), "Compression not supported");
+  ASSERT_EQ_(2000, run_query(con, "MOCK ROWS 2000 2 50", 1999, value, &error), "Wrong compressed row count");
+  ASSERT_FALSE_(error, "Query error");
+  ASSERT_EQ_(50, strlen(value), "Wrong compressed row value");
+  attachsql_connect_destroy(con);
+
+  /* Any measured compression time is over 1ns per KB, so after the first
+   * statement the rest are sent uncompressed */
+  char compressible[320]= "SELECT ";
+  memset(compressible + 7, 'a', 300);
+  compressible[307]= '\0';
+  uint32_t max_time= 1;
+  attachsql_connect_stats_st stats;
+  uint64_t compressed_out;
+  uint64_t uncompressed_out;
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESS, NULL);
+  ASSERT_FALSE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_MAX_TIME, NULL), "Missing compression time accepted");
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_MAX_TIME, &max_time), "Could not set compression time");
+  ASSERT_EQ_(1, run_query(con, compressible, 0, NULL, &error), "Wrong row count");
+  ASSERT_FALSE_(error, "Query error");
+  attachsql_connect_get_stats(con, &stats);
+  ASSERT_TRUE_(stats.compressed_bytes_out < stats.uncompressed_bytes_out, "First statement not compressed");
+  compressed_out= stats.compressed_bytes_out;
+  uncompressed_out= stats.uncompressed_bytes_out;
+  for (int query= 0; query < 4; query++)
+  {
+    ASSERT_EQ_(1, run_query(con, compressible, 0, NULL, &error), "Wrong row count");
+    ASSERT_FALSE_(error, "Query error");
+  }
+  attachsql_connect_get_stats(con, &stats);
+  ASSERT_EQ_(stats.uncompressed_bytes_out - uncompressed_out, stats.compressed_bytes_out - compressed_out, "Slow compression not skipped");
+  attachsql_connect_destroy(con);
+
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  attachsql_compression_algorithm_t algorithm= ATTACHSQL_COMPRESSION_ALGORITHM_ZSTD;
+  if (attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_ALGORITHM, &algorithm))
+  {
+    attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESS, NULL);
+    connections++;
+    ASSERT_EQ_(2000, run_query(con, "MOCK ROWS 2000 2 50", 1999, value, &error), "Wrong zstd row count");
+    ASSERT_FALSE_(error, "Query error");
+  }
+  attachsql_connect_destroy(con);
+
+  /* A large parameter doesn't pin its query buffer after the query */
+  size_t shrink_size= 64 * 1024;
+  size_t large_length= 1024 * 1024;
+  char *large= new char[large_length];
+  memset(large, 'a', large_length);
+  attachsql_query_parameter_st param;
+  param.type= ATTACHSQL_ESCAPE_TYPE_CHAR;
+  param.data= large;
+  param.length= large_length;
+  param.is_unsigned= false;
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  connections++;
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_BUFFER_SHRINK_SIZE, &shrink_size), "Could not set shrink size");
+  for (int query= 0; query < 2; query++)
+  {
+    attachsql_query(con, 4, "DO ?", 1, &param, &error);
+    aret= ATTACHSQL_RETURN_NONE;
+    while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+    {
+      aret= attachsql_connect_poll(con, &error);
+    }
+    ASSERT_FALSE_(error, "Large parameter query error");
+    attachsql_query_close(con);
+    attachsql_connect_get_stats(con, &stats);
+    ASSERT_EQ_(query + 1, stats.buffer_shrinks, "Query buffer not shrunk");
+    /* and a small one leaves the shrunk buffer alone */
+    ASSERT_EQ_(1, run_query(con, "SELECT 1", 0, NULL, &error), "Wrong row count");
+    attachsql_connect_get_stats(con, &stats);
+    ASSERT_EQ_(query + 1, stats.buffer_shrinks, "Small query shrunk a buffer");
+  }
+  attachsql_connect_destroy(con);
+  delete[] large;
+
+  /* Prepared statements */
+  const char *data= "SELECT ? as a, ? as b";
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  attachsql_statement_prepare(con, strlen(data), data, &error);
+  aret= ATTACHSQL_RETURN_NONE;
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+  }
+  ASSERT_FALSE_(error, "Statement prepare error");
+  ASSERT_EQ_(2, attachsql_statement_get_param_count(con), "Wrong number of params");
+  attachsql_statement_set_string(con, 0, 11, "hello world", NULL);
+  attachsql_statement_set_int(con, 1, 123456, NULL);
+  attachsql_statement_execute(con, &error);
+  aret= ATTACHSQL_RETURN_NONE;
+  rows= 0;
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+    if (aret == ATTACHSQL_RETURN_ROW_READY)
+    {
+      size_t len;
+      attachsql_statement_row_get(con, &error);
+      char *col_data= attachsql_statement_get_char(con, 0, &len, &error);
+      ASSERT_STREQL_("hello world", col_data, len, "Column 0 result match fail");
+      ASSERT_EQ_(123456, attachsql_statement_get_int(con, 1, &error), "Column 1 result match fail");
+      ASSERT_EQ_(ATTACHSQL_COLUMN_TYPE_LONG, attachsql_statement_get_column_type(con, 1), "Column 1 type match fail");
+      rows++;
+      attachsql_statement_row_next(con);
+    }
+  }
+  ASSERT_FALSE_(error, "Statement execute error");
+  ASSERT_EQ_(1, rows, "Wrong statement row count");
+  attachsql_statement_close(con);
+  attachsql_connect_destroy(con);
+
+  ASSERT_EQ_(connections, mock_server_connection_count(server), "Wrong connection count");
+  mock_server_stop(server);
+}
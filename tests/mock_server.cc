@@ -0,0 +1,1486 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include "config.h"
+#include "tests/mock_server.h"
+#include <uv.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+#ifdef HAVE_OPENSSL
+# include <openssl/ssl.h>
+#endif
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+
+#define MOCK_MAX_PACKET 0xffffff
+#define MOCK_COMPRESS_MIN 50
+#define MOCK_HANDSHAKE_RESPONSE_MAX 1024
+
+#define MOCK_CAP_CONNECT_WITH_DB (1 << 3)
+#define MOCK_CAP_COMPRESS (1 << 5)
+#define MOCK_CAP_SSL (1 << 11)
+#define MOCK_CAP_PLUGIN_AUTH (1 << 19)
+#define MOCK_CAP_ZSTD (1 << 26)
+#define MOCK_CAPABILITIES (1 | 2 | 4 | MOCK_CAP_CONNECT_WITH_DB | MOCK_CAP_COMPRESS | (1 << 9) | (1 << 13) | (1 << 15) | (1 << 16) | (1 << 17) | MOCK_CAP_PLUGIN_AUTH)
+
+#define MOCK_STATUS_AUTOCOMMIT 0x0002
+#define MOCK_STATUS_MORE_RESULTS 0x0008
+
+#define MOCK_TYPE_NULL 6
+#define MOCK_TYPE_VARSTRING 253
+
+enum mock_command_t
+{
+  MOCK_COMMAND_QUIT= 0x01,
+  MOCK_COMMAND_INIT_DB= 0x02,
+  MOCK_COMMAND_QUERY= 0x03,
+  MOCK_COMMAND_PING= 0x0e,
+  MOCK_COMMAND_STMT_PREPARE= 0x16,
+  MOCK_COMMAND_STMT_EXECUTE= 0x17,
+  MOCK_COMMAND_STMT_SEND_LONG_DATA= 0x18,
+  MOCK_COMMAND_STMT_CLOSE= 0x19,
+  MOCK_COMMAND_STMT_RESET= 0x1a
+};
+
+struct mock_buffer_st
+{
+  char *data;
+  size_t length;
+  size_t size;
+};
+
+struct mock_result_st
+{
+  char *query;
+  uint16_t column_count;
+  char **columns;
+  uint64_t row_count;
+  char **values;
+  mock_result_st *next;
+};
+
+struct mock_statement_st
+{
+  uint32_t id;
+  uint16_t param_count;
+  uint16_t *types;
+  mock_statement_st *next;
+};
+
+struct mock_client_st;
+
+struct mock_server_st
+{
+  uv_loop_t loop;
+  uv_tcp_t listener;
+  uv_async_t stop;
+  uv_thread_t thread;
+  uv_mutex_t lock;
+  in_port_t port;
+  uint32_t latency;
+  uint32_t connection_count;
+  /* The last full handshake response, for tests checking its layout */
+  char handshake_response[MOCK_HANDSHAKE_RESPONSE_MAX];
+  size_t handshake_response_length;
+  mock_result_st *results;
+  mock_client_st *clients;
+#ifdef HAVE_OPENSSL
+  SSL_CTX *ssl_context;
+#endif
+};
+
+struct mock_client_st
+{
+  uv_tcp_t tcp;
+  uv_timer_t timer;
+  mock_server_st *server;
+  mock_client_st *next;
+  uint8_t handles;
+  bool closing;
+  bool authenticated;
+  bool compress;
+  bool zstd;
+  int zstd_level;
+  bool delayed;
+  uint32_t connection_id;
+  uint8_t sequence;
+  uint8_t compressed_sequence;
+  /* Where the held back response started, for KILL QUERY */
+  uint8_t command_sequence;
+  uint8_t command_compressed_sequence;
+  uint32_t delay;
+  uint32_t next_statement_id;
+  mock_statement_st *statements;
+  mock_buffer_st raw;
+  mock_buffer_st plain;
+  mock_buffer_st response;
+  mock_buffer_st pending;
+#ifdef HAVE_OPENSSL
+  /* Memory BIOs, ciphertext is moved between them and the socket */
+  SSL *ssl;
+  BIO *ssl_read_bio;
+  BIO *ssl_write_bio;
+#endif
+};
+
+struct mock_write_st
+{
+  uv_write_t req;
+  char *data;
+};
+
+static void mock_process(mock_client_st *client);
+
+static void mock_buffer_append(mock_buffer_st *buffer, const void *data, size_t length)
+{
+  if (buffer->length + length > buffer->size)
+  {
+    size_t new_size= (buffer->size > 0) ? buffer->size : 4096;
+    while (new_size < buffer->length + length)
+    {
+      new_size*= 2;
+    }
+    char *new_data= (char*)realloc(buffer->data, new_size);
+    if (new_data == NULL)
+    {
+      abort();
+    }
+    buffer->data= new_data;
+    buffer->size= new_size;
+  }
+  memcpy(buffer->data + buffer->length, data, length);
+  buffer->length+= length;
+}
+
+static void mock_buffer_byte(mock_buffer_st *buffer, uint8_t value)
+{
+  mock_buffer_append(buffer, &value, 1);
+}
+
+static void mock_buffer_int(mock_buffer_st *buffer, uint64_t value, uint8_t bytes)
+{
+  for (uint8_t byte= 0; byte < bytes; byte++)
+  {
+    mock_buffer_byte(buffer, (uint8_t)(value >> (byte * 8)));
+  }
+}
+
+static void mock_buffer_lenenc_int(mock_buffer_st *buffer, uint64_t value)
+{
+  if (value < 251)
+  {
+    mock_buffer_byte(buffer, (uint8_t)value);
+  }
+  else if (value < (1 << 16))
+  {
+    mock_buffer_byte(buffer, 0xfc);
+    mock_buffer_int(buffer, value, 2);
+  }
+  else if (value < (1 << 24))
+  {
+    mock_buffer_byte(buffer, 0xfd);
+    mock_buffer_int(buffer, value, 3);
+  }
+  else
+  {
+    mock_buffer_byte(buffer, 0xfe);
+    mock_buffer_int(buffer, value, 8);
+  }
+}
+
+static void mock_buffer_lenenc_string(mock_buffer_st *buffer, const char *data, size_t length)
+{
+  mock_buffer_lenenc_int(buffer, length);
+  mock_buffer_append(buffer, data, length);
+}
+
+static void mock_buffer_consume(mock_buffer_st *buffer, size_t length)
+{
+  memmove(buffer->data, buffer->data + length, buffer->length - length);
+  buffer->length-= length;
+}
+
+static uint32_t mock_unpack(const char *data, uint8_t bytes)
+{
+  uint32_t value= 0;
+  for (uint8_t byte= 0; byte < bytes; byte++)
+  {
+    value|= (uint32_t)(uint8_t)data[byte] << (byte * 8);
+  }
+  return value;
+}
+
+/* Response building */
+
+static void mock_packet_begin(mock_client_st *client, size_t *start)
+{
+  *start= client->response.length;
+  mock_buffer_int(&client->response, 0, 3);
+  mock_buffer_byte(&client->response, client->sequence);
+  client->sequence++;
+}
+
+static void mock_packet_end(mock_client_st *client, size_t start)
+{
+  size_t length= client->response.length - start - 4;
+  client->response.data[start]= (char)(length & 0xff);
+  client->response.data[start + 1]= (char)((length >> 8) & 0xff);
+  client->response.data[start + 2]= (char)((length >> 16) & 0xff);
+}
+
+static void mock_send_ok(mock_client_st *client, uint64_t affected_rows, uint64_t insert_id, uint16_t status)
+{
+  size_t start;
+  mock_packet_begin(client, &start);
+  mock_buffer_byte(&client->response, 0x00);
+  mock_buffer_lenenc_int(&client->response, affected_rows);
+  mock_buffer_lenenc_int(&client->response, insert_id);
+  mock_buffer_int(&client->response, status, 2);
+  mock_buffer_int(&client->response, 0, 2);
+  mock_packet_end(client, start);
+}
+
+static void mock_send_eof(mock_client_st *client, uint16_t status)
+{
+  size_t start;
+  mock_packet_begin(client, &start);
+  mock_buffer_byte(&client->response, 0xfe);
+  mock_buffer_int(&client->response, 0, 2);
+  mock_buffer_int(&client->response, status, 2);
+  mock_packet_end(client, start);
+}
+
+static void mock_send_error(mock_client_st *client, uint16_t code, const char *message)
+{
+  size_t start;
+  mock_packet_begin(client, &start);
+  mock_buffer_byte(&client->response, 0xff);
+  mock_buffer_int(&client->response, code, 2);
+  mock_buffer_append(&client->response, "#HY000", 6);
+  mock_buffer_append(&client->response, message, strlen(message));
+  mock_packet_end(client, start);
+}
+
+static void mock_send_column(mock_client_st *client, const char *name, uint8_t type, uint16_t flags)
+{
+  size_t start;
+  mock_packet_begin(client, &start);
+  mock_buffer_lenenc_string(&client->response, "def", 3);
+  mock_buffer_lenenc_string(&client->response, "mock", 4);
+  mock_buffer_lenenc_string(&client->response, "", 0);
+  mock_buffer_lenenc_string(&client->response, "", 0);
+  mock_buffer_lenenc_string(&client->response, name, strlen(name));
+  mock_buffer_lenenc_string(&client->response, name, strlen(name));
+  mock_buffer_byte(&client->response, 0x0c);
+  /* utf8_general_ci */
+  mock_buffer_int(&client->response, 33, 2);
+  mock_buffer_int(&client->response, 255, 4);
+  mock_buffer_byte(&client->response, type);
+  mock_buffer_int(&client->response, flags, 2);
+  mock_buffer_byte(&client->response, 0);
+  mock_buffer_int(&client->response, 0, 2);
+  mock_packet_end(client, start);
+}
+
+static void mock_send_column_count(mock_client_st *client, uint16_t column_count)
+{
+  size_t start;
+  mock_packet_begin(client, &start);
+  mock_buffer_lenenc_int(&client->response, column_count);
+  mock_packet_end(client, start);
+}
+
+static void mock_write_callback(uv_write_t *req, int status)
+{
+  (void) status;
+  mock_write_st *write= (mock_write_st*)req;
+  free(write->data);
+  delete write;
+}
+
+/* Takes ownership of data */
+static void mock_write_data(mock_client_st *client, char *data, size_t length)
+{
+  mock_write_st *write= new (std::nothrow) mock_write_st;
+  if (write == NULL)
+  {
+    abort();
+  }
+  write->data= data;
+  uv_buf_t buf= uv_buf_init(data, (unsigned int)length);
+  if (uv_write(&write->req, (uv_stream_t*)&client->tcp, &buf, 1, mock_write_callback) != 0)
+  {
+    free(write->data);
+    delete write;
+  }
+}
+
+#ifdef HAVE_OPENSSL
+/* Sends whatever OpenSSL has encrypted, including handshake records */
+static void mock_ssl_send(mock_client_st *client)
+{
+  size_t length= BIO_ctrl_pending(client->ssl_write_bio);
+  if (client->closing or (length == 0))
+  {
+    return;
+  }
+  char *data= (char*)malloc(length);
+  if (data == NULL)
+  {
+    abort();
+  }
+  BIO_read(client->ssl_write_bio, data, (int)length);
+  mock_write_data(client, data, length);
+}
+#endif
+
+static void mock_write(mock_client_st *client, mock_buffer_st *buffer)
+{
+  if (client->closing or (buffer->length == 0))
+  {
+    buffer->length= 0;
+    return;
+  }
+#ifdef HAVE_OPENSSL
+  if (client->ssl != NULL)
+  {
+    /* Memory BIOs grow so the whole buffer is always written */
+    SSL_write(client->ssl, buffer->data, (int)buffer->length);
+    buffer->length= 0;
+    mock_ssl_send(client);
+    return;
+  }
+#endif
+  /* Hand over the buffer to the write request */
+  char *data= buffer->data;
+  size_t length= buffer->length;
+  buffer->data= NULL;
+  buffer->length= 0;
+  buffer->size= 0;
+  mock_write_data(client, data, length);
+}
+
+/* Wraps the built response in compressed protocol frames if required and
+ * appends it to the pending output */
+static void mock_frame_response(mock_client_st *client)
+{
+  if (not client->compress)
+  {
+    mock_buffer_append(&client->pending, client->response.data, client->response.length);
+    client->response.length= 0;
+    return;
+  }
+
+  size_t position= 0;
+  while (position < client->response.length)
+  {
+    size_t length= client->response.length - position;
+    if (length > MOCK_MAX_PACKET)
+    {
+      length= MOCK_MAX_PACKET;
+    }
+    const char *data= client->response.data + position;
+    char *compressed= NULL;
+    size_t compressed_length= 0;
+    if (length >= MOCK_COMPRESS_MIN)
+    {
+#ifdef HAVE_ZSTD
+      if (client->zstd)
+      {
+        compressed_length= ZSTD_compressBound(length);
+        compressed= (char*)malloc(compressed_length);
+        compressed_length= ZSTD_compress(compressed, compressed_length, data, length, client->zstd_level);
+        if (ZSTD_isError(compressed_length))
+        {
+          compressed_length= length;
+        }
+      }
+      else
+#endif
+      {
+        uLongf zlib_length= compressBound(length);
+        compressed= (char*)malloc(zlib_length);
+        /* Fastest level so that the mock isn't the bottleneck in benchmarks */
+        if (compress2((Bytef*)compressed, &zlib_length, (const Bytef*)data, length, Z_BEST_SPEED) != Z_OK)
+        {
+          zlib_length= length;
+        }
+        compressed_length= zlib_length;
+      }
+    }
+    if ((compressed != NULL) and (compressed_length < length))
+    {
+      mock_buffer_int(&client->pending, compressed_length, 3);
+      mock_buffer_byte(&client->pending, client->compressed_sequence);
+      mock_buffer_int(&client->pending, length, 3);
+      mock_buffer_append(&client->pending, compressed, compressed_length);
+    }
+    else
+    {
+      mock_buffer_int(&client->pending, length, 3);
+      mock_buffer_byte(&client->pending, client->compressed_sequence);
+      mock_buffer_int(&client->pending, 0, 3);
+      mock_buffer_append(&client->pending, data, length);
+    }
+    free(compressed);
+    client->compressed_sequence++;
+    position+= length;
+  }
+  client->response.length= 0;
+}
+
+static void mock_timer_callback(uv_timer_t *handle)
+{
+  mock_client_st *client= (mock_client_st*)handle->data;
+  client->delayed= false;
+  mock_write(client, &client->pending);
+  mock_process(client);
+}
+
+/* Sends the response, holding it back if latency is configured.  Input is
+ * not processed while a response is held back so ordering is kept */
+static void mock_flush(mock_client_st *client)
+{
+  uint32_t delay;
+
+  uv_mutex_lock(&client->server->lock);
+  delay= client->server->latency + client->delay;
+  uv_mutex_unlock(&client->server->lock);
+  client->delay= 0;
+
+  mock_frame_response(client);
+  if (delay > 0)
+  {
+    client->delayed= true;
+    uv_timer_start(&client->timer, mock_timer_callback, delay, 0);
+    return;
+  }
+  mock_write(client, &client->pending);
+}
+
+/* Text protocol */
+
+static void mock_send_text_result(mock_client_st *client, uint16_t column_count, const char * const *columns, uint64_t row_count, const char * const *values, uint16_t status)
+{
+  mock_send_column_count(client, column_count);
+  for (uint16_t column= 0; column < column_count; column++)
+  {
+    mock_send_column(client, columns[column], MOCK_TYPE_VARSTRING, 0);
+  }
+  mock_send_eof(client, MOCK_STATUS_AUTOCOMMIT);
+  for (uint64_t row= 0; row < row_count; row++)
+  {
+    size_t start;
+    mock_packet_begin(client, &start);
+    for (uint16_t column= 0; column < column_count; column++)
+    {
+      const char *value= values[row * column_count + column];
+      if (value == NULL)
+      {
+        mock_buffer_byte(&client->response, 0xfb);
+      }
+      else
+      {
+        mock_buffer_lenenc_string(&client->response, value, strlen(value));
+      }
+    }
+    mock_packet_end(client, start);
+  }
+  mock_send_eof(client, status);
+}
+
+static void mock_send_generated_rows(mock_client_st *client, uint64_t row_count, uint16_t column_count, uint32_t width, uint16_t status)
+{
+  char name[16];
+  char *value= (char*)malloc(width + 21);
+
+  mock_send_column_count(client, column_count);
+  for (uint16_t column= 0; column < column_count; column++)
+  {
+    snprintf(name, sizeof(name), "c%u", column);
+    mock_send_column(client, name, MOCK_TYPE_VARSTRING, 0);
+  }
+  mock_send_eof(client, MOCK_STATUS_AUTOCOMMIT);
+  for (uint64_t row= 0; row < row_count; row++)
+  {
+    size_t start;
+    int length= snprintf(value, width + 21, "%0*" PRIu64, (int)width, row);
+    mock_packet_begin(client, &start);
+    for (uint16_t column= 0; column < column_count; column++)
+    {
+      mock_buffer_lenenc_string(&client->response, value, (size_t)length);
+    }
+    mock_packet_end(client, start);
+  }
+  mock_send_eof(client, status);
+  free(value);
+}
+
+/* Returns false if no further statements should be executed */
+/* Only a response still held back by MOCK SLEEP or latency can be
+ * interrupted, anything else has already been sent */
+static bool mock_kill_query(mock_client_st *client, uint32_t connection_id)
+{
+  mock_client_st *target= client->server->clients;
+
+  while ((target != NULL) and ((target->connection_id != connection_id) or target->closing))
+  {
+    target= target->next;
+  }
+  if (target == NULL)
+  {
+    return false;
+  }
+  if (target->delayed)
+  {
+    uv_timer_stop(&target->timer);
+    target->pending.length= 0;
+    target->sequence= target->command_sequence;
+    target->compressed_sequence= target->command_compressed_sequence;
+    mock_send_error(target, 1317, "Query execution was interrupted");
+    mock_frame_response(target);
+    target->delayed= false;
+    mock_write(target, &target->pending);
+    mock_process(target);
+  }
+  return true;
+}
+
+static bool mock_statement(mock_client_st *client, char *query, uint16_t status)
+{
+  mock_server_st *server= client->server;
+  uint64_t first= 0;
+  uint64_t second= 0;
+  uint64_t third= 0;
+
+  if (strncasecmp(query, "MOCK ROWS ", 10) == 0)
+  {
+    int fields= sscanf(query + 10, "%" SCNu64 " %" SCNu64 " %" SCNu64, &first, &second, &third);
+    if (fields < 2)
+    {
+      second= 1;
+    }
+    if (fields < 3)
+    {
+      third= 1;
+    }
+    if ((second == 0) or (second > 0xffff) or (third > 0xffff))
+    {
+      mock_send_error(client, 1064, "Bad MOCK ROWS arguments");
+      return false;
+    }
+    mock_send_generated_rows(client, first, (uint16_t)second, (uint32_t)third, status);
+    return true;
+  }
+  if (strncasecmp(query, "MOCK SLEEP ", 11) == 0)
+  {
+    const char *column= "sleep";
+    const char *value= "0";
+    client->delay+= (uint32_t)strtoul(query + 11, NULL, 10);
+    mock_send_text_result(client, 1, &column, 1, &value, status);
+    return true;
+  }
+  if (strncasecmp(query, "KILL QUERY ", 11) == 0)
+  {
+    if (not mock_kill_query(client, (uint32_t)strtoul(query + 11, NULL, 10)))
+    {
+      mock_send_error(client, 1094, "Unknown thread id");
+      return false;
+    }
+    mock_send_ok(client, 0, 0, status);
+    return true;
+  }
+  if (strncasecmp(query, "MOCK ERROR ", 11) == 0)
+  {
+    mock_send_error(client, (uint16_t)strtoul(query + 11, NULL, 10), "Mock error");
+    return false;
+  }
+  if (strncasecmp(query, "MOCK OK ", 8) == 0)
+  {
+    sscanf(query + 8, "%" SCNu64 " %" SCNu64, &first, &second);
+    mock_send_ok(client, first, second, status);
+    return true;
+  }
+
+  uv_mutex_lock(&server->lock);
+  for (mock_result_st *result= server->results; result != NULL; result= result->next)
+  {
+    if (strcmp(result->query, query) == 0)
+    {
+      mock_send_text_result(client, result->column_count, result->columns, result->row_count, result->values, status);
+      uv_mutex_unlock(&server->lock);
+      return true;
+    }
+  }
+  uv_mutex_unlock(&server->lock);
+
+  if (strncasecmp(query, "SELECT ", 7) == 0)
+  {
+    const char *value= query + 7;
+    mock_send_text_result(client, 1, &value, 1, &value, status);
+    return true;
+  }
+  mock_send_ok(client, 0, 0, status);
+  return true;
+}
+
+static char *mock_trim(char *query)
+{
+  while ((*query == ' ') or (*query == '\t') or (*query == '\n'))
+  {
+    query++;
+  }
+  size_t length= strlen(query);
+  while ((length > 0) and ((query[length - 1] == ' ') or (query[length - 1] == '\t') or (query[length - 1] == '\n')))
+  {
+    length--;
+  }
+  query[length]= '\0';
+  return query;
+}
+
+static void mock_query(mock_client_st *client, const char *data, size_t length)
+{
+  char *query= (char*)malloc(length + 1);
+  memcpy(query, data, length);
+  query[length]= '\0';
+
+  char *statement= query;
+  while (statement != NULL)
+  {
+    char *end= strchr(statement, ';');
+    if (end != NULL)
+    {
+      *end= '\0';
+      end++;
+      /* A trailing ';' does not start another statement */
+      if (*mock_trim(end) == '\0')
+      {
+        end= NULL;
+      }
+    }
+    uint16_t status= MOCK_STATUS_AUTOCOMMIT | ((end != NULL) ? MOCK_STATUS_MORE_RESULTS : 0);
+    if (not mock_statement(client, mock_trim(statement), status))
+    {
+      break;
+    }
+    statement= end;
+  }
+  free(query);
+}
+
+/* Prepared statements */
+
+static mock_statement_st *mock_statement_find(mock_client_st *client, uint32_t id)
+{
+  for (mock_statement_st *stmt= client->statements; stmt != NULL; stmt= stmt->next)
+  {
+    if (stmt->id == id)
+    {
+      return stmt;
+    }
+  }
+  return NULL;
+}
+
+static void mock_prepare(mock_client_st *client, const char *data, size_t length)
+{
+  mock_statement_st *stmt= new (std::nothrow) mock_statement_st;
+  if (stmt == NULL)
+  {
+    abort();
+  }
+  stmt->param_count= 0;
+  for (size_t position= 0; position < length; position++)
+  {
+    if (data[position] == '?')
+    {
+      stmt->param_count++;
+    }
+  }
+  stmt->types= (uint16_t*)calloc(stmt->param_count + 1, sizeof(uint16_t));
+  client->next_statement_id++;
+  stmt->id= client->next_statement_id;
+  stmt->next= client->statements;
+  client->statements= stmt;
+
+  size_t start;
+  mock_packet_begin(client, &start);
+  mock_buffer_byte(&client->response, 0x00);
+  mock_buffer_int(&client->response, stmt->id, 4);
+  /* Every parameter is echoed back as a column */
+  mock_buffer_int(&client->response, stmt->param_count, 2);
+  mock_buffer_int(&client->response, stmt->param_count, 2);
+  mock_buffer_byte(&client->response, 0);
+  mock_buffer_int(&client->response, 0, 2);
+  mock_packet_end(client, start);
+  if (stmt->param_count == 0)
+  {
+    return;
+  }
+  for (uint16_t param= 0; param < stmt->param_count; param++)
+  {
+    mock_send_column(client, "?", MOCK_TYPE_VARSTRING, 0);
+  }
+  mock_send_eof(client, MOCK_STATUS_AUTOCOMMIT);
+  for (uint16_t param= 0; param < stmt->param_count; param++)
+  {
+    char name[16];
+    snprintf(name, sizeof(name), "p%u", param);
+    mock_send_column(client, name, MOCK_TYPE_VARSTRING, 0);
+  }
+  mock_send_eof(client, MOCK_STATUS_AUTOCOMMIT);
+}
+
+/* Length of a binary protocol value, 0 if it runs past the end */
+static size_t mock_value_length(uint8_t type, const char *data, size_t available)
+{
+  switch (type)
+  {
+    /* TINY */
+    case 1:
+      return 1;
+    /* SHORT, YEAR */
+    case 2:
+    case 13:
+      return 2;
+    /* LONG, FLOAT, INT24 */
+    case 3:
+    case 4:
+    case 9:
+      return 4;
+    /* DOUBLE, LONGLONG */
+    case 5:
+    case 8:
+      return 8;
+    /* TIMESTAMP, DATE, TIME, DATETIME */
+    case 7:
+    case 10:
+    case 11:
+    case 12:
+      return (available > 0) ? 1 + (uint8_t)data[0] : 0;
+    default:
+    {
+      if (available == 0)
+      {
+        return 0;
+      }
+      uint8_t marker= (uint8_t)data[0];
+      if (marker < 251)
+      {
+        return 1 + marker;
+      }
+      uint8_t bytes= (marker == 0xfc) ? 2 : ((marker == 0xfd) ? 3 : 8);
+      if (available < (size_t)bytes + 1)
+      {
+        return 0;
+      }
+      uint64_t length= mock_unpack(data + 1, (bytes > 4) ? 4 : bytes);
+      return 1 + bytes + length;
+    }
+  }
+}
+
+static void mock_execute(mock_client_st *client, const char *data, size_t length)
+{
+  if (length < 9)
+  {
+    mock_send_error(client, 1243, "Malformed execute");
+    return;
+  }
+  mock_statement_st *stmt= mock_statement_find(client, mock_unpack(data, 4));
+  if (stmt == NULL)
+  {
+    mock_send_error(client, 1243, "Unknown prepared statement handler");
+    return;
+  }
+  if (stmt->param_count == 0)
+  {
+    mock_send_ok(client, 0, 0, MOCK_STATUS_AUTOCOMMIT);
+    return;
+  }
+
+  size_t position= 9;
+  uint16_t null_bytes= (stmt->param_count + 7) / 8;
+  if (length < position + null_bytes + 1)
+  {
+    mock_send_error(client, 1243, "Malformed execute");
+    return;
+  }
+  const char *null_bitmap= data + position;
+  position+= null_bytes;
+  if (data[position] == 1)
+  {
+    position++;
+    if (length < position + (stmt->param_count * 2))
+    {
+      mock_send_error(client, 1243, "Malformed execute");
+      return;
+    }
+    for (uint16_t param= 0; param < stmt->param_count; param++)
+    {
+      stmt->types[param]= (uint16_t)mock_unpack(data + position, 2);
+      position+= 2;
+    }
+  }
+  else
+  {
+    position++;
+  }
+
+  /* The row echoes the parameters: header, NULL bitmap offset by 2, values */
+  mock_buffer_st row= {NULL, 0, 0};
+  uint16_t row_null_bytes= (stmt->param_count + 9) / 8;
+  mock_buffer_byte(&row, 0x00);
+  for (uint16_t byte= 0; byte < row_null_bytes; byte++)
+  {
+    mock_buffer_byte(&row, 0);
+  }
+  for (uint16_t param= 0; param < stmt->param_count; param++)
+  {
+    if (null_bitmap[param / 8] & (1 << (param % 8)))
+    {
+      row.data[1 + ((param + 2) / 8)] |= (char)(1 << ((param + 2) % 8));
+      continue;
+    }
+    size_t value_length= mock_value_length((uint8_t)stmt->types[param], data + position, length - position);
+    if ((value_length == 0) or (position + value_length > length))
+    {
+      free(row.data);
+      mock_send_error(client, 1243, "Malformed execute");
+      return;
+    }
+    mock_buffer_append(&row, data + position, value_length);
+    position+= value_length;
+  }
+
+  mock_send_column_count(client, stmt->param_count);
+  for (uint16_t param= 0; param < stmt->param_count; param++)
+  {
+    char name[16];
+    bool is_null= (null_bitmap[param / 8] & (1 << (param % 8)));
+    /* The unsigned bit of the parameter type becomes the UNSIGNED flag */
+    uint16_t flags= (stmt->types[param] & 0x8000) ? 0x20 : 0;
+    snprintf(name, sizeof(name), "p%u", param);
+    mock_send_column(client, name, is_null ? MOCK_TYPE_NULL : (uint8_t)stmt->types[param], flags);
+  }
+  mock_send_eof(client, MOCK_STATUS_AUTOCOMMIT);
+  size_t start;
+  mock_packet_begin(client, &start);
+  mock_buffer_append(&client->response, row.data, row.length);
+  mock_packet_end(client, start);
+  mock_send_eof(client, MOCK_STATUS_AUTOCOMMIT);
+  free(row.data);
+}
+
+static void mock_statement_close(mock_client_st *client, uint32_t id)
+{
+  mock_statement_st **stmt= &client->statements;
+  while (*stmt != NULL)
+  {
+    if ((*stmt)->id == id)
+    {
+      mock_statement_st *old= *stmt;
+      *stmt= old->next;
+      free(old->types);
+      delete old;
+      return;
+    }
+    stmt= &(*stmt)->next;
+  }
+}
+
+/* Connection handling */
+
+static void mock_close_callback(uv_handle_t *handle)
+{
+  mock_client_st *client= (mock_client_st*)handle->data;
+  client->handles--;
+  if (client->handles > 0)
+  {
+    return;
+  }
+  mock_client_st **next= &client->server->clients;
+  while (*next != client)
+  {
+    next= &(*next)->next;
+  }
+  *next= client->next;
+  while (client->statements != NULL)
+  {
+    mock_statement_close(client, client->statements->id);
+  }
+  free(client->raw.data);
+  free(client->plain.data);
+  free(client->response.data);
+  free(client->pending.data);
+#ifdef HAVE_OPENSSL
+  SSL_free(client->ssl);
+#endif
+  delete client;
+}
+
+static void mock_client_close(mock_client_st *client)
+{
+  if (client->closing)
+  {
+    return;
+  }
+  client->closing= true;
+  uv_timer_stop(&client->timer);
+  uv_close((uv_handle_t*)&client->tcp, mock_close_callback);
+  uv_close((uv_handle_t*)&client->timer, mock_close_callback);
+}
+
+#ifdef HAVE_OPENSSL
+/* Decrypts data received from the socket into the raw buffer, returns false
+ * if the connection should be closed */
+static bool mock_ssl_input(mock_client_st *client, const char *data, size_t length)
+{
+  char buffer[16384];
+  int bytes;
+
+  if (length > 0)
+  {
+    BIO_write(client->ssl_read_bio, data, (int)length);
+  }
+  while ((bytes= SSL_read(client->ssl, buffer, sizeof(buffer))) > 0)
+  {
+    mock_buffer_append(&client->raw, buffer, (size_t)bytes);
+  }
+  int error= SSL_get_error(client->ssl, bytes);
+  mock_ssl_send(client);
+  return (error == SSL_ERROR_WANT_READ);
+}
+
+/* Called for the SSL request packet, anything after it in the plain buffer
+ * is already the client's TLS handshake */
+static void mock_ssl_start(mock_client_st *client, size_t length)
+{
+  client->ssl= SSL_new(client->server->ssl_context);
+  client->ssl_read_bio= BIO_new(BIO_s_mem());
+  client->ssl_write_bio= BIO_new(BIO_s_mem());
+  if ((client->ssl == NULL) or (client->ssl_read_bio == NULL) or (client->ssl_write_bio == NULL))
+  {
+    abort();
+  }
+  SSL_set_bio(client->ssl, client->ssl_read_bio, client->ssl_write_bio);
+  SSL_set_accept_state(client->ssl);
+
+  size_t trailing= client->plain.length - length - 4;
+  client->plain.length= length + 4;
+  if (not mock_ssl_input(client, client->plain.data + length + 4, trailing))
+  {
+    mock_client_close(client);
+  }
+}
+#endif
+
+static void mock_handshake_response(mock_client_st *client, const char *data, size_t length)
+{
+  uint32_t capabilities= (length >= 4) ? mock_unpack(data, 4) : 0;
+#ifdef HAVE_OPENSSL
+  /* The SSL request is the handshake response cut off after the filler */
+  if ((capabilities & MOCK_CAP_SSL) and (length == 32) and (client->ssl == NULL) and (client->server->ssl_context != NULL))
+  {
+    mock_ssl_start(client, length);
+    return;
+  }
+#endif
+
+  uv_mutex_lock(&client->server->lock);
+  client->server->handshake_response_length= (length < MOCK_HANDSHAKE_RESPONSE_MAX) ? length : MOCK_HANDSHAKE_RESPONSE_MAX;
+  memcpy(client->server->handshake_response, data, client->server->handshake_response_length);
+  uv_mutex_unlock(&client->server->lock);
+
+  mock_send_ok(client, 0, 0, MOCK_STATUS_AUTOCOMMIT);
+  /* The OK packet is the last one sent before compression starts */
+  mock_flush(client);
+  client->authenticated= true;
+  if (capabilities & MOCK_CAP_COMPRESS)
+  {
+    client->compress= true;
+  }
+#ifdef HAVE_ZSTD
+  else if (capabilities & MOCK_CAP_ZSTD)
+  {
+    /* Read the way a real server does: user, auth data, schema and plugin
+     * name come before the compression level */
+    size_t position= 32;
+    const char *end= (const char*)memchr(data + position, '\0', length - position);
+    position= (end != NULL) ? (size_t)(end - data) + 1 : length;
+    if (position < length)
+    {
+      position+= 1 + (uint8_t)data[position];
+    }
+    if ((capabilities & MOCK_CAP_CONNECT_WITH_DB) and (position < length))
+    {
+      end= (const char*)memchr(data + position, '\0', length - position);
+      position= (end != NULL) ? (size_t)(end - data) + 1 : length;
+    }
+    if ((capabilities & MOCK_CAP_PLUGIN_AUTH) and (position < length))
+    {
+      end= (const char*)memchr(data + position, '\0', length - position);
+      position= (end != NULL) ? (size_t)(end - data) + 1 : length;
+    }
+    client->zstd_level= (position < length) ? (uint8_t)data[position] : 3;
+    client->compress= true;
+    client->zstd= true;
+  }
+#endif
+}
+
+static void mock_command(mock_client_st *client, const char *data, size_t length)
+{
+  client->command_sequence= client->sequence;
+  client->command_compressed_sequence= client->compressed_sequence;
+  if (length == 0)
+  {
+    mock_send_error(client, 1047, "Unknown command");
+    mock_flush(client);
+    return;
+  }
+  switch ((uint8_t)data[0])
+  {
+    case MOCK_COMMAND_QUIT:
+      mock_client_close(client);
+      return;
+    case MOCK_COMMAND_INIT_DB:
+    case MOCK_COMMAND_PING:
+      mock_send_ok(client, 0, 0, MOCK_STATUS_AUTOCOMMIT);
+      break;
+    case MOCK_COMMAND_QUERY:
+      mock_query(client, data + 1, length - 1);
+      break;
+    case MOCK_COMMAND_STMT_PREPARE:
+      mock_prepare(client, data + 1, length - 1);
+      break;
+    case MOCK_COMMAND_STMT_EXECUTE:
+      mock_execute(client, data + 1, length - 1);
+      break;
+    case MOCK_COMMAND_STMT_CLOSE:
+      if (length >= 5)
+      {
+        mock_statement_close(client, mock_unpack(data + 1, 4));
+      }
+      /* No response for these */
+      return;
+    case MOCK_COMMAND_STMT_SEND_LONG_DATA:
+      return;
+    case MOCK_COMMAND_STMT_RESET:
+      mock_send_ok(client, 0, 0, MOCK_STATUS_AUTOCOMMIT);
+      break;
+    default:
+      mock_send_error(client, 1047, "Unknown command");
+      break;
+  }
+  mock_flush(client);
+}
+
+/* Moves complete compressed frames from the raw buffer to the plain one */
+static bool mock_decompress(mock_client_st *client)
+{
+  while (client->raw.length >= 7)
+  {
+    size_t compressed_length= mock_unpack(client->raw.data, 3);
+    size_t length= mock_unpack(client->raw.data + 4, 3);
+    if (client->raw.length < compressed_length + 7)
+    {
+      break;
+    }
+    client->compressed_sequence= (uint8_t)(client->raw.data[3] + 1);
+    const char *data= client->raw.data + 7;
+    if (length == 0)
+    {
+      mock_buffer_append(&client->plain, data, compressed_length);
+    }
+    else
+    {
+      char *uncompressed= (char*)malloc(length);
+      bool failed;
+#ifdef HAVE_ZSTD
+      if (client->zstd)
+      {
+        failed= (ZSTD_decompress(uncompressed, length, data, compressed_length) != length);
+      }
+      else
+#endif
+      {
+        uLongf zlib_length= length;
+        failed= (uncompress((Bytef*)uncompressed, &zlib_length, (const Bytef*)data, compressed_length) != Z_OK) or (zlib_length != length);
+      }
+      if (failed)
+      {
+        free(uncompressed);
+        return false;
+      }
+      mock_buffer_append(&client->plain, uncompressed, length);
+      free(uncompressed);
+    }
+    mock_buffer_consume(&client->raw, compressed_length + 7);
+  }
+  return true;
+}
+
+static void mock_process(mock_client_st *client)
+{
+  while (not client->delayed and not client->closing)
+  {
+    if (client->compress)
+    {
+      if (not mock_decompress(client))
+      {
+        mock_client_close(client);
+        return;
+      }
+    }
+    else if (client->raw.length > 0)
+    {
+      mock_buffer_append(&client->plain, client->raw.data, client->raw.length);
+      client->raw.length= 0;
+    }
+    if (client->plain.length < 4)
+    {
+      return;
+    }
+    size_t length= mock_unpack(client->plain.data, 3);
+    if (client->plain.length < length + 4)
+    {
+      return;
+    }
+    client->sequence= (uint8_t)(client->plain.data[3] + 1);
+    if (client->authenticated)
+    {
+      mock_command(client, client->plain.data + 4, length);
+    }
+    else
+    {
+      mock_handshake_response(client, client->plain.data + 4, length);
+    }
+    if (client->closing)
+    {
+      return;
+    }
+    mock_buffer_consume(&client->plain, length + 4);
+  }
+}
+
+static void mock_alloc_callback(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf)
+{
+  mock_client_st *client= (mock_client_st*)handle->data;
+  if (client->raw.size - client->raw.length < suggested_size)
+  {
+    size_t new_size= client->raw.length + suggested_size;
+    char *new_data= (char*)realloc(client->raw.data, new_size);
+    if (new_data == NULL)
+    {
+      abort();
+    }
+    client->raw.data= new_data;
+    client->raw.size= new_size;
+  }
+  *buf= uv_buf_init(client->raw.data + client->raw.length, (unsigned int)(client->raw.size - client->raw.length));
+}
+
+static void mock_read_callback(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
+{
+  (void) buf;
+  mock_client_st *client= (mock_client_st*)stream->data;
+  if (nread < 0)
+  {
+    mock_client_close(client);
+    return;
+  }
+#ifdef HAVE_OPENSSL
+  if (client->ssl != NULL)
+  {
+    /* The ciphertext was read past the end of the raw buffer */
+    if (not mock_ssl_input(client, client->raw.data + client->raw.length, (size_t)nread))
+    {
+      mock_client_close(client);
+      return;
+    }
+  }
+  else
+#endif
+  {
+    client->raw.length+= (size_t)nread;
+  }
+  mock_process(client);
+}
+
+static void mock_send_handshake(mock_client_st *client, uint32_t connection_id)
+{
+  uint32_t capabilities= MOCK_CAPABILITIES;
+#ifdef HAVE_ZSTD
+  capabilities|= MOCK_CAP_ZSTD;
+#endif
+#ifdef HAVE_OPENSSL
+  if (client->server->ssl_context != NULL)
+  {
+    capabilities|= MOCK_CAP_SSL;
+  }
+#endif
+  size_t start;
+
+  client->sequence= 0;
+  mock_packet_begin(client, &start);
+  mock_buffer_byte(&client->response, 0x0a);
+  mock_buffer_append(&client->response, "5.5.0-mock", 11);
+  mock_buffer_int(&client->response, connection_id, 4);
+  mock_buffer_append(&client->response, "abcdefgh", 9);
+  mock_buffer_int(&client->response, capabilities & 0xffff, 2);
+  mock_buffer_byte(&client->response, 33);
+  mock_buffer_int(&client->response, MOCK_STATUS_AUTOCOMMIT, 2);
+  mock_buffer_int(&client->response, capabilities >> 16, 2);
+  mock_buffer_byte(&client->response, 21);
+  for (uint8_t byte= 0; byte < 10; byte++)
+  {
+    mock_buffer_byte(&client->response, 0);
+  }
+  mock_buffer_append(&client->response, "ijklmnopqrst", 13);
+  mock_buffer_append(&client->response, "mysql_native_password", 22);
+  mock_packet_end(client, start);
+  mock_flush(client);
+}
+
+static void mock_connection_callback(uv_stream_t *listener, int status)
+{
+  mock_server_st *server= (mock_server_st*)listener->data;
+  if (status != 0)
+  {
+    return;
+  }
+  mock_client_st *client= new (std::nothrow) mock_client_st();
+  if (client == NULL)
+  {
+    abort();
+  }
+  client->server= server;
+  uv_tcp_init(&server->loop, &client->tcp);
+  uv_timer_init(&server->loop, &client->timer);
+  client->tcp.data= client;
+  client->timer.data= client;
+  client->handles= 2;
+  client->next= server->clients;
+  server->clients= client;
+  if (uv_accept(listener, (uv_stream_t*)&client->tcp) != 0)
+  {
+    mock_client_close(client);
+    return;
+  }
+  uv_tcp_nodelay(&client->tcp, 1);
+
+  uv_mutex_lock(&server->lock);
+  server->connection_count++;
+  uint32_t connection_id= server->connection_count;
+  uv_mutex_unlock(&server->lock);
+
+  client->connection_id= connection_id;
+  mock_send_handshake(client, connection_id);
+  uv_read_start((uv_stream_t*)&client->tcp, mock_alloc_callback, mock_read_callback);
+}
+
+static void mock_stop_callback(uv_async_t *handle)
+{
+  mock_server_st *server= (mock_server_st*)handle->data;
+  for (mock_client_st *client= server->clients; client != NULL; client= client->next)
+  {
+    mock_client_close(client);
+  }
+  uv_close((uv_handle_t*)&server->listener, NULL);
+  uv_close((uv_handle_t*)&server->stop, NULL);
+}
+
+static void mock_thread(void *arg)
+{
+  mock_server_st *server= (mock_server_st*)arg;
+  uv_run(&server->loop, UV_RUN_DEFAULT);
+}
+
+mock_server_st *mock_server_start(in_port_t port)
+{
+  struct sockaddr_in address;
+  int length= sizeof(address);
+  mock_server_st *server= new (std::nothrow) mock_server_st();
+
+  if (server == NULL)
+  {
+    return NULL;
+  }
+  uv_loop_init(&server->loop);
+  uv_mutex_init(&server->lock);
+  uv_tcp_init(&server->loop, &server->listener);
+  server->listener.data= server;
+  uv_ip4_addr("127.0.0.1", port, &address);
+  if ((uv_tcp_bind(&server->listener, (const struct sockaddr*)&address, 0) != 0)
+      or (uv_listen((uv_stream_t*)&server->listener, 128, mock_connection_callback) != 0)
+      or (uv_tcp_getsockname(&server->listener, (struct sockaddr*)&address, &length) != 0))
+  {
+    uv_close((uv_handle_t*)&server->listener, NULL);
+    uv_run(&server->loop, UV_RUN_DEFAULT);
+    uv_loop_close(&server->loop);
+    uv_mutex_destroy(&server->lock);
+    delete server;
+    return NULL;
+  }
+  server->port= ntohs(address.sin_port);
+  uv_async_init(&server->loop, &server->stop, mock_stop_callback);
+  server->stop.data= server;
+  if (uv_thread_create(&server->thread, mock_thread, server) != 0)
+  {
+    uv_close((uv_handle_t*)&server->listener, NULL);
+    uv_close((uv_handle_t*)&server->stop, NULL);
+    uv_run(&server->loop, UV_RUN_DEFAULT);
+    uv_loop_close(&server->loop);
+    uv_mutex_destroy(&server->lock);
+    delete server;
+    return NULL;
+  }
+  return server;
+}
+
+in_port_t mock_server_port(mock_server_st *server)
+{
+  return server->port;
+}
+
+void mock_server_set_latency(mock_server_st *server, uint32_t latency)
+{
+  uv_mutex_lock(&server->lock);
+  server->latency= latency;
+  uv_mutex_unlock(&server->lock);
+}
+
+static char *mock_strdup(const char *value)
+{
+  return (value == NULL) ? NULL : strdup(value);
+}
+
+void mock_server_add_result(mock_server_st *server, const char *query, uint16_t column_count, const char * const *columns, uint64_t row_count, const char * const *values)
+{
+  mock_result_st *result= new (std::nothrow) mock_result_st;
+  if (result == NULL)
+  {
+    abort();
+  }
+  result->query= strdup(query);
+  result->column_count= column_count;
+  result->row_count= row_count;
+  result->columns= (char**)calloc(column_count, sizeof(char*));
+  for (uint16_t column= 0; column < column_count; column++)
+  {
+    result->columns[column]= mock_strdup(columns[column]);
+  }
+  result->values= (char**)calloc(row_count * column_count, sizeof(char*));
+  for (uint64_t value= 0; value < row_count * column_count; value++)
+  {
+    result->values[value]= mock_strdup(values[value]);
+  }
+  uv_mutex_lock(&server->lock);
+  result->next= server->results;
+  server->results= result;
+  uv_mutex_unlock(&server->lock);
+}
+
+bool mock_server_set_ssl(mock_server_st *server, const char *cert, const char *key)
+{
+#ifdef HAVE_OPENSSL
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  SSL_CTX *context= SSL_CTX_new(TLS_server_method());
+#else
+  SSL_CTX *context= SSL_CTX_new(SSLv23_server_method());
+#endif
+  if (context == NULL)
+  {
+    return false;
+  }
+  if ((SSL_CTX_use_certificate_chain_file(context, cert) != 1)
+      or (SSL_CTX_use_PrivateKey_file(context, key, SSL_FILETYPE_PEM) != 1))
+  {
+    SSL_CTX_free(context);
+    return false;
+  }
+  server->ssl_context= context;
+  return true;
+#else
+  (void) server;
+  (void) cert;
+  (void) key;
+  return false;
+#endif
+}
+
+size_t mock_server_handshake_response(mock_server_st *server, char *data, size_t length)
+{
+  uv_mutex_lock(&server->lock);
+  if (length > server->handshake_response_length)
+  {
+    length= server->handshake_response_length;
+  }
+  memcpy(data, server->handshake_response, length);
+  uv_mutex_unlock(&server->lock);
+  return length;
+}
+
+uint32_t mock_server_connection_count(mock_server_st *server)
+{
+  uint32_t count;
+  uv_mutex_lock(&server->lock);
+  count= server->connection_count;
+  uv_mutex_unlock(&server->lock);
+  return count;
+}
+
+void mock_server_stop(mock_server_st *server)
+{
+  if (server == NULL)
+  {
+    return;
+  }
+  uv_async_send(&server->stop);
+  uv_thread_join(&server->thread);
+  uv_loop_close(&server->loop);
+  uv_mutex_destroy(&server->lock);
+  while (server->results != NULL)
+  {
+    mock_result_st *result= server->results;
+    server->results= result->next;
+    for (uint16_t column= 0; column < result->column_count; column++)
+    {
+      free(result->columns[column]);
+    }
+    for (uint64_t value= 0; value < result->row_count * result->column_count; value++)
+    {
+      free(result->values[value]);
+    }
+    free(result->columns);
+    free(result->values);
+    free(result->query);
+    delete result;
+  }
+#ifdef HAVE_OPENSSL
+  SSL_CTX_free(server->ssl_context);
+#endif
+  delete server;
+}
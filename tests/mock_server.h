@@ -0,0 +1,73 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/* A fake MySQL server running its own libuv loop in a thread so that tests
+ * and benchmarks can run without a real server.
+ *
+ * It accepts any credentials and speaks the handshake, COM_QUERY text
+ * results, prepared statements, zlib/zstd compression, multi-statement
+ * results and TLS once mock_server_set_ssl() is called.  Queries are
+ * answered as follows:
+ *
+ *   MOCK ROWS <rows> [<columns> [<width>]]  generated result set, column
+ *                                           values are the row number
+ *                                           zero-padded to <width>
+ *   MOCK SLEEP <ms>                         delays the response by <ms>
+ *   MOCK ERROR <code>                       error packet with <code>
+ *   MOCK OK <affected rows> <insert id>     OK packet
+ *   KILL QUERY <connection id>              interrupts a response held back
+ *                                           by MOCK SLEEP or latency with
+ *                                           error 1317
+ *   a query added with mock_server_add_result() returns that result
+ *   SELECT <anything>                       one row echoing <anything>
+ *   anything else                           OK packet
+ *
+ * Queries separated by ';' return multiple results.  Prepared statements
+ * return one row echoing the bound parameters with their types.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+struct mock_server_st;
+
+/* Starts listening on 127.0.0.1, a port of 0 picks a free port */
+mock_server_st *mock_server_start(in_port_t port);
+
+in_port_t mock_server_port(mock_server_st *server);
+
+/* Latency in milliseconds added to every response */
+void mock_server_set_latency(mock_server_st *server, uint32_t latency);
+
+/* Offers TLS with the given PEM certificate and key, must be called before
+ * any client connects.  Returns false without OpenSSL or if the files can't
+ * be loaded */
+bool mock_server_set_ssl(mock_server_st *server, const char *cert, const char *key);
+
+/* values holds row_count * column_count strings, NULL for SQL NULL */
+void mock_server_add_result(mock_server_st *server, const char *query, uint16_t column_count, const char * const *columns, uint64_t row_count, const char * const *values);
+
+/* Copies up to length bytes of the last full handshake response payload
+ * received, returns the number of bytes copied */
+size_t mock_server_handshake_response(mock_server_st *server, char *data, size_t length);
+
+uint32_t mock_server_connection_count(mock_server_st *server);
+
+void mock_server_stop(mock_server_st *server);
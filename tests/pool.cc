@@ -56,6 +56,7 @@ void callbk(attachsql_connect_t *current_con, uint32_t connection_id, attachsql_
       }
       attachsql_query_row_next(current_con);
       break;
+    case ATTACHSQL_EVENT_WARM_UP_COMPLETE:
     case ATTACHSQL_EVENT_NONE:
       break;
   }
@@ -71,7 +72,9 @@ int main(int argc, char *argv[])
   const char *data= "SHOW PROCESSLIST";
 
   pool= attachsql_pool_create(callbk, NULL, NULL);
+  ASSERT_TRUE_(attachsql_pool_set_max_buffer_size(pool, 64*1024*1024), "Could not set pool buffer limit");
   con[0]= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
+  ASSERT_FALSE_(attachsql_connect_set_option(con[0], ATTACHSQL_OPTION_MAX_BUFFER_SIZE, NULL), "NULL buffer limit accepted");
   attachsql_pool_add_connection(pool, con[0], &error);
   con[1]= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
   attachsql_pool_add_connection(pool, con[1], &error);
@@ -85,5 +88,6 @@ int main(int argc, char *argv[])
   {
     attachsql_pool_run(pool);
   }
+  ASSERT_TRUE_(attachsql_pool_get_buffer_size(pool) >= attachsql_connect_get_buffer_size(con[0]), "Pool buffer size smaller than a connection's");
   attachsql_pool_destroy(pool);
 }
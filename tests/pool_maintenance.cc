@@ -0,0 +1,125 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+#include "tests/mock_server.h"
+#include "tests/test_helpers.h"
+
+struct results_st
+{
+  uint32_t eof;
+  uint32_t errors;
+  uint32_t error_code;
+  uint32_t finished;
+};
+
+static void callbk(attachsql_connect_t *current_con, uint32_t connection_id, attachsql_events_t events, void *context, attachsql_error_t *error)
+{
+  (void) connection_id;
+  results_st *results= (results_st*)context;
+  switch(events)
+  {
+    case ATTACHSQL_EVENT_ERROR:
+      results->errors++;
+      results->finished++;
+      results->error_code= attachsql_error_code(error);
+      attachsql_error_free(error);
+      attachsql_query_close(current_con);
+      break;
+    case ATTACHSQL_EVENT_EOF:
+      results->eof++;
+      results->finished++;
+      attachsql_query_close(current_con);
+      break;
+    case ATTACHSQL_EVENT_ROW_READY:
+      attachsql_query_row_get(current_con, &error);
+      attachsql_query_row_next(current_con);
+      break;
+    case ATTACHSQL_EVENT_CONNECTED:
+    case ATTACHSQL_EVENT_WARM_UP_COMPLETE:
+    case ATTACHSQL_EVENT_NONE:
+      break;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_pool_t *pool;
+  attachsql_connect_t *con;
+  attachsql_error_t *error= NULL;
+  attachsql_connect_stats_st stats;
+  results_st results= {0, 0, 0, 0};
+  struct timeval start;
+  uint32_t timeout= 100;
+  uint32_t connections;
+
+  mock_server_st *server= mock_server_start(0);
+  ASSERT_TRUE_(server, "Could not start the mock server");
+
+  /* Keepalive pings on an idle connection */
+  pool= attachsql_pool_create(callbk, &results, NULL);
+  ASSERT_FALSE_(attachsql_pool_set_keepalive(NULL, 50), "NULL pool accepted");
+  ASSERT_TRUE_(attachsql_pool_set_keepalive(pool, 100), "Could not set keepalive");
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  attachsql_pool_add_connection(pool, con, &error);
+  ASSERT_FALSE_(error, "Could not add connection");
+  pool_run_query(pool, con, "SELECT 1", &results.finished);
+  ASSERT_EQ_(1, results.eof, "Query failed");
+  pool_run_for(pool, 600);
+  attachsql_connect_get_stats(con, &stats);
+  /* COM_PING */
+  ASSERT_TRUE_(stats.commands[0x0e] >= 3, "Too few keepalive pings sent");
+  ASSERT_EQ_(0, results.errors, "Keepalive caused an error");
+  /* Queries can be sent whilst a ping is in flight */
+  pool_run_query(pool, con, "MOCK ROWS 100", &results.finished);
+  pool_run_query(pool, con, "SELECT 1", &results.finished);
+  ASSERT_EQ_(3, results.eof, "Query after keepalive failed");
+  /* Pings not answered within the interval abort the connection, turned off
+   * so that a loaded machine doesn't fail the tests below */
+  attachsql_pool_set_keepalive(pool, 0);
+
+  /* Recycling on lifetime, the application doesn't see it */
+  connections= mock_server_connection_count(server);
+  ASSERT_TRUE_(attachsql_pool_set_max_lifetime(pool, 200), "Could not set max lifetime");
+  pool_run_for(pool, 500);
+  ASSERT_TRUE_(mock_server_connection_count(server) > connections, "Connection not recycled");
+  ASSERT_EQ_(0, results.errors, "Recycle caused an error");
+  ASSERT_EQ_(3, results.eof, "Recycle sent an event");
+  pool_run_query(pool, con, "SELECT 1", &results.finished);
+  ASSERT_EQ_(4, results.eof, "Query after recycle failed");
+  attachsql_pool_set_max_lifetime(pool, 0);
+
+  /* Query timeouts use the pool's timer wheel */
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_QUERY_TIMEOUT, &timeout), "Could not set query timeout");
+  attachsql_pool_add_connection(pool, con, &error);
+  pool_run_query(pool, con, "SELECT 1", &results.finished);
+  ASSERT_EQ_(5, results.eof, "Query failed");
+  gettimeofday(&start, NULL);
+  pool_run_query(pool, con, "MOCK SLEEP 5000", &results.finished);
+  ASSERT_EQ_(1, results.errors, "Query did not time out");
+  ASSERT_EQ_(ATTACHSQL_ERROR_CODE_TIMEOUT, results.error_code, "Wrong error code");
+  ASSERT_TRUE_(elapsed_ms(&start) < 2000, "Query timeout too slow");
+  ASSERT_TRUE_(elapsed_ms(&start) >= 100, "Query timeout too fast");
+  attachsql_pool_destroy(pool);
+
+  mock_server_stop(server);
+}
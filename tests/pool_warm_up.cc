@@ -0,0 +1,85 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain 
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+
+static uint32_t connected_events= 0;
+static bool complete= false;
+
+void callbk(attachsql_connect_t *current_con, uint32_t connection_id, attachsql_events_t events, void *context, attachsql_error_t *error)
+{
+  (void) context;
+  (void) current_con;
+  switch(events)
+  {
+    case ATTACHSQL_EVENT_CONNECTED:
+      printf("Connected event on con %d\n", connection_id);
+      connected_events++;
+      break;
+    case ATTACHSQL_EVENT_ERROR:
+      if (error && (attachsql_error_code(error) == 2002))
+      {
+        SKIP_IF_(true, "No MYSQL server");
+      }
+      else
+      {
+        ASSERT_FALSE_(true, "Error exists on con %d: %d", connection_id, attachsql_error_code(error));
+      }
+      break;
+    case ATTACHSQL_EVENT_WARM_UP_COMPLETE:
+      ASSERT_NULL_(current_con, "Warm up complete event has a connection");
+      complete= true;
+      break;
+    case ATTACHSQL_EVENT_EOF:
+    case ATTACHSQL_EVENT_ROW_READY:
+    case ATTACHSQL_EVENT_NONE:
+      break;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_pool_t *pool;
+  attachsql_connect_t *con_template;
+  attachsql_error_t *error= NULL;
+  uint32_t connected= 0;
+  uint32_t failed= 0;
+
+  pool= attachsql_pool_create(callbk, NULL, &error);
+  ASSERT_NULL_(error, "Error not NULL");
+  con_template= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
+  ASSERT_TRUE_(attachsql_pool_warm_up(pool, con_template, 10, 4, &error), "Warm up did not start");
+  ASSERT_NULL_(error, "Error not NULL");
+  ASSERT_FALSE_(attachsql_pool_warm_up(pool, con_template, 10, 4, &error), "Second warm up started");
+  ASSERT_NOT_NULL_(error, "Error is NULL");
+  attachsql_error_free(error);
+  error= NULL;
+
+  while (not attachsql_pool_get_warm_up_progress(pool, &connected, &failed))
+  {
+    attachsql_pool_run(pool);
+  }
+  ASSERT_TRUE_(complete, "No warm up complete event");
+  ASSERT_EQ_(10, connected, "Unexpected connected count");
+  ASSERT_EQ_(0, failed, "Unexpected failed count");
+  ASSERT_EQ_(10, connected_events, "Unexpected connected event count");
+  attachsql_connect_destroy(con_template);
+  attachsql_pool_destroy(pool);
+}
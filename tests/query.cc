@@ -19,6 +19,18 @@
 #include "version.h"
 #include <libattachsql2/attachsql.h>
 
+static uint32_t trace_points[ATTACHSQL_TRACE_ERROR + 1];
+
+static void trace_callback(attachsql_connect_t *con, attachsql_trace_point_t point, uint64_t command_id, uint8_t command, uint64_t timestamp, void *context)
+{
+  (void) con;
+  (void) command_id;
+  (void) command;
+  (void) timestamp;
+  (void) context;
+  trace_points[point]++;
+}
+
 int main(int argc, char *argv[])
 {
   (void) argc;
@@ -30,9 +42,13 @@ int main(int argc, char *argv[])
   attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
   attachsql_query_row_st *row;
   attachsql_query_parameter_st param[5];
+  attachsql_connect_stats_st stats;
+  char log_buffer[4096];
   uint16_t columns, col;
 
   con= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
+  ASSERT_TRUE_(attachsql_connect_set_trace_callback(con, trace_callback, NULL), "Trace callback not set");
+  ASSERT_TRUE_(attachsql_connect_set_log_level(con, ATTACHSQL_LOG_LEVEL_DEBUG), "Log level not set");
   attachsql_query(con, strlen(data), data, 0, NULL, &error);
   while(aret != ATTACHSQL_RETURN_EOF)
   {
@@ -96,5 +112,17 @@ int main(int argc, char *argv[])
     }
   }
   attachsql_query_close(con);
+  attachsql_connect_get_stats(con, &stats);
+  ASSERT_EQ_(2, stats.commands[3], "Unexpected query count");
+  ASSERT_EQ_(1, stats.connect_time.count, "Connect not timed");
+  ASSERT_EQ_(2, stats.query_time.count, "Queries not timed");
+  ASSERT_TRUE_(stats.rows >= 2, "Rows not counted");
+  ASSERT_TRUE_(attachsql_histogram_percentile(&stats.query_time, 100) == stats.query_time.max, "Bad percentile");
+  ASSERT_EQ_(2, trace_points[ATTACHSQL_TRACE_BEGIN], "Trace begin not fired");
+  ASSERT_EQ_(2, trace_points[ATTACHSQL_TRACE_FIRST_BYTE], "Trace first byte not fired");
+  ASSERT_EQ_(2, trace_points[ATTACHSQL_TRACE_END], "Trace end not fired");
+  ASSERT_EQ_(0, trace_points[ATTACHSQL_TRACE_ERROR], "Unexpected trace error");
+  ASSERT_TRUE_(attachsql_connect_get_log(con, log_buffer, sizeof(log_buffer)) > 0, "Nothing logged");
+  ASSERT_TRUE_(strstr(log_buffer, "Sending command 0x03") != NULL, "Query not logged");
   attachsql_connect_destroy(con);
 }
@@ -0,0 +1,123 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+#include "tests/mock_server.h"
+#include "tests/test_helpers.h"
+
+static void pool_callback(attachsql_connect_t *current_con, uint32_t connection_id, attachsql_events_t events, void *context, attachsql_error_t *error)
+{
+  (void) connection_id;
+  uint32_t *result= (uint32_t*)context;
+  switch(events)
+  {
+    case ATTACHSQL_EVENT_ERROR:
+      *result= attachsql_error_code(error);
+      attachsql_error_free(error);
+      attachsql_query_close(current_con);
+      break;
+    case ATTACHSQL_EVENT_EOF:
+      *result= 1;
+      attachsql_query_close(current_con);
+      break;
+    case ATTACHSQL_EVENT_ROW_READY:
+      attachsql_query_row_get(current_con, &error);
+      attachsql_query_row_next(current_con);
+      break;
+    case ATTACHSQL_EVENT_CONNECTED:
+    case ATTACHSQL_EVENT_WARM_UP_COMPLETE:
+    case ATTACHSQL_EVENT_NONE:
+      break;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_connect_t *con;
+  attachsql_pool_t *pool;
+  attachsql_error_t *error= NULL;
+  struct timeval start;
+  uint32_t connections;
+  uint32_t result= 0;
+  const char *query= "MOCK SLEEP 5000";
+
+  mock_server_st *server= mock_server_start(0);
+  ASSERT_TRUE_(server, "Could not start the mock server");
+
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  ASSERT_FALSE_(attachsql_query_cancel(NULL, &error), "NULL connection accepted");
+  attachsql_error_free(error);
+  error= NULL;
+  ASSERT_EQ_(1, run_query(con, "SELECT 1", 0, 1, &error), "Wrong row count");
+  ASSERT_FALSE_(error, "Query error");
+  /* Nothing to cancel */
+  ASSERT_TRUE_(attachsql_query_cancel(con, &error), "Cancel of a finished query failed");
+  connections= mock_server_connection_count(server);
+
+  /* The server stops the query */
+  gettimeofday(&start, NULL);
+  run_query(con, query, 0, 100, &error);
+  ASSERT_TRUE_(error, "Query not cancelled");
+  ASSERT_EQ_(1317, attachsql_error_code(error), "Wrong error code");
+  ASSERT_TRUE_(elapsed_ms(&start) < 2000, "Cancel too slow");
+  attachsql_error_free(error);
+  error= NULL;
+  ASSERT_EQ_(1, run_query(con, "SELECT 1", 0, 1000, &error), "Query after cancel failed");
+  ASSERT_FALSE_(error, "Query error");
+
+  /* The control connection is kept for the next cancel */
+  run_query(con, query, 0, 100, &error);
+  ASSERT_TRUE_(error, "Second query not cancelled");
+  ASSERT_EQ_(1317, attachsql_error_code(error), "Wrong error code");
+  attachsql_error_free(error);
+  error= NULL;
+  ASSERT_EQ_(connections + 1, mock_server_connection_count(server), "Control connection not reused");
+
+  /* Rows already sent are thrown away */
+  ASSERT_EQ_(1, run_query(con, "MOCK ROWS 100000 1 10", 0, TEST_CANCEL_FIRST_ROW, &error), "Rows not discarded");
+  ASSERT_FALSE_(error, "Query error");
+  ASSERT_EQ_(1, run_query(con, "SELECT 1", 0, 1000, &error), "Query after discard failed");
+  ASSERT_FALSE_(error, "Query error");
+  attachsql_connect_destroy(con);
+
+  /* Pool connections */
+  pool= attachsql_pool_create(pool_callback, &result, NULL);
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  attachsql_pool_add_connection(pool, con, &error);
+  attachsql_query(con, strlen(query), query, 0, NULL, &error);
+  gettimeofday(&start, NULL);
+  while (elapsed_ms(&start) < 100)
+  {
+    attachsql_pool_run(pool);
+    usleep(1000);
+  }
+  ASSERT_TRUE_(attachsql_query_cancel(con, &error), "Cancel failed");
+  while (result == 0)
+  {
+    attachsql_pool_run(pool);
+    usleep(1000);
+  }
+  ASSERT_EQ_(1317, result, "Pool query not cancelled");
+  ASSERT_TRUE_(elapsed_ms(&start) < 2000, "Pool cancel too slow");
+  attachsql_pool_destroy(pool);
+
+  mock_server_stop(server);
+}
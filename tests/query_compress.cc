@@ -35,6 +35,26 @@ int main(int argc, char *argv[])
   con= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
   bool compress= attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESS, NULL);
   SKIP_IF_(!compress, "Not compiled with ZLib");
+  int level= 10;
+  ASSERT_FALSE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_LEVEL, &level), "Invalid zlib compression level accepted");
+  attachsql_compression_algorithm_t algorithm= ATTACHSQL_COMPRESSION_ALGORITHM_ZSTD;
+  if (attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_ALGORITHM, &algorithm))
+  {
+    ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_LEVEL, &level), "Could not set zstd compression level");
+    level= 23;
+    ASSERT_FALSE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_LEVEL, &level), "Invalid zstd compression level accepted");
+    /* The zstd level of 10 doesn't carry over to zlib */
+    algorithm= ATTACHSQL_COMPRESSION_ALGORITHM_ZLIB;
+    ASSERT_FALSE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_ALGORITHM, &algorithm), "zlib selected with a zstd compression level");
+  }
+  level= 1;
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_LEVEL, &level), "Could not set compression level");
+  algorithm= ATTACHSQL_COMPRESSION_ALGORITHM_ZLIB;
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_ALGORITHM, &algorithm), "Could not select zlib compression");
+  int saving= 101;
+  ASSERT_FALSE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_MIN_SAVING, &saving), "Invalid compression saving accepted");
+  saving= 5;
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_COMPRESSION_MIN_SAVING, &saving), "Could not set compression saving");
   attachsql_query(con, strlen(data), data, 0, NULL, &error);
   while(aret != ATTACHSQL_RETURN_EOF)
   {
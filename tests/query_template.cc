@@ -0,0 +1,97 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain 
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_connect_t *con;
+  attachsql_error_t *error= NULL;
+  attachsql_query_template_t *tpl;
+  const char *data= "SELECT ? as a, '?' as b, ? as c /* ? */, ? as d -- ?\n";
+  attachsql_return_t aret;
+  attachsql_query_row_st *row;
+  attachsql_query_parameter_st param[3];
+  uint16_t columns;
+  uint32_t tn;
+  int run;
+
+  tpl= attachsql_query_template_create(strlen(data), data, ATTACHSQL_QUERY_TEMPLATE_FLAG_NONE, &error);
+  ASSERT_NULL_(error, "Error not NULL");
+  ASSERT_EQ_(6, attachsql_query_template_parameter_count(tpl), "Unexpected placeholder count");
+  attachsql_query_template_destroy(tpl);
+
+  tpl= attachsql_query_template_create(strlen(data), data, ATTACHSQL_QUERY_TEMPLATE_FLAG_SKIP_QUOTED, &error);
+  ASSERT_NULL_(error, "Error not NULL");
+  ASSERT_EQ_(3, attachsql_query_template_parameter_count(tpl), "Unexpected placeholder count");
+
+  con= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
+  attachsql_query_template_execute(con, tpl, 0, NULL, &error);
+  ASSERT_NOT_NULL_(error, "Missing parameters not detected");
+  attachsql_error_free(error);
+  error= NULL;
+
+  const char *td= "te'st";
+  param[0].type= ATTACHSQL_ESCAPE_TYPE_CHAR;
+  param[0].data= (char*)td;
+  param[0].length= strlen(td);
+  param[1].type= ATTACHSQL_ESCAPE_TYPE_INT;
+  param[1].data= &tn;
+  param[1].is_unsigned= true;
+  param[2].type= ATTACHSQL_ESCAPE_TYPE_CHAR;
+  param[2].data= (char*)td;
+  param[2].length= strlen(td);
+  /* Run more than once to check the template and buffer are reusable */
+  for (run= 0; run < 3; run++)
+  {
+    tn= 45768 + run;
+    attachsql_query_template_execute(con, tpl, 3, param, &error);
+    ASSERT_NULL_(error, "Error not NULL");
+    aret= ATTACHSQL_RETURN_NONE;
+    while(aret != ATTACHSQL_RETURN_EOF)
+    {
+      aret= attachsql_connect_poll(con, &error);
+      if (aret == ATTACHSQL_RETURN_ROW_READY)
+      {
+        char expected[6];
+        row= attachsql_query_row_get(con, &error);
+        columns= attachsql_query_column_count(con);
+        ASSERT_EQ_(4, columns, "Column count unexpected");
+        ASSERT_STREQL_("te'st", row[0].data, 5, "Bad row data");
+        ASSERT_STREQL_("?", row[1].data, 1, "Bad row data");
+        snprintf(expected, sizeof(expected), "%u", tn);
+        ASSERT_STREQL_(expected, row[2].data, 5, "Bad row data");
+        ASSERT_STREQL_("te'st", row[3].data, 5, "Bad row data");
+        attachsql_query_row_next(con);
+      }
+      if (error && (attachsql_error_code(error) == 2002))
+      {
+        SKIP_IF_(true, "No MYSQL server");
+      }
+      else if (error)
+      {
+        ASSERT_FALSE_(true, "Error exists: %d", attachsql_error_code(error));
+      }
+    }
+    attachsql_query_close(con);
+  }
+  attachsql_query_template_destroy(tpl);
+  attachsql_connect_destroy(con);
+}
@@ -0,0 +1,78 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain 
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+
+static void connect_ssl(attachsql_ssl_context_t *ctx, bool *reused)
+{
+  attachsql_connect_t *con;
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  const char *data= "SELECT 1";
+
+  attachsql_ssl_version_t min_version= ATTACHSQL_SSL_VERSION_TLS1_2;
+
+  con= attachsql_connect_create("localhost", 3306, "test", "test", "", NULL);
+  ASSERT_TRUE_(attachsql_connect_set_ssl_context(con, ctx, &error), "Could not set SSL context");
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_SSL_MIN_VERSION, &min_version), "Could not set SSL minimum version");
+  ASSERT_FALSE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_SSL_MAX_VERSION, NULL), "SSL maximum version without an argument accepted");
+  attachsql_query(con, strlen(data), data, 0, NULL, &error);
+  while(aret != ATTACHSQL_RETURN_EOF)
+  {
+    aret= attachsql_connect_poll(con, &error);
+    if (aret == ATTACHSQL_RETURN_ROW_READY)
+    {
+      attachsql_query_row_next(con);
+    }
+    if (error && (attachsql_error_code(error) == 2002))
+    {
+      SKIP_IF_(true, "No MYSQL server, or MySQL doesn't support SSL");
+    }
+    else if (error)
+    {
+      ASSERT_FALSE_(true, "Error exists: %d, %s", attachsql_error_code(error), attachsql_error_message(error));
+    }
+  }
+  *reused= attachsql_connect_ssl_session_reused(con);
+  attachsql_query_close(con);
+  attachsql_connect_destroy(con);
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_ssl_context_t *ctx;
+  attachsql_error_t *error= NULL;
+  bool reused;
+
+  attachsql_library_init();
+  ctx= attachsql_ssl_context_create("tests/ssl/client-key.pem", "tests/ssl/client-cert.pem", "tests/ssl/ca-cert.pem", NULL, NULL, false, &error);
+  if (error and (attachsql_error_code(error) == 3002))
+  {
+    SKIP_IF_(true, "SSL not supported");
+  }
+  SKIP_IF_(error, "SSL certs missing");
+
+  connect_ssl(ctx, &reused);
+  ASSERT_FALSE_(reused, "First connection cannot resume a session");
+  /* The server may not issue tickets so resumption isn't guaranteed */
+  connect_ssl(ctx, &reused);
+  printf("Second connection session reused: %s\n", reused ? "yes" : "no");
+  attachsql_ssl_context_destroy(ctx);
+}
@@ -0,0 +1,142 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain 
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include "config.h"
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+#include "tests/mock_server.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#ifdef HAVE_OPENSSL
+# include <openssl/opensslv.h>
+#endif
+
+#ifndef TCP_ULP
+# define TCP_ULP 31
+#endif
+
+/* Whether the library is built with kernel TLS and the kernel accepts the
+ * TLS upper layer protocol on an established TCP socket, which is what the
+ * library tries once the handshake is done */
+static bool kernel_tls_available()
+{
+#if defined(HAVE_OPENSSL) and defined(HAVE_LINUX_TLS_H) and (OPENSSL_VERSION_NUMBER >= 0x10101000L)
+  struct sockaddr_in address;
+  socklen_t length= sizeof(address);
+  bool available= false;
+  int listener= socket(AF_INET, SOCK_STREAM, 0);
+  int client= socket(AF_INET, SOCK_STREAM, 0);
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family= AF_INET;
+  address.sin_addr.s_addr= htonl(INADDR_LOOPBACK);
+  if ((listener >= 0) and (client >= 0)
+      and (bind(listener, (struct sockaddr*)&address, sizeof(address)) == 0)
+      and (listen(listener, 1) == 0)
+      and (getsockname(listener, (struct sockaddr*)&address, &length) == 0)
+      and (connect(client, (struct sockaddr*)&address, sizeof(address)) == 0))
+  {
+    available= (setsockopt(client, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) == 0);
+  }
+  if (client >= 0)
+  {
+    close(client);
+  }
+  if (listener >= 0)
+  {
+    close(listener);
+  }
+  return available;
+#else
+  return false;
+#endif
+}
+
+static uint64_t run_query(attachsql_connect_t *con, const char *data)
+{
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  uint64_t rows= 0;
+
+  attachsql_query(con, strlen(data), data, 0, NULL, &error);
+  while((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+    if (aret == ATTACHSQL_RETURN_ROW_READY)
+    {
+      rows++;
+      attachsql_query_row_next(con);
+    }
+  }
+  if (error)
+  {
+    ASSERT_FALSE_(true, "Error exists: %d, %s", attachsql_error_code(error), attachsql_error_message(error));
+  }
+  attachsql_query_close(con);
+  return rows;
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_connect_t *con;
+  attachsql_error_t *error= NULL;
+  attachsql_ssl_version_t max_version= ATTACHSQL_SSL_VERSION_TLS1_2;
+  bool expect_ktls= kernel_tls_available();
+
+  attachsql_library_init();
+  mock_server_st *server= mock_server_start(0);
+  ASSERT_TRUE_(server, "Could not start the mock server");
+  if (not mock_server_set_ssl(server, "tests/ssl/server-cert.pem", "tests/ssl/server-key.pem"))
+  {
+    mock_server_stop(server);
+    SKIP_IF_(true, "Mock server has no SSL support");
+  }
+
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  attachsql_connect_set_ssl(con, "tests/ssl/client-key.pem", "tests/ssl/client-cert.pem", "tests/ssl/ca-cert.pem", NULL, NULL, false, &error);
+  if (error and (attachsql_error_code(error) == 3002))
+  {
+    SKIP_IF_(true, "SSL not supported");
+  }
+  SKIP_IF_(error, "SSL certs missing");
+  /* Kernel TLS is only used for TLS 1.2 */
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_SSL_MAX_VERSION, &max_version), "Could not set SSL maximum version");
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_SSL_KTLS, NULL), "Could not enable kernel TLS");
+  ASSERT_FALSE_(attachsql_connect_ssl_ktls_active(con), "Kernel TLS active before connecting");
+
+  /* The first query completes the handshake, the rest run over the kernel
+   * TLS socket if it was enabled, the large result spans many records */
+  ASSERT_EQ_(1, run_query(con, "SELECT 1"), "Wrong row count");
+  ASSERT_EQ_(1, run_query(con, "SELECT 2"), "Wrong row count");
+  ASSERT_EQ_(5000, run_query(con, "MOCK ROWS 5000 4 32"), "Wrong row count");
+  if (expect_ktls)
+  {
+    ASSERT_TRUE_(attachsql_connect_ssl_ktls_active(con), "Kernel TLS not active although the kernel supports it");
+  }
+  else
+  {
+    /* Queries above succeeded through OpenSSL */
+    ASSERT_FALSE_(attachsql_connect_ssl_ktls_active(con), "Kernel TLS active without kernel support");
+  }
+  ASSERT_EQ_(1, run_query(con, "SELECT 3"), "Wrong row count");
+  attachsql_connect_destroy(con);
+  mock_server_stop(server);
+}
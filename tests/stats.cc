@@ -0,0 +1,170 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+#include "tests/mock_server.h"
+#include <uv.h>
+#include <unistd.h>
+
+#define QUERY "MOCK ROWS 10"
+#define QUERY_ROWS 10
+#define QUERY_COUNT 20
+#define LATENCY_MS 10
+#define COM_QUERY 0x03
+
+struct results_st
+{
+  uint32_t eof;
+  uint32_t errors;
+};
+
+struct reader_st
+{
+  attachsql_pool_t *pool;
+  bool stop;
+  uint32_t reads;
+  bool went_backwards;
+};
+
+static void callbk(attachsql_connect_t *current_con, uint32_t connection_id, attachsql_events_t events, void *context, attachsql_error_t *error)
+{
+  (void) connection_id;
+  results_st *results= (results_st*)context;
+  switch(events)
+  {
+    case ATTACHSQL_EVENT_ERROR:
+      results->errors++;
+      attachsql_error_free(error);
+      attachsql_query_close(current_con);
+      break;
+    case ATTACHSQL_EVENT_EOF:
+      results->eof++;
+      attachsql_query_close(current_con);
+      break;
+    case ATTACHSQL_EVENT_ROW_READY:
+      attachsql_query_row_get(current_con, &error);
+      attachsql_query_row_next(current_con);
+      break;
+    case ATTACHSQL_EVENT_CONNECTED:
+    case ATTACHSQL_EVENT_WARM_UP_COMPLETE:
+    case ATTACHSQL_EVENT_NONE:
+      break;
+  }
+}
+
+/* A metrics thread reading the pool's stats while the pool runs and grows */
+static void reader_thread(void *arg)
+{
+  reader_st *reader= (reader_st*)arg;
+  attachsql_connect_stats_st stats;
+  uint64_t last_commands= 0;
+
+  while (not __atomic_load_n(&reader->stop, __ATOMIC_ACQUIRE))
+  {
+    attachsql_pool_get_stats(reader->pool, &stats);
+    if (stats.commands[COM_QUERY] < last_commands)
+    {
+      reader->went_backwards= true;
+    }
+    last_commands= stats.commands[COM_QUERY];
+    reader->reads++;
+    usleep(100);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_pool_t *pool;
+  attachsql_connect_t *con[2];
+  attachsql_error_t *error= NULL;
+  attachsql_connect_stats_st stats;
+  attachsql_histogram_st empty;
+  results_st results= {0, 0};
+  reader_st reader;
+  uv_thread_t thread;
+
+  mock_server_st *server= mock_server_start(0);
+  ASSERT_TRUE_(server, "Could not start the mock server");
+  mock_server_set_latency(server, LATENCY_MS);
+
+  pool= attachsql_pool_create(callbk, &results, NULL);
+  reader.pool= pool;
+  reader.stop= false;
+  reader.reads= 0;
+  reader.went_backwards= false;
+  ASSERT_EQ_(0, uv_thread_create(&thread, reader_thread, &reader), "Could not start the reader thread");
+
+  /* Connections are added while the other thread reads the stats */
+  for (int connection= 0; connection < 2; connection++)
+  {
+    con[connection]= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+    attachsql_pool_add_connection(pool, con[connection], &error);
+    ASSERT_FALSE_(error, "Could not add connection");
+    for (int query= 0; query < QUERY_COUNT; query++)
+    {
+      uint32_t finished= results.eof + results.errors;
+      attachsql_query(con[connection], strlen(QUERY), QUERY, 0, NULL, &error);
+      ASSERT_FALSE_(error, "Query send error");
+      while (results.eof + results.errors == finished)
+      {
+        attachsql_pool_run(pool);
+        usleep(1000);
+      }
+    }
+  }
+  __atomic_store_n(&reader.stop, true, __ATOMIC_RELEASE);
+  uv_thread_join(&thread);
+  ASSERT_EQ_(0, results.errors, "Query error");
+  ASSERT_TRUE_(reader.reads > 0, "Reader thread never read the stats");
+  ASSERT_FALSE_(reader.went_backwards, "Pool stats went backwards");
+
+  /* Counters of one connection */
+  attachsql_connect_get_stats(con[0], &stats);
+  ASSERT_EQ_(QUERY_COUNT, stats.commands[COM_QUERY], "Wrong query count");
+  ASSERT_EQ_(QUERY_COUNT * QUERY_ROWS, stats.rows, "Wrong row count");
+  ASSERT_TRUE_(stats.packets_in > stats.rows, "Too few packets in");
+  ASSERT_TRUE_(stats.bytes_in > stats.packets_in * 4, "Too few bytes in");
+  ASSERT_TRUE_(stats.bytes_out > QUERY_COUNT * strlen(QUERY), "Too few bytes out");
+  ASSERT_EQ_(1, stats.connect_time.count, "Wrong connect count");
+  ASSERT_EQ_(QUERY_COUNT, stats.first_row_time.count, "Wrong first row count");
+  ASSERT_EQ_(QUERY_COUNT, stats.query_time.count, "Wrong query time count");
+
+  /* Every query waits for the mock server's latency, percentiles are the
+   * upper bound of a bucket so they can't be below it */
+  ASSERT_TRUE_(stats.query_time.max >= LATENCY_MS * 1000, "Query time max below the latency");
+  ASSERT_TRUE_(attachsql_histogram_percentile(&stats.query_time, 50) >= LATENCY_MS * 1000, "Median query time below the latency");
+  ASSERT_TRUE_(attachsql_histogram_percentile(&stats.query_time, 50) <= attachsql_histogram_percentile(&stats.query_time, 99.9), "Percentiles out of order");
+  ASSERT_TRUE_(attachsql_histogram_percentile(&stats.query_time, 100) >= stats.query_time.max, "Top percentile below the max");
+  ASSERT_TRUE_(attachsql_histogram_percentile(&stats.first_row_time, 50) <= attachsql_histogram_percentile(&stats.query_time, 50), "First row after the query finished");
+  memset(&empty, 0, sizeof(empty));
+  ASSERT_EQ_(0, attachsql_histogram_percentile(&empty, 50), "Empty histogram has a percentile");
+  ASSERT_EQ_(0, attachsql_histogram_percentile(NULL, 50), "NULL histogram has a percentile");
+
+  /* The pool adds up both connections */
+  attachsql_pool_get_stats(pool, &stats);
+  ASSERT_EQ_(QUERY_COUNT * 2, stats.commands[COM_QUERY], "Wrong pool query count");
+  ASSERT_EQ_(QUERY_COUNT * QUERY_ROWS * 2, stats.rows, "Wrong pool row count");
+  ASSERT_EQ_(2, stats.connect_time.count, "Wrong pool connect count");
+  ASSERT_EQ_(QUERY_COUNT * 2, stats.query_time.count, "Wrong pool query time count");
+  ASSERT_TRUE_(attachsql_histogram_percentile(&stats.query_time, 50) >= LATENCY_MS * 1000, "Pool median query time below the latency");
+
+  attachsql_pool_destroy(pool);
+  mock_server_stop(server);
+}
@@ -0,0 +1,91 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <yatl/lite.h>
+#include "tests/test_helpers.h"
+#include <string.h>
+
+uint64_t elapsed_ms(struct timeval *start)
+{
+  struct timeval end;
+  gettimeofday(&end, NULL);
+  return (uint64_t)((end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec) / 1000);
+}
+
+uint64_t run_query(attachsql_connect_t *con, const char *query, useconds_t hold_ms, uint64_t cancel_ms, attachsql_error_t **error)
+{
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  struct timeval start;
+  bool cancelled= (cancel_ms == 0);
+  uint64_t rows= 0;
+
+  attachsql_query(con, strlen(query), query, 0, NULL, error);
+  gettimeofday(&start, NULL);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (*error == NULL))
+  {
+    aret= attachsql_connect_poll(con, error);
+    if (aret == ATTACHSQL_RETURN_ROW_READY)
+    {
+      attachsql_query_row_get(con, error);
+      if (hold_ms > 0)
+      {
+        usleep(hold_ms * 1000);
+      }
+      rows++;
+      if (not cancelled and (cancel_ms == TEST_CANCEL_FIRST_ROW))
+      {
+        ASSERT_TRUE_(attachsql_query_cancel(con, error), "Cancel failed");
+        cancelled= true;
+      }
+      attachsql_query_row_next(con);
+    }
+    else if (not cancelled and (cancel_ms != TEST_CANCEL_FIRST_ROW) and (elapsed_ms(&start) >= cancel_ms))
+    {
+      ASSERT_TRUE_(attachsql_query_cancel(con, error), "Cancel failed");
+      cancelled= true;
+    }
+    usleep(1000);
+  }
+  attachsql_query_close(con);
+  return rows;
+}
+
+void pool_run_query(attachsql_pool_t *pool, attachsql_connect_t *con, const char *query, const uint32_t *finished)
+{
+  attachsql_error_t *error= NULL;
+  uint32_t start= *finished;
+
+  attachsql_query(con, strlen(query), query, 0, NULL, &error);
+  ASSERT_FALSE_(error, "Query send error");
+  while (*finished == start)
+  {
+    attachsql_pool_run(pool);
+    usleep(1000);
+  }
+}
+
+void pool_run_for(attachsql_pool_t *pool, uint64_t ms)
+{
+  struct timeval start;
+
+  gettimeofday(&start, NULL);
+  while (elapsed_ms(&start) < ms)
+  {
+    attachsql_pool_run(pool);
+    usleep(1000);
+  }
+}
@@ -0,0 +1,43 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+/* Polling helpers shared by the tests that run against the mock server */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <libattachsql2/attachsql.h>
+
+/* Passed as cancel_ms to run_query() to cancel once the first row arrives */
+#define TEST_CANCEL_FIRST_ROW UINT64_MAX
+
+/* Milliseconds since start */
+uint64_t elapsed_ms(struct timeval *start);
+
+/* Sends the query and polls con until it finishes, returning the number of
+ * rows seen.  The application takes hold_ms to handle each row.  A non-zero
+ * cancel_ms cancels the query after that many milliseconds */
+uint64_t run_query(attachsql_connect_t *con, const char *query, useconds_t hold_ms, uint64_t cancel_ms, attachsql_error_t **error);
+
+/* Sends the query on a pool connection and runs the pool until the pool
+ * callback bumps *finished on EOF or error */
+void pool_run_query(attachsql_pool_t *pool, attachsql_connect_t *con, const char *query, const uint32_t *finished);
+
+/* Runs the pool for ms milliseconds */
+void pool_run_for(attachsql_pool_t *pool, uint64_t ms);
@@ -0,0 +1,193 @@
+/* vim:expandtab:shiftwidth=2:tabstop=2:smarttab:
+ * Copyright 2014 Hewlett-Packard Development Company, L.P.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may
+ * not use this file except in compliance with the License. You may obtain
+ * a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *
+ */
+
+#include <yatl/lite.h>
+#include "version.h"
+#include <libattachsql2/attachsql.h>
+#include "tests/mock_server.h"
+#include "tests/test_helpers.h"
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+struct pool_results_st
+{
+  attachsql_connect_t *con;
+  uint32_t error_code;
+  uint32_t finished;
+};
+
+static void pool_callback(attachsql_connect_t *current_con, uint32_t connection_id, attachsql_events_t events, void *context, attachsql_error_t *error)
+{
+  (void) connection_id;
+  pool_results_st *results= (pool_results_st*)context;
+  switch(events)
+  {
+    case ATTACHSQL_EVENT_CONNECTED:
+      results->con= current_con;
+      break;
+    case ATTACHSQL_EVENT_ERROR:
+      results->error_code= attachsql_error_code(error);
+      attachsql_error_free(error);
+      if (current_con != NULL)
+      {
+        attachsql_query_close(current_con);
+      }
+      results->finished++;
+      break;
+    case ATTACHSQL_EVENT_EOF:
+      attachsql_query_close(current_con);
+      results->finished++;
+      break;
+    case ATTACHSQL_EVENT_ROW_READY:
+      attachsql_query_row_get(current_con, &error);
+      attachsql_query_row_next(current_con);
+      break;
+    case ATTACHSQL_EVENT_WARM_UP_COMPLETE:
+    case ATTACHSQL_EVENT_NONE:
+      break;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  (void) argc;
+  (void) argv;
+  attachsql_connect_t *con;
+  attachsql_error_t *error= NULL;
+  attachsql_return_t aret= ATTACHSQL_RETURN_NONE;
+  struct timeval start;
+  uint32_t timeout= 200;
+
+  mock_server_st *server= mock_server_start(0);
+  ASSERT_TRUE_(server, "Could not start the mock server");
+
+  /* Query timeout */
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_QUERY_TIMEOUT, &timeout), "Could not set query timeout");
+  ASSERT_EQ_(1, run_query(con, "SELECT 1", 0, 0, &error), "Wrong row count");
+  ASSERT_FALSE_(error, "Query error");
+  gettimeofday(&start, NULL);
+  run_query(con, "MOCK SLEEP 5000", 0, 0, &error);
+  ASSERT_TRUE_(error, "Query did not time out");
+  ASSERT_EQ_(ATTACHSQL_ERROR_CODE_TIMEOUT, attachsql_error_code(error), "Wrong error code");
+  ASSERT_STREQ_("HYT00", attachsql_error_sqlstate(error), "Wrong sqlstate");
+  ASSERT_TRUE_(elapsed_ms(&start) < 2000, "Query timeout too slow");
+  attachsql_error_free(error);
+  error= NULL;
+  attachsql_connect_destroy(con);
+
+  /* Read timeout only counts while waiting on the server */
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  ASSERT_TRUE_(attachsql_connect_set_option(con, ATTACHSQL_OPTION_READ_TIMEOUT, &timeout), "Could not set read timeout");
+  ASSERT_EQ_(3, run_query(con, "MOCK ROWS 3", 300, 0, &error), "Wrong row count");
+  ASSERT_FALSE_(error, "Slow application timed out");
+  gettimeofday(&start, NULL);
+  run_query(con, "MOCK SLEEP 5000", 0, 0, &error);
+  ASSERT_TRUE_(error, "Read did not time out");
+  ASSERT_EQ_(ATTACHSQL_ERROR_CODE_TIMEOUT, attachsql_error_code(error), "Wrong error code");
+  ASSERT_TRUE_(elapsed_ms(&start) < 2000, "Read timeout too slow");
+  attachsql_error_free(error);
+  error= NULL;
+  attachsql_connect_destroy(con);
+
+  /* Semi-blocking polls wake up for the timeout */
+  con= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  attachsql_connect_set_option(con, ATTACHSQL_OPTION_SEMI_BLOCKING, NULL);
+  attachsql_connect_set_option(con, ATTACHSQL_OPTION_READ_TIMEOUT, &timeout);
+  gettimeofday(&start, NULL);
+  run_query(con, "MOCK SLEEP 5000", 0, 0, &error);
+  ASSERT_TRUE_(error, "Semi-blocking read did not time out");
+  ASSERT_EQ_(ATTACHSQL_ERROR_CODE_TIMEOUT, attachsql_error_code(error), "Wrong error code");
+  ASSERT_TRUE_(elapsed_ms(&start) < 2000, "Semi-blocking read timeout too slow");
+  attachsql_error_free(error);
+  error= NULL;
+  attachsql_connect_destroy(con);
+
+  /* Pool warm up connections are cloned from the template with its
+   * timeouts and compression */
+  pool_results_st results= {NULL, 0, 0};
+  attachsql_connect_stats_st stats;
+  uint32_t connected= 0;
+  uint32_t failed= 0;
+  attachsql_pool_t *pool= attachsql_pool_create(pool_callback, &results, NULL);
+  attachsql_connect_t *con_template= attachsql_connect_create("127.0.0.1", mock_server_port(server), "test", "test", "", NULL);
+  attachsql_connect_set_option(con_template, ATTACHSQL_OPTION_QUERY_TIMEOUT, &timeout);
+  bool compress= attachsql_connect_set_option(con_template, ATTACHSQL_OPTION_COMPRESS, NULL);
+  ASSERT_TRUE_(attachsql_pool_warm_up(pool, con_template, 1, 1, &error), "Warm up did not start");
+  while (not attachsql_pool_get_warm_up_progress(pool, &connected, &failed))
+  {
+    attachsql_pool_run(pool);
+  }
+  ASSERT_EQ_(1, connected, "Warm up connection failed");
+  ASSERT_TRUE_(results.con, "No connected event");
+  pool_run_query(pool, results.con, "MOCK ROWS 100 2 50", &results.finished);
+  ASSERT_EQ_(0, results.error_code, "Query error");
+  attachsql_connect_get_stats(results.con, &stats);
+  ASSERT_EQ_(compress, (stats.compressed_bytes_in > 0), "Compression not inherited");
+  gettimeofday(&start, NULL);
+  pool_run_query(pool, results.con, "MOCK SLEEP 5000", &results.finished);
+  ASSERT_EQ_(ATTACHSQL_ERROR_CODE_TIMEOUT, results.error_code, "Warm up connection did not time out");
+  ASSERT_TRUE_(elapsed_ms(&start) < 2000, "Warm up query timeout too slow");
+  attachsql_connect_destroy(con_template);
+  attachsql_pool_destroy(pool);
+
+  /* Connect timeout, the listener never accepts so no handshake arrives */
+  int listener= socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  socklen_t address_length= sizeof(address);
+  memset(&address, 0, sizeof(address));
+  address.sin_family= AF_INET;
+  address.sin_addr.s_addr= htonl(INADDR_LOOPBACK);
+  ASSERT_EQ_(0, bind(listener, (struct sockaddr*)&address, sizeof(address)), "Could not bind");
+  ASSERT_EQ_(0, listen(listener, 1), "Could not listen");
+  getsockname(listener, (struct sockaddr*)&address, &address_length);
+  con= attachsql_connect_create("127.0.0.1", ntohs(address.sin_port), "test", "test", "", NULL);
+  attachsql_connect_set_option(con, ATTACHSQL_OPTION_CONNECT_TIMEOUT, &timeout);
+  gettimeofday(&start, NULL);
+  attachsql_connect(con, &error);
+  while ((aret != ATTACHSQL_RETURN_EOF) and (error == NULL))
+  {
+    aret= attachsql_connect_poll(con, &error);
+  }
+  ASSERT_TRUE_(error, "Connect did not time out");
+  ASSERT_EQ_(ATTACHSQL_ERROR_CODE_TIMEOUT, attachsql_error_code(error), "Wrong error code");
+  ASSERT_TRUE_(elapsed_ms(&start) < 2000, "Connect timeout too slow");
+  attachsql_error_free(error);
+  error= NULL;
+  attachsql_connect_destroy(con);
+
+  /* and for a warm up connection cloned from a template */
+  results.error_code= 0;
+  pool= attachsql_pool_create(pool_callback, &results, NULL);
+  con_template= attachsql_connect_create("127.0.0.1", ntohs(address.sin_port), "test", "test", "", NULL);
+  attachsql_connect_set_option(con_template, ATTACHSQL_OPTION_CONNECT_TIMEOUT, &timeout);
+  gettimeofday(&start, NULL);
+  ASSERT_TRUE_(attachsql_pool_warm_up(pool, con_template, 1, 1, &error), "Warm up did not start");
+  while (not attachsql_pool_get_warm_up_progress(pool, &connected, &failed))
+  {
+    attachsql_pool_run(pool);
+    usleep(1000);
+  }
+  ASSERT_EQ_(1, failed, "Warm up connect did not fail");
+  ASSERT_EQ_(ATTACHSQL_ERROR_CODE_TIMEOUT, results.error_code, "Warm up connect did not time out");
+  ASSERT_TRUE_(elapsed_ms(&start) < 2000, "Warm up connect timeout too slow");
+  attachsql_connect_destroy(con_template);
+  attachsql_pool_destroy(pool);
+  close(listener);
+
+  mock_server_stop(server);
+}